@@ -0,0 +1,184 @@
+//! 事件序列化基准：对比旧版 HashMap + serde_json + CString 路径与强类型 EventData + 复用缓冲区路径，
+//! 以及远程输出端的 JSON 帧与 MessagePack 记录
+//!
+//! 运行: cargo bench --bench event_serialization
+//!
+//! 通过计数分配器统计每个事件的堆分配次数，输出每事件耗时与分配次数。
+//!
+//! 单看序列化（`EventBuffers::encode`、远程帧编码）不分配；端到端投递（构造事件、入队、序列化、
+//! 调用 C 回调）摊销约 0.03 次/事件，来自 `std::sync::mpsc` 每 31 条消息分配一个链表块。
+//! 回调 JSON 与远程帧并非同一份字节：同时设置回调和远程地址时，投递线程为回调编码一次，
+//! 远程连接的写任务再按协商格式（JSON 帧或 MessagePack）编码一次，即每种输出格式各一次。
+
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::collections::HashMap;
+use std::ffi::c_char;
+use std::hint::black_box;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::Instant;
+
+use tthsd::core::downloader::{Event, EventType};
+use tthsd::core::event_data::{EventData, ProgressData};
+use tthsd::core::event_dispatcher::{EventBuffers, EventDispatcher};
+use tthsd::core::flight_recorder::FlightRecorder;
+use tthsd::core::remote_protocol::{RemoteEncoder, RemoteEvent};
+use tthsd::core::remote_queue::RemoteQueue;
+
+struct CountingAlloc;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+
+unsafe impl GlobalAlloc for CountingAlloc {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        unsafe { System.alloc(layout) }
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        unsafe { System.dealloc(ptr, layout) }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        unsafe { System.realloc(ptr, layout, new_size) }
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAlloc = CountingAlloc;
+
+const ITERATIONS: usize = 200_000;
+
+fn progress_event() -> Event {
+    Event::global(EventType::Update, "进度更新")
+}
+
+fn progress_data() -> ProgressData {
+    ProgressData {
+        downloaded: 123_456_789,
+        total: 987_654_321,
+        current_speed_bps: 12_345_678.0,
+        average_speed_bps: 10_000_000.0,
+        peak_speed_bps: 20_000_000.0,
+        chunk_downloads: 42,
+        failed_chunks: 0,
+        retried_chunks: 1,
+        elapsed_time: 12.5,
+    }
+}
+
+/// 旧版路径：构建 HashMap，serde_json 分别序列化事件与数据，再为回调创建 CString，
+/// 远程输出端再把数据 JSON 作为字符串嵌套序列化一次
+fn legacy_path(event: &Event, progress: &ProgressData) -> usize {
+    let mut data: HashMap<String, serde_json::Value> = HashMap::new();
+    data.insert("total_bytes".to_string(), serde_json::Value::from(progress.downloaded));
+    data.insert("Downloaded".to_string(), serde_json::Value::from(progress.downloaded));
+    data.insert("Total".to_string(), serde_json::Value::from(progress.total));
+    data.insert("current_speed_bps".to_string(), serde_json::Value::from(progress.current_speed_bps as i64));
+    data.insert("average_speed_bps".to_string(), serde_json::Value::from(progress.average_speed_bps as i64));
+    data.insert("peak_speed_bps".to_string(), serde_json::Value::from(progress.peak_speed_bps as i64));
+    data.insert("chunk_downloads".to_string(), serde_json::Value::from(progress.chunk_downloads));
+    data.insert("failed_chunks".to_string(), serde_json::Value::from(progress.failed_chunks));
+    data.insert("retried_chunks".to_string(), serde_json::Value::from(progress.retried_chunks));
+    data.insert("elapsed_time".to_string(), serde_json::Value::from(progress.elapsed_time));
+
+    let event_json = serde_json::to_string(event).unwrap();
+    let data_json = serde_json::to_string(&data).unwrap();
+    let c_event = std::ffi::CString::new(event_json).unwrap();
+    let c_data = std::ffi::CString::new(data_json).unwrap();
+
+    let remote_msg = serde_json::to_string(&data).unwrap();
+    let remote = serde_json::json!({ "Type": "Update", "Msg": remote_msg }).to_string();
+
+    c_event.as_bytes().len() + c_data.as_bytes().len() + remote.len()
+}
+
+/// 新版路径：强类型数据写入复用缓冲区，产出回调字符串与远程 JSON 帧
+fn typed_path(buffers: &mut EventBuffers, encoder: &mut RemoteEncoder, frame: &mut Vec<u8>, item: &RemoteEvent) -> usize {
+    buffers.encode(&item.event, &item.data);
+    frame.clear();
+    encoder.write_json_frame(item, frame);
+    frame.len()
+}
+
+/// 远程输出端：单独编码 JSON 帧或 MessagePack 记录
+fn remote_json(encoder: &mut RemoteEncoder, frame: &mut Vec<u8>, item: &RemoteEvent) -> usize {
+    frame.clear();
+    encoder.write_json_frame(item, frame);
+    frame.len()
+}
+
+fn remote_msgpack(encoder: &mut RemoteEncoder, frame: &mut Vec<u8>, item: &RemoteEvent) -> usize {
+    frame.clear();
+    encoder.write_msgpack_record(item, frame);
+    frame.len()
+}
+
+extern "C" fn host_callback(event: *const c_char, data: *const c_char) {
+    black_box((event, data));
+}
+
+/// 端到端的回调路径：按下载器的方式构造事件，经 dispatch 入队，再由 poll_events 序列化并调用 C 回调
+fn dispatch_path(dispatcher: &EventDispatcher, progress: &ProgressData) -> usize {
+    let event = Event::global(EventType::Update, "进度更新");
+    dispatcher.dispatch(event, EventData::Progress(progress.clone()));
+    dispatcher.poll_events(1)
+}
+
+/// 端到端的远程路径：事件进入远程发送队列，写任务取出后按协商格式编码
+fn remote_queue_path(queue: &RemoteQueue, encoder: &mut RemoteEncoder, frame: &mut Vec<u8>, progress: &ProgressData) -> usize {
+    let event = Event::global(EventType::Update, "进度更新");
+    queue.push(RemoteEvent { event, data: EventData::Progress(progress.clone()), downloader_id: 1 });
+    let item = queue.try_recv().unwrap();
+    remote_msgpack(encoder, frame, &item)
+}
+
+fn measure<F: FnMut() -> usize>(name: &str, mut f: F) {
+    // 预热，让复用缓冲区扩容到稳定大小
+    for _ in 0..1000 {
+        black_box(f());
+    }
+
+    let allocs_before = ALLOCATIONS.load(Ordering::Relaxed);
+    let started = Instant::now();
+    for _ in 0..ITERATIONS {
+        black_box(f());
+    }
+    let elapsed = started.elapsed();
+    let allocs = ALLOCATIONS.load(Ordering::Relaxed) - allocs_before;
+
+    println!(
+        "{:<28} {:>8.1} ns/event {:>8.2} allocs/event",
+        name,
+        elapsed.as_nanos() as f64 / ITERATIONS as f64,
+        allocs as f64 / ITERATIONS as f64
+    );
+}
+
+fn main() {
+    let event = progress_event();
+    let progress = progress_data();
+    let item = RemoteEvent { event: event.clone(), data: EventData::Progress(progress.clone()), downloader_id: 1 };
+    let mut buffers = EventBuffers::default();
+    let mut encoder = RemoteEncoder::default();
+    let mut frame = Vec::new();
+
+    println!("=== 进度事件序列化 ({} 次) ===", ITERATIONS);
+    measure("legacy HashMap + serde_json", || legacy_path(&event, &progress));
+    measure("typed EventData + buffers", || typed_path(&mut buffers, &mut encoder, &mut frame, &item));
+
+    println!("=== 端到端投递（构造事件 + 入队 + 序列化 + 输出） ===");
+    let dispatcher = EventDispatcher::new(Some(host_callback), None, 0, None, None, Arc::new(FlightRecorder::new()));
+    dispatcher.set_host_pump(true);
+    measure("dispatch -> C callback", || dispatch_path(&dispatcher, &progress));
+    let queue = RemoteQueue::new(1024);
+    measure("remote queue -> MessagePack", || remote_queue_path(&queue, &mut encoder, &mut frame, &progress));
+
+    println!("=== 远程帧编码 ===");
+    let json_len = remote_json(&mut encoder, &mut frame, &item);
+    let msgpack_len = remote_msgpack(&mut encoder, &mut frame, &item);
+    measure("remote JSON frame", || remote_json(&mut encoder, &mut frame, &item));
+    measure("remote MessagePack record", || remote_msgpack(&mut encoder, &mut frame, &item));
+    println!("帧大小: JSON {} 字节, MessagePack {} 字节", json_len, msgpack_len);
+}
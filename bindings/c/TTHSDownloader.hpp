@@ -1,8 +1,11 @@
 /**
  * TTHSDownloader.hpp - TTHSD 高速下载器 C++ 封装类
  *
- * RAII 风格，通过 dlopen/LoadLibrary 动态加载 TTHSD 动态库。
- * 使用 std::function 接收回调，内部使用 nlohmann/json 解析事件 JSON。
+ * RAII 风格，默认通过 dlopen/LoadLibrary 动态加载 TTHSD 动态库；定义 TTHSD_DIRECT_LINK=1
+ * （CMake 中链接 tthsd::cpp 目标时自动定义）后改为直接调用 tthsd.h 中的函数，由链接器解析符号，
+ * 可以静态或动态链接 libtthsd，配合 LTO 内联。
+ * 使用 std::function 接收回调：json 回调用 nlohmann/json 解析事件，强类型回调（DownloadEvent）
+ * 用内置的 std::string_view 解析器。
  *
  * 依赖:
  *   - nlohmann/json (header-only): https://github.com/nlohmann/json
@@ -11,9 +14,9 @@
  * 使用示例:
  * ```cpp
  * TTHSDownloader dl;
- * dl.load();  // 自动搜索 TTHSD.dll/TTHSD.so/TTHSD.dylib
+ * dl.load();  // 依次尝试 libtthsd.so（Cargo 输出名）与 TTHSD.so；直接链接模式下不做任何事
  *
- * int id = dl.startDownload(
+ * DownloadHandle h = dl.startDownload(
  *   {"https://example.com/a.zip"},
  *   {"/tmp/a.zip"},
  *   {.threadCount=32},
@@ -22,6 +25,47 @@
  *           std::cout << "进度: " << data["Downloaded"] << "/" << data["Total"] << "\n";
  *   }
  * );
+ * h.wait();
+ * ```
+ *
+ * startDownload / getDownloader 返回只能移动的 DownloadHandle：回调归句柄所有，事件只投递给它自己的回调，
+ * 同一个实例上可以并发任意多个下载；句柄析构时停止尚未结束的下载（不想要时调用 release()）。
+ * 句柄不能比创建它的 TTHSDownloader 活得更久。
+ *
+ * 强类型事件（不经过 nlohmann::json，update 事件解析不分配内存）：
+ * ```cpp
+ * auto h = dl.startDownload(urls, paths, {}, [](const DownloadEvent& e) {
+ *     if (auto* p = std::get_if<ProgressEvent>(&e))
+ *         printf("%.1f%% %.1f MB/s\n", p->fraction() * 100, p->speed / 1048576);
+ *     else if (auto* err = std::get_if<ErrorEvent>(&e))
+ *         fprintf(stderr, "%s\n", err->message.c_str());
+ * });
+ * ```
+ *
+ * 远程模式（Unix 平台）：连接 tthsd-daemon，多个进程共享同一个下载调度与连接预算，
+ * 不再加载动态库，其余接口用法不变：
+ * ```cpp
+ * TTHSDownloader dl;
+ * dl.connectDaemon();  // 默认 $TTHSD_SOCKET / $XDG_RUNTIME_DIR/tthsd.sock / /tmp/tthsd.sock
+ * auto h = dl.startDownload({"https://example.com/a.zip"}, {"/tmp/a.zip"}, {}, callback);
+ * ```
+ * 远程模式下回调在内部读取线程上执行（不要在回调中同步调用本类的其他接口）。
+ *
+ * 等待结束（无需在回调里自己置标志再轮询）：
+ * ```cpp
+ * WaitResult r = h.wait();                                     // 阻塞到结束
+ * WaitResult r = h.waitFor(std::chrono::seconds(30));          // r.timedOut() 表示超时
+ * WaitResult r = dl.waitAny({h1.id(), h2.id()});               // r.id 为先结束的那个
+ * ```
+ *
+ * C++20 协程（编译器支持协程时可用，TTHSD_HAS_COROUTINES 为 1）：
+ * ```cpp
+ * Task run(TTHSDownloader& dl, Executor ex, std::stop_token st) {
+ *     auto op = dl.download(urls, paths, {}, {ex, st});     // st 请求停止时调用 stopDownload
+ *     while (auto p = co_await op.nextProgress())           // 下载结束后返回 std::nullopt
+ *         printf("%.1f%%\n", p->fraction() * 100);
+ *     DownloadResult r = co_await op;                       // r.tasks[i].completed
+ * }
  * ```
  */
 
@@ -29,29 +73,80 @@
 
 #include <string>
 #include <vector>
+#include <chrono>
+#include <climits>
 #include <functional>
 #include <stdexcept>
 #include <cstring>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <variant>
+#include <type_traits>
+#include <memory>
 #include <nlohmann/json.hpp>
 
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>) && __has_include(<stop_token>)
+  #include <coroutine>
+  #include <stop_token>
+  #if defined(__cpp_lib_coroutine) && defined(__cpp_lib_jthread)
+    #define TTHSD_HAS_COROUTINES 1
+  #endif
+#endif
+#ifndef TTHSD_HAS_COROUTINES
+  #define TTHSD_HAS_COROUTINES 0
+#endif
+
+#ifndef TTHSD_DIRECT_LINK
+  #define TTHSD_DIRECT_LINK 0
+#endif
+
+#if TTHSD_DIRECT_LINK
+  #include "tthsd.h"
+  /// 直接链接：调用 tthsd.h 中声明的函数
+  #define TTHSD_FN(name)       ::name
+#else
+  /// 动态加载：调用 load() 解析出的函数指针
+  #define TTHSD_FN(name)       _fn_##name
+#endif
+
 #ifdef _WIN32
   #include <windows.h>
   #define TTHSD_LIB_OPEN(p)    LoadLibraryA(p)
   #define TTHSD_LIB_SYM(h, s)  GetProcAddress((HMODULE)(h), s)
   #define TTHSD_LIB_CLOSE(h)   FreeLibrary((HMODULE)(h))
-  #define TTHSD_DEFAULT_LIB    "TTHSD.dll"
+  #define TTHSD_CARGO_LIB      "tthsd.dll"
+  #define TTHSD_LEGACY_LIB     "TTHSD.dll"
 #else
-  #include <dlfcn.h>
+  #if !TTHSD_DIRECT_LINK
+    #include <dlfcn.h>
+  #endif
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <unistd.h>
   #define TTHSD_LIB_OPEN(p)    dlopen(p, RTLD_LAZY)
   #define TTHSD_LIB_SYM(h, s)  dlsym(h, s)
   #define TTHSD_LIB_CLOSE(h)   dlclose(h)
   #ifdef __APPLE__
-    #define TTHSD_DEFAULT_LIB  "TTHSD.dylib"
+    #define TTHSD_CARGO_LIB    "libtthsd.dylib"
+    #define TTHSD_LEGACY_LIB   "TTHSD.dylib"
   #else
-    #define TTHSD_DEFAULT_LIB  "TTHSD.so"
+    #define TTHSD_CARGO_LIB    "libtthsd.so"
+    #define TTHSD_LEGACY_LIB   "TTHSD.so"
   #endif
 #endif
 
+// load() 不带路径时首先尝试的库名，默认为 cargo build 的输出文件名；可在包含本头文件之前定义以覆盖
+#ifndef TTHSD_DEFAULT_LIB
+  #define TTHSD_DEFAULT_LIB    TTHSD_CARGO_LIB
+#endif
+
 using json = nlohmann::json;
 
 /// 回调函数类型
@@ -67,22 +162,635 @@ struct DownloadParams {
     bool* isMultiple  = nullptr;
 };
 
+/// 下载器结局（数值与 tthsd.h 中的 TTHSD_WAIT_* 一致）
+enum class WaitStatus : int {
+    Completed = 0,   ///< 所有任务结束
+    Failed    = 1,   ///< 启动失败或运行出错
+    Cancelled = 2,   ///< 被停止（暂停不是结局）
+    Timeout   = -2,
+    Invalid   = -1,  ///< ID 无效（或已结束太久，结局不再保留）
+};
+
+struct WaitResult {
+    int        id     = -1;  ///< 结束的下载器 ID；超时或无效时为 -1
+    WaitStatus status = WaitStatus::Invalid;
+
+    bool completed() const { return status == WaitStatus::Completed; }
+    bool timedOut()  const { return status == WaitStatus::Timeout; }
+    /// 下载器已结束（无论成功、失败还是被取消）
+    bool finished()  const { return (int)status >= 0; }
+};
+
+// ---------------------------------------------------------------------------
+// 强类型事件
+//
+// 回调 JSON 由库按固定格式生成（扁平对象、键无转义），这里用 std::string_view 手写解析，
+// 不经过 nlohmann::json。update 事件解析过程不分配堆内存；其他事件（数量很少）的字符串字段
+// 会反转义后存入 std::string。
+// ---------------------------------------------------------------------------
+
+enum class EventType {
+    Start,     ///< start
+    StartOne,  ///< startOne
+    Update,    ///< update
+    End,       ///< end
+    EndOne,    ///< endOne
+    Msg,       ///< msg
+    Err,       ///< err
+    Unknown,
+};
+
+/// update：整体进度
+struct ProgressEvent {
+    int64_t downloaded   = 0;
+    int64_t total        = 0;
+    double  speed        = 0;  ///< 当前速度（字节/秒）
+    double  averageSpeed = 0;  ///< 平均速度（字节/秒）
+    double  elapsed      = 0;  ///< 已运行时间（秒）
+
+    double fraction() const { return total > 0 ? (double)downloaded / (double)total : 0.0; }
+};
+
+/// startOne / endOne：单个任务开始或结束
+struct TaskEvent {
+    bool        finished = false;  ///< false = startOne，true = endOne
+    std::string url;
+    std::string savePath;
+    std::string showName;
+    int         index = 0;         ///< 从 1 开始
+    int         total = 0;
+};
+
+/// start / end：整个下载器开始或结束
+struct StateEvent {
+    bool finished = false;  ///< false = start，true = end
+};
+
+/// msg
+struct MessageEvent {
+    std::string text;
+};
+
+/// err；失败时 flightRecorder 为自动转储的飞行记录文件路径
+struct ErrorEvent {
+    std::string message;
+    std::string flightRecorder;
+};
+
+using DownloadEvent = std::variant<ProgressEvent, TaskEvent, StateEvent, MessageEvent, ErrorEvent>;
+
+/// 强类型回调（配合 std::visit 使用）
+using EventCallback = std::function<void(const DownloadEvent& event)>;
+
+namespace tthsd_detail {
+
+inline const char* skipSpace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+    return p;
+}
+
+/// 跳过字符串值（p 指向起始引号之后），返回结束引号的位置
+inline const char* skipString(const char* p, const char* end) {
+    while (p < end && *p != '"') p += (*p == '\\') ? 2 : 1;
+    return p < end ? p : end;
+}
+
+/// 遍历扁平 JSON 对象的成员：visit(key, raw, isString)
+/// 字符串值的 raw 为引号内未反转义的内容，其他值为原始字面量；遇到嵌套对象/数组时停止，返回 false
+template <class Visit>
+bool forEachMember(std::string_view json, Visit&& visit) {
+    const char* p   = json.data();
+    const char* end = p + json.size();
+    p = skipSpace(p, end);
+    if (p == end || *p != '{') return false;
+    ++p;
+    for (;;) {
+        p = skipSpace(p, end);
+        if (p < end && *p == '}') return true;
+        if (p == end || *p != '"') return false;
+        const char* keyBegin = ++p;
+        p = skipString(p, end);
+        std::string_view key(keyBegin, (size_t)(p - keyBegin));
+        p = skipSpace(p + 1, end);
+        if (p >= end || *p != ':') return false;
+        p = skipSpace(p + 1, end);
+        if (p == end) return false;
+
+        if (*p == '"') {
+            const char* valueBegin = ++p;
+            p = skipString(p, end);
+            visit(key, std::string_view(valueBegin, (size_t)(p - valueBegin)), true);
+            ++p;
+        } else {
+            if (*p == '{' || *p == '[') return false;
+            const char* valueBegin = p;
+            while (p < end && *p != ',' && *p != '}' && *p != ' ' && *p != '\n') ++p;
+            visit(key, std::string_view(valueBegin, (size_t)(p - valueBegin)), false);
+        }
+
+        p = skipSpace(p, end);
+        if (p < end && *p == ',') { ++p; continue; }
+        return p < end && *p == '}';
+    }
+}
+
+template <class T>
+inline T toNumber(std::string_view raw) {
+    T value{};
+    std::from_chars(raw.data(), raw.data() + raw.size(), value);
+    return value;
+}
+
+inline void appendUtf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += (char)cp;
+    } else if (cp < 0x800) {
+        out += (char)(0xC0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += (char)(0xE0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else {
+        out += (char)(0xF0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3F));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+/// 字符串值反转义
+inline std::string unescape(std::string_view raw) {
+    std::string out;
+    out.reserve(raw.size());
+    for (size_t i = 0; i < raw.size(); ++i) {
+        char c = raw[i];
+        if (c != '\\' || i + 1 >= raw.size()) { out += c; continue; }
+        switch (raw[++i]) {
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'u': {
+                if (i + 4 >= raw.size()) return out;
+                uint32_t cp = 0;
+                std::from_chars(raw.data() + i + 1, raw.data() + i + 5, cp, 16);
+                i += 4;
+                // 代理对
+                if (cp >= 0xD800 && cp < 0xDC00 && i + 6 < raw.size() && raw[i + 1] == '\\' && raw[i + 2] == 'u') {
+                    uint32_t low = 0;
+                    std::from_chars(raw.data() + i + 3, raw.data() + i + 7, low, 16);
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    i += 6;
+                }
+                appendUtf8(out, cp);
+                break;
+            }
+            default: out += raw[i]; break;  // \" \\ \/
+        }
+    }
+    return out;
+}
+
+inline EventType eventTypeOf(std::string_view eventJson) {
+    std::string_view type;
+    forEachMember(eventJson, [&](std::string_view key, std::string_view raw, bool) {
+        if (key == "Type") type = raw;
+    });
+    if (type == "update")   return EventType::Update;
+    if (type == "start")    return EventType::Start;
+    if (type == "startOne") return EventType::StartOne;
+    if (type == "end")      return EventType::End;
+    if (type == "endOne")   return EventType::EndOne;
+    if (type == "msg")      return EventType::Msg;
+    if (type == "err")      return EventType::Err;
+    return EventType::Unknown;
+}
+
+} // namespace tthsd_detail
+
+/// 把一对回调 JSON 解析为强类型事件；类型未知或格式不符时返回 std::nullopt
+inline std::optional<DownloadEvent> parseEvent(std::string_view eventJson, std::string_view dataJson) {
+    using namespace tthsd_detail;
+    EventType type = eventTypeOf(eventJson);
+    switch (type) {
+        case EventType::Update: {
+            ProgressEvent e;
+            bool ok = forEachMember(dataJson, [&](std::string_view key, std::string_view raw, bool) {
+                if      (key == "Downloaded")        e.downloaded   = toNumber<int64_t>(raw);
+                else if (key == "Total")             e.total        = toNumber<int64_t>(raw);
+                else if (key == "current_speed_bps") e.speed        = toNumber<double>(raw);
+                else if (key == "average_speed_bps") e.averageSpeed = toNumber<double>(raw);
+                else if (key == "elapsed_time")      e.elapsed      = toNumber<double>(raw);
+            });
+            if (!ok) return std::nullopt;
+            return e;
+        }
+        case EventType::StartOne:
+        case EventType::EndOne: {
+            TaskEvent e;
+            e.finished = type == EventType::EndOne;
+            forEachMember(dataJson, [&](std::string_view key, std::string_view raw, bool) {
+                if      (key == "URL")      e.url      = unescape(raw);
+                else if (key == "SavePath") e.savePath = unescape(raw);
+                else if (key == "ShowName") e.showName = unescape(raw);
+                else if (key == "Index")    e.index    = toNumber<int>(raw);
+                else if (key == "Total")    e.total    = toNumber<int>(raw);
+            });
+            return e;
+        }
+        case EventType::Start: return StateEvent{false};
+        case EventType::End:   return StateEvent{true};
+        case EventType::Msg: {
+            MessageEvent e;
+            forEachMember(dataJson, [&](std::string_view key, std::string_view raw, bool) {
+                if (key == "Text") e.text = unescape(raw);
+            });
+            return e;
+        }
+        case EventType::Err: {
+            ErrorEvent e;
+            forEachMember(dataJson, [&](std::string_view key, std::string_view raw, bool) {
+                if      (key == "Error")          e.message        = unescape(raw);
+                else if (key == "FlightRecorder") e.flightRecorder = unescape(raw);
+            });
+            return e;
+        }
+        default:
+            return std::nullopt;
+    }
+}
+
+namespace tthsd_detail {
+
+/// 单个下载器的事件接收端：本地模式经 tthsd_set_callbacks 注册，远程模式按事件的 "downloader" 字段路由
+struct Listener {
+    virtual ~Listener() = default;
+    virtual void onEvent(std::string_view eventJson, std::string_view dataJson) = 0;
+    /// 结束通知：只调用一次，且排在该下载器结束前的所有事件之后
+    virtual void onFinish(WaitStatus status) = 0;
+};
+
+/// DownloadHandle 的共享状态：持有回调、最新进度与结局
+class HandleState : public Listener {
+public:
+    HandleState(DownloadCallback callback, EventCallback onEvent)
+        : _callback(std::move(callback)), _onEvent(std::move(onEvent)) {}
+
+    void onEvent(std::string_view eventJson, std::string_view dataJson) override {
+        std::optional<DownloadEvent> event;
+        if (_onEvent || eventTypeOf(eventJson) == EventType::Update) event = parseEvent(eventJson, dataJson);
+        if (event) {
+            if (auto* p = std::get_if<ProgressEvent>(&*event)) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _progress = *p;
+            }
+        }
+
+        if (_onEvent) {
+            if (event) _onEvent(*event);
+        } else if (_callback) {
+            _callback(json::parse(eventJson), json::parse(dataJson));
+        }
+    }
+
+    void onFinish(WaitStatus status) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _status = status;
+        _finished = true;
+        _cv.notify_all();
+    }
+
+    ProgressEvent progress() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _progress;
+    }
+
+    bool finished() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _finished;
+    }
+
+    /// timeoutMs < 0 无限等待；超时返回 WaitStatus::Timeout
+    WaitStatus wait(int timeoutMs) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (timeoutMs < 0) {
+            _cv.wait(lock, [&] { return _finished; });
+        } else if (!_cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&] { return _finished; })) {
+            return WaitStatus::Timeout;
+        }
+        return _status;
+    }
+
+private:
+    DownloadCallback _callback;
+    EventCallback    _onEvent;
+    std::mutex       _mutex;
+    std::condition_variable _cv;
+    ProgressEvent    _progress;
+    WaitStatus       _status = WaitStatus::Invalid;
+    bool             _finished = false;
+};
+
+} // namespace tthsd_detail
+
+class TTHSDownloader;
+
+/// startDownload / getDownloader 返回的下载句柄（只能移动）
+///
+/// 句柄持有自己的回调，事件只投递给它；析构（或 reset）时停止尚未结束的下载。
+/// 句柄不能比创建它的 TTHSDownloader 活得更久。创建失败时 valid() 为 false。
+///
+/// 本地模式下每个运行中的句柄在库内各占一个回调投递线程（"tthsd-callback"，首个事件时创建，
+/// 下载结束且事件投递完后退出），同时运行上百个句柄就有上百个这样的线程；
+/// 大量小文件请用一个句柄的 isMultiple 批量下载。远程模式下所有句柄共用一个读取线程。
+class [[nodiscard]] DownloadHandle {
+public:
+    DownloadHandle() = default;
+    DownloadHandle(DownloadHandle&& other) noexcept
+        : _owner(std::exchange(other._owner, nullptr)),
+          _id(std::exchange(other._id, -1)),
+          _multiple(other._multiple),
+          _state(std::move(other._state)) {}
+
+    DownloadHandle& operator=(DownloadHandle&& other) noexcept {
+        if (this != &other) {
+            reset();
+            _owner = std::exchange(other._owner, nullptr);
+            _id = std::exchange(other._id, -1);
+            _multiple = other._multiple;
+            _state = std::move(other._state);
+        }
+        return *this;
+    }
+
+    DownloadHandle(const DownloadHandle&) = delete;
+    DownloadHandle& operator=(const DownloadHandle&) = delete;
+
+    ~DownloadHandle() { reset(); }
+
+    int  id() const { return _id; }
+    bool valid() const { return _id >= 0; }
+    explicit operator bool() const { return valid(); }
+
+    /// 启动 getDownloader 创建的下载器（按创建时的 isMultiple 选择启动方式）；已在运行时返回 false，不影响当前运行
+    inline bool start();
+    /// 暂停后 wait() 继续等待，resume() 重新运行全部任务，stop() 结束下载
+    inline bool pause();
+    inline bool resume();
+    inline bool stop();
+
+    /// 最近一次 update 事件的进度（尚未收到时全为 0），不需要设置回调
+    ///
+    /// 字节数与 update 事件一致，只统计本句柄的下载器（total 为已知大小的任务之和），可以直接计算完成比例
+    ProgressEvent progress() const { return _state ? _state->progress() : ProgressEvent{}; }
+
+    /// 下载器已结束（完成、失败或被停止）
+    bool finished() const { return _state && _state->finished(); }
+
+    /// 阻塞等待结束（由结束通知唤醒，远程模式也不额外发请求）
+    WaitResult wait() { return waitFor(std::chrono::milliseconds(-1)); }
+
+    /// 最多等待 timeout（为负表示无限等待）；超时返回 status == WaitStatus::Timeout
+    template <class Rep, class Period>
+    WaitResult waitFor(const std::chrono::duration<Rep, Period>& timeout) {
+        if (!_state) return {};
+        int ms = -1;
+        if (timeout >= timeout.zero()) {
+            auto count = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+            ms = count > INT_MAX ? INT_MAX : (int)count;
+        }
+        WaitStatus status = _state->wait(ms);
+        return {status == WaitStatus::Timeout ? -1 : _id, status};
+    }
+
+    /// 放弃所有权并返回 ID：析构时不再停止下载，回调照常投递直到下载结束
+    int release() {
+        _owner = nullptr;
+        _state.reset();
+        return std::exchange(_id, -1);
+    }
+
+    /// 停止尚未结束的下载并释放句柄
+    inline void reset();
+
+private:
+    friend class TTHSDownloader;
+
+    TTHSDownloader* _owner = nullptr;
+    int  _id = -1;
+    bool _multiple = false;
+    std::shared_ptr<tthsd_detail::HandleState> _state;
+};
+
+#if TTHSD_HAS_COROUTINES
+
+/// 协程的恢复方式：把句柄投递到调用方的执行器（线程池、事件循环等）上恢复
+using Executor = std::function<void(std::coroutine_handle<>)>;
+
+struct AwaitOptions {
+    Executor        executor;   ///< 为空时直接在回调线程上恢复（协程里不要做阻塞操作）
+    std::stop_token stopToken;  ///< 请求停止时调用 stopDownload，结局为 WaitStatus::Cancelled
+};
+
+struct TaskResult {
+    std::string url;
+    std::string savePath;
+    bool        completed = false;  ///< 收到该任务的 endOne 且之前没有 err（被暂停/停止的任务不会收到 endOne）
+    std::string error;              ///< 该任务的错误信息
+};
+
+struct DownloadResult {
+    int         id     = -1;
+    WaitStatus  status = WaitStatus::Invalid;
+    std::vector<TaskResult> tasks;  ///< 与传入的 urls 一一对应
+    std::string error;              ///< 最后一个 err 事件的错误信息
+
+    bool completed() const { return status == WaitStatus::Completed; }
+};
+
+namespace tthsd_detail {
+
+/// download() 的共享状态：回调线程写入，协程在执行器上读取
+class AsyncDownload : public Listener {
+public:
+    AsyncDownload(DownloadResult result, Executor executor)
+        : _executor(std::move(executor)), _result(std::move(result)) {}
+
+    void onEvent(std::string_view eventJson, std::string_view dataJson) override {
+        auto event = parseEvent(eventJson, dataJson);
+        if (!event) return;
+        std::coroutine_handle<> waiter;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (auto* p = std::get_if<ProgressEvent>(&*event)) {
+                _progress = *p;
+                waiter = std::exchange(_progressWaiter, nullptr);
+            } else if (auto* t = std::get_if<TaskEvent>(&*event)) {
+                // 只有跑完的任务才有 endOne（被取消的任务没有），出错的任务在它之前先收到 err
+                if (t->finished && t->index >= 1 && (size_t)t->index <= _result.tasks.size()) {
+                    auto& task = _result.tasks[t->index - 1];
+                    task.completed = task.error.empty();
+                }
+            } else if (auto* e = std::get_if<ErrorEvent>(&*event)) {
+                _result.error = e->message;
+                // 任务级错误的事件 ID 为任务 ID，即任务下标（见 buildTasksJson）
+                std::string_view taskId;
+                forEachMember(eventJson, [&](std::string_view key, std::string_view raw, bool) {
+                    if (key == "ID") taskId = raw;
+                });
+                int index = taskId.empty() ? -1 : toNumber<int>(taskId);
+                if (index >= 0 && (size_t)index < _result.tasks.size()) _result.tasks[index].error = e->message;
+            }
+        }
+        resume(waiter);
+    }
+
+    /// 只有第一次生效：fail() 之后到达的结束通知不会覆盖 Failed
+    void onFinish(WaitStatus status) override {
+        std::coroutine_handle<> progressWaiter, resultWaiter;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_finished) return;
+            _result.status = status;
+            _finished = true;
+            progressWaiter = std::exchange(_progressWaiter, nullptr);
+            resultWaiter = std::exchange(_resultWaiter, nullptr);
+        }
+        resume(progressWaiter);
+        resume(resultWaiter);
+    }
+
+    /// 创建或启动失败时直接结束
+    void fail(std::string error) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _result.error = std::move(error);
+        }
+        onFinish(WaitStatus::Failed);
+    }
+
+    void setId(int id) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _result.id = id;
+    }
+
+    bool finished() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _finished;
+    }
+
+    /// 尚未结束时登记等待者并返回 true（协程挂起）
+    bool suspendForResult(std::coroutine_handle<> h) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_finished) return false;
+        _resultWaiter = h;
+        return true;
+    }
+
+    DownloadResult result() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _result;
+    }
+
+    /// 没有未取走的进度且尚未结束时登记等待者并返回 true
+    bool suspendForProgress(std::coroutine_handle<> h) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_progress || _finished) return false;
+        _progressWaiter = h;
+        return true;
+    }
+
+    std::optional<ProgressEvent> takeProgress() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return std::exchange(_progress, std::nullopt);
+    }
+
+private:
+    std::mutex     _mutex;
+    Executor       _executor;
+    DownloadResult _result;
+    bool           _finished = false;
+    /// 尚未取走的最新进度；消费慢时只保留最新一个
+    std::optional<ProgressEvent> _progress;
+    std::coroutine_handle<> _progressWaiter;
+    std::coroutine_handle<> _resultWaiter;
+
+    void resume(std::coroutine_handle<> h) {
+        if (!h) return;
+        if (_executor) _executor(h);
+        else h.resume();
+    }
+};
+
+} // namespace tthsd_detail
+
+/// TTHSDownloader::download() 返回的可等待对象（只能移动）
+///
+/// `co_await op` 等待结束并得到 DownloadResult；`co_await op.nextProgress()` 逐个取进度，
+/// 下载结束后返回 std::nullopt。两者各自同一时刻只能有一个协程在等待。
+/// op 与创建它的 TTHSDownloader 都要活到下载结束。
+class DownloadOperation {
+public:
+    int id() const { return _id; }
+
+    struct ProgressAwaiter {
+        std::shared_ptr<tthsd_detail::AsyncDownload> state;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h) { return state->suspendForProgress(h); }
+        std::optional<ProgressEvent> await_resume() { return state->takeProgress(); }
+    };
+
+    /// 下一次进度；中间没来得及取走的进度会被更新的一次合并
+    ProgressAwaiter nextProgress() const { return {_state}; }
+
+    bool await_ready() const { return _state->finished(); }
+    bool await_suspend(std::coroutine_handle<> h) { return _state->suspendForResult(h); }
+    DownloadResult await_resume() { return _state->result(); }
+
+private:
+    friend class TTHSDownloader;
+    using StopCallback = std::stop_callback<std::function<void()>>;
+
+    int _id = -1;
+    std::shared_ptr<tthsd_detail::AsyncDownload> _state;
+    std::unique_ptr<StopCallback> _stop;
+};
+
+#endif // TTHSD_HAS_COROUTINES
+
 class TTHSDownloader {
 public:
     TTHSDownloader() = default;
 
     ~TTHSDownloader() {
+        disconnectDaemon();
+#if !TTHSD_DIRECT_LINK
         if (_handle) TTHSD_LIB_CLOSE(_handle);
+#endif
     }
 
     // 禁止拷贝
     TTHSDownloader(const TTHSDownloader&) = delete;
     TTHSDownloader& operator=(const TTHSDownloader&) = delete;
 
-    /// 加载动态库（空路径则自动搜索）
+    /// 加载动态库；空路径时依次尝试 TTHSD_DEFAULT_LIB（默认 libtthsd.so / libtthsd.dylib / tthsd.dll）
+    /// 与旧的 TTHSD.so / TTHSD.dylib / TTHSD.dll，按系统的库搜索路径查找
+    ///
+    /// 直接链接模式（TTHSD_DIRECT_LINK）下符号已由链接器解析，libPath 被忽略。
     void load(const std::string& libPath = "") {
+#if TTHSD_DIRECT_LINK
+        (void)libPath;
+        _loaded = true;
+#else
         std::string path = libPath.empty() ? TTHSD_DEFAULT_LIB : libPath;
         _handle = TTHSD_LIB_OPEN(path.c_str());
+        if (!_handle && libPath.empty() && path != TTHSD_LEGACY_LIB) {
+            path = TTHSD_LEGACY_LIB;
+            _handle = TTHSD_LIB_OPEN(path.c_str());
+        }
         if (!_handle)
             throw std::runtime_error("[TTHSD] 无法加载动态库: " + path);
 
@@ -90,90 +798,503 @@ public:
             _fn_##name = reinterpret_cast<type>(TTHSD_LIB_SYM(_handle, #name)); \
             if (!_fn_##name) throw std::runtime_error("[TTHSD] 符号未找到: " #name);
 
-        LOAD(start_download,            StartDownloadFn)
         LOAD(get_downloader,            GetDownloaderFn)
         LOAD(start_download_id,         IntIntFn)
         LOAD(start_multiple_downloads_id, IntIntFn)
         LOAD(pause_download,            IntIntFn)
         LOAD(resume_download,           IntIntFn)
         LOAD(stop_download,             IntIntFn)
+        LOAD(tthsd_wait,                WaitFn)
+        LOAD(tthsd_wait_any,            WaitAnyFn)
+        LOAD(tthsd_set_callbacks,       SetCallbacksFn)
         #undef LOAD
         _loaded = true;
+#endif
     }
 
-    /// 创建并立即启动下载
-    int startDownload(
+    /// 远程模式：连接 tthsd-daemon（空路径则使用默认套接字路径），之后所有调用都通过 RPC 转发
+    void connectDaemon(const std::string& socketPath = "") {
+#ifdef _WIN32
+        (void)socketPath;
+        throw std::runtime_error("[TTHSD] 远程模式目前只支持 Unix 平台");
+#else
+        std::string path = socketPath.empty() ? defaultDaemonSocket() : socketPath;
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("[TTHSD] 套接字路径过长: " + path);
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) throw std::runtime_error("[TTHSD] 创建套接字失败");
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(fd);
+            throw std::runtime_error("[TTHSD] 无法连接守护进程: " + path);
+        }
+
+        disconnectDaemon();
+        _remoteFd = fd;
+        _remoteClosed = false;
+        _reader = std::thread([this] { readLoop(); });
+#endif
+    }
+
+    /// 断开守护进程连接（守护进程会停止本连接创建的下载器）
+    void disconnectDaemon() {
+#ifndef _WIN32
+        if (_remoteFd < 0) return;
+        ::shutdown(_remoteFd, SHUT_RDWR);
+        if (_reader.joinable()) _reader.join();
+        ::close(_remoteFd);
+        _remoteFd = -1;
+#endif
+    }
+
+    bool isRemote() const { return _remoteFd >= 0; }
+
+    /// 创建并立即启动下载；失败时返回的句柄 valid() 为 false
+    DownloadHandle startDownload(
         const std::vector<std::string>& urls,
         const std::vector<std::string>& savePaths,
         DownloadParams params = {},
         DownloadCallback callback = nullptr
     ) {
         assertLoaded();
-        auto tasksJson = buildTasksJson(urls, savePaths);
-        _callback = std::move(callback);
+        return createHandle(urls, savePaths, params, std::move(callback), nullptr, true);
+    }
 
-        return _fn_start_download(
-            tasksJson.c_str(), (int)urls.size(),
-            params.threadCount, params.chunkSizeMB,
-            _callback ? reinterpret_cast<void*>(&TTHSDownloader::cCallback) : nullptr,
-            params.useCallbackUrl,
-            params.userAgent.empty() ? nullptr : params.userAgent.c_str(),
-            params.remoteCallbackUrl.empty() ? nullptr : params.remoteCallbackUrl.c_str(),
-            params.useSocket,
-            params.isMultiple
-        );
+    /// 创建并立即启动下载，以强类型事件接收回调：`[](const DownloadEvent& e) { std::visit(...); }`
+    template <class F, std::enable_if_t<std::is_invocable_v<F&, const DownloadEvent&>, int> = 0>
+    DownloadHandle startDownload(
+        const std::vector<std::string>& urls,
+        const std::vector<std::string>& savePaths,
+        DownloadParams params,
+        F&& onEvent
+    ) {
+        assertLoaded();
+        return createHandle(urls, savePaths, params, nullptr, EventCallback(std::forward<F>(onEvent)), true);
     }
 
-    /// 创建下载器（不立即启动）
-    int getDownloader(
+    /// 创建下载器（不立即启动，之后调用 handle.start()）
+    DownloadHandle getDownloader(
         const std::vector<std::string>& urls,
         const std::vector<std::string>& savePaths,
         DownloadParams params = {},
         DownloadCallback callback = nullptr
     ) {
         assertLoaded();
-        auto tasksJson = buildTasksJson(urls, savePaths);
-        _callback = std::move(callback);
+        return createHandle(urls, savePaths, params, std::move(callback), nullptr, false);
+    }
 
-        return _fn_get_downloader(
-            tasksJson.c_str(), (int)urls.size(),
-            params.threadCount, params.chunkSizeMB,
-            _callback ? reinterpret_cast<void*>(&TTHSDownloader::cCallback) : nullptr,
-            params.useCallbackUrl,
-            params.userAgent.empty() ? nullptr : params.userAgent.c_str(),
-            params.remoteCallbackUrl.empty() ? nullptr : params.remoteCallbackUrl.c_str(),
-            params.useSocket
-        );
+    /// 创建下载器（不立即启动），以强类型事件接收回调
+    template <class F, std::enable_if_t<std::is_invocable_v<F&, const DownloadEvent&>, int> = 0>
+    DownloadHandle getDownloader(
+        const std::vector<std::string>& urls,
+        const std::vector<std::string>& savePaths,
+        DownloadParams params,
+        F&& onEvent
+    ) {
+        assertLoaded();
+        return createHandle(urls, savePaths, params, nullptr, EventCallback(std::forward<F>(onEvent)), false);
     }
 
-    bool startDownloadById(int id)          { assertLoaded(); return _fn_start_download_id(id)           == 0; }
-    bool startMultipleDownloadsById(int id) { assertLoaded(); return _fn_start_multiple_downloads_id(id) == 0; }
-    bool pauseDownload(int id)              { assertLoaded(); return _fn_pause_download(id)               == 0; }
-    bool resumeDownload(int id)             { assertLoaded(); return _fn_resume_download(id)              == 0; }
-    bool stopDownload(int id)               { assertLoaded(); return _fn_stop_download(id)                == 0; }
+    bool startDownloadById(int id)          { assertLoaded(); return isRemote() ? remoteOk("start_download_id", id)           : TTHSD_FN(start_download_id)(id)           == 0; }
+    bool startMultipleDownloadsById(int id) { assertLoaded(); return isRemote() ? remoteOk("start_multiple_downloads_id", id) : TTHSD_FN(start_multiple_downloads_id)(id) == 0; }
+    bool pauseDownload(int id)              { assertLoaded(); return isRemote() ? remoteOk("pause_download", id)              : TTHSD_FN(pause_download)(id)               == 0; }
+    bool resumeDownload(int id)             { assertLoaded(); return isRemote() ? remoteOk("resume_download", id)             : TTHSD_FN(resume_download)(id)              == 0; }
+    bool stopDownload(int id)               { assertLoaded(); return isRemote() ? remoteOk("stop_download", id)               : TTHSD_FN(stop_download)(id)                == 0; }
+
+    /// 阻塞等待下载器结束（库内由条件变量唤醒，远程模式由守护进程推送响应，均无轮询）
+    WaitResult wait(int id) { return waitAny({id}, std::chrono::milliseconds(-1)); }
+
+    /// 最多等待 timeout；超时返回 status == WaitStatus::Timeout
+    template <class Rep, class Period>
+    WaitResult waitFor(int id, const std::chrono::duration<Rep, Period>& timeout) {
+        return waitAny({id}, timeout);
+    }
+
+    /// 等待 ids 中任意一个结束；timeout 为负表示无限等待
+    template <class Rep = std::chrono::milliseconds::rep, class Period = std::chrono::milliseconds::period>
+    WaitResult waitAny(const std::vector<int>& ids,
+                       const std::chrono::duration<Rep, Period>& timeout = std::chrono::milliseconds(-1)) {
+        assertLoaded();
+        if (ids.empty()) return {};
+        int ms = toTimeoutMs(timeout);
+        if (isRemote()) return remoteWait(ids, ms);
+
+        if (ids.size() == 1) {
+            int r = TTHSD_FN(tthsd_wait)(ids[0], ms);
+            return {r >= 0 ? ids[0] : -1, static_cast<WaitStatus>(r)};
+        }
+        int index = TTHSD_FN(tthsd_wait_any)(ids.data(), (int)ids.size(), ms);
+        if (index < 0) return {-1, static_cast<WaitStatus>(index)};
+        // 结局会保留，再查一次不会等待
+        return {ids[index], static_cast<WaitStatus>(TTHSD_FN(tthsd_wait)(ids[index], 0))};
+    }
+
+#if TTHSD_HAS_COROUTINES
+    /// 创建并启动下载，返回可等待对象：`DownloadResult r = co_await dl.download(urls, paths);`
+    ///
+    /// 事件只路由给这次下载（不经过 startDownload 设置的回调），结束与进度都由回调唤醒，不占用额外线程。
+    /// 创建或启动失败时 op 立即结束，结局为 WaitStatus::Failed。
+    DownloadOperation download(
+        const std::vector<std::string>& urls,
+        const std::vector<std::string>& savePaths,
+        DownloadParams params = {},
+        AwaitOptions options = {}
+    ) {
+        assertLoaded();
+        DownloadResult initial;
+        for (size_t i = 0; i < urls.size(); ++i) {
+            TaskResult& task = initial.tasks.emplace_back();
+            task.url = urls[i];
+            if (i < savePaths.size()) task.savePath = savePaths[i];
+        }
+
+        DownloadOperation op;
+        op._state = std::make_shared<tthsd_detail::AsyncDownload>(std::move(initial), std::move(options.executor));
+
+        int id = createDownloader(urls, savePaths, params);
+        if (id < 0) {
+            op._state->fail("创建下载器失败");
+            return op;
+        }
+        if (!attachListener(id, op._state)) {
+            stopDownload(id);
+            op._state->fail("注册回调失败");
+            return op;
+        }
+        op._id = id;
+        op._state->setId(id);
+
+        bool started = params.isMultiple && *params.isMultiple ? startMultipleDownloadsById(id) : startDownloadById(id);
+        if (!started) {
+            // 先记为 Failed，再停止释放下载器；之后到达的 Cancelled 结束通知被忽略
+            op._state->fail("启动下载失败");
+            stopDownload(id);
+        } else if (options.stopToken.stop_possible()) {
+            op._stop = std::make_unique<DownloadOperation::StopCallback>(
+                std::move(options.stopToken), std::function<void()>([this, id] { stopDownload(id); }));
+        }
+        return op;
+    }
+#endif
 
 private:
-    void*  _handle = nullptr;
     bool   _loaded = false;
-    DownloadCallback _callback;
+
+    // 远程模式状态
+    int         _remoteFd = -1;
+    bool        _remoteClosed = false;
+    long long   _nextRequestId = 0;
+    std::thread _reader;
+    std::mutex  _rpcMutex;
+    std::condition_variable _rpcCv;
+    std::map<long long, json> _responses;
+    /// 异步请求（rpcAsync）的响应处理，在读取线程上调用
+    std::map<long long, std::function<void(json)>> _continuations;
+    /// 按下载器 ID 路由的事件接收端
+    std::map<int, std::shared_ptr<tthsd_detail::Listener>> _listeners;
+
+#if !TTHSD_DIRECT_LINK
+    void*  _handle = nullptr;
 
     // 函数指针类型别名
-    using StartDownloadFn  = int(*)(const char*, int, int, int, void*, bool, const char*, const char*, const bool*, const bool*);
     using GetDownloaderFn  = int(*)(const char*, int, int, int, void*, bool, const char*, const char*, const bool*);
     using IntIntFn         = int(*)(int);
+    using WaitFn           = int(*)(int, int);
+    using WaitAnyFn        = int(*)(const int*, int, int);
+    using ListenerEventFn  = void(*)(int, const char*, const char*, void*);
+    using ListenerFinishFn = void(*)(int, int, void*);
+    using SetCallbacksFn   = int(*)(int, ListenerEventFn, ListenerFinishFn, void*);
 
-    StartDownloadFn  _fn_start_download              = nullptr;
     GetDownloaderFn  _fn_get_downloader              = nullptr;
     IntIntFn         _fn_start_download_id           = nullptr;
     IntIntFn         _fn_start_multiple_downloads_id = nullptr;
     IntIntFn         _fn_pause_download              = nullptr;
     IntIntFn         _fn_resume_download             = nullptr;
     IntIntFn         _fn_stop_download               = nullptr;
+    WaitFn           _fn_tthsd_wait                  = nullptr;
+    WaitAnyFn        _fn_tthsd_wait_any              = nullptr;
+    SetCallbacksFn   _fn_tthsd_set_callbacks         = nullptr;
+#endif
+
+    /// 创建下载器并注册句柄的回调；start 为 true 时随后启动
+    DownloadHandle createHandle(
+        const std::vector<std::string>& urls,
+        const std::vector<std::string>& savePaths,
+        const DownloadParams& params,
+        DownloadCallback callback,
+        EventCallback onEvent,
+        bool start
+    ) {
+        auto state = std::make_shared<tthsd_detail::HandleState>(std::move(callback), std::move(onEvent));
+        int id = createDownloader(urls, savePaths, params);
+        if (id < 0) return {};
+        // 先注册回调再启动，不会漏掉开头的事件
+        if (!attachListener(id, state)) {
+            stopDownload(id);
+            return {};
+        }
+
+        DownloadHandle handle;
+        handle._owner = this;
+        handle._id = id;
+        handle._multiple = params.isMultiple && *params.isMultiple;
+        handle._state = std::move(state);
+        if (start && !handle.start()) return {};  // 句柄析构时停止下载器
+        return handle;
+    }
+
+    /// 创建下载器（不启动、不设置回调），事件由 attachListener 注册的接收端处理
+    int createDownloader(
+        const std::vector<std::string>& urls,
+        const std::vector<std::string>& savePaths,
+        const DownloadParams& params
+    ) {
+        if (isRemote()) return remoteCreate("get_downloader", urls, savePaths, params);
+        auto tasksJson = buildTasksJson(urls, savePaths);
+        return TTHSD_FN(get_downloader)(
+            tasksJson.c_str(), (int)urls.size(),
+            params.threadCount, params.chunkSizeMB,
+            nullptr,
+            params.useCallbackUrl,
+            params.userAgent.empty() ? nullptr : params.userAgent.c_str(),
+            params.remoteCallbackUrl.empty() ? nullptr : params.remoteCallbackUrl.c_str(),
+            params.useSocket
+        );
+    }
+
+    /// 把下载器的事件与结束通知交给 listener（应在启动之前调用）
+    bool attachListener(int id, std::shared_ptr<tthsd_detail::Listener> listener) {
+        if (isRemote()) {
+            {
+                std::lock_guard<std::mutex> lock(_rpcMutex);
+                _listeners[id] = listener;
+            }
+            // 守护进程在该下载器结束前的事件全部发出之后才回复 wait
+            bool sent = rpcAsync("wait", {{"ids", std::vector<int>{id}}}, [this, id](json response) {
+                std::shared_ptr<tthsd_detail::Listener> l;
+                {
+                    std::lock_guard<std::mutex> lock(_rpcMutex);
+                    auto it = _listeners.find(id);
+                    if (it == _listeners.end()) return;
+                    l = std::move(it->second);
+                    _listeners.erase(it);
+                }
+                auto status = WaitStatus::Invalid;
+                if (response.contains("result") && response["result"].is_object())
+                    status = static_cast<WaitStatus>(response["result"].value("outcome", -1));
+                try { l->onFinish(status); } catch (...) {}
+            });
+            if (!sent) {
+                std::lock_guard<std::mutex> lock(_rpcMutex);
+                _listeners.erase(id);
+            }
+            return sent;
+        }
+
+        // user_data 持有一份引用，在结束通知里释放
+        auto* holder = new std::shared_ptr<tthsd_detail::Listener>(std::move(listener));
+        if (TTHSD_FN(tthsd_set_callbacks)(id, &TTHSDownloader::listenerEvent, &TTHSDownloader::listenerFinish, holder) != 0) {
+            delete holder;
+            return false;
+        }
+        return true;
+    }
+
+    static void listenerEvent(int, const char* eventJson, const char* dataJson, void* userData) {
+        auto& listener = *static_cast<std::shared_ptr<tthsd_detail::Listener>*>(userData);
+        try {
+            listener->onEvent(eventJson ? eventJson : "{}", dataJson ? dataJson : "{}");
+        } catch (...) {}
+    }
+
+    static void listenerFinish(int, int outcome, void* userData) {
+        std::unique_ptr<std::shared_ptr<tthsd_detail::Listener>> holder(
+            static_cast<std::shared_ptr<tthsd_detail::Listener>*>(userData));
+        try {
+            (*holder)->onFinish(static_cast<WaitStatus>(outcome));
+        } catch (...) {}
+    }
 
     void assertLoaded() const {
-        if (!_loaded) throw std::runtime_error("[TTHSD] 未调用 load()");
+        if (!_loaded && !isRemote()) throw std::runtime_error("[TTHSD] 未调用 load() 或 connectDaemon()");
+    }
+
+    static std::string defaultDaemonSocket() {
+        // 与 tthsd-daemon 的默认路径规则一致
+        if (const char* p = std::getenv("TTHSD_SOCKET"); p && *p) return p;
+        if (const char* dir = std::getenv("XDG_RUNTIME_DIR"); dir && *dir) return std::string(dir) + "/tthsd.sock";
+        if (const char* tmp = std::getenv("TMPDIR"); tmp && *tmp) return std::string(tmp) + "/tthsd.sock";
+        return "/tmp/tthsd.sock";
+    }
+
+    int remoteCreate(
+        const char* method,
+        const std::vector<std::string>& urls,
+        const std::vector<std::string>& savePaths,
+        const DownloadParams& params
+    ) {
+        json p = {
+            {"tasks",         json::parse(buildTasksJson(urls, savePaths))},
+            {"thread_count",  params.threadCount},
+            {"chunk_size_mb", params.chunkSizeMB},
+            {"is_multiple",   params.isMultiple ? *params.isMultiple : false},
+        };
+        if (!params.userAgent.empty()) p["user_agent"] = params.userAgent;
+        json result = rpc(method, p);
+        return result.is_number_integer() ? result.get<int>() : -1;
+    }
+
+    template <class Rep, class Period>
+    static int toTimeoutMs(const std::chrono::duration<Rep, Period>& timeout) {
+        if (timeout < timeout.zero()) return -1;
+        auto ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+        return ms > INT_MAX ? INT_MAX : (int)ms;
+    }
+
+    WaitResult remoteWait(const std::vector<int>& ids, int timeoutMs) {
+        json p = {{"ids", ids}};
+        if (timeoutMs >= 0) p["timeout_ms"] = timeoutMs;
+        try {
+            json result = rpc("wait", p);
+            int index = result.value("index", -1);
+            auto status = static_cast<WaitStatus>(result.value("outcome", -1));
+            return {index >= 0 ? ids[index] : -1, status};
+        } catch (const std::exception&) {
+            return {};
+        }
+    }
+
+    bool remoteOk(const char* method, int id) {
+        try {
+            rpc(method, {{"id", id}});
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
     }
 
+    /// 发送一次请求并等待对应 ID 的响应；守护进程返回错误时抛出异常
+    json rpc(const char* method, const json& params) {
+#ifdef _WIN32
+        (void)method; (void)params;
+        throw std::runtime_error("[TTHSD] 远程模式目前只支持 Unix 平台");
+#else
+        std::unique_lock<std::mutex> lock(_rpcMutex);
+        long long reqId = ++_nextRequestId;
+        if (!sendRequest(reqId, method, params)) throw std::runtime_error("[TTHSD] 守护进程连接已断开");
+
+        _rpcCv.wait(lock, [&] { return _remoteClosed || _responses.count(reqId) > 0; });
+        auto it = _responses.find(reqId);
+        if (it == _responses.end()) throw std::runtime_error("[TTHSD] 守护进程连接已断开");
+        json response = std::move(it->second);
+        _responses.erase(it);
+
+        if (response.contains("error"))
+            throw std::runtime_error("[TTHSD] " + response["error"].get<std::string>());
+        return response.value("result", json());
+#endif
+    }
+
+    /// 发送请求但不等待：响应（连接断开时为 {"error": ...}）在读取线程上交给 onResponse，
+    /// onResponse 里不要同步调用 rpc()
+    bool rpcAsync(const char* method, const json& params, std::function<void(json)> onResponse) {
+#ifdef _WIN32
+        (void)method; (void)params; (void)onResponse;
+        return false;
+#else
+        std::lock_guard<std::mutex> lock(_rpcMutex);
+        if (_remoteClosed) return false;
+        long long reqId = ++_nextRequestId;
+        _continuations[reqId] = std::move(onResponse);
+        if (!sendRequest(reqId, method, params)) {
+            _continuations.erase(reqId);
+            return false;
+        }
+        return true;
+#endif
+    }
+
+#ifndef _WIN32
+    /// 调用方持有 _rpcMutex
+    bool sendRequest(long long reqId, const char* method, const json& params) {
+        std::string line = json{{"id", reqId}, {"method", method}, {"params", params}}.dump() + "\n";
+        for (size_t sent = 0; sent < line.size();) {
+            ssize_t n = ::send(_remoteFd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            sent += (size_t)n;
+        }
+        return true;
+    }
+#endif
+
+#ifndef _WIN32
+    /// 读取线程：按行拆分守护进程的输出，响应交给等待中的 rpc()，事件转发给回调
+    void readLoop() {
+        std::string buffer;
+        char chunk[8192];
+        for (;;) {
+            ssize_t n = ::recv(_remoteFd, chunk, sizeof(chunk), 0);
+            if (n <= 0) break;
+            buffer.append(chunk, (size_t)n);
+
+            size_t start = 0, end;
+            while ((end = buffer.find('\n', start)) != std::string::npos) {
+                handleRemoteLine(buffer.substr(start, end - start));
+                start = end + 1;
+            }
+            buffer.erase(0, start);
+        }
+
+        std::map<long long, std::function<void(json)>> orphaned;
+        {
+            std::lock_guard<std::mutex> lock(_rpcMutex);
+            _remoteClosed = true;
+            orphaned.swap(_continuations);
+            _rpcCv.notify_all();
+        }
+        for (auto& entry : orphaned) entry.second(json{{"error", "守护进程连接已断开"}});
+    }
+
+    void handleRemoteLine(const std::string& line) {
+        json message = json::parse(line, nullptr, false);
+        if (message.is_discarded()) return;
+
+        if (message.contains("downloader")) {
+            std::shared_ptr<tthsd_detail::Listener> listener;
+            if (message["downloader"].is_number_integer()) {
+                std::lock_guard<std::mutex> lock(_rpcMutex);
+                auto it = _listeners.find(message["downloader"].get<int>());
+                if (it != _listeners.end()) listener = it->second;
+            }
+            if (!listener) return;
+            try {
+                listener->onEvent(message.value("event", json::object()).dump(), message.value("data", json::object()).dump());
+            } catch (...) {}
+            return;
+        }
+
+        if (message.contains("id") && message["id"].is_number_integer()) {
+            long long reqId = message["id"].get<long long>();
+            std::function<void(json)> continuation;
+            {
+                std::lock_guard<std::mutex> lock(_rpcMutex);
+                auto it = _continuations.find(reqId);
+                if (it == _continuations.end()) {
+                    _responses[reqId] = std::move(message);
+                    _rpcCv.notify_all();
+                    return;
+                }
+                continuation = std::move(it->second);
+                _continuations.erase(it);
+            }
+            continuation(std::move(message));
+        }
+    }
+#endif
+
     std::string buildTasksJson(
         const std::vector<std::string>& urls,
         const std::vector<std::string>& savePaths
@@ -190,19 +1311,20 @@ private:
         }
         return tasks.dump();
     }
+};
 
-    // 静态 C 回调（转发给实例的 _callback）
-    // 简化版：单实例场景
-    static TTHSDownloader* _instance;
+inline bool DownloadHandle::start() {
+    if (!_owner) return false;
+    return _multiple ? _owner->startMultipleDownloadsById(_id) : _owner->startDownloadById(_id);
+}
 
-    static void cCallback(const char* eventJson, const char* dataJson) {
-        if (!_instance || !_instance->_callback) return;
-        try {
-            auto event = json::parse(eventJson ? eventJson : "{}");
-            auto data  = json::parse(dataJson  ? dataJson  : "{}");
-            _instance->_callback(event, data);
-        } catch (...) {}
-    }
-};
+inline bool DownloadHandle::pause()  { return _owner && _owner->pauseDownload(_id); }
+inline bool DownloadHandle::resume() { return _owner && _owner->resumeDownload(_id); }
+inline bool DownloadHandle::stop()   { return _owner && _owner->stopDownload(_id); }
 
-inline TTHSDownloader* TTHSDownloader::_instance = nullptr;
+inline void DownloadHandle::reset() {
+    if (_owner && _state && !_state->finished()) _owner->stopDownload(_id);
+    _owner = nullptr;
+    _state.reset();
+    _id = -1;
+}
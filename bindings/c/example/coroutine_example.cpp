@@ -0,0 +1,93 @@
+/**
+ * C++20 协程示例：在单线程事件循环上 co_await 下载结果与进度，Ctrl+C 通过 std::stop_token 取消
+ *
+ * 编译方式:
+ *   mkdir build && cd build
+ *   cmake .. && make coroutine_example
+ *   ./coroutine_example https://example.com/a.zip /tmp/a.zip
+ */
+
+#include "../TTHSDownloader.hpp"
+#include <csignal>
+#include <cstdio>
+#include <deque>
+#include <exception>
+
+#if !TTHSD_HAS_COROUTINES
+  #error "需要支持协程的 C++20 编译器"
+#endif
+
+/// 最简单的单线程执行器：回调线程把协程句柄投递进来，由主线程恢复
+class EventLoop {
+public:
+    void post(std::coroutine_handle<> h) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.push_back(h);
+        }
+        _cv.notify_one();
+    }
+
+    void quit() { post(nullptr); }
+
+    void run() {
+        for (;;) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [&] { return !_queue.empty(); });
+            auto h = _queue.front();
+            _queue.pop_front();
+            lock.unlock();
+            if (!h) return;
+            h.resume();
+        }
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::coroutine_handle<>> _queue;
+};
+
+/// 立即开始、结束时退出事件循环的协程
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+static std::stop_source g_stop;
+
+static Detached run(TTHSDownloader& dl, EventLoop& loop, std::string url, std::string savePath) {
+    // 注意：GCC 12 对 co_await 表达式里的花括号初始化列表有编译错误，先构造 op 再 co_await
+    auto op = dl.download({url}, {savePath}, DownloadParams{.threadCount = 32},
+                          {[&loop](std::coroutine_handle<> h) { loop.post(h); }, g_stop.get_token()});
+
+    while (auto p = co_await op.nextProgress())
+        printf("\r进度: %.2f%% %.1f MB/s", p->fraction() * 100.0, p->speed / 1048576.0);
+
+    DownloadResult r = co_await op;
+    printf("\n%s\n", r.completed() && r.tasks[0].completed ? "完成"
+                     : r.status == WaitStatus::Cancelled ? "已取消"
+                     : ("失败: " + r.error).c_str());
+    loop.quit();
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "用法: %s <url> <保存路径>\n", argv[0]);
+        return 1;
+    }
+    std::signal(SIGINT, [](int) { g_stop.request_stop(); });
+
+    TTHSDownloader dl;
+    dl.load();
+
+    EventLoop loop;
+    run(dl, loop, argv[1], argv[2]);
+    loop.run();
+    return 0;
+}
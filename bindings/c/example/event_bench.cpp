@@ -0,0 +1,102 @@
+/**
+ * 事件解析微基准：强类型解析器（parseEvent）对比 nlohmann::json
+ *
+ * 输入为库实际生成的回调 JSON，同时统计每个事件的堆分配次数。
+ *
+ * 编译方式:
+ *   mkdir build && cd build
+ *   cmake .. -DCMAKE_BUILD_TYPE=Release && make event_bench
+ *   ./event_bench
+ */
+
+#include "../TTHSDownloader.hpp"
+#include <chrono>
+#include <cstdio>
+#include <new>
+
+// 替换全局 operator new 统计分配次数；GCC 会把内联后的 malloc/free 配对误报为不匹配
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+static size_t g_allocations = 0;
+
+void* operator new(size_t size) {
+    ++g_allocations;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+static const char* kUpdateEvent =
+    R"({"Type":"update","Name":"进度更新","ShowName":"全局","ID":""})";
+static const char* kUpdateData =
+    R"({"Downloaded":123456789,"total_bytes":123456789,"Total":987654321,)"
+    R"("current_speed_bps":52428800,"current_speed_mbps":50.0,"average_speed_bps":41943040,)"
+    R"("average_speed_mbps":40.0,"peak_speed_bps":62914560,"peak_speed_mbps":60.0,)"
+    R"("chunk_downloads":12,"failed_chunks":0,"retried_chunks":1,"elapsed_time":2.9437})";
+static const char* kEndOneEvent =
+    R"({"Type":"endOne","Name":"结束一个任务","ShowName":"a.zip","ID":"1"})";
+static const char* kEndOneData =
+    R"({"URL":"https://example.com/a.zip","SavePath":"/tmp/a.zip","ShowName":"a.zip","Index":1,"Total":3})";
+
+struct Result {
+    double nsPerEvent;
+    double allocsPerEvent;
+    int64_t checksum;
+};
+
+template <class F>
+static Result run(int iterations, F&& parseOne) {
+    int64_t checksum = 0;
+    for (int i = 0; i < 1000; ++i) checksum += parseOne();  // 预热
+
+    size_t allocsBefore = g_allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) checksum += parseOne();
+    auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return {ns / iterations, (double)(g_allocations - allocsBefore) / iterations, checksum};
+}
+
+static void report(const char* name, const Result& typed, const Result& nlohmann) {
+    printf("%-8s  typed: %7.1f ns/事件 %5.1f 次分配 | nlohmann: %7.1f ns/事件 %5.1f 次分配 | %.1fx\n",
+           name, typed.nsPerEvent, typed.allocsPerEvent,
+           nlohmann.nsPerEvent, nlohmann.allocsPerEvent,
+           nlohmann.nsPerEvent / typed.nsPerEvent);
+    if (typed.checksum != nlohmann.checksum) printf("  结果不一致: %lld vs %lld\n",
+                                                    (long long)typed.checksum, (long long)nlohmann.checksum);
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 1000000;
+
+    Result typedUpdate = run(iterations, [] {
+        auto event = parseEvent(kUpdateEvent, kUpdateData);
+        const auto& p = std::get<ProgressEvent>(*event);
+        return p.downloaded + p.total + (int64_t)p.speed;
+    });
+    Result jsonUpdate = run(iterations, [] {
+        auto event = json::parse(kUpdateEvent);
+        auto data  = json::parse(kUpdateData);
+        if (event["Type"] != "update") return int64_t(0);
+        return data["Downloaded"].get<int64_t>() + data["Total"].get<int64_t>()
+             + (int64_t)data["current_speed_bps"].get<double>();
+    });
+    report("update", typedUpdate, jsonUpdate);
+
+    Result typedTask = run(iterations / 4, [] {
+        auto event = parseEvent(kEndOneEvent, kEndOneData);
+        const auto& t = std::get<TaskEvent>(*event);
+        return (int64_t)(t.url.size() + t.savePath.size()) + t.index;
+    });
+    Result jsonTask = run(iterations / 4, [] {
+        auto event = json::parse(kEndOneEvent);
+        auto data  = json::parse(kEndOneData);
+        if (event["Type"] != "endOne") return int64_t(0);
+        return (int64_t)(data["URL"].get<std::string>().size() + data["SavePath"].get<std::string>().size())
+             + data["Index"].get<int>();
+    });
+    report("endOne", typedTask, jsonTask);
+    return 0;
+}
@@ -10,12 +10,6 @@
 
 #include "../TTHSDownloader.hpp"
 #include <iostream>
-#include <atomic>
-#include <thread>
-#include <chrono>
-#include <csignal>
-
-std::atomic<bool> g_done{false};
 
 int main() {
     TTHSDownloader dl;
@@ -30,8 +24,8 @@ int main() {
 
     std::cout << "🚀 TTHSD C++ 示例启动\n";
 
-    // 2. 启动下载，lambda 捕获回调事件
-    int id = dl.startDownload(
+    // 2. 启动下载，lambda 捕获回调事件（回调归返回的句柄所有，句柄析构时停止未结束的下载）
+    DownloadHandle download = dl.startDownload(
         {"https://example.com/file.zip"},
         {"/tmp/file.zip"},
         DownloadParams{.threadCount = 32, .chunkSizeMB = 10},
@@ -61,25 +55,19 @@ int main() {
 
             } else if (type == "end") {
                 std::cout << "\n🏁 全部下载完成\n";
-                g_done = true;
 
             } else if (type == "err") {
                 std::cerr << "\n❌ 错误: " << data.value("Error", "未知") << "\n";
-                g_done = true;
             }
         }
     );
 
-    if (id == -1) {
+    if (!download) {
         std::cerr << "startDownload 失败\n";
         return 1;
     }
 
-    // 3. 等待下载结束
-    while (!g_done) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    }
-
-    dl.stopDownload(id);
-    return 0;
+    // 3. 等待下载结束（结束后下载器自动释放，无需再 stopDownload）
+    WaitResult result = download.wait();
+    return result.completed() ? 0 : 1;
 }
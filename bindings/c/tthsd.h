@@ -23,6 +23,125 @@ extern "C" {
  */
 typedef void (*TTHSD_Callback)(const char* event_json, const char* data_json);
 
+/**
+ * 单个下载器的回调（用于 tthsd_set_callbacks），user_data 为设置时传入的指针：
+ *   TTHSD_EventCallback   参数同 TTHSD_Callback，另带下载器 ID
+ *   TTHSD_FinishCallback  outcome 为 TTHSD_WAIT_COMPLETED / FAILED / CANCELLED
+ */
+typedef void (*TTHSD_EventCallback)(int id, const char* event_json, const char* data_json, void* user_data);
+typedef void (*TTHSD_FinishCallback)(int id, int outcome, void* user_data);
+
+/**
+ * 事件订阅掩码（用于 tthsd_set_event_mask，按位或组合）
+ */
+#define TTHSD_EVENT_START     (1u << 0)  /* start    */
+#define TTHSD_EVENT_START_ONE (1u << 1)  /* startOne */
+#define TTHSD_EVENT_UPDATE    (1u << 2)  /* update   */
+#define TTHSD_EVENT_END       (1u << 3)  /* end      */
+#define TTHSD_EVENT_END_ONE   (1u << 4)  /* endOne   */
+#define TTHSD_EVENT_MSG       (1u << 5)  /* msg      */
+#define TTHSD_EVENT_ERR       (1u << 6)  /* err      */
+#define TTHSD_EVENT_ALL       ((1u << 7) - 1)
+
+/**
+ * 运行中修改的字段（TTHSD_ConfigPatch.fields，按位或组合）
+ */
+#define TTHSD_PATCH_THREAD_COUNT      (1u << 0)
+#define TTHSD_PATCH_CHUNK_SIZE        (1u << 1)
+#define TTHSD_PATCH_RATE_LIMIT        (1u << 2)
+#define TTHSD_PATCH_PROGRESS_INTERVAL (1u << 3)
+#define TTHSD_PATCH_USER_AGENT        (1u << 4)
+
+/**
+ * tthsd_wait / tthsd_wait_any 的返回值（下载器的结局与超时）
+ */
+#define TTHSD_WAIT_COMPLETED  0   /* 所有任务结束 */
+#define TTHSD_WAIT_FAILED     1   /* 启动失败或运行出错 */
+#define TTHSD_WAIT_CANCELLED  2   /* 被停止（暂停不是结局，等待会继续） */
+#define TTHSD_WAIT_TIMEOUT    (-2)
+
+/**
+ * tthsd_set_power_profile 的功耗档位
+ */
+#define TTHSD_POWER_NORMAL    0
+#define TTHSD_POWER_SAVER     1   /* 低唤醒：定时器合并、进度上报放缓、写入攒批 */
+
+/**
+ * 进度上报参数（字段为 0 表示使用默认值 / 不启用）
+ *
+ *   interval_ms        进度上报间隔（毫秒），默认 500；后台批处理可设为 10000，交互界面可设为 16
+ *   batch_bytes        分块内累计多少字节后提交到全局计数器，默认 512KB
+ *   min_delta_percent  "显著变化"模式：进度变化超过该百分比才上报
+ *   min_delta_bytes    "显著变化"模式：进度变化超过该字节数才上报
+ */
+typedef struct TTHSD_ProgressOptions {
+    unsigned int interval_ms;
+    unsigned int batch_bytes;
+    double       min_delta_percent;
+    long long    min_delta_bytes;
+} TTHSD_ProgressOptions;
+
+/**
+ * 回调投递参数
+ *
+ *   budget_ms  单次回调耗时预算（毫秒），超过后输出警告并计入统计，0 = 默认 50
+ *   host_pump  true = 不创建投递线程，由宿主调用 tthsd_poll_events 在自己的线程（如 UI/游戏主循环）上接收回调
+ *
+ * 默认情况下回调在专用的 "tthsd-callback" 线程上按顺序调用，不会阻塞下载工作线程。
+ * 该线程每个下载器一个（首个事件时创建，下载器释放且事件投递完后退出），同时运行的下载器很多时
+ * 可以用 host_pump 改由宿主线程投递。
+ */
+typedef struct TTHSD_CallbackOptions {
+    unsigned int budget_ms;
+    bool         host_pump;
+} TTHSD_CallbackOptions;
+
+/**
+ * 运行中修改的下载参数（用于 tthsd_update_config），只应用 fields 中标记的字段
+ *
+ *   thread_count          并发分块数
+ *   chunk_size_mb         分块大小（MB）
+ *   rate_limit_bps        限速（字节/秒），0 = 不限速
+ *   progress_interval_ms  进度上报间隔（毫秒），0 = 默认 500
+ *   user_agent            请求使用的 UA
+ */
+typedef struct TTHSD_ConfigPatch {
+    unsigned int       fields;
+    unsigned int       thread_count;
+    unsigned int       chunk_size_mb;
+    unsigned long long rate_limit_bps;
+    unsigned int       progress_interval_ms;
+    const char*        user_agent;
+} TTHSD_ConfigPatch;
+
+/**
+ * 运行时参数（用于 tthsd_init，字段为 0 / NULL 表示使用默认值）
+ *
+ *   worker_threads        工作线程数，默认每个 CPU 核一个；核数很多的服务器或手机上可显式限制
+ *   max_blocking_threads  阻塞线程池（文件 IO 等）上限，默认 512
+ *   thread_name_prefix    线程名前缀，默认 "tthsd-worker"，线程名为 <前缀>-<序号>
+ *   cpu_affinity          允许运行时线程使用的 CPU 编号数组（仅 Linux/Android，其他平台忽略）
+ *   cpu_affinity_len      cpu_affinity 的元素个数
+ *   current_thread        true = 单线程模式：所有下载任务在一个专用线程上运行（忽略 worker_threads）
+ */
+typedef struct TTHSD_RuntimeConfig {
+    unsigned int        worker_threads;
+    unsigned int        max_blocking_threads;
+    const char*         thread_name_prefix;
+    const unsigned int* cpu_affinity;
+    unsigned int        cpu_affinity_len;
+    bool                current_thread;
+} TTHSD_RuntimeConfig;
+
+/**
+ * tthsd_init - 配置全局运行时
+ *
+ * 必须在第一次调用其他函数（创建下载器）之前调用；不调用时在第一次使用时按默认参数创建。
+ * @param config  运行时参数，NULL = 按默认参数立即创建
+ * @return 0=成功，-1=运行时已创建或参数无效
+ */
+int tthsd_init(const TTHSD_RuntimeConfig* config);
+
 /**
  * start_download - 创建并立即启动下载器
  *
@@ -33,10 +152,18 @@ typedef void (*TTHSD_Callback)(const char* event_json, const char* data_json);
  * @param callback          回调函数指针（可为 NULL）
  * @param use_callback_url  是否启用远程回调
  * @param user_agent        自定义 UA（可为 NULL）
- * @param remote_callback_url 远程回调 URL（可为 NULL）
+ * @param remote_callback_url 远程回调 URL（可为 NULL）。unix:///path/to.sock 为 Unix 域套接字
+ *                          （Linux/Android 上 unix://@name 为抽象命名空间），此时总是使用 Socket 帧格式。
+ *                          支持查询参数：
+ *                          format=msgpack  改用二进制 MessagePack 记录（见 scripts/tthsd_remote_decoder.py）
+ *                          flush_ms=N      攒批间隔，默认 50ms；err/end 事件总是立即发送
+ *                          batch_bytes=N   单批达到该字节数时立即发送，默认 64KB
+ *                          回调 URL 完全相同的下载器共享同一条连接，每条消息的 Downloader 字段为下载器 ID
  * @param use_socket        是否使用 Socket（bool*，可为 NULL）
  * @param is_multiple       是否并行多任务（bool*，可为 NULL）
- * @return 下载器 ID（正整数），-1 表示失败
+ * @return 下载器 ID（正整数，不连续），-1 表示失败（包括同时存在的下载器超过 65536 个）。
+ *         下载器结束或被 stop_download 释放后 ID 立即失效，之后用它调用任何接口都返回 -1，
+ *         不会误操作复用了同一内部槽位的新下载器。
  */
 int start_download(
     const char*     tasks_data,
@@ -68,21 +195,146 @@ int get_downloader(
     const bool*     use_socket
 );
 
-/** 按 ID 顺序启动下载，0=成功，-1=失败 */
+/** 按 ID 顺序启动下载，0=成功，-1=失败（ID 不存在，或下载器正在运行；正在进行的运行不受影响）*/
 int start_download_id(int id);
 
-/** 按 ID 并行启动下载，0=成功，-1=失败 */
+/** 按 ID 并行启动下载，返回值同 start_download_id */
 int start_multiple_downloads_id(int id);
 
-/** 暂停下载 */
+/** 暂停下载：等正在传输的分块退出后返回，下载器保留，之后可 resume_download 或 stop_download */
 int pause_download(int id);
 
-/** 恢复下载（需核心版本 >=0.5.1）*/
+/** 恢复下载（需核心版本 >=0.5.1）：按上次的启动方式重新运行全部任务；仍在运行时返回 -1 */
 int resume_download(int id);
 
-/** 停止并销毁下载器 */
+/** 停止并销毁下载器：等正在传输的分块全部退出（不再写文件）后才返回，结局记为 TTHSD_WAIT_CANCELLED */
 int stop_download(int id);
 
+/**
+ * tthsd_set_progress_options - 设置进度上报节奏
+ *
+ * 运行中也可调用：interval_ms 与 min_delta_* 在下一次上报时生效，batch_bytes 从下一个分块开始生效。
+ * @return 0=成功，-1=下载器不存在或参数无效（负数或 NaN）
+ */
+int tthsd_set_progress_options(int id, const TTHSD_ProgressOptions* options);
+
+/**
+ * tthsd_set_callback_options - 设置回调投递方式（需在启动下载前调用）
+ * @return 0=成功，-1=下载器不存在、未设置回调或投递线程已启动
+ */
+int tthsd_set_callback_options(int id, const TTHSD_CallbackOptions* options);
+
+/**
+ * tthsd_update_config - 修改运行中（或尚未启动）的下载器参数，不中断正在传输的分块
+ *
+ * 线程数、分块大小与 UA 在下一个分块开始时生效，已下载的进度不会丢失；限速立即生效；
+ * 进度上报间隔在下一次上报时生效。例如在链路变差时限速到 1MB/s：
+ *   TTHSD_ConfigPatch p = {0};
+ *   p.fields = TTHSD_PATCH_RATE_LIMIT;
+ *   p.rate_limit_bps = 1024 * 1024;
+ *   tthsd_update_config(id, &p);
+ * @return 0=成功，-1=下载器不存在或参数无效（线程数/分块大小为 0、UA 为空等）
+ */
+int tthsd_update_config(int id, const TTHSD_ConfigPatch* patch);
+
+/**
+ * tthsd_set_event_mask - 设置事件订阅掩码，立即生效
+ *
+ * 未订阅的事件在构建数据和序列化之前就被丢弃（同时作用于回调函数和远程回调地址）。
+ * 例如只关心结束与错误：tthsd_set_event_mask(id, TTHSD_EVENT_END | TTHSD_EVENT_ERR)
+ * @return 0=成功，-1=下载器不存在
+ */
+int tthsd_set_event_mask(int id, unsigned int mask);
+
+/**
+ * tthsd_poll_events - 宿主驱动模式下，在调用线程上投递最多 max_events 个回调
+ * @return 实际投递的事件数，-1=下载器不存在
+ */
+int tthsd_poll_events(int id, int max_events);
+
+/**
+ * tthsd_get_stats - 获取下载器运行统计 JSON（如 callback.queue_depth / avg_callback_us）
+ *
+ * callback 分组中 dropped_updates 为回调队列积压超过 4096 时丢弃的进度事件数（控制类事件从不丢弃），
+ * dropped_messages 为投递端已退出而无法入队的事件数。
+ *
+ * 使用 Socket 远程回调时另有 socket 分组：connected / queue_depth / sent_messages / write_calls /
+ * coalesced_updates（被新进度覆盖的旧进度）/ dropped_updates / dropped_messages（连接关闭后无法入队的事件）/
+ * backpressure_waits（队列满时控制类事件等待空间的次数，控制类事件从不丢弃）/ connects / connect_failures 等；连接被多个下载器共享时统计为整条连接的数据，
+ * shared_by 为共用该连接的下载器数量。
+ * 使用 WebSocket 远程回调时另有 websocket 分组（字段同上，另含 flushes / liveness_timeouts）。
+ * rate_limit 分组：rate_bps（当前限速，0 = 不限速）/ throttle_waits / throttled_ms（因限速等待的次数与总时长）。
+ *
+ * @param buf      输出缓冲区（可为 NULL，用于查询所需长度）
+ * @param buf_len  缓冲区大小（含结尾 NUL）
+ * @return JSON 长度（不含 NUL）；缓冲区不足时不写入并返回所需长度；-1=下载器不存在
+ */
+int tthsd_get_stats(int id, char* buf, int buf_len);
+
+/**
+ * tthsd_dump_flight_recorder - 将飞行记录转储到文件（制表符分隔文本）
+ *
+ * 每个下载器始终保留最近 1024 条内部事件（任务开始/结束、分块、HTTP 状态码、停滞、
+ * 回调积压等）。任务失败时会自动转储到系统临时目录下的 tthsd-flight/，路径附在 err 事件的
+ * "FlightRecorder" 字段中（该目录只保留最近 32 个、7 天内的转储）；也可随时调用本函数手动导出。
+ * error 记录的 a 列为错误码（HTTP 状态码，或 -1 其他 / -2 网络 / -3 超时 / -4 文件读写 /
+ * -5 连接停滞 / -6 下载不完整），b 列为出错分块的起始偏移（-1 = 与分块无关）。
+ * @return 0=成功，-1=下载器不存在或写入失败
+ */
+int tthsd_dump_flight_recorder(int id, const char* path);
+
+/**
+ * tthsd_wait - 阻塞等待下载器结束（由条件变量唤醒，无轮询）
+ *
+ * 下载器结束后即使已被自动释放，最近结束的 4096 个下载器仍可查到结局。
+ * 不要在回调函数中调用（可能在等待自己的结束）。
+ * @param timeout_ms  <0 无限等待，0 只查询不等待
+ * @return TTHSD_WAIT_COMPLETED / FAILED / CANCELLED；超时返回 TTHSD_WAIT_TIMEOUT；-1=ID 无效
+ */
+int tthsd_wait(int id, int timeout_ms);
+
+/**
+ * tthsd_wait_any - 阻塞等待 ids 中任意一个下载器结束
+ *
+ * 多个已结束时返回下标最小的一个；其结局可再用 tthsd_wait(ids[i], 0) 取得。
+ * @return 已结束下载器在 ids 中的下标；超时返回 TTHSD_WAIT_TIMEOUT；-1=参数无效或包含无效 ID
+ */
+int tthsd_wait_any(const int* ids, int count, int timeout_ms);
+
+/**
+ * tthsd_set_callbacks - 为下载器设置带 user_data 的事件回调与结束通知（各自可为 NULL）
+ *
+ * 与创建时传入的 TTHSD_Callback 互不影响，多个下载器可以各自路由到不同的对象。
+ * 应在 get_downloader 之后、启动之前调用，每个下载器只能设置一次。
+ * 两者都在回调投递线程上按顺序调用：on_finish 排在结束前产生的所有事件之后，且只调用一次，
+ * 之后不再调用 on_event，可以在 on_finish 中释放 user_data。
+ * @return 0=成功，-1=下载器不存在、两个回调都为 NULL 或已经设置过
+ */
+int tthsd_set_callbacks(int id, TTHSD_EventCallback on_event, TTHSD_FinishCallback on_finish, void* user_data);
+
+/**
+ * tthsd_set_power_profile - 设置进程级功耗档位，对所有下载器立即生效
+ *
+ * TTHSD_POWER_SAVER（适合移动端电池供电时）：
+ *   - 进度上报等周期性定时器对齐到整秒，多个下载器的定时器由一次唤醒统一处理；
+ *   - 进度上报间隔不小于 2 秒；
+ *   - 每个分块攒满 1MB 再写入文件；
+ *   - 在创建第一个下载器（或调用 tthsd_init）之前设置时，默认运行时只创建 2 个工作线程，
+ *     运行时创建后切换档位不改变线程数；tthsd_init 显式指定的 worker_threads 优先。
+ * 分块停滞检测（30 秒无数据）在两种档位下都不额外占用定时器。
+ * @return 0=成功，-1=档位无效
+ */
+int tthsd_set_power_profile(int profile);
+
+/**
+ * tthsd_set_background - 通知宿主应用进入/离开后台
+ *
+ * 后台时暂停所有下载器的 update 事件（下载照常进行，start/end/err 等事件照常发送），
+ * 进度上报任务不再定时唤醒；切回前台时立即补报一次当前进度。
+ * @return 0
+ */
+int tthsd_set_background(bool background);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -1,5 +1,20 @@
 package com.tthsd
 
+import java.nio.ByteBuffer
+
+/**
+ * 原生监听器：由 TTHSD 的事件投递线程直接调用（每个下载器一个投递线程）
+ *
+ * 不要在回调中做耗时操作；[TTHSDownloaderAndroid] 会把事件合并后转交到用户指定的 Executor。
+ */
+interface TTHSDNativeListener {
+    /** 最新进度已写入注册时传入的进度缓冲区（布局见 `TTHSDLibraryJNI.PROGRESS_*`），仅在本回调内读取 */
+    fun onProgress(downloaderId: Int)
+
+    /** 其他事件（start / startOne / endOne / end / msg / err），与桌面端回调相同的两段 JSON */
+    fun onEvent(downloaderId: Int, eventJson: String, dataJson: String)
+}
+
 /**
  * TTHSDLibraryJNI - Android 平台 JNI 接口
  *
@@ -26,6 +41,39 @@ object TTHSDLibraryJNI {
     // JNI 原生方法声明（对应 android_export.rs 的导出函数）
     // ------------------------------------------------------------------
 
+    /**
+     * 配置全局运行时（须在创建第一个下载器之前调用，不调用则每个 CPU 核一个工作线程）
+     * @param workerThreads       工作线程数，0 = CPU 核数；手机上通常 2 个就足够
+     * @param maxBlockingThreads  阻塞线程池上限，0 = 默认 512
+     * @param threadNamePrefix    线程名前缀，空字符串 = "tthsd-worker"
+     * @param cpuAffinity         允许运行时线程使用的 CPU 编号（例如只用小核），null = 不限制
+     * @param currentThread       单线程模式：所有下载任务在一个线程上运行
+     * @return 0 = 成功，-1 = 运行时已创建或参数无效
+     */
+    @JvmStatic
+    external fun init(
+        workerThreads: Int,
+        maxBlockingThreads: Int,
+        threadNamePrefix: String,
+        cpuAffinity: IntArray?,
+        currentThread: Boolean
+    ): Int
+
+    /** 进度缓冲区最小容量（字节），须用 `ByteBuffer.allocateDirect(...).order(ByteOrder.nativeOrder())` 分配 */
+    const val PROGRESS_BUFFER_SIZE = 48
+    /** 进度缓冲区字段偏移：Long 已下载字节 */
+    const val PROGRESS_DOWNLOADED = 0
+    /** Long 总字节 */
+    const val PROGRESS_TOTAL = 8
+    /** Double 当前速度（字节/秒） */
+    const val PROGRESS_CURRENT_SPEED = 16
+    /** Double 平均速度（字节/秒） */
+    const val PROGRESS_AVERAGE_SPEED = 24
+    /** Double 峰值速度（字节/秒） */
+    const val PROGRESS_PEAK_SPEED = 32
+    /** Double 已运行时间（秒） */
+    const val PROGRESS_ELAPSED = 40
+
     /**
      * 创建并立即启动下载
      * @param tasksJson        任务列表 JSON 字符串
@@ -35,6 +83,8 @@ object TTHSDLibraryJNI {
      * @param callbackUrl      远程回调 URL（WebSocket 或 Socket）
      * @param useSocket        是否使用 TCP Socket（否则用 WebSocket）
      * @param isMultiple       是否并行多任务下载
+     * @param listener         进程内监听器，null = 不使用（只走回调 URL）
+     * @param progressBuffer   使用监听器时必填：至少 [PROGRESS_BUFFER_SIZE] 字节的直接 ByteBuffer（本机字节序）
      * @return 下载器 ID，失败返回 -1
      */
     @JvmStatic
@@ -45,11 +95,13 @@ object TTHSDLibraryJNI {
         useCallbackUrl: Boolean,
         callbackUrl: String,
         useSocket: Boolean,
-        isMultiple: Boolean
+        isMultiple: Boolean,
+        listener: TTHSDNativeListener?,
+        progressBuffer: ByteBuffer?
     ): Int
 
     /**
-     * 创建下载器（不立即启动）
+     * 创建下载器（不立即启动），listener / progressBuffer 同 [startDownload]
      * @return 下载器 ID，失败返回 -1
      */
     @JvmStatic
@@ -59,7 +111,9 @@ object TTHSDLibraryJNI {
         chunkSizeMB: Int,
         useCallbackUrl: Boolean,
         callbackUrl: String,
-        useSocket: Boolean
+        useSocket: Boolean,
+        listener: TTHSDNativeListener?,
+        progressBuffer: ByteBuffer?
     ): Int
 
     @JvmStatic external fun startDownloadById(id: Int): Int
@@ -67,4 +121,25 @@ object TTHSDLibraryJNI {
     @JvmStatic external fun pauseDownload(id: Int): Int
     @JvmStatic external fun resumeDownload(id: Int): Int
     @JvmStatic external fun stopDownload(id: Int): Int
+
+    /** 普通功耗档位 */
+    const val POWER_NORMAL = 0
+    /** 省电档位：定时器对齐到整秒合并唤醒、进度上报间隔不小于 2 秒、分块写入攒满 1MB 再写 */
+    const val POWER_SAVER = 1
+
+    /**
+     * 设置功耗档位，对所有下载器立即生效（例如在电池供电、电量低时切到 POWER_SAVER）
+     *
+     * 在 init() 或创建第一个下载器之前设为 POWER_SAVER 时，默认运行时只创建 2 个工作线程。
+     * @return 0 = 成功，-1 = 档位无效
+     */
+    @JvmStatic external fun setPowerProfile(profile: Int): Int
+
+    /**
+     * 通知应用进入/离开后台（通常在 ProcessLifecycleOwner 的 onStop/onStart 中调用）
+     *
+     * 后台时下载照常进行，但暂停 update 进度事件；切回前台时立即补报一次当前进度。
+     * @return 0
+     */
+    @JvmStatic external fun setBackground(background: Boolean): Int
 }
@@ -1,27 +1,63 @@
 package com.tthsd
 
 import com.google.gson.Gson
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.util.concurrent.Executor
+
+/**
+ * DownloadProgress - 进度快照（从原生进度缓冲区读出，字段与桌面端 update 事件一致）
+ *
+ * 只统计所属下载器的本次运行，total 为已得知大小的任务之和，可以直接算出该下载的完成比例
+ */
+data class DownloadProgress(
+    val downloaded: Long,
+    val total: Long,
+    val currentSpeedBps: Double,
+    val averageSpeedBps: Double,
+    val peakSpeedBps: Double,
+    val elapsedTime: Double
+)
+
+/**
+ * DownloadListener - Android 端进程内监听器，在 [TTHSDownloaderAndroid] 的 callbackExecutor 上回调
+ */
+interface DownloadListener {
+    /** 进度更新；Executor 来不及处理时相邻的进度会被合并，只收到最新一次（不会越过之后的事件） */
+    fun onProgress(downloaderId: Int, progress: DownloadProgress) {}
+
+    /** 其他事件（start / startOne / endOne / end / msg / err），不合并，与进度按发生顺序送达 */
+    fun onEvent(downloaderId: Int, event: DownloadEvent, data: Map<String, Any?>) {}
+}
 
 /**
  * TTHSDownloaderAndroid - Android 平台封装类
  *
  * 使用 JNI（JNA 的 Android 替代方案）调用 android_export.rs 导出的本地方法。
- * 注意：回调进度事件需通过远程 WebSocket/Socket URL 接收（Android JNI 接口不支持函数指针回调）。
+ * 进度事件可以通过 [DownloadListener] 在进程内直接接收（原生层把进度写入直接 ByteBuffer，
+ * 不构造 JSON），也可以继续通过远程 WebSocket/Socket URL 接收。
  *
  * 使用方式（在 Application 初始化时）：
  * ```kotlin
  * TTHSDLibraryJNI.load()  // System.loadLibrary("TTHSD")
  *
- * val dl = TTHSDownloaderAndroid()
+ * val dl = TTHSDownloaderAndroid(ContextCompat.getMainExecutor(context))
  * val id = dl.startDownload(
  *     urls = listOf("https://example.com/a.zip"),
  *     savePaths = listOf("/sdcard/Download/a.zip"),
- *     callbackUrl = "ws://192.168.1.100:8080",
- *     useSocket = false
+ *     listener = object : DownloadListener {
+ *         override fun onProgress(downloaderId: Int, progress: DownloadProgress) {
+ *             progressBar.progress = (progress.downloaded * 100 / progress.total).toInt()
+ *         }
+ *     }
  * )
  * ```
+ *
+ * @param callbackExecutor 监听器回调执行的位置，默认直接在原生投递线程上执行
  */
-class TTHSDownloaderAndroid : AutoCloseable {
+class TTHSDownloaderAndroid(
+    private val callbackExecutor: Executor = Executor { it.run() }
+) : AutoCloseable {
 
     private val gson = Gson()
     private val activeIds = mutableListOf<Int>()
@@ -55,6 +91,89 @@ class TTHSDownloaderAndroid : AutoCloseable {
         return gson.toJson(tasks)
     }
 
+    /**
+     * 合并投递：进度与其他事件按原生投递顺序进入同一个队列，由 Executor 串行取出执行
+     * （Executor 是线程池时也不会并发或乱序）。队尾是尚未执行的进度时新进度直接替换它，
+     * 因此某个事件之前的进度总是先于该事件送达，之后的进度也不会越过它
+     */
+    private class ConflatingListener(
+        private val listener: DownloadListener,
+        private val executor: Executor,
+        private val gson: Gson
+    ) : TTHSDNativeListener {
+        val buffer: ByteBuffer = ByteBuffer
+            .allocateDirect(TTHSDLibraryJNI.PROGRESS_BUFFER_SIZE)
+            .order(ByteOrder.nativeOrder())
+
+        private class ProgressItem(val downloaderId: Int, val progress: DownloadProgress)
+        private class EventItem(val downloaderId: Int, val event: DownloadEvent, val data: Map<String, Any?>)
+
+        /** 待执行的 ProgressItem / EventItem，与 draining 一起由 queue 自身加锁保护 */
+        private val queue = ArrayDeque<Any>()
+        private var draining = false
+
+        override fun onProgress(downloaderId: Int) {
+            // 缓冲区只在本回调内有效（下一次进度会覆盖），先复制出来
+            val progress = DownloadProgress(
+                downloaded      = buffer.getLong(TTHSDLibraryJNI.PROGRESS_DOWNLOADED),
+                total           = buffer.getLong(TTHSDLibraryJNI.PROGRESS_TOTAL),
+                currentSpeedBps = buffer.getDouble(TTHSDLibraryJNI.PROGRESS_CURRENT_SPEED),
+                averageSpeedBps = buffer.getDouble(TTHSDLibraryJNI.PROGRESS_AVERAGE_SPEED),
+                peakSpeedBps    = buffer.getDouble(TTHSDLibraryJNI.PROGRESS_PEAK_SPEED),
+                elapsedTime     = buffer.getDouble(TTHSDLibraryJNI.PROGRESS_ELAPSED)
+            )
+            enqueue(ProgressItem(downloaderId, progress), conflate = true)
+        }
+
+        override fun onEvent(downloaderId: Int, eventJson: String, dataJson: String) {
+            try {
+                val event = gson.fromJson(eventJson, DownloadEvent::class.java)
+                @Suppress("UNCHECKED_CAST")
+                val data = gson.fromJson(dataJson, Map::class.java) as Map<String, Any?>
+                enqueue(EventItem(downloaderId, event, data), conflate = false)
+            } catch (e: Exception) {
+                System.err.println("[TTHSD] 回调异常（不影响下载）: ${e.message}")
+            }
+        }
+
+        private fun enqueue(item: Any, conflate: Boolean) {
+            val schedule = synchronized(queue) {
+                if (conflate && queue.lastOrNull() is ProgressItem) {
+                    queue[queue.lastIndex] = item
+                } else {
+                    queue.addLast(item)
+                }
+                if (draining) {
+                    false
+                } else {
+                    draining = true
+                    true
+                }
+            }
+            if (schedule) executor.execute(::drain)
+        }
+
+        /** 在 Executor 上按顺序执行队列直到取空；同一时刻只有一个 drain 在运行 */
+        private fun drain() {
+            while (true) {
+                val item = synchronized(queue) {
+                    queue.removeFirstOrNull() ?: run {
+                        draining = false
+                        return
+                    }
+                }
+                try {
+                    when (item) {
+                        is ProgressItem -> listener.onProgress(item.downloaderId, item.progress)
+                        is EventItem -> listener.onEvent(item.downloaderId, item.event, item.data)
+                    }
+                } catch (e: Exception) {
+                    System.err.println("[TTHSD] 监听器异常（不影响下载）: ${e.message}")
+                }
+            }
+        }
+    }
+
     // ------------------------------------------------------------------
     // 公开 API
     // ------------------------------------------------------------------
@@ -62,8 +181,7 @@ class TTHSDownloaderAndroid : AutoCloseable {
     /**
      * 创建并立即启动下载器
      *
-     * Android 端不支持 C 函数指针回调，请通过 [callbackUrl] 指定 WebSocket/Socket 服务地址接收进度事件。
-     *
+     * @param listener     进程内监听器（推荐），在 callbackExecutor 上回调
      * @param callbackUrl  可选的 WebSocket（ws://）或 TCP Socket 地址
      * @param useSocket    true=TCP Socket，false=WebSocket
      * @return 下载器 ID
@@ -77,14 +195,17 @@ class TTHSDownloaderAndroid : AutoCloseable {
         useSocket: Boolean = false,
         isMultiple: Boolean = false,
         showNames: List<String>? = null,
-        ids: List<String>? = null
+        ids: List<String>? = null,
+        listener: DownloadListener? = null
     ): Int {
         val tasksJson = buildTasksJson(urls, savePaths, showNames, ids)
         val useCallbackUrl = callbackUrl.isNotEmpty()
+        val native = listener?.let { ConflatingListener(it, callbackExecutor, gson) }
 
         val id = TTHSDLibraryJNI.startDownload(
             tasksJson, threadCount, chunkSizeMB,
-            useCallbackUrl, callbackUrl, useSocket, isMultiple
+            useCallbackUrl, callbackUrl, useSocket, isMultiple,
+            native, native?.buffer
         )
         if (id == -1) error("[TTHSD] startDownload 失败（JNI 返回 -1）")
         activeIds += id
@@ -92,7 +213,7 @@ class TTHSDownloaderAndroid : AutoCloseable {
     }
 
     /**
-     * 创建下载器（不立即启动）
+     * 创建下载器（不立即启动），参数同 [startDownload]
      */
     fun getDownloader(
         urls: List<String>,
@@ -102,14 +223,17 @@ class TTHSDownloaderAndroid : AutoCloseable {
         callbackUrl: String = "",
         useSocket: Boolean = false,
         showNames: List<String>? = null,
-        ids: List<String>? = null
+        ids: List<String>? = null,
+        listener: DownloadListener? = null
     ): Int {
         val tasksJson = buildTasksJson(urls, savePaths, showNames, ids)
         val useCallbackUrl = callbackUrl.isNotEmpty()
+        val native = listener?.let { ConflatingListener(it, callbackExecutor, gson) }
 
         val id = TTHSDLibraryJNI.getDownloader(
             tasksJson, threadCount, chunkSizeMB,
-            useCallbackUrl, callbackUrl, useSocket
+            useCallbackUrl, callbackUrl, useSocket,
+            native, native?.buffer
         )
         if (id == -1) error("[TTHSD] getDownloader 失败（JNI 返回 -1）")
         activeIds += id
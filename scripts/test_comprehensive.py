@@ -482,7 +482,57 @@ def test_repeated_create_destroy():
     passed = success_count == iterations
     print_result(f"反复创建/销毁 ({iterations} 次)", passed,
                  f"成功 {success_count}/{iterations}")
-    return passed
+
+    # 多线程并发创建/销毁：ID 不重复，销毁后旧 ID 立即失效（调用返回 -1）
+    thread_count = 2000
+    rounds = 5
+    issued_ids = []
+    errors = []
+    lock = threading.Lock()
+    barrier = threading.Barrier(thread_count)
+
+    with TTHSDownloader(DLL_PATH) as dl:
+        dll = dl._dll
+
+        def churn(idx):
+            barrier.wait()
+            mine = []
+            for r in range(rounds):
+                dl_id = dl.get_downloader(
+                    urls=[url],
+                    save_paths=[str(DOWNLOAD_DIR / f"churn_{idx}_{r}.bin")],
+                    thread_count=1,
+                    chunk_size_mb=1,
+                )
+                if dl_id <= 0:
+                    errors.append(f"get_downloader 返回 {dl_id}")
+                    continue
+                mine.append(dl_id)
+                if dll.stop_download(dl_id) != 0:
+                    errors.append(f"stop_download({dl_id}) 失败")
+                if dll.stop_download(dl_id) != -1 or dll.pause_download(dl_id) != -1:
+                    errors.append(f"已销毁的 ID {dl_id} 仍然有效")
+            with lock:
+                issued_ids.extend(mine)
+
+        start = time.time()
+        workers = [threading.Thread(target=churn, args=(i,)) for i in range(thread_count)]
+        for t in workers:
+            t.start()
+        for t in workers:
+            t.join()
+        elapsed = time.time() - start
+
+        stale = [i for i in issued_ids if dll.start_download_id(i) != -1]
+
+    expected = thread_count * rounds
+    unique = len(set(issued_ids))
+    stress_passed = not errors and not stale and unique == len(issued_ids) == expected
+    print_result(f"并发创建/销毁 ({thread_count} 线程 × {rounds} 次)", stress_passed,
+                 f"ID {unique}/{expected} 不重复, 旧 ID 仍有效 {len(stale)} 个, "
+                 f"错误 {len(errors)} 个, 耗时 {elapsed:.2f}s"
+                 + (f", 例: {errors[0]}" if errors else ""))
+    return passed and stress_passed
 
 
 def test_unicode_filename():
@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+"""
+tthsd_remote_decoder.py - TTHSD 远程回调协议参考解码器
+======================================================
+
+远程回调（Socket / WebSocket）支持两种编码：
+
+  JSON（默认，旧版兼容）
+      {"Type":"Update","Msg":"<数据 JSON 字符串>","Downloader":1}
+      Socket 传输时每条以换行分隔；WebSocket 每个文本帧一条。
+
+  MessagePack（回调地址附加 ?format=msgpack 启用）
+      每个事件一条记录：4 字节大端长度 + MessagePack map
+          {"Type": "Update", "Name": ..., "ShowName": ..., "ID": ..., "Downloader": 1, "Data": {...}}
+      Data 中的数值保持原始类型（整数 / float64），不再有嵌套的 JSON 字符串。
+      WebSocket 通过子协议 tthsd.msgpack 协商，每个二进制帧包含一条或多条记录。
+
+两种编码的 Type 都是首字母大写的旧版拼写（Update / Err / EndOne ...），切换编码不影响按类型分发。
+
+同一条 Socket 连接只会使用一种编码：首字节为 '{' 时是 JSON，否则是 MessagePack。
+回调地址相同的下载器共享同一条连接，用 Downloader 字段（下载器 ID）区分消息来源。
+
+用法:
+    # 作为 Socket 回调服务端，打印收到的事件
+    python3 tthsd_remote_decoder.py --listen 127.0.0.1:9000
+
+    # 作为 Unix 域套接字回调服务端（对应 remote_callback_url=unix:///tmp/tthsd.sock，
+    # 抽象命名空间写作 unix://@name）
+    python3 tthsd_remote_decoder.py --listen unix:///tmp/tthsd.sock
+
+    # 解码抓包得到的原始字节流
+    python3 tthsd_remote_decoder.py capture.bin
+
+依赖: Python 3.8+，仅标准库
+"""
+
+import argparse
+import json
+import socket
+import struct
+import sys
+import threading
+
+
+class MsgPackError(ValueError):
+    pass
+
+
+def _unpack(buf, pos):
+    """解码 buf[pos:] 处的一个 MessagePack 值，返回 (value, new_pos)（只实现 TTHSD 用到的类型）"""
+    if pos >= len(buf):
+        raise MsgPackError("unexpected end of data")
+    b = buf[pos]
+    pos += 1
+
+    if b <= 0x7F:
+        return b, pos
+    if b >= 0xE0:
+        return b - 0x100, pos
+    if 0x80 <= b <= 0x8F:
+        return _unpack_map(buf, pos, b & 0x0F)
+    if 0xA0 <= b <= 0xBF:
+        n = b & 0x1F
+        return buf[pos:pos + n].decode("utf-8"), pos + n
+    if b == 0xC0:
+        return None, pos
+    if b == 0xC2:
+        return False, pos
+    if b == 0xC3:
+        return True, pos
+
+    fixed = {
+        0xCA: ">f", 0xCB: ">d",
+        0xCC: ">B", 0xCD: ">H", 0xCE: ">I", 0xCF: ">Q",
+        0xD0: ">b", 0xD1: ">h", 0xD2: ">i", 0xD3: ">q",
+    }
+    if b in fixed:
+        fmt = fixed[b]
+        size = struct.calcsize(fmt)
+        return struct.unpack_from(fmt, buf, pos)[0], pos + size
+
+    if b in (0xD9, 0xDA, 0xDB):
+        fmt = {0xD9: ">B", 0xDA: ">H", 0xDB: ">I"}[b]
+        n = struct.unpack_from(fmt, buf, pos)[0]
+        pos += struct.calcsize(fmt)
+        return buf[pos:pos + n].decode("utf-8"), pos + n
+    if b in (0xDE, 0xDF):
+        fmt = ">H" if b == 0xDE else ">I"
+        n = struct.unpack_from(fmt, buf, pos)[0]
+        return _unpack_map(buf, pos + struct.calcsize(fmt), n)
+
+    raise MsgPackError(f"unsupported type byte 0x{b:02x}")
+
+
+def _unpack_map(buf, pos, n):
+    result = {}
+    for _ in range(n):
+        key, pos = _unpack(buf, pos)
+        value, pos = _unpack(buf, pos)
+        result[key] = value
+    return result, pos
+
+
+def decode_msgpack_records(buf):
+    """从 buf 中解码尽可能多的完整记录，返回 (events, 已消费字节数)"""
+    events = []
+    pos = 0
+    while len(buf) - pos >= 4:
+        (length,) = struct.unpack_from(">I", buf, pos)
+        if len(buf) - pos - 4 < length:
+            break
+        record, end = _unpack(buf, pos + 4)
+        if end != pos + 4 + length:
+            raise MsgPackError("record length mismatch")
+        events.append(record)
+        pos = end
+    return events, pos
+
+
+def decode_json_lines(buf):
+    """解码以换行分隔的旧版 JSON 帧，统一转换成与 MessagePack 记录相同的结构"""
+    events = []
+    pos = 0
+    while True:
+        end = buf.find(b"\n", pos)
+        if end < 0:
+            break
+        line = buf[pos:end].strip()
+        pos = end + 1
+        if not line:
+            continue
+        frame = json.loads(line)
+        event = {"Type": frame.get("Type", ""), "Data": json.loads(frame.get("Msg") or "{}")}
+        if "Downloader" in frame:
+            event["Downloader"] = frame["Downloader"]
+        events.append(event)
+    return events, pos
+
+
+class StreamDecoder:
+    """增量解码器：按到达顺序喂入字节，返回解出的事件"""
+
+    def __init__(self):
+        self._buf = bytearray()
+        self._format = None
+
+    @property
+    def format(self):
+        return self._format
+
+    def feed(self, data):
+        self._buf.extend(data)
+        if self._format is None:
+            if not self._buf:
+                return []
+            self._format = "json" if self._buf[0] == ord("{") else "msgpack"
+
+        if self._format == "json":
+            events, used = decode_json_lines(bytes(self._buf))
+        else:
+            events, used = decode_msgpack_records(bytes(self._buf))
+        del self._buf[:used]
+        return events
+
+
+def _print_events(prefix, events, fmt):
+    for event in events:
+        print(f"{prefix} [{fmt}] {json.dumps(event, ensure_ascii=False)}", flush=True)
+
+
+def _serve_client(conn, addr):
+    decoder = StreamDecoder()
+    prefix = f"{addr[0]}:{addr[1]}" if isinstance(addr, tuple) else "unix"
+    with conn:
+        while True:
+            data = conn.recv(65536)
+            if not data:
+                break
+            _print_events(prefix, decoder.feed(data), decoder.format)
+    print(f"{prefix} 连接关闭", flush=True)
+
+
+def _bind(address):
+    if address.startswith("unix:"):
+        path = address[len("unix:"):]
+        if path.startswith("//"):
+            path = path[2:]
+        server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        # 抽象命名空间：首字节为 NUL
+        server.bind("\0" + path[1:] if path.startswith("@") else path)
+        return server
+
+    host, _, port = address.rpartition(":")
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind((host or "127.0.0.1", int(port)))
+    return server
+
+
+def listen(address):
+    server = _bind(address)
+    server.listen()
+    print(f"监听 {address}，等待 TTHSD 连接...", flush=True)
+    while True:
+        conn, addr = server.accept()
+        threading.Thread(target=_serve_client, args=(conn, addr), daemon=True).start()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="TTHSD 远程回调协议参考解码器")
+    parser.add_argument("file", nargs="?", help="原始字节流文件（与 --listen 二选一）")
+    parser.add_argument("--listen", metavar="ADDRESS", help="作为 Socket 回调服务端运行（HOST:PORT 或 unix:///path）")
+    args = parser.parse_args()
+
+    if args.listen:
+        listen(args.listen)
+    elif args.file:
+        decoder = StreamDecoder()
+        with open(args.file, "rb") as f:
+            _print_events(args.file, decoder.feed(f.read()), decoder.format)
+    else:
+        parser.print_help()
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,95 @@
+//! TTHSD 守护进程：在一个进程内运行下载器，通过本地 Unix 套接字向多个客户端进程提供下载器 API
+//!
+//! 用法: tthsd-daemon [--socket PATH] [--max-connections N] [--max-rate BYTES] [--worker-threads N] [--proxy ADDR [--cache-dir DIR [--cache-max-mb N]]]
+//!
+//! 协议说明见 `tthsd::core::daemon::run`。
+
+#[cfg(unix)]
+fn main() {
+    use tthsd::core::daemon::{self, DaemonOptions};
+    use tthsd::core::proxy::ProxyOptions;
+    use tthsd::core::runtime::{self, RuntimeConfig};
+
+    let mut options = DaemonOptions::default();
+    let mut worker_threads = None;
+    let mut proxy_listen = None;
+    let mut cache_dir = None;
+    let mut cache_max_mb = None;
+
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = |name: &str| {
+            args.next().unwrap_or_else(|| {
+                eprintln!("{} 缺少参数", name);
+                std::process::exit(2);
+            })
+        };
+        match arg.as_str() {
+            "--socket" => options.socket_path = value("--socket").into(),
+            "--max-connections" => options.max_connections = parse_count("--max-connections", &value("--max-connections")),
+            "--max-rate" => options.max_rate_bps = parse_count("--max-rate", &value("--max-rate")) as u64,
+            "--worker-threads" => worker_threads = Some(parse_count("--worker-threads", &value("--worker-threads"))),
+            "--proxy" => proxy_listen = Some(value("--proxy")),
+            "--cache-dir" => cache_dir = Some(std::path::PathBuf::from(value("--cache-dir"))),
+            "--cache-max-mb" => cache_max_mb = Some(parse_count("--cache-max-mb", &value("--cache-max-mb"))),
+            "-h" | "--help" => {
+                println!("用法: tthsd-daemon [--socket PATH] [--max-connections N] [--max-rate BYTES] [--worker-threads N] [--proxy ADDR [--cache-dir DIR [--cache-max-mb N]]]");
+                println!("  --socket PATH          RPC 套接字路径（默认 {}）", daemon::default_socket_path().display());
+                println!("  --max-connections N    所有客户端共用的并发连接预算（默认 {}）", daemon::DEFAULT_MAX_CONNECTIONS);
+                println!("  --max-rate BYTES       所有客户端共用的总限速，字节/秒（默认不限速）");
+                println!("  --worker-threads N     运行时工作线程数（默认 CPU 核数）");
+                println!("  --proxy ADDR           同时运行本机 HTTP 正向代理，例如 127.0.0.1:3128");
+                println!("  --cache-dir DIR        代理的内容缓存目录（默认不缓存）");
+                println!("  --cache-max-mb N       缓存容量上限（MB），超出时淘汰最久未使用的条目（默认不限制）");
+                return;
+            }
+            other => {
+                eprintln!("未知参数: {}（--help 查看用法）", other);
+                std::process::exit(2);
+            }
+        }
+    }
+
+    if cache_max_mb.is_some() && cache_dir.is_none() {
+        eprintln!("--cache-max-mb 需要与 --cache-dir 一起使用");
+        std::process::exit(2);
+    }
+    match (proxy_listen, cache_dir) {
+        (Some(listen), cache_dir) => {
+            let cache_max_bytes = cache_max_mb.map_or(0, |mb| mb as u64 * 1024 * 1024);
+            options.proxy = Some(ProxyOptions { listen, cache_dir, cache_max_bytes, ..Default::default() });
+        }
+        (None, Some(_)) => {
+            eprintln!("--cache-dir 需要与 --proxy 一起使用");
+            std::process::exit(2);
+        }
+        (None, None) => {}
+    }
+
+    if let Err(e) = runtime::init(RuntimeConfig { worker_threads, ..Default::default() }) {
+        eprintln!("{}", e);
+        std::process::exit(1);
+    }
+
+    if let Err(e) = runtime::get().block_on(daemon::run(options)) {
+        eprintln!("守护进程退出: {}", e);
+        std::process::exit(1);
+    }
+}
+
+#[cfg(unix)]
+fn parse_count(name: &str, value: &str) -> usize {
+    match value.parse::<usize>() {
+        Ok(n) if n > 0 => n,
+        _ => {
+            eprintln!("{} 需要正整数，收到 {:?}", name, value);
+            std::process::exit(2);
+        }
+    }
+}
+
+#[cfg(not(unix))]
+fn main() {
+    eprintln!("tthsd-daemon 目前只支持 Unix 平台");
+    std::process::exit(1);
+}
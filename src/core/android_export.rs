@@ -4,43 +4,248 @@
 #[cfg(feature = "android")]
 use jni::JNIEnv;
 #[cfg(feature = "android")]
-use jni::objects::{JClass, JString, JObject, JValue};
+use jni::JavaVM;
 #[cfg(feature = "android")]
-use jni::sys::{jint, jboolean};
+use jni::objects::{GlobalRef, JByteBuffer, JClass, JIntArray, JMethodID, JString, JObject, JValue};
 #[cfg(feature = "android")]
-use std::sync::{Arc, Mutex};
+use jni::signature::{Primitive, ReturnType};
 #[cfg(feature = "android")]
-use std::collections::HashMap;
+use jni::sys::{jint, jboolean};
 #[cfg(feature = "android")]
 use std::ffi::CString;
 #[cfg(feature = "android")]
-use tokio::sync::RwLock;
+use std::sync::Arc;
 
 #[cfg(feature = "android")]
-use super::downloader::{HSDownloader, DownloadTask, DownloadConfig, Event, EventType, UA};
+use super::downloader::{HSDownloader, DownloadTask, DownloadConfig, Event, UA};
+#[cfg(feature = "android")]
+use super::event_data::{write_event_json, EventData, ProgressData};
+#[cfg(feature = "android")]
+use super::event_dispatcher::EventSink;
 #[cfg(feature = "android")]
-use super::send_message::send_message;
+use super::power::{self, PowerProfile};
+#[cfg(feature = "android")]
+use super::registry::{self, Registry};
+#[cfg(feature = "android")]
+use super::runtime::{self, RuntimeConfig, DEFAULT_THREAD_NAME_PREFIX};
 
 #[cfg(feature = "android")]
-lazy_static::lazy_static! {
-    static ref RUNTIME: tokio::runtime::Runtime = tokio::runtime::Builder::new_multi_thread()
-        .enable_all()
-        .build()
-        .unwrap();
+fn get_downloaders() -> &'static Registry<HSDownloader> {
+    static DOWNLOADERS: once_cell::sync::Lazy<Registry<HSDownloader>> =
+        once_cell::sync::Lazy::new(Registry::new);
+    &DOWNLOADERS
 }
 
+/// 第一次注册监听器时缓存，投递线程通过它挂接到 JVM
 #[cfg(feature = "android")]
-fn get_downloaders() -> &'static Mutex<HashMap<i32, Arc<RwLock<HSDownloader>>>> {
-    static DOWNLOADERS: once_cell::sync::Lazy<Mutex<HashMap<i32, Arc<RwLock<HSDownloader>>>>> =
-        once_cell::sync::Lazy::new(|| Mutex::new(HashMap::new()));
-    &DOWNLOADERS
+static JAVA_VM: once_cell::sync::OnceCell<JavaVM> = once_cell::sync::OnceCell::new();
+
+/// 进度缓冲区布局（本机字节序，与 Kotlin 端 `TTHSDLibraryJNI.PROGRESS_*` 偏移一致）
+#[cfg(feature = "android")]
+#[repr(C)]
+struct ProgressSlot {
+    downloaded: i64,
+    total: i64,
+    current_speed_bps: f64,
+    average_speed_bps: f64,
+    peak_speed_bps: f64,
+    elapsed_time: f64,
+}
+
+/// Java 端的 `TTHSDNativeListener`
+///
+/// 进度写入 Kotlin 分配的直接 ByteBuffer 后只调用一次 `onProgress(id)`，不创建任何 Java 对象；
+/// 其他事件（数量很少）以 JSON 字符串交给 `onEvent`。方法 ID 在注册时解析一次，
+/// 投递线程第一次回调时永久挂接到 JVM，之后不再挂接/分离。
+#[cfg(feature = "android")]
+struct JavaListener {
+    downloader_id: i32,
+    listener: GlobalRef,
+    /// 持有 ByteBuffer 的全局引用，保证 `progress` 指向的内存在监听器存活期间有效
+    _buffer: GlobalRef,
+    progress: *mut ProgressSlot,
+    on_progress: JMethodID,
+    on_event: JMethodID,
+}
+
+// progress 只在该下载器的投递线程上写入，Kotlin 端也只在 onProgress 中（同一线程）读取
+#[cfg(feature = "android")]
+unsafe impl Send for JavaListener {}
+#[cfg(feature = "android")]
+unsafe impl Sync for JavaListener {}
+
+#[cfg(feature = "android")]
+impl JavaListener {
+    /// listener 为 null 时返回 Ok(None)；缓冲区不是直接 ByteBuffer 或容量不足时返回 Err
+    fn new(
+        env: &mut JNIEnv,
+        listener: &JObject,
+        buffer: &JByteBuffer,
+    ) -> Result<Option<Self>, String> {
+        if listener.is_null() {
+            return Ok(None);
+        }
+        if buffer.is_null() {
+            return Err("使用监听器时必须提供进度缓冲区".to_string());
+        }
+
+        let vm = env.get_java_vm().map_err(|e| format!("获取 JavaVM 失败: {:?}", e))?;
+        let _ = JAVA_VM.set(vm);
+
+        let capacity = env.get_direct_buffer_capacity(buffer).map_err(|_| "进度缓冲区必须是直接 ByteBuffer".to_string())?;
+        if capacity < std::mem::size_of::<ProgressSlot>() {
+            return Err(format!("进度缓冲区容量不足: {} < {}", capacity, std::mem::size_of::<ProgressSlot>()));
+        }
+        let progress = env.get_direct_buffer_address(buffer).map_err(|_| "进度缓冲区必须是直接 ByteBuffer".to_string())?;
+
+        let class = env.get_object_class(listener).map_err(|e| format!("获取监听器类失败: {:?}", e))?;
+        let on_progress = env
+            .get_method_id(&class, "onProgress", "(I)V")
+            .map_err(|e| format!("监听器缺少 onProgress(int): {:?}", e))?;
+        let on_event = env
+            .get_method_id(&class, "onEvent", "(ILjava/lang/String;Ljava/lang/String;)V")
+            .map_err(|e| format!("监听器缺少 onEvent(int, String, String): {:?}", e))?;
+
+        Ok(Some(JavaListener {
+            // 在注册表分配 ID 时填入
+            downloader_id: 0,
+            listener: env.new_global_ref(listener).map_err(|e| format!("{:?}", e))?,
+            _buffer: env.new_global_ref(buffer).map_err(|e| format!("{:?}", e))?,
+            progress: progress as *mut ProgressSlot,
+            on_progress,
+            on_event,
+        }))
+    }
+
+    fn into_sink(self) -> EventSink {
+        Arc::new(move |event: &Event, data: &EventData| self.deliver(event, data))
+    }
+
+    /// 在投递线程上调用
+    fn deliver(&self, event: &Event, data: &EventData) {
+        let Some(vm) = JAVA_VM.get() else {
+            return;
+        };
+        let mut env = match vm.attach_current_thread_permanently() {
+            Ok(env) => env,
+            Err(e) => {
+                eprintln!("投递线程挂接 JVM 失败: {:?}", e);
+                return;
+            }
+        };
+
+        let result = match data {
+            EventData::Progress(p) => self.deliver_progress(&mut env, p),
+            _ => self.deliver_event(&mut env, event, data),
+        };
+        if result.is_err() || env.exception_check().unwrap_or(false) {
+            // 监听器抛出的异常不能留在投递线程上，否则后续所有 JNI 调用都会失败
+            let _ = env.exception_clear();
+            eprintln!("监听器回调失败 (event {:?})", event.event_type);
+        }
+    }
+
+    fn deliver_progress(&self, env: &mut JNIEnv, p: &ProgressData) -> jni::errors::Result<()> {
+        let slot = ProgressSlot {
+            downloaded: p.downloaded,
+            total: p.total,
+            current_speed_bps: p.current_speed_bps,
+            average_speed_bps: p.average_speed_bps,
+            peak_speed_bps: p.peak_speed_bps,
+            elapsed_time: p.elapsed_time,
+        };
+        // 直接 ByteBuffer 的地址不保证按 8 字节对齐
+        unsafe { std::ptr::write_unaligned(self.progress, slot) };
+
+        let args = [JValue::Int(self.downloader_id).as_jni()];
+        unsafe {
+            env.call_method_unchecked(self.listener.as_obj(), self.on_progress, ReturnType::Primitive(Primitive::Void), &args)?;
+        }
+        Ok(())
+    }
+
+    fn deliver_event(&self, env: &mut JNIEnv, event: &Event, data: &EventData) -> jni::errors::Result<()> {
+        let mut event_json = Vec::with_capacity(128);
+        write_event_json(event, &mut event_json);
+        let mut data_json = Vec::with_capacity(128);
+        data.write_json(&mut data_json);
+
+        let event_str = env.new_string(String::from_utf8_lossy(&event_json))?;
+        let data_str = env.new_string(String::from_utf8_lossy(&data_json))?;
+        let args = [
+            JValue::Int(self.downloader_id).as_jni(),
+            JValue::Object(&event_str).as_jni(),
+            JValue::Object(&data_str).as_jni(),
+        ];
+        let result = unsafe {
+            env.call_method_unchecked(self.listener.as_obj(), self.on_event, ReturnType::Primitive(Primitive::Void), &args)
+        };
+        // 投递线程永久挂接、不会返回 Java，局部引用必须手动释放
+        let _ = env.delete_local_ref(event_str);
+        let _ = env.delete_local_ref(data_str);
+        result.map(|_| ())
+    }
 }
 
+/// JNI 函数: 配置全局运行时（须在创建第一个下载器之前调用）
+///
+/// 参数说明:
+/// - worker_threads: 工作线程数，0 = CPU 核数（手机上通常设为 2）
+/// - max_blocking_threads: 阻塞线程池上限，0 = 默认 512
+/// - thread_name_prefix: 线程名前缀，空字符串 = "tthsd-worker"
+/// - cpu_affinity: 允许运行时线程使用的 CPU 编号（例如只用小核），null = 不限制
+/// - current_thread: 单线程模式
+///
+/// 返回值: 0=成功，-1=运行时已创建或参数无效
 #[cfg(feature = "android")]
-fn get_downloader_id() -> &'static Mutex<i32> {
-    static DOWNLOADER_ID: once_cell::sync::Lazy<Mutex<i32>> =
-        once_cell::sync::Lazy::new(|| Mutex::new(0));
-    &DOWNLOADER_ID
+#[unsafe(no_mangle)]
+pub extern "C" fn Java_com_tthsd_TTHSDLibrary_init<'local>(
+    mut env: jni::JNIEnv<'local>,
+    _class: JClass,
+    worker_threads: jint,
+    max_blocking_threads: jint,
+    thread_name_prefix: JString,
+    cpu_affinity: JIntArray,
+    current_thread: jboolean,
+) -> jint {
+    let thread_name_prefix = match env.get_string(&thread_name_prefix) {
+        Ok(s) => String::from(s),
+        Err(_) => String::new(),
+    };
+
+    let mut cpus = Vec::new();
+    if !cpu_affinity.is_null() {
+        let len = env.get_array_length(&cpu_affinity).unwrap_or(0).max(0);
+        let mut buf = vec![0 as jint; len as usize];
+        if env.get_int_array_region(&cpu_affinity, 0, &mut buf).is_err() {
+            eprintln!("读取 CPU 亲和性数组失败");
+            return -1;
+        }
+        if buf.iter().any(|&cpu| cpu < 0) {
+            return -1;
+        }
+        cpus = buf.into_iter().map(|cpu| cpu as usize).collect();
+    }
+
+    let config = RuntimeConfig {
+        worker_threads: (worker_threads > 0).then_some(worker_threads as usize),
+        max_blocking_threads: (max_blocking_threads > 0).then_some(max_blocking_threads as usize),
+        thread_name_prefix: if thread_name_prefix.is_empty() {
+            DEFAULT_THREAD_NAME_PREFIX.to_string()
+        } else {
+            thread_name_prefix
+        },
+        cpu_affinity: cpus,
+        current_thread: current_thread != 0,
+    };
+
+    match runtime::init(config) {
+        Ok(()) => 0,
+        Err(e) => {
+            eprintln!("{}", e);
+            -1
+        }
+    }
 }
 
 /// JNI 函数: 启动下载任务
@@ -55,6 +260,8 @@ fn get_downloader_id() -> &'static Mutex<i32> {
 /// - callback_url: 回调 URL 地址
 /// - use_socket: 是否使用 Socket
 /// - is_multiple: 是否为多任务下载
+/// - listener: 进程内监听器（`TTHSDNativeListener`），null = 不使用
+/// - progress_buffer: 使用监听器时必填，至少 48 字节的直接 ByteBuffer，进度按固定布局写入其中
 ///
 /// 返回值: 下载器 ID，失败返回 -1
 #[cfg(feature = "android")]
@@ -69,6 +276,8 @@ pub extern "C" fn Java_com_tthsd_TTHSDLibrary_startDownload<'local>(
     callback_url: JString,
     use_socket: jboolean,
     is_multiple: jboolean,
+    listener: JObject,
+    progress_buffer: JByteBuffer,
 ) -> jint {
     // 转换 JSON 字符串
     let tasks_str: String = match env.get_string(&tasks_json) {
@@ -98,65 +307,53 @@ pub extern "C" fn Java_com_tthsd_TTHSDLibrary_startDownload<'local>(
         None
     };
 
-    let config = DownloadConfig {
-        tasks,
-        thread_count: thread_count as usize,
-        chunk_size_mb: chunk_size_mb as usize,
-        callback_func: None,
-        use_callback_url: use_callback_url != jni::sys::JNI_FALSE,
-        callback_url: cb_url,
-        use_socket: if use_socket != jni::sys::JNI_FALSE { Some(true) } else { None },
-        show_name: String::new(),
-        user_agent: UA.to_string(),
+    let listener = match JavaListener::new(&mut env, &listener, &progress_buffer) {
+        Ok(l) => l,
+        Err(e) => {
+            eprintln!("注册监听器失败: {}", e);
+            return -1;
+        }
     };
 
-    let downloader = Arc::new(RwLock::new(HSDownloader::new(config)));
-
-    let downloader_id = {
-        let mut id = get_downloader_id().lock().unwrap();
-        *id += 1;
-        *id
+    // ID 在创建前分配，远程回调消息会带上该 ID 以区分共享连接上的下载器
+    let registered = get_downloaders().insert_with(|downloader_id| {
+        let config = DownloadConfig {
+            tasks: tasks.into(),
+            thread_count: thread_count as usize,
+            chunk_size_mb: chunk_size_mb as usize,
+            callback_func: None,
+            use_callback_url: use_callback_url != jni::sys::JNI_FALSE,
+            callback_url: cb_url,
+            use_socket: if use_socket != jni::sys::JNI_FALSE { Some(true) } else { None },
+            show_name: String::new(),
+            user_agent: UA.to_string(),
+            downloader_id,
+            ..Default::default()
+        };
+        let sink = listener.map(|mut l| {
+            l.downloader_id = downloader_id;
+            l.into_sink()
+        });
+        // 在运行时上下文中创建，远程回调客户端会在运行时上启动写任务
+        let _guard = runtime::get().enter();
+        HSDownloader::with_event_sink(config, sink)
+    });
+    let Some((downloader_id, downloader)) = registered else {
+        eprintln!("下载器数量已达上限 ({})", registry::CAPACITY);
+        return -1;
     };
 
-    {
-        let mut downloaders = get_downloaders().lock().unwrap();
-        downloaders.insert(downloader_id, downloader.clone());
+    let started = runtime::get().block_on(downloader.spawn_run(is_multiple != jni::sys::JNI_FALSE, move |_| {
+        get_downloaders().remove(downloader_id);
+    }));
+    if let Err(e) = started {
+        eprintln!("启动下载失败: {}", e);
     }
 
-    let downloader_clone = downloader.clone();
-    RUNTIME.spawn(async move {
-        let result = if is_multiple != jni::sys::JNI_FALSE {
-            downloader_clone.read().await.start_multiple_downloads().await
-        } else {
-            downloader_clone.read().await.start_download().await
-        };
-
-        if let Err(e) = result {
-            let event = Event {
-                event_type: EventType::Err,
-                name: "错误".to_string(),
-                show_name: String::new(),
-                id: String::new(),
-            };
-
-            let mut data = HashMap::new();
-            data.insert("Error".to_string(), serde_json::Value::String(e.to_string()));
-
-            let config = downloader_clone.read().await.config.clone();
-            let ws_client = downloader_clone.read().await.ws_client.clone();
-            let socket_client = downloader_clone.read().await.socket_client.clone();
-
-            let _ = send_message(event, data, &config, &ws_client, &socket_client).await;
-        }
-
-        let mut downloaders = get_downloaders().lock().unwrap();
-        downloaders.remove(&downloader_id);
-    });
-
     downloader_id
 }
 
-/// JNI 函数: 创建下载器但不立即启动
+/// JNI 函数: 创建下载器但不立即启动（listener / progress_buffer 与 startDownload 相同）
 #[cfg(feature = "android")]
 #[unsafe(no_mangle)]
 pub extern "C" fn Java_com_tthsd_TTHSDLibrary_getDownloader<'local>(
@@ -168,6 +365,8 @@ pub extern "C" fn Java_com_tthsd_TTHSDLibrary_getDownloader<'local>(
     use_callback_url: jboolean,
     callback_url: JString,
     use_socket: jboolean,
+    listener: JObject,
+    progress_buffer: JByteBuffer,
 ) -> jint {
     let tasks_str: String = match env.get_string(&tasks_json) {
         Ok(s) => String::from(s),
@@ -191,31 +390,42 @@ pub extern "C" fn Java_com_tthsd_TTHSDLibrary_getDownloader<'local>(
         None
     };
 
-    let config = DownloadConfig {
-        tasks,
-        thread_count: thread_count as usize,
-        chunk_size_mb: chunk_size_mb as usize,
-        callback_func: None,
-        use_callback_url: use_callback_url != jni::sys::JNI_FALSE,
-        callback_url: cb_url,
-        use_socket: if use_socket != jni::sys::JNI_FALSE { Some(true) } else { None },
-        show_name: String::new(),
-        user_agent: UA.to_string(),
+    let listener = match JavaListener::new(&mut env, &listener, &progress_buffer) {
+        Ok(l) => l,
+        Err(e) => {
+            eprintln!("注册监听器失败: {}", e);
+            return -1;
+        }
     };
 
-    let downloader = Arc::new(RwLock::new(HSDownloader::new(config)));
-
-    let downloader_id = {
-        let mut id = get_downloader_id().lock().unwrap();
-        *id += 1;
-        *id
+    // ID 在创建前分配，远程回调消息会带上该 ID 以区分共享连接上的下载器
+    let registered = get_downloaders().insert_with(|downloader_id| {
+        let config = DownloadConfig {
+            tasks: tasks.into(),
+            thread_count: thread_count as usize,
+            chunk_size_mb: chunk_size_mb as usize,
+            callback_func: None,
+            use_callback_url: use_callback_url != jni::sys::JNI_FALSE,
+            callback_url: cb_url,
+            use_socket: if use_socket != jni::sys::JNI_FALSE { Some(true) } else { None },
+            show_name: String::new(),
+            user_agent: UA.to_string(),
+            downloader_id,
+            ..Default::default()
+        };
+        let sink = listener.map(|mut l| {
+            l.downloader_id = downloader_id;
+            l.into_sink()
+        });
+        // 在运行时上下文中创建，远程回调客户端会在运行时上启动写任务
+        let _guard = runtime::get().enter();
+        HSDownloader::with_event_sink(config, sink)
+    });
+    let Some((downloader_id, _)) = registered else {
+        eprintln!("下载器数量已达上限 ({})", registry::CAPACITY);
+        return -1;
     };
 
-    {
-        let mut downloaders = get_downloaders().lock().unwrap();
-        downloaders.insert(downloader_id, downloader);
-    }
-
     downloader_id
 }
 
@@ -227,38 +437,21 @@ pub extern "C" fn Java_com_tthsd_TTHSDLibrary_startDownloadById<'local>(
     _class: JClass,
     id: jint,
 ) -> jint {
-    let downloaders = get_downloaders().lock().unwrap();
-    let downloader = downloaders.get(&id).cloned();
-    drop(downloaders);
+    let downloader = get_downloaders().get(id);
 
     match downloader {
         Some(d) => {
-            let d_clone = d.clone();
-            RUNTIME.spawn(async move {
-                let result = d_clone.read().await.start_download().await;
-
-                if let Err(e) = result {
-                    let event = Event {
-                        event_type: EventType::Err,
-                        name: "错误".to_string(),
-                        show_name: String::new(),
-                        id: String::new(),
-                    };
-
-                    let mut data = HashMap::new();
-                    data.insert("Error".to_string(), serde_json::Value::String(e.to_string()));
-
-                    let config = d_clone.read().await.config.clone();
-                    let ws_client = d_clone.read().await.ws_client.clone();
-                    let socket_client = d_clone.read().await.socket_client.clone();
-
-                    let _ = send_message(event, data, &config, &ws_client, &socket_client).await;
+            // 同步登记运行：已在运行时返回 -1，不记录结局、也不移出注册表，正在进行的运行不受影响
+            let started = runtime::get().block_on(d.spawn_run(false, move |_| {
+                get_downloaders().remove(id);
+            }));
+            match started {
+                Ok(()) => 0,
+                Err(e) => {
+                    eprintln!("启动下载失败: {}", e);
+                    -1
                 }
-
-                let mut downloaders = get_downloaders().lock().unwrap();
-                downloaders.remove(&id);
-            });
-            0
+            }
         }
         None => -1,
     }
@@ -272,38 +465,21 @@ pub extern "C" fn Java_com_tthsd_TTHSDLibrary_startMultipleDownloadsById<'local>
     _class: JClass,
     id: jint,
 ) -> jint {
-    let downloaders = get_downloaders().lock().unwrap();
-    let downloader = downloaders.get(&id).cloned();
-    drop(downloaders);
+    let downloader = get_downloaders().get(id);
 
     match downloader {
         Some(d) => {
-            let d_clone = d.clone();
-            RUNTIME.spawn(async move {
-                let result = d_clone.read().await.start_multiple_downloads().await;
-
-                if let Err(e) = result {
-                    let event = Event {
-                        event_type: EventType::Err,
-                        name: "错误".to_string(),
-                        show_name: String::new(),
-                        id: String::new(),
-                    };
-
-                    let mut data = HashMap::new();
-                    data.insert("Error".to_string(), serde_json::Value::String(e.to_string()));
-
-                    let config = d_clone.read().await.config.clone();
-                    let ws_client = d_clone.read().await.ws_client.clone();
-                    let socket_client = d_clone.read().await.socket_client.clone();
-
-                    let _ = send_message(event, data, &config, &ws_client, &socket_client).await;
+            // 同步登记运行：已在运行时返回 -1，不记录结局、也不移出注册表，正在进行的运行不受影响
+            let started = runtime::get().block_on(d.spawn_run(true, move |_| {
+                get_downloaders().remove(id);
+            }));
+            match started {
+                Ok(()) => 0,
+                Err(e) => {
+                    eprintln!("启动下载失败: {}", e);
+                    -1
                 }
-
-                let mut downloaders = get_downloaders().lock().unwrap();
-                downloaders.remove(&id);
-            });
-            0
+            }
         }
         None => -1,
     }
@@ -317,14 +493,12 @@ pub extern "C" fn Java_com_tthsd_TTHSDLibrary_pauseDownload<'local>(
     _class: JClass,
     id: jint,
 ) -> jint {
-    let downloaders = get_downloaders().lock().unwrap();
-    let downloader = downloaders.get(&id).cloned();
-    drop(downloaders);
+    let downloader = get_downloaders().get(id);
 
     match downloader {
         Some(d) => {
-            RUNTIME.block_on(async {
-                d.read().await.pause_download().await;
+            runtime::get().block_on(async {
+                d.pause_download().await;
             });
             0
         }
@@ -340,18 +514,20 @@ pub extern "C" fn Java_com_tthsd_TTHSDLibrary_resumeDownload<'local>(
     _class: JClass,
     id: jint,
 ) -> jint {
-    let downloaders = get_downloaders().lock().unwrap();
-    let downloader = downloaders.get(&id).cloned();
-    drop(downloaders);
+    let downloader = get_downloaders().get(id);
 
     match downloader {
         Some(d) => {
-            let result = RUNTIME.block_on(async {
-                d.read().await.resume_download().await
-            });
-            match result {
-                Ok(_) => 0,
-                Err(_) => -1,
+            // 与启动相同：登记失败（仍在运行）时返回 -1，不影响正在进行的运行
+            let resumed = runtime::get().block_on(d.resume_download(move |_| {
+                get_downloaders().remove(id);
+            }));
+            match resumed {
+                Ok(()) => 0,
+                Err(e) => {
+                    eprintln!("恢复下载失败: {}", e);
+                    -1
+                }
             }
         }
         None => -1,
@@ -366,15 +542,15 @@ pub extern "C" fn Java_com_tthsd_TTHSDLibrary_stopDownload<'local>(
     _class: JClass,
     id: jint,
 ) -> jint {
-    let mut downloaders = get_downloaders().lock().unwrap();
-    let downloader = downloaders.remove(&id);
-    drop(downloaders);
+    // 停止（记录结局）之后才移出注册表，等待者不会看到"已移除但没有结局"的中间状态
+    let downloader = get_downloaders().get(id);
 
     match downloader {
         Some(d) => {
-            let result = RUNTIME.block_on(async {
-                d.read().await.stop_download().await
+            let result = runtime::get().block_on(async {
+                d.stop_download().await
             });
+            get_downloaders().remove(id);
             match result {
                 Ok(_) => 0,
                 Err(_) => -1,
@@ -382,4 +558,37 @@ pub extern "C" fn Java_com_tthsd_TTHSDLibrary_stopDownload<'local>(
         }
         None => -1,
     }
-}
\ No newline at end of file
+}
+
+/// JNI 函数: 设置功耗档位（0=普通，1=省电），对所有下载器立即生效
+///
+/// 在调用 init 或创建第一个下载器之前设为省电时，默认运行时只创建两个工作线程。
+///
+/// 返回值: 0=成功，-1=档位无效
+#[cfg(feature = "android")]
+#[unsafe(no_mangle)]
+pub extern "C" fn Java_com_tthsd_TTHSDLibrary_setPowerProfile<'local>(
+    _env: jni::JNIEnv<'local>,
+    _class: JClass,
+    profile: jint,
+) -> jint {
+    match PowerProfile::from_code(profile) {
+        Some(profile) => {
+            power::set_profile(profile);
+            0
+        }
+        None => -1,
+    }
+}
+
+/// JNI 函数: 通知应用进入/离开后台（后台时暂停进度上报，切回前台时立即补报一次）
+#[cfg(feature = "android")]
+#[unsafe(no_mangle)]
+pub extern "C" fn Java_com_tthsd_TTHSDLibrary_setBackground<'local>(
+    _env: jni::JNIEnv<'local>,
+    _class: JClass,
+    background: jboolean,
+) -> jint {
+    power::set_background(background != 0);
+    0
+}
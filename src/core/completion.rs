@@ -0,0 +1,266 @@
+use std::collections::{HashMap, VecDeque};
+use std::sync::atomic::{AtomicBool, AtomicI32, Ordering};
+use std::sync::{Arc, Condvar, Mutex};
+use std::time::{Duration, Instant};
+use once_cell::sync::Lazy;
+use tokio::sync::Notify;
+
+/// 下载器一次运行的结局（数值与 C 头文件中的 `TTHSD_WAIT_*` 一致）
+#[repr(i32)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Outcome {
+    /// 所有任务结束
+    Completed = 0,
+    /// 启动失败或运行中出错
+    Failed = 1,
+    /// 被停止（暂停不是结局）
+    Cancelled = 2,
+}
+
+impl Outcome {
+    fn from_code(code: i32) -> Option<Self> {
+        match code {
+            0 => Some(Outcome::Completed),
+            1 => Some(Outcome::Failed),
+            2 => Some(Outcome::Cancelled),
+            _ => None,
+        }
+    }
+}
+
+/// 等待结果
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum WaitResult {
+    /// 第 index 个下载器已结束
+    Done { index: usize, outcome: Outcome },
+    TimedOut,
+    /// 第 index 个 ID 不存在（从未分配，或结束太久、已不在最近结束记录中）
+    Unknown { index: usize },
+}
+
+const RUNNING: i32 = -1;
+/// 已从注册表移除的下载器保留结局的数量，超出后按结束顺序淘汰
+const RECENT_CAPACITY: usize = 4096;
+
+#[derive(Default)]
+struct Recent {
+    outcomes: HashMap<i32, Outcome>,
+    order: VecDeque<i32>,
+}
+
+/// 所有下载器共用一个条件变量：结束事件很少，唤醒后各等待者自行检查关心的 ID
+struct Board {
+    recent: Mutex<Recent>,
+    cond: Condvar,
+}
+
+static BOARD: Lazy<Board> = Lazy::new(|| Board {
+    recent: Mutex::new(Recent::default()),
+    cond: Condvar::new(),
+});
+
+/// 单个下载器的完成状态（随 `HSDownloader` 创建）
+///
+/// 结局只记录一次（第一次 `finish` 生效），记录后同时唤醒阻塞等待者（条件变量）与异步等待者（`Notify`）。
+/// 暂停不记录结局；新一次运行开始时 `reset` 清除上一次的记录。
+/// 下载器被移出注册表之前总是先记录结局，因此移除后仍可通过 [`recent_outcome`] 查到。
+#[derive(Debug)]
+pub struct Completion {
+    id: i32,
+    outcome: AtomicI32,
+    /// 本次运行是否被暂停/停止，被取消的运行结束时不记录结局
+    cancelled: AtomicBool,
+    notify: Notify,
+}
+
+impl Completion {
+    pub fn new(id: i32) -> Self {
+        Completion {
+            id,
+            outcome: AtomicI32::new(RUNNING),
+            cancelled: AtomicBool::new(false),
+            notify: Notify::new(),
+        }
+    }
+
+    pub fn outcome(&self) -> Option<Outcome> {
+        Outcome::from_code(self.outcome.load(Ordering::Acquire))
+    }
+
+    pub fn set_cancelled(&self, cancelled: bool) {
+        self.cancelled.store(cancelled, Ordering::Release);
+    }
+
+    pub fn is_cancelled(&self) -> bool {
+        self.cancelled.load(Ordering::Acquire)
+    }
+
+    /// 开始新一次运行：结局恢复为运行中，清除取消标记与最近结束记录
+    pub fn reset(&self) {
+        self.cancelled.store(false, Ordering::Release);
+        if self.outcome.swap(RUNNING, Ordering::AcqRel) != RUNNING && self.id > 0 {
+            let mut recent = BOARD.recent.lock().unwrap();
+            if recent.outcomes.remove(&self.id).is_some() {
+                recent.order.retain(|&id| id != self.id);
+            }
+        }
+    }
+
+    /// 记录结局并唤醒所有等待者；已记录过时忽略
+    pub fn finish(&self, outcome: Outcome) {
+        if self
+            .outcome
+            .compare_exchange(RUNNING, outcome as i32, Ordering::AcqRel, Ordering::Acquire)
+            .is_err()
+        {
+            return;
+        }
+
+        if self.id > 0 {
+            let mut recent = BOARD.recent.lock().unwrap();
+            if recent.outcomes.insert(self.id, outcome).is_none() {
+                recent.order.push_back(self.id);
+            }
+            while recent.order.len() > RECENT_CAPACITY {
+                if let Some(old) = recent.order.pop_front() {
+                    recent.outcomes.remove(&old);
+                }
+            }
+        } else {
+            // 与等待者的检查同步，避免检查与进入等待之间错过通知
+            drop(BOARD.recent.lock().unwrap());
+        }
+        BOARD.cond.notify_all();
+        self.notify.notify_waiters();
+    }
+
+    /// 异步等待结局
+    pub async fn wait(&self) -> Outcome {
+        loop {
+            let notified = self.notify.notified();
+            tokio::pin!(notified);
+            notified.as_mut().enable();
+            if let Some(outcome) = self.outcome() {
+                return outcome;
+            }
+            notified.await;
+        }
+    }
+}
+
+/// 异步等待任意一个结束，返回 (下标, 结局)；多个已结束时返回下标最小的一个。`completions` 不能为空
+pub async fn wait_any_async(completions: &[Arc<Completion>]) -> (usize, Outcome) {
+    if let Some(done) = completions.iter().enumerate().find_map(|(i, c)| c.outcome().map(|o| (i, o))) {
+        return done;
+    }
+    let waits = completions.iter().enumerate().map(|(i, c)| Box::pin(async move { (i, c.wait().await) }));
+    futures::future::select_all(waits).await.0
+}
+
+/// 已结束并移出注册表的下载器的结局
+pub fn recent_outcome(id: i32) -> Option<Outcome> {
+    BOARD.recent.lock().unwrap().outcomes.get(&id).copied()
+}
+
+/// 阻塞等待任意一个下载器结束，timeout 为 None 时无限等待
+///
+/// `targets` 为 (ID, 仍在注册表中的下载器的完成状态)；完成状态为 None 时按最近结束记录判断。
+/// 多个已结束时返回下标最小的一个。
+pub fn wait_any(targets: &[(i32, Option<Arc<Completion>>)], timeout: Option<Duration>) -> WaitResult {
+    let deadline = timeout.map(|t| Instant::now() + t);
+    let mut recent = BOARD.recent.lock().unwrap();
+    loop {
+        for (index, (id, completion)) in targets.iter().enumerate() {
+            let outcome = match completion {
+                Some(c) => c.outcome(),
+                None => match recent.outcomes.get(id) {
+                    Some(&outcome) => Some(outcome),
+                    None => return WaitResult::Unknown { index },
+                },
+            };
+            if let Some(outcome) = outcome {
+                return WaitResult::Done { index, outcome };
+            }
+        }
+
+        recent = match deadline {
+            None => BOARD.cond.wait(recent).unwrap(),
+            Some(deadline) => {
+                let now = Instant::now();
+                if now >= deadline {
+                    return WaitResult::TimedOut;
+                }
+                BOARD.cond.wait_timeout(recent, deadline - now).unwrap().0
+            }
+        };
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// 结束记录是进程级的，各测试使用互不重叠的 ID 段
+    fn completion(id: i32) -> Arc<Completion> {
+        Arc::new(Completion::new(id))
+    }
+
+    #[test]
+    fn outcome_is_recorded_once() {
+        let c = completion(1_000_001);
+        assert_eq!(c.outcome(), None);
+        c.finish(Outcome::Failed);
+        c.finish(Outcome::Completed);
+        assert_eq!(c.outcome(), Some(Outcome::Failed));
+        assert_eq!(recent_outcome(1_000_001), Some(Outcome::Failed));
+    }
+
+    #[test]
+    fn wait_any_times_out_and_wakes_on_finish() {
+        let a = completion(1_100_001);
+        let b = completion(1_100_002);
+        let targets = [(1_100_001, Some(a.clone())), (1_100_002, Some(b.clone()))];
+
+        let started = Instant::now();
+        assert_eq!(wait_any(&targets, Some(Duration::from_millis(50))), WaitResult::TimedOut);
+        assert!(started.elapsed() >= Duration::from_millis(50));
+
+        let finisher = std::thread::spawn(move || {
+            std::thread::sleep(Duration::from_millis(30));
+            b.finish(Outcome::Cancelled);
+        });
+        assert_eq!(wait_any(&targets, None), WaitResult::Done { index: 1, outcome: Outcome::Cancelled });
+        finisher.join().unwrap();
+
+        // 已移出注册表的 ID 按最近结束记录判断，不认识的 ID 直接报告
+        let removed = [(1_100_002, None), (1_100_003, None)];
+        assert_eq!(wait_any(&removed, Some(Duration::ZERO)), WaitResult::Done { index: 0, outcome: Outcome::Cancelled });
+        assert_eq!(wait_any(&removed[1..], Some(Duration::ZERO)), WaitResult::Unknown { index: 0 });
+    }
+
+    #[tokio::test]
+    async fn wait_any_async_returns_first_finished() {
+        let a = completion(1_200_001);
+        let b = completion(1_200_002);
+        let waiter = tokio::spawn({
+            let completions = vec![a.clone(), b.clone()];
+            async move { wait_any_async(&completions).await }
+        });
+        tokio::time::sleep(Duration::from_millis(20)).await;
+        assert!(!waiter.is_finished());
+
+        a.finish(Outcome::Completed);
+        assert_eq!(waiter.await.unwrap(), (0, Outcome::Completed));
+        assert_eq!(a.wait().await, Outcome::Completed);
+    }
+
+    #[test]
+    fn recent_outcomes_evict_oldest_first() {
+        let base = 2_000_000;
+        for i in 0..=RECENT_CAPACITY as i32 {
+            completion(base + i).finish(Outcome::Completed);
+        }
+        assert_eq!(recent_outcome(base), None);
+        assert_eq!(recent_outcome(base + RECENT_CAPACITY as i32), Some(Outcome::Completed));
+    }
+}
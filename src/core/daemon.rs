@@ -0,0 +1,589 @@
+use std::collections::HashSet;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+use serde::Deserialize;
+use serde_json::{json, Value};
+use tokio::io::{AsyncBufReadExt, AsyncWriteExt, BufReader};
+use tokio::net::{UnixListener, UnixStream};
+use tokio::sync::{mpsc, Semaphore};
+use super::downloader::{ConfigUpdate, DownloadConfig, DownloadTask, Event, EventType, HSDownloader, EVENT_MASK_ALL, UA};
+use super::completion::{self, Completion, Outcome};
+use super::event_data::{write_event_json, EventData};
+use super::event_dispatcher::{EventDispatcher, EventSink, DEFAULT_CALLBACK_BUDGET_MS};
+use super::flight_recorder::FlightRecorder;
+use super::proxy::{ProxyOptions, ProxyServer};
+use super::rate_limiter::RateLimiter;
+use super::registry::{self, Registry};
+
+/// 默认的全局并发连接预算（所有客户端的所有下载器共用）
+pub const DEFAULT_MAX_CONNECTIONS: usize = 64;
+/// 每个客户端连接的待发送消息上限（按条数计），满时丢弃进度事件
+const CLIENT_QUEUE_SIZE: usize = 4096;
+
+/// 守护进程参数
+#[derive(Debug, Clone)]
+pub struct DaemonOptions {
+    pub socket_path: PathBuf,
+    pub max_connections: usize,
+    /// 所有客户端的所有下载器（以及代理）共用的总限速，字节/秒，0 = 不限速
+    pub max_rate_bps: u64,
+    /// 同时运行本机 HTTP 正向代理（与下载器共用并发连接预算），None = 不启用
+    pub proxy: Option<ProxyOptions>,
+}
+
+impl Default for DaemonOptions {
+    fn default() -> Self {
+        DaemonOptions {
+            socket_path: default_socket_path(),
+            max_connections: DEFAULT_MAX_CONNECTIONS,
+            max_rate_bps: 0,
+            proxy: None,
+        }
+    }
+}
+
+/// 默认 RPC 套接字路径：`$TTHSD_SOCKET`，否则 `$XDG_RUNTIME_DIR/tthsd.sock`，否则临时目录下的 `tthsd.sock`
+pub fn default_socket_path() -> PathBuf {
+    if let Some(path) = std::env::var_os("TTHSD_SOCKET").filter(|p| !p.is_empty()) {
+        return PathBuf::from(path);
+    }
+    match std::env::var_os("XDG_RUNTIME_DIR").filter(|p| !p.is_empty()) {
+        Some(dir) => PathBuf::from(dir).join("tthsd.sock"),
+        None => std::env::temp_dir().join("tthsd.sock"),
+    }
+}
+
+#[derive(Deserialize)]
+struct RpcRequest {
+    #[serde(default)]
+    id: Value,
+    method: String,
+    #[serde(default)]
+    params: Value,
+}
+
+#[derive(Deserialize)]
+struct CreateParams {
+    tasks: Vec<DownloadTask>,
+    #[serde(default)]
+    thread_count: Option<usize>,
+    #[serde(default)]
+    chunk_size_mb: Option<usize>,
+    #[serde(default)]
+    user_agent: Option<String>,
+    #[serde(default)]
+    event_mask: Option<u32>,
+    /// 仅 `start_download`：是否并行下载多个任务
+    #[serde(default)]
+    is_multiple: bool,
+}
+
+#[derive(Deserialize)]
+struct IdParams {
+    id: i32,
+}
+
+#[derive(Deserialize)]
+struct EventMaskParams {
+    id: i32,
+    mask: u32,
+}
+
+#[derive(Deserialize)]
+struct UpdateConfigParams {
+    id: i32,
+    #[serde(default)]
+    thread_count: Option<usize>,
+    #[serde(default)]
+    chunk_size_mb: Option<usize>,
+    #[serde(default)]
+    rate_limit_bps: Option<u64>,
+    #[serde(default)]
+    progress_interval_ms: Option<u64>,
+    #[serde(default)]
+    user_agent: Option<String>,
+}
+
+#[derive(Deserialize)]
+struct WaitParams {
+    ids: Vec<i32>,
+    /// 省略 = 无限等待
+    #[serde(default)]
+    timeout_ms: Option<u64>,
+}
+
+#[derive(Deserialize)]
+struct RateParams {
+    rate_bps: u64,
+}
+
+#[derive(Deserialize)]
+struct DumpParams {
+    id: i32,
+    path: PathBuf,
+}
+
+enum WaitTarget {
+    /// 已有下载器结束，直接回复
+    Done(usize, Outcome),
+    /// 完成状态、各自的事件投递器、超时（毫秒）
+    Pending(Vec<Arc<Completion>>, Vec<Option<Arc<EventDispatcher>>>, Option<u64>),
+}
+
+struct DaemonState {
+    downloaders: Registry<HSDownloader>,
+    budget: Arc<Semaphore>,
+    max_connections: usize,
+    /// 守护进程范围的总限速，与各下载器自己的限速同时生效
+    rate_limiter: Arc<RateLimiter>,
+    clients: AtomicUsize,
+    proxy: Option<Arc<ProxyServer>>,
+}
+
+/// 运行守护进程，直到收到 SIGINT / SIGTERM
+///
+/// 守护进程在一个进程内持有下载器，多个客户端进程通过本地 Unix 套接字调用下载器 API，
+/// 因而共享同一个运行时、全局性能监控、远程回调连接、并发连接预算以及总限速（`max_rate_bps`）。
+///
+/// 协议为换行分隔的 JSON：
+/// - 请求 `{"id":1,"method":"get_downloader","params":{...}}`
+/// - 响应 `{"id":1,"result":...}` 或 `{"id":1,"error":"..."}`
+/// - 事件 `{"downloader":1,"event":{...},"data":{...}}`，只发给创建该下载器的连接
+///
+/// 方法：`ping`、`get_downloader`、`start_download`（创建并启动）、`start_download_id`、
+/// `start_multiple_downloads_id`、`pause_download`、`resume_download`、`stop_download`、
+/// `set_event_mask`、`update_config`、`get_stats`、`dump_flight_recorder`、`wait`、`daemon_stats`、
+/// `set_max_rate`（`{"rate_bps":N}`，修改总限速，0 = 不限速）。
+/// 客户端断开时，它创建的下载器会被停止并释放。
+///
+/// 设置了 `options.proxy` 时同时运行本机 HTTP 正向代理（见 [`ProxyServer`]）。
+pub async fn run(options: DaemonOptions) -> std::io::Result<()> {
+    let budget = Arc::new(Semaphore::new(options.max_connections.max(1)));
+    let rate_limiter = Arc::new(RateLimiter::new(options.max_rate_bps));
+    let proxy = match options.proxy.clone() {
+        Some(proxy_options) => {
+            let proxy_options = ProxyOptions {
+                connection_budget: Some(budget.clone()),
+                rate_limiter: Some(rate_limiter.clone()),
+                ..proxy_options
+            };
+            let server = ProxyServer::new(proxy_options).map_err(|e| std::io::Error::other(e.to_string()))?;
+            Some(server)
+        }
+        None => None,
+    };
+
+    let listener = bind(&options.socket_path).await?;
+    let state = Arc::new(DaemonState {
+        downloaders: Registry::new(),
+        budget,
+        max_connections: options.max_connections.max(1),
+        rate_limiter,
+        clients: AtomicUsize::new(0),
+        proxy: proxy.clone(),
+    });
+    eprintln!(
+        "TTHSD 守护进程已启动: {}（并发连接预算 {}）",
+        options.socket_path.display(),
+        state.max_connections
+    );
+
+    if let Some(server) = proxy {
+        tokio::spawn(async move {
+            if let Err(e) = server.run().await {
+                eprintln!("代理退出: {:?}", e);
+            }
+        });
+    }
+
+    let mut terminate = tokio::signal::unix::signal(tokio::signal::unix::SignalKind::terminate())?;
+    let result = loop {
+        tokio::select! {
+            accepted = listener.accept() => match accepted {
+                Ok((stream, _)) => {
+                    tokio::spawn(handle_client(state.clone(), stream));
+                }
+                Err(e) => eprintln!("接受客户端连接失败: {:?}", e),
+            },
+            signal = tokio::signal::ctrl_c() => break signal,
+            _ = terminate.recv() => break Ok(()),
+        }
+    };
+
+    let _ = std::fs::remove_file(&options.socket_path);
+    result
+}
+
+/// 绑定套接字；残留的套接字文件（上次异常退出）会被清理，已有实例在运行时返回错误
+async fn bind(path: &Path) -> std::io::Result<UnixListener> {
+    if path.exists() {
+        if UnixStream::connect(path).await.is_ok() {
+            return Err(std::io::Error::new(
+                std::io::ErrorKind::AddrInUse,
+                format!("已有守护进程在监听 {}", path.display()),
+            ));
+        }
+        std::fs::remove_file(path)?;
+    }
+
+    // 先在只有当前用户能进入的临时目录（0700）里绑定并收紧为 0600，再原子地改名到目标路径：
+    // 套接字从出现在目标路径起就只允许当前用户连接。不改 umask，它是进程级的，会影响其他线程同时创建的文件
+    let parent = match path.parent() {
+        Some(p) if !p.as_os_str().is_empty() => p,
+        _ => Path::new("."),
+    };
+    let staging_dir = parent.join(format!(".tthsd-bind-{}", std::process::id()));
+    if staging_dir.exists() {
+        std::fs::remove_dir_all(&staging_dir)?;
+    }
+    {
+        use std::os::unix::fs::DirBuilderExt;
+        std::fs::DirBuilder::new().mode(0o700).create(&staging_dir)?;
+    }
+
+    let staging = staging_dir.join("sock");
+    let result = (|| {
+        use std::os::unix::fs::PermissionsExt;
+        let listener = UnixListener::bind(&staging)?;
+        std::fs::set_permissions(&staging, std::fs::Permissions::from_mode(0o600))?;
+        std::fs::rename(&staging, path)?;
+        Ok(listener)
+    })();
+    let _ = std::fs::remove_dir_all(&staging_dir);
+    result
+}
+
+async fn handle_client(state: Arc<DaemonState>, stream: UnixStream) {
+    state.clients.fetch_add(1, Ordering::Relaxed);
+    let (read_half, mut write_half) = stream.into_split();
+    let (tx, mut rx) = mpsc::channel::<Vec<u8>>(CLIENT_QUEUE_SIZE);
+
+    // 响应与事件共用一个写任务，保证每行完整写出
+    tokio::spawn(async move {
+        while let Some(line) = rx.recv().await {
+            if write_half.write_all(&line).await.is_err() {
+                break;
+            }
+        }
+    });
+
+    let mut owned = HashSet::new();
+    let mut lines = BufReader::new(read_half).lines();
+    while let Ok(Some(line)) = lines.next_line().await {
+        if line.trim().is_empty() {
+            continue;
+        }
+
+        let response = match serde_json::from_str::<RpcRequest>(&line) {
+            Ok(request) if request.method == "wait" => {
+                // 等待可能持续很久，单独回复，不阻塞本连接上的其他请求
+                state.spawn_wait(request, tx.clone(), &owned);
+                continue;
+            }
+            Ok(request) => {
+                let id = request.id.clone();
+                match state.clone().handle(request, &tx, &mut owned).await {
+                    Ok(result) => json!({ "id": id, "result": result }),
+                    Err(error) => json!({ "id": id, "error": error }),
+                }
+            }
+            Err(e) => json!({ "id": Value::Null, "error": format!("无效请求: {}", e) }),
+        };
+
+        let mut out = serde_json::to_vec(&response).unwrap_or_default();
+        out.push(b'\n');
+        if tx.send(out).await.is_err() {
+            break;
+        }
+    }
+
+    // 客户端断开：先停止（记录结局）再移出注册表，与 `stop_download` 的顺序一致
+    for id in owned {
+        let downloader = state.downloaders.get(id);
+        if let Some(d) = downloader {
+            let _ = d.stop_download().await;
+        }
+        state.downloaders.remove(id);
+    }
+    state.clients.fetch_sub(1, Ordering::Relaxed);
+}
+
+impl DaemonState {
+    async fn handle(
+        self: Arc<Self>,
+        request: RpcRequest,
+        tx: &mpsc::Sender<Vec<u8>>,
+        owned: &mut HashSet<i32>,
+    ) -> Result<Value, String> {
+        let params = request.params;
+        match request.method.as_str() {
+            "ping" => Ok(json!({ "version": env!("CARGO_PKG_VERSION") })),
+            "get_downloader" | "start_download" => {
+                let params: CreateParams = parse_params(params)?;
+                let is_multiple = params.is_multiple;
+                let (id, downloader) = self.create(params, tx)?;
+                owned.insert(id);
+                if request.method == "start_download" {
+                    self.clone().spawn_start(id, downloader, is_multiple).await?;
+                }
+                Ok(json!(id))
+            }
+            "start_download_id" | "start_multiple_downloads_id" => {
+                let IdParams { id } = parse_params(params)?;
+                let downloader = self.owned(owned, id)?;
+                self.clone().spawn_start(id, downloader, request.method == "start_multiple_downloads_id").await?;
+                Ok(json!(0))
+            }
+            "pause_download" => {
+                let IdParams { id } = parse_params(params)?;
+                self.owned(owned, id)?.pause_download().await;
+                Ok(json!(0))
+            }
+            "resume_download" => {
+                let IdParams { id } = parse_params(params)?;
+                let downloader = self.owned(owned, id)?;
+                let state = self.clone();
+                downloader
+                    .resume_download(move |_| {
+                        state.downloaders.remove(id);
+                    })
+                    .await
+                    .map(|_| json!(0))
+                    .map_err(|e| e.to_string())
+            }
+            "stop_download" => {
+                let IdParams { id } = parse_params(params)?;
+                let downloader = self.owned(owned, id)?;
+                // 停止（记录结局）之后才移出注册表；ID 留在 owned 中，之后仍可 wait 到结局
+                let result = downloader.stop_download().await;
+                self.downloaders.remove(id);
+                result.map(|_| json!(0)).map_err(|e| e.to_string())
+            }
+            "set_event_mask" => {
+                let EventMaskParams { id, mask } = parse_params(params)?;
+                let downloader = self.owned(owned, id)?;
+                downloader.update_config(|cfg| cfg.event_mask = mask & EVENT_MASK_ALL);
+                Ok(json!(0))
+            }
+            "update_config" => {
+                let p: UpdateConfigParams = parse_params(params)?;
+                let downloader = self.owned(owned, p.id)?;
+                let update = ConfigUpdate {
+                    thread_count: p.thread_count,
+                    chunk_size_mb: p.chunk_size_mb,
+                    rate_limit_bps: p.rate_limit_bps,
+                    progress_interval_ms: p.progress_interval_ms,
+                    user_agent: p.user_agent,
+                };
+                downloader.apply_config_update(&update)?;
+                Ok(json!(0))
+            }
+            "get_stats" => {
+                let IdParams { id } = parse_params(params)?;
+                let downloader = self.owned(owned, id)?;
+                let stats = downloader.get_stats().await;
+                Ok(json!(stats))
+            }
+            "dump_flight_recorder" => {
+                let DumpParams { id, path } = parse_params(params)?;
+                let downloader = self.owned(owned, id)?;
+                let result = downloader.dump_flight_recorder(&path).await;
+                result.map(|_| json!(0)).map_err(|e| e.to_string())
+            }
+            "set_max_rate" => {
+                let RateParams { rate_bps } = parse_params(params)?;
+                self.rate_limiter.set_rate(rate_bps);
+                Ok(json!(0))
+            }
+            "daemon_stats" => Ok(self.stats()),
+            other => Err(format!("未知方法: {}", other)),
+        }
+    }
+
+    /// 只允许操作本连接创建的下载器
+    fn owned(&self, owned: &HashSet<i32>, id: i32) -> Result<Arc<HSDownloader>, String> {
+        if !owned.contains(&id) {
+            return Err(format!("下载器 {} 不存在", id));
+        }
+        self.downloaders
+            .get(id)
+            .ok_or_else(|| format!("下载器 {} 不存在", id))
+    }
+
+    fn create(&self, params: CreateParams, tx: &mpsc::Sender<Vec<u8>>) -> Result<(i32, Arc<HSDownloader>), String> {
+        if params.tasks.is_empty() {
+            return Err("任务列表为空".to_string());
+        }
+
+        self.downloaders
+            .insert_with(|downloader_id| {
+                let recorder = Arc::new(FlightRecorder::new());
+                let dispatcher = EventDispatcher::with_event_sink(
+                    client_sink(downloader_id, tx.clone()),
+                    DEFAULT_CALLBACK_BUDGET_MS,
+                    recorder.clone(),
+                );
+
+                let defaults = DownloadConfig::default();
+                let config = DownloadConfig {
+                    tasks: params.tasks.into(),
+                    thread_count: params.thread_count.filter(|n| *n > 0).unwrap_or(defaults.thread_count),
+                    chunk_size_mb: params.chunk_size_mb.filter(|n| *n > 0).unwrap_or(defaults.chunk_size_mb),
+                    user_agent: params.user_agent.unwrap_or_else(|| UA.to_string()),
+                    event_mask: params.event_mask.map_or(EVENT_MASK_ALL, |m| m & EVENT_MASK_ALL),
+                    event_dispatcher: Some(Arc::new(dispatcher)),
+                    flight_recorder: recorder,
+                    downloader_id,
+                    connection_budget: Some(self.budget.clone()),
+                    shared_rate_limiter: Some(self.rate_limiter.clone()),
+                    ..defaults
+                };
+                HSDownloader::new(config)
+            })
+            .ok_or_else(|| format!("下载器数量已达上限 ({})", registry::CAPACITY))
+    }
+
+    /// 启动一次运行；下载器已在运行时返回错误，不记录结局也不移出注册表
+    async fn spawn_start(self: Arc<Self>, id: i32, downloader: Arc<HSDownloader>, multiple: bool) -> Result<(), String> {
+        downloader
+            .spawn_run(multiple, move |_| {
+                self.downloaders.remove(id);
+            })
+            .await
+            .map_err(|e| e.to_string())
+    }
+
+    /// `wait`：等待 ids 中任意一个下载器结束，结果为 `{"index":下标,"outcome":0/1/2}`，超时为 `{"index":-1,"outcome":-2}`
+    fn spawn_wait(&self, request: RpcRequest, tx: mpsc::Sender<Vec<u8>>, owned: &HashSet<i32>) {
+        let request_id = request.id;
+        let targets = parse_params::<WaitParams>(request.params).and_then(|p| {
+            if p.ids.is_empty() {
+                return Err("ids 为空".to_string());
+            }
+            let mut completions = Vec::with_capacity(p.ids.len());
+            let mut dispatchers = Vec::with_capacity(p.ids.len());
+            for (index, &id) in p.ids.iter().enumerate() {
+                if !owned.contains(&id) {
+                    return Err(format!("下载器 {} 不存在", id));
+                }
+                match self.downloaders.get(id) {
+                    Some(d) => {
+                        completions.push(d.completion.clone());
+                        dispatchers.push(d.config.load().event_dispatcher.clone());
+                    }
+                    // 已移出注册表的下载器总是先记录了结局
+                    None => match completion::recent_outcome(id) {
+                        Some(outcome) => return Ok(WaitTarget::Done(index, outcome)),
+                        None => return Err(format!("下载器 {} 不存在", id)),
+                    },
+                }
+            }
+            Ok(WaitTarget::Pending(completions, dispatchers, p.timeout_ms))
+        });
+
+        tokio::spawn(async move {
+            // 经由结束的下载器的投递队列回复：客户端收到响应时，该下载器结束前的事件都已送达
+            let mut via = None;
+            let result = match targets {
+                Ok(WaitTarget::Done(index, outcome)) => Ok((index as i64, outcome as i32)),
+                Ok(WaitTarget::Pending(completions, mut dispatchers, timeout_ms)) => {
+                    let wait = completion::wait_any_async(&completions);
+                    let done = match timeout_ms {
+                        Some(ms) => tokio::time::timeout(std::time::Duration::from_millis(ms), wait).await.ok(),
+                        None => Some(wait.await),
+                    };
+                    if let Some((index, _)) = done {
+                        via = dispatchers[index].take();
+                    }
+                    Ok(done.map_or((-1, -2), |(index, outcome)| (index as i64, outcome as i32)))
+                }
+                Err(error) => Err(error),
+            };
+            let response = match result {
+                Ok((index, outcome)) => json!({ "id": request_id, "result": { "index": index, "outcome": outcome } }),
+                Err(error) => json!({ "id": request_id, "error": error }),
+            };
+            let mut out = serde_json::to_vec(&response).unwrap_or_default();
+            out.push(b'\n');
+            match via {
+                // 投递线程不在运行时上，可以同步等待
+                Some(dispatcher) => dispatcher.dispatch_call(Box::new(move || {
+                    let _ = tx.blocking_send(out);
+                })),
+                None => {
+                    let _ = tx.send(out).await;
+                }
+            }
+        });
+    }
+
+    fn stats(&self) -> Value {
+        let available = self.budget.available_permits();
+        let mut rate_limit = std::collections::HashMap::new();
+        self.rate_limiter.write_stats(&mut rate_limit);
+        json!({
+            "clients": self.clients.load(Ordering::Relaxed),
+            "downloaders": self.downloaders.len(),
+            "max_connections": self.max_connections,
+            "active_connections": self.max_connections.saturating_sub(available),
+            "rate_limit": rate_limit,
+            "proxy": self.proxy.as_ref().map(|p| p.get_stats()),
+        })
+    }
+}
+
+fn parse_params<T: for<'de> Deserialize<'de>>(params: Value) -> Result<T, String> {
+    serde_json::from_value(params).map_err(|e| format!("参数无效: {}", e))
+}
+
+/// 把下载器事件编码为一行 JSON 发给所属客户端；积压时丢弃进度事件，控制类事件在投递线程上等待
+fn client_sink(downloader_id: i32, tx: mpsc::Sender<Vec<u8>>) -> EventSink {
+    Arc::new(move |event: &Event, data: &EventData| {
+        let mut line = Vec::with_capacity(256);
+        line.extend_from_slice(b"{\"downloader\":");
+        line.extend_from_slice(downloader_id.to_string().as_bytes());
+        line.extend_from_slice(b",\"event\":");
+        write_event_json(event, &mut line);
+        line.extend_from_slice(b",\"data\":");
+        data.write_json(&mut line);
+        line.extend_from_slice(b"}\n");
+
+        match tx.try_send(line) {
+            Ok(()) | Err(mpsc::error::TrySendError::Closed(_)) => {}
+            Err(mpsc::error::TrySendError::Full(line)) => {
+                if event.event_type != EventType::Update {
+                    // 投递线程不在运行时上，可以同步等待
+                    let _ = tx.blocking_send(line);
+                }
+            }
+        }
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::os::unix::fs::PermissionsExt;
+
+    #[tokio::test]
+    async fn bind_creates_owner_only_socket() {
+        let dir = std::env::temp_dir().join(format!("tthsd-daemon-bind-test-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        let path = dir.join("tthsd.sock");
+
+        let listener = bind(&path).await.unwrap();
+        let mode = std::fs::metadata(&path).unwrap().permissions().mode();
+        assert_eq!(mode & 0o777, 0o600);
+        // 临时目录已清理，只留下目标套接字
+        assert_eq!(std::fs::read_dir(&dir).unwrap().count(), 1);
+
+        let (accepted, connected) = tokio::join!(listener.accept(), UnixStream::connect(&path));
+        accepted.unwrap();
+        connected.unwrap();
+
+        // 套接字仍在监听时再次绑定会失败，而不是顶替它
+        assert!(bind(&path).await.is_err());
+        let _ = std::fs::remove_dir_all(&dir);
+    }
+}
@@ -1,27 +1,43 @@
 use std::collections::HashMap;
 use std::sync::Arc;
-use tokio::sync::{Mutex, RwLock};
+use arc_swap::ArcSwap;
+use once_cell::sync::Lazy;
 use serde::{Deserialize, Serialize};
 use super::websocket_client::WebSocketClient;
 use super::socket_client::SocketClient;
 use super::send_message::send_message;
-use super::performance_monitor::get_global_monitor;
+use super::performance_monitor::{get_global_monitor, PerformanceMonitor};
+use super::event_data::EventData;
+use super::remote_protocol::is_unix_socket_url;
+use super::flight_recorder::{error_chunk_offset, error_code, FlightRecorder, RecordKind, NO_TASK};
+use super::event_dispatcher::{EventDispatcher, EventSink, DEFAULT_CALLBACK_BUDGET_MS};
+use super::rate_limiter::RateLimiter;
+use super::completion::{Completion, Outcome};
+use super::power;
 
 pub const UA: &str = "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/131.0.0.0 Safari/537.36";
 
+/// 默认进度上报间隔（毫秒）
+pub const DEFAULT_PROGRESS_INTERVAL_MS: u64 = 500;
+/// 进度上报间隔下限，避免 interval 退化为忙等
+pub const MIN_PROGRESS_INTERVAL_MS: u64 = 1;
+/// 分块下载时累计多少字节后才合并到全局计数器
+pub const DEFAULT_PROGRESS_BATCH_BYTES: i64 = 512 * 1024;
+
+/// 单个下载任务；字段为共享字符串，分块任务和快照之间复制时只增加引用计数
 #[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct DownloadTask {
-    pub url: String,
-    pub save_path: String,
-    pub show_name: String,
-    pub id: String,
+    pub url: Arc<str>,
+    pub save_path: Arc<str>,
+    pub show_name: Arc<str>,
+    pub id: Arc<str>,
 }
 
 pub type ProgressCallback = extern "C" fn(*const std::ffi::c_char, *const std::ffi::c_char);
 
 #[derive(Debug, Clone)]
 pub struct DownloadConfig {
-    pub tasks: Vec<DownloadTask>,
+    pub tasks: Arc<[DownloadTask]>,
     pub thread_count: usize,
     pub chunk_size_mb: usize,
     pub callback_func: Option<ProgressCallback>,
@@ -30,8 +46,115 @@ pub struct DownloadConfig {
     pub use_socket: Option<bool>,
     pub show_name: String,
     pub user_agent: String,
+    /// 进度上报间隔（毫秒）
+    pub progress_interval_ms: u64,
+    /// 分块内累计字节达到该值后才提交到全局计数器
+    pub progress_batch_bytes: i64,
+    /// "显著变化"模式：进度变化超过该百分比才上报（0 表示不按百分比判断）
+    pub progress_min_delta_percent: f64,
+    /// "显著变化"模式：进度变化超过该字节数才上报（0 表示不按字节判断）
+    pub progress_min_delta_bytes: i64,
+    /// 单次宿主回调的耗时预算（毫秒），超过后输出警告并计入统计
+    pub callback_budget_ms: u64,
+    /// 事件订阅掩码，未订阅的事件在构建数据和序列化之前就被丢弃
+    pub event_mask: u32,
+    /// 事件投递器（由 `HSDownloader::new` 创建，负责回调与远程回调地址的输出）
+    pub event_dispatcher: Option<Arc<EventDispatcher>>,
+    /// 飞行记录器，保存最近的内部事件用于失败后排查
+    pub flight_recorder: Arc<FlightRecorder>,
+    /// 下载器 ID（由导出层分配，0 = 未分配），用于在共享的远程连接上区分消息来源
+    pub downloader_id: i32,
+    /// 多个下载器共享的并发连接预算（守护进程模式下所有客户端共用一份），None = 不限制
+    pub connection_budget: Option<Arc<tokio::sync::Semaphore>>,
+    /// 下载限速（所有分块共用，速率可在运行中修改）
+    pub rate_limiter: Arc<RateLimiter>,
+    /// 多个下载器共享的总限速（守护进程模式下所有客户端共用一份），与 `rate_limiter` 同时生效，None = 不限制
+    pub shared_rate_limiter: Option<Arc<RateLimiter>>,
+    /// 本下载器当前运行的进度统计（每次运行开始时替换），update 事件据此上报；进程级统计见 `get_global_monitor`
+    pub progress_monitor: Arc<PerformanceMonitor>,
 }
 
+impl Default for DownloadConfig {
+    fn default() -> Self {
+        DownloadConfig {
+            tasks: Arc::from([]),
+            thread_count: num_cpus::get() * 2,
+            chunk_size_mb: 10,
+            callback_func: None,
+            use_callback_url: false,
+            callback_url: None,
+            use_socket: None,
+            show_name: String::new(),
+            user_agent: UA.to_string(),
+            progress_interval_ms: DEFAULT_PROGRESS_INTERVAL_MS,
+            progress_batch_bytes: DEFAULT_PROGRESS_BATCH_BYTES,
+            progress_min_delta_percent: 0.0,
+            progress_min_delta_bytes: 0,
+            callback_budget_ms: DEFAULT_CALLBACK_BUDGET_MS,
+            event_mask: EVENT_MASK_ALL,
+            event_dispatcher: None,
+            flight_recorder: Arc::new(FlightRecorder::new()),
+            downloader_id: 0,
+            connection_budget: None,
+            rate_limiter: Arc::new(RateLimiter::new(0)),
+            shared_rate_limiter: None,
+            progress_monitor: Arc::new(PerformanceMonitor::new()),
+        }
+    }
+}
+
+impl DownloadConfig {
+    /// 是否订阅了该类型的事件
+    pub fn is_subscribed(&self, event_type: &EventType) -> bool {
+        self.event_mask & event_type.mask_bit() != 0
+    }
+
+    /// 判断本次进度是否相对上次上报发生了"显著变化"
+    ///
+    /// 两个阈值都为 0 时每个周期都上报（与旧版行为一致）。
+    pub fn is_significant_progress(&self, last_reported: i64, downloaded: i64, total: i64) -> bool {
+        if self.progress_min_delta_bytes <= 0 && self.progress_min_delta_percent <= 0.0 {
+            return true;
+        }
+
+        let delta = (downloaded - last_reported).abs();
+        if delta == 0 {
+            return false;
+        }
+
+        if self.progress_min_delta_bytes > 0 && delta >= self.progress_min_delta_bytes {
+            return true;
+        }
+
+        if self.progress_min_delta_percent > 0.0 && total > 0 {
+            let delta_percent = delta as f64 / total as f64 * 100.0;
+            if delta_percent >= self.progress_min_delta_percent {
+                return true;
+            }
+        }
+
+        // 下载完成的最后一次进度总是上报，避免界面停在 99%
+        total > 0 && downloaded >= total
+    }
+}
+
+/// 运行中修改配置的参数（None = 不修改），见 [`HSDownloader::apply_config_update`]
+#[derive(Debug, Clone, Default)]
+pub struct ConfigUpdate {
+    pub thread_count: Option<usize>,
+    pub chunk_size_mb: Option<usize>,
+    /// 字节/秒，0 = 不限速
+    pub rate_limit_bps: Option<u64>,
+    pub progress_interval_ms: Option<u64>,
+    pub user_agent: Option<String>,
+}
+
+/// 下载器配置的共享句柄
+///
+/// 读取方用 `load()` 拿到当前的不可变快照，不加锁也不等待；修改方通过 [`HSDownloader::update_config`]
+/// 复制一份改完后整体替换，已经拿到旧快照的读取方不受影响。
+pub type SharedConfig = Arc<ArcSwap<DownloadConfig>>;
+
 #[derive(Debug, Clone)]
 pub struct DownloadChunk {
     pub start_offset: i64,
@@ -57,16 +180,55 @@ pub enum EventType {
     Err,
 }
 
-#[derive(Debug, Clone, Serialize, Deserialize)]
+impl EventType {
+    /// 事件订阅掩码中对应的位（与 tthsd.h 中的 TTHSD_EVENT_* 常量一致）
+    pub const fn mask_bit(&self) -> u32 {
+        match self {
+            EventType::Start => 1 << 0,
+            EventType::StartOne => 1 << 1,
+            EventType::Update => 1 << 2,
+            EventType::End => 1 << 3,
+            EventType::EndOne => 1 << 4,
+            EventType::Msg => 1 << 5,
+            EventType::Err => 1 << 6,
+        }
+    }
+}
+
+/// 订阅全部事件
+pub const EVENT_MASK_ALL: u32 = (1 << 7) - 1;
+
+/// 事件头：名称为字面量，显示名与 ID 和任务共享同一份字符串，构造与复制都不分配堆内存
+#[derive(Debug, Clone, Serialize)]
 pub struct Event {
     #[serde(rename = "Type")]
     pub event_type: EventType,
     #[serde(rename = "Name")]
-    pub name: String,
+    pub name: &'static str,
     #[serde(rename = "ShowName")]
-    pub show_name: String,
+    pub show_name: Arc<str>,
     #[serde(rename = "ID")]
-    pub id: String,
+    pub id: Arc<str>,
+}
+
+static GLOBAL_SHOW_NAME: Lazy<Arc<str>> = Lazy::new(|| Arc::from("全局"));
+static EMPTY_STR: Lazy<Arc<str>> = Lazy::new(|| Arc::from(""));
+
+impl Event {
+    /// 整个下载器的事件（显示名为"全局"，ID 为空）
+    pub fn global(event_type: EventType, name: &'static str) -> Self {
+        Event { event_type, name, show_name: GLOBAL_SHOW_NAME.clone(), id: EMPTY_STR.clone() }
+    }
+
+    /// 不属于任何任务的事件（显示名与 ID 均为空），如下载器创建失败时的错误
+    pub fn bare(event_type: EventType, name: &'static str) -> Self {
+        Event { event_type, name, show_name: EMPTY_STR.clone(), id: EMPTY_STR.clone() }
+    }
+
+    /// 单个任务的事件
+    pub fn task(event_type: EventType, name: &'static str, task: &DownloadTask) -> Self {
+        Event { event_type, name, show_name: task.show_name.clone(), id: task.id.clone() }
+    }
 }
 
 #[derive(Debug, Clone)]
@@ -76,42 +238,65 @@ pub struct ProgressEvent {
 }
 
 pub struct HSDownloader {
-    pub config: Arc<RwLock<DownloadConfig>>,
+    pub config: SharedConfig,
     pub ws_client: Option<Arc<tokio::sync::Mutex<WebSocketClient>>>,
     pub socket_client: Option<Arc<tokio::sync::Mutex<SocketClient>>>,
     pub cancel_token: Arc<tokio::sync::Mutex<Option<tokio_util::sync::CancellationToken>>>,
     pub current_task_index: Arc<tokio::sync::Mutex<usize>>,
+    /// 运行结局，供 tthsd_wait 等待
+    pub completion: Arc<Completion>,
+    /// 一次运行结束（所有工作任务退出、取消令牌清除）时通知
+    run_ended: tokio::sync::Notify,
+    /// 最近一次运行是否为批量（并行）下载，恢复时沿用
+    multiple: std::sync::atomic::AtomicBool,
 }
 
 impl HSDownloader {
     pub fn new(config: DownloadConfig) -> Self {
-        let config = Arc::new(RwLock::new(config));
-
-        let (ws_client, socket_client) = {
-            let cfg = config.blocking_read();
-            let mut ws_client = None;
-            let mut socket_client = None;
-
-            if cfg.use_callback_url {
-                if let Some(ref callback_url) = cfg.callback_url {
-                    if let Some(use_socket) = cfg.use_socket {
-                        if use_socket {
-                            socket_client = Some(Arc::new(tokio::sync::Mutex::new(SocketClient::new(callback_url.clone()))));
-                        } else {
-                            ws_client = Some(Arc::new(tokio::sync::Mutex::new(WebSocketClient::new(callback_url.clone()))));
-                        }
+        Self::with_event_sink(config, None)
+    }
+
+    /// 创建下载器，事件除回调函数与远程回调地址外还投递给进程内接收端（例如 JNI 监听器）
+    pub fn with_event_sink(mut config: DownloadConfig, sink: Option<EventSink>) -> Self {
+        let mut ws_client = None;
+        let mut socket_client = None;
+
+        if config.use_callback_url {
+            if let Some(ref callback_url) = config.callback_url {
+                // unix:// 地址只能走原始 Socket 帧，不受 use_socket 影响
+                let use_socket = if is_unix_socket_url(callback_url) { Some(true) } else { config.use_socket };
+                if let Some(use_socket) = use_socket {
+                    if use_socket {
+                        socket_client = Some(SocketClient::new(callback_url.clone(), config.downloader_id));
+                    } else {
+                        ws_client = Some(WebSocketClient::new(callback_url.clone(), config.downloader_id));
                     }
                 }
             }
-            (ws_client, socket_client)
-        };
+        }
+
+        if config.event_dispatcher.is_none() {
+            config.event_dispatcher = Some(Arc::new(EventDispatcher::new(
+                config.callback_func,
+                sink,
+                config.callback_budget_ms,
+                ws_client.clone(),
+                socket_client.clone(),
+                config.flight_recorder.clone(),
+            )));
+        }
+
+        let completion = Arc::new(Completion::new(config.downloader_id));
 
         HSDownloader {
-            config,
-            ws_client,
-            socket_client,
+            config: Arc::new(ArcSwap::from_pointee(config)),
+            ws_client: ws_client.map(|c| Arc::new(tokio::sync::Mutex::new(c))),
+            socket_client: socket_client.map(|c| Arc::new(tokio::sync::Mutex::new(c))),
             cancel_token: Arc::new(tokio::sync::Mutex::new(None)),
             current_task_index: Arc::new(tokio::sync::Mutex::new(0)),
+            completion,
+            run_ended: tokio::sync::Notify::new(),
+            multiple: std::sync::atomic::AtomicBool::new(false),
         }
     }
 
@@ -121,52 +306,139 @@ impl HSDownloader {
         let chunk_size_mb = if chunk_size_mb == 0 { 10 } else { chunk_size_mb };
 
         let config = DownloadConfig {
-            tasks,
+            tasks: tasks.into(),
             thread_count,
             chunk_size_mb,
             callback_func: None,
             use_callback_url: false,
             callback_url: None,
             use_socket: None,
-            show_name: String::new(),
-            user_agent: UA.to_string(),
+            ..Default::default()
         };
 
         Self::new(config)
     }
 
     pub async fn start_download(&self) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+        let token = self.begin_run().await?;
+        self.run(token, false).await
+    }
+
+    pub async fn start_multiple_downloads(&self) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+        let token = self.begin_run().await?;
+        self.run(token, true).await
+    }
+
+    /// 登记一次运行后在当前运行时上启动它，供各导出层的 start 调用
+    ///
+    /// 已有运行尚未结束时直接返回 Err：不发送事件、不记录结局，正在进行的运行不受影响，
+    /// 调用方应原样报告失败（-1 / RPC 错误）而不是移出下载器。
+    /// 运行结束后依次：出错时发送 err 事件、记录结局；结局确定（完成或失败）时调用 `on_end`（通常用于移出注册表）。
+    /// 被暂停或停止的运行不调用 `on_end`：暂停的下载器留在注册表中等待恢复，停止由 stop 的调用方负责移除。
+    pub async fn spawn_run<F>(self: &Arc<Self>, multiple: bool, on_end: F) -> Result<(), Box<dyn std::error::Error + Send + Sync>>
+    where
+        F: FnOnce(Outcome) + Send + 'static,
+    {
+        let token = self.begin_run().await?;
+        self.multiple.store(multiple, std::sync::atomic::Ordering::Relaxed);
+        let downloader = self.clone();
+        tokio::spawn(async move {
+            let result = downloader.run(token, multiple).await;
+
+            if let Err(ref e) = result {
+                let event = Event::bare(EventType::Err, "错误");
+                let _ = send_message(event, EventData::error(e.to_string()), &downloader.config).await;
+            }
+
+            if let Some(outcome) = downloader.finish(&result) {
+                on_end(outcome);
+            }
+        });
+        Ok(())
+    }
+
+    /// 恢复暂停的下载：按最近一次的启动方式重新运行全部任务，其余同 `spawn_run`
+    pub async fn resume_download<F>(self: &Arc<Self>, on_end: F) -> Result<(), Box<dyn std::error::Error + Send + Sync>>
+    where
+        F: FnOnce(Outcome) + Send + 'static,
+    {
+        self.spawn_run(self.multiple.load(std::sync::atomic::Ordering::Relaxed), on_end).await
+    }
+
+    /// 执行一次已登记的运行，结束时释放运行登记
+    async fn run(
+        &self,
+        token: tokio_util::sync::CancellationToken,
+        multiple: bool,
+    ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+        let result = if multiple {
+            self.run_tasks(&token, "开始批量下载", "结束批量下载").await
+        } else {
+            let result = self.run_tasks(&token, "开始下载", "结束所有下载").await;
+            if result.is_ok() {
+                if let Some(monitor) = get_global_monitor().await {
+                    monitor.print_stats().await;
+                }
+            }
+            result
+        };
+        self.end_run().await;
+        result
+    }
+
+    /// 登记一次运行；取消令牌在运行结束（所有工作任务退出）前一直保留，期间再次启动会失败
+    ///
+    /// 同时把完成状态重置为运行中，之前暂停留下的取消标记不会影响本次运行的结局。
+    async fn begin_run(&self) -> Result<tokio_util::sync::CancellationToken, Box<dyn std::error::Error + Send + Sync>> {
         let mut cancel_guard = self.cancel_token.lock().await;
         if cancel_guard.is_some() {
-            drop(cancel_guard);
             return Err("downloader already running".into());
         }
 
         let token = tokio_util::sync::CancellationToken::new();
         *cancel_guard = Some(token.clone());
         drop(cancel_guard);
+        self.completion.reset();
+        Ok(token)
+    }
 
-        let event = Event {
-            event_type: EventType::Start,
-            name: "开始下载".to_string(),
-            show_name: "全局".to_string(),
-            id: String::new(),
-        };
+    async fn end_run(&self) {
+        *self.cancel_token.lock().await = None;
+        self.run_ended.notify_waiters();
+    }
+
+    /// 等待当前运行结束；没有运行时立即返回
+    async fn wait_run_end(&self) {
+        loop {
+            let notified = self.run_ended.notified();
+            tokio::pin!(notified);
+            notified.as_mut().enable();
+            if self.cancel_token.lock().await.is_none() {
+                return;
+            }
+            notified.await;
+        }
+    }
 
-        send_message(event, HashMap::new(), &self.config, &self.ws_client, &self.socket_client).await?;
+    async fn run_tasks(
+        &self,
+        token: &tokio_util::sync::CancellationToken,
+        start_name: &'static str,
+        end_name: &'static str,
+    ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+        let event = Event::global(EventType::Start, start_name);
 
-        let tasks = {
-            let config = self.config.read().await;
-            config.tasks.clone()
-        };
+        send_message(event, EventData::Empty, &self.config).await?;
+
+        // 每次运行（包括恢复）从零开始统计，update 事件只反映本下载器的字节数与总大小
+        self.update_config(|cfg| cfg.progress_monitor = Arc::new(PerformanceMonitor::new()));
+        let tasks = self.config.load().tasks.clone();
 
         let mut join_set = tokio::task::JoinSet::new();
 
-        for (index, task) in tasks.into_iter().enumerate() {
+        for (index, task) in tasks.iter().cloned().enumerate() {
             let token_clone = token.clone();
             let config = self.config.clone();
-            let ws_client = self.ws_client.clone();
-            let socket_client = self.socket_client.clone();
 
             join_set.spawn(async move {
                 Self::download_task(
@@ -174,233 +446,131 @@ impl HSDownloader {
                     index,
                     token_clone,
                     config,
-                    ws_client,
-                    socket_client,
                 ).await
             });
         }
 
         // 启动进度监控上报任务
-        let (progress_done_tx, mut progress_done_rx) = tokio::sync::mpsc::channel::<()>(1);
-        let monitor_config = self.config.clone();
-        let monitor_ws = self.ws_client.clone();
-        let monitor_socket = self.socket_client.clone();
-        let monitor_token = token.clone();
-        let monitor_handle = tokio::spawn(async move {
-            let mut interval = tokio::time::interval(std::time::Duration::from_millis(500));
-            loop {
-                tokio::select! {
-                    _ = interval.tick() => {
-                        if let Some(monitor) = get_global_monitor().await {
-                            let mut stats = monitor.get_stats().await;
-                            
-                            // 兼容旧版 Golang 接口的字段命名 (各语言 Bindings 依赖这两个字段计算进度)
-                            if let Some(total_bytes) = stats.get("total_bytes").cloned() {
-                                stats.insert("Downloaded".to_string(), total_bytes);
-                            }
-                            let event = Event {
-                                event_type: EventType::Update,
-                                name: "进度更新".to_string(),
-                                show_name: "全局".to_string(),
-                                id: String::new(),
-                            };
-                            let _ = send_message(event, stats, &monitor_config, &monitor_ws, &monitor_socket).await;
-                        }
-                    }
-                    _ = progress_done_rx.recv() => {
-                        break;
-                    }
-                    _ = monitor_token.cancelled() => {
-                        break;
-                    }
-                }
-            }
-        });
+        let (progress_done_tx, monitor_handle) = self.spawn_progress_monitor(token.clone()).await;
 
-        // 等待所有下载任务完成，或者被取消
+        // 等待所有下载任务结束；暂停/停止时各任务观察到取消令牌后自行退出（不再写入文件），
+        // 全部退出后才返回，结局因此在工作任务停止之后记录
         while let Some(result) = join_set.join_next().await {
             if let Err(e) = result {
                 eprintln!("Task failed: {:?}", e);
             }
-            // 如果 token 被取消（暂停/停止），中止剩余任务
-            if token.is_cancelled() {
-                join_set.abort_all();
-                break;
-            }
         }
 
         // 停止进度监控
         let _ = progress_done_tx.send(()).await;
         let _ = monitor_handle.await;
 
-        let end_event = Event {
-            event_type: EventType::End,
-            name: "结束所有下载".to_string(),
-            show_name: "全局".to_string(),
-            id: String::new(),
-        };
-
-        send_message(end_event, HashMap::new(), &self.config, &self.ws_client, &self.socket_client).await?;
-
-        if let Some(monitor) = get_global_monitor().await {
-            monitor.print_stats().await;
-        }
+        let end_event = Event::global(EventType::End, end_name);
 
-        let mut cancel_guard = self.cancel_token.lock().await;
-        *cancel_guard = None;
-        drop(cancel_guard);
+        send_message(end_event, EventData::Empty, &self.config).await?;
 
         Ok(())
     }
 
-    pub async fn start_multiple_downloads(&self) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
-        let mut cancel_guard = self.cancel_token.lock().await;
-        if cancel_guard.is_some() {
-            drop(cancel_guard);
-            return Err("downloader already running".into());
-        }
-
-        let token = tokio_util::sync::CancellationToken::new();
-        *cancel_guard = Some(token.clone());
-        drop(cancel_guard);
-
-        let event = Event {
-            event_type: EventType::Start,
-            name: "开始批量下载".to_string(),
-            show_name: "全局".to_string(),
-            id: String::new(),
-        };
-
-        send_message(event, HashMap::new(), &self.config, &self.ws_client, &self.socket_client).await?;
-
-        let tasks = {
-            let config = self.config.read().await;
-            config.tasks.clone()
-        };
-
-        let mut join_set = tokio::task::JoinSet::new();
-
-        for (index, task) in tasks.into_iter().enumerate() {
-            let token_clone = token.clone();
-            let config = self.config.clone();
-            let ws_client = self.ws_client.clone();
-            let socket_client = self.socket_client.clone();
-
-            join_set.spawn(async move {
-                Self::download_task(
-                    task,
-                    index,
-                    token_clone,
-                    config,
-                    ws_client,
-                    socket_client,
-                ).await
-            });
-        }
-
-        // 启动进度监控上报任务
+    /// 启动进度监控上报任务
+    ///
+    /// 上报间隔与"显著变化"阈值在启动时从配置读取；返回的 sender 用于通知监控任务退出。
+    async fn spawn_progress_monitor(
+        &self,
+        token: tokio_util::sync::CancellationToken,
+    ) -> (tokio::sync::mpsc::Sender<()>, tokio::task::JoinHandle<()>) {
         let (progress_done_tx, mut progress_done_rx) = tokio::sync::mpsc::channel::<()>(1);
         let monitor_config = self.config.clone();
-        let monitor_ws = self.ws_client.clone();
-        let monitor_socket = self.socket_client.clone();
-        let monitor_token = token.clone();
-        let monitor_handle = tokio::spawn(async move {
-            let mut interval = tokio::time::interval(std::time::Duration::from_millis(500));
+
+        let handle = tokio::spawn(async move {
+            let mut power = power::subscribe();
+            // 与 interval 一样，第一次上报立即进行
+            let mut next_tick = tokio::time::Instant::now();
+            let mut last_reported: Option<i64> = None;
+
             loop {
+                // 后台时不设定时器，只等待切回前台；省电模式下到期时间对齐到全局时间点，与其他定时器合并唤醒
+                let configured_ms = monitor_config.load().progress_interval_ms.max(MIN_PROGRESS_INTERVAL_MS);
+                let deadline = power::progress_interval(configured_ms).map(|_| power::align(next_tick));
+                let tick = async move {
+                    match deadline {
+                        Some(deadline) => tokio::time::sleep_until(deadline).await,
+                        None => std::future::pending().await,
+                    }
+                };
+
                 tokio::select! {
-                    _ = interval.tick() => {
-                        if let Some(monitor) = get_global_monitor().await {
-                            let mut stats = monitor.get_stats().await;
-                            
-                            // 兼容旧版 Golang 接口的字段命名
-                            if let Some(total_bytes) = stats.get("total_bytes").cloned() {
-                                stats.insert("Downloaded".to_string(), total_bytes);
+                    _ = tick => {
+                        // 上报间隔在运行中被修改时，从下一次上报开始使用新间隔；回调线程处理不过来时不补发积压的上报
+                        let configured_ms = monitor_config.load().progress_interval_ms.max(MIN_PROGRESS_INTERVAL_MS);
+                        let period = power::progress_interval(configured_ms).unwrap_or_default();
+                        next_tick = tokio::time::Instant::now() + period;
+
+                        // 上报本下载器的统计（而不是进程级统计），同时运行的多个下载器各自得到自己的字节数与总大小
+                        // 先用订阅掩码和原子计数判断是否需要上报，避免无意义地构建统计数据
+                        let monitor = {
+                            let cfg = monitor_config.load();
+                            if !cfg.is_subscribed(&EventType::Update) {
+                                continue;
+                            }
+                            let downloaded = cfg.progress_monitor.total_bytes();
+                            if let Some(last) = last_reported {
+                                if !cfg.is_significant_progress(last, downloaded, cfg.progress_monitor.expected_bytes()) {
+                                    continue;
+                                }
                             }
-                            
-                            let event = Event {
-                                event_type: EventType::Update,
-                                name: "进度更新".to_string(),
-                                show_name: "全局".to_string(),
-                                id: String::new(),
-                            };
-                            let _ = send_message(event, stats, &monitor_config, &monitor_ws, &monitor_socket).await;
+                            last_reported = Some(downloaded);
+                            cfg.progress_monitor.clone()
+                        };
+
+                        // 进度数据中同时包含兼容旧版 Golang 接口的 Downloaded/Total 字段 (各语言 Bindings 依赖这两个字段计算进度)
+                        let progress = monitor.progress_data().await;
+                        let event = Event::global(EventType::Update, "进度更新");
+                        let _ = send_message(event, EventData::Progress(progress), &monitor_config).await;
+                    }
+                    changed = power.changed() => {
+                        // 切回前台时立即补报一次当前进度
+                        if changed.is_ok() && !power.borrow_and_update().background {
+                            next_tick = tokio::time::Instant::now();
                         }
                     }
                     _ = progress_done_rx.recv() => {
                         break;
                     }
-                    _ = monitor_token.cancelled() => {
+                    _ = token.cancelled() => {
                         break;
                     }
                 }
             }
         });
 
-        // 等待所有下载任务完成，或者被取消
-        while let Some(result) = join_set.join_next().await {
-            if let Err(e) = result {
-                eprintln!("Task failed: {:?}", e);
-            }
-            if token.is_cancelled() {
-                join_set.abort_all();
-                break;
-            }
-        }
-
-        // 停止进度监控
-        let _ = progress_done_tx.send(()).await;
-        let _ = monitor_handle.await;
-
-        let end_event = Event {
-            event_type: EventType::End,
-            name: "结束批量下载".to_string(),
-            show_name: "全局".to_string(),
-            id: String::new(),
-        };
-
-        send_message(end_event, HashMap::new(), &self.config, &self.ws_client, &self.socket_client).await?;
-
-        let mut cancel_guard = self.cancel_token.lock().await;
-        *cancel_guard = None;
-        drop(cancel_guard);
-
-        Ok(())
+        (progress_done_tx, handle)
     }
 
     async fn download_task(
         task: DownloadTask,
         index: usize,
         token: tokio_util::sync::CancellationToken,
-        config: Arc<RwLock<DownloadConfig>>,
-        ws_client: Option<Arc<Mutex<WebSocketClient>>>,
-        socket_client: Option<Arc<Mutex<SocketClient>>>,
+        config: SharedConfig,
     ) {
-        let total = {
-            let cfg = config.read().await;
-            cfg.tasks.len()
+        let (total, want_start_one, want_end_one, recorder) = {
+            let cfg = config.load();
+            (
+                cfg.tasks.len(),
+                cfg.is_subscribed(&EventType::StartOne),
+                cfg.is_subscribed(&EventType::EndOne),
+                cfg.flight_recorder.clone(),
+            )
         };
+        recorder.record(RecordKind::TaskStart, index as u32, 0, 0);
 
-        let start_event = Event {
-            event_type: EventType::StartOne,
-            name: "开始一个下载".to_string(),
-            show_name: task.show_name.clone(),
-            id: task.id.clone(),
-        };
-
-        let mut data = HashMap::new();
-        data.insert("URL".to_string(), serde_json::Value::String(task.url.clone()));
-        data.insert("SavePath".to_string(), serde_json::Value::String(task.save_path.clone()));
-        data.insert("ShowName".to_string(), serde_json::Value::String(task.show_name.clone()));
-        data.insert("Index".to_string(), serde_json::Value::Number(serde_json::Number::from(index + 1)));
-        data.insert("Total".to_string(), serde_json::Value::Number(serde_json::Number::from(total)));
-
-        if let Err(e) = send_message(start_event, data, &config, &ws_client, &socket_client).await {
-            eprintln!("Failed to send start event: {:?}", e);
+        if want_start_one {
+            Self::send_start_one(&task, index, total, &config).await;
         }
 
         // 通过工厂函数获取下载器实例（支持多种下载器类型扩展）
         let err: Option<Box<dyn std::error::Error + Send + Sync>> = {
-            let mut downloader = super::get_downloader::get_downloader(config.clone()).await;
+            let mut downloader = super::get_downloader::get_downloader(config.clone(), token.clone()).await;
             match downloader.download(&task).await {
                 Ok(()) => None,
                 Err(e) => {
@@ -410,64 +580,141 @@ impl HSDownloader {
             }
         };
 
-        let mut end_data = HashMap::new();
-        end_data.insert("URL".to_string(), serde_json::Value::String(task.url));
-        end_data.insert("SavePath".to_string(), serde_json::Value::String(task.save_path));
-        end_data.insert("ShowName".to_string(), serde_json::Value::String(task.show_name.clone()));
-        end_data.insert("Index".to_string(), serde_json::Value::Number(serde_json::Number::from(index + 1)));
-        end_data.insert("Total".to_string(), serde_json::Value::Number(serde_json::Number::from(total)));
+        recorder.record(RecordKind::TaskEnd, index as u32, err.is_some() as i64, 0);
 
         if let Some(e) = err {
             if !token.is_cancelled() {
-                let error_event = Event {
-                    event_type: EventType::Err,
-                    name: "错误".to_string(),
-                    show_name: task.show_name.clone(),
-                    id: task.id.clone(),
+                recorder.record(RecordKind::Error, index as u32, error_code(e.as_ref()), error_chunk_offset(e.as_ref()));
+                let dump_path = recorder.dump_on_failure().await;
+
+                let error_event = Event::task(EventType::Err, "错误", &task);
+                let error_data = EventData::Error {
+                    message: format!("下载文件失败: {:?}", e),
+                    flight_recorder: dump_path.map(|p| p.to_string_lossy().into_owned()),
                 };
-                let mut error_data = HashMap::new();
-                error_data.insert("Error".to_string(), serde_json::Value::String(format!("下载文件失败: {:?}", e)));
 
-                let _ = send_message(error_event, error_data, &config, &ws_client, &socket_client).await;
+                let _ = send_message(error_event, error_data, &config).await;
             }
         }
 
-        let end_event = Event {
-            event_type: EventType::EndOne,
-            name: "结束一个下载".to_string(),
-            show_name: task.show_name,
-            id: task.id,
+        // 被取消的任务没有结束，不发送 endOne
+        if !want_end_one || token.is_cancelled() {
+            return;
+        }
+
+        let end_data = EventData::Task {
+            url: task.url.clone(),
+            save_path: task.save_path.clone(),
+            show_name: task.show_name.clone(),
+            index,
+            total,
+        };
+
+        let end_event = Event::task(EventType::EndOne, "结束一个下载", &task);
+
+        let _ = send_message(end_event, end_data, &config).await;
+    }
+
+    async fn send_start_one(
+        task: &DownloadTask,
+        index: usize,
+        total: usize,
+        config: &SharedConfig,
+    ) {
+        let start_event = Event::task(EventType::StartOne, "开始一个下载", task);
+
+        let data = EventData::Task {
+            url: task.url.clone(),
+            save_path: task.save_path.clone(),
+            show_name: task.show_name.clone(),
+            index,
+            total,
         };
 
-        let _ = send_message(end_event, end_data, &config, &ws_client, &socket_client).await;
+        if let Err(e) = send_message(start_event, data, config).await {
+            eprintln!("Failed to send start event: {:?}", e);
+        }
     }
 
+    /// 暂停：取消当前运行并等所有工作任务退出后返回，下载器保留，之后可以恢复或停止
+    ///
+    /// 暂停不记录结局，等待者继续等待恢复后的运行结束（或停止）。
     pub async fn pause_download(&self) {
-        let mut cancel_guard = self.cancel_token.lock().await;
-        if let Some(token) = cancel_guard.take() {
+        if self.cancel_run().await {
+            self.wait_run_end().await;
+        }
+    }
+
+    /// 取消正在进行的运行并发送"暂停"消息，返回是否有运行尚未结束
+    async fn cancel_run(&self) -> bool {
+        let cancel_guard = self.cancel_token.lock().await;
+        // 先标记再取消：运行任务观察到取消后记录的结局必然是 Cancelled
+        self.completion.set_cancelled(true);
+        let running = cancel_guard.is_some();
+        if let Some(ref token) = *cancel_guard {
             token.cancel();
         }
         drop(cancel_guard);
 
-        let event = Event {
-            event_type: EventType::Msg,
-            name: "暂停".to_string(),
-            show_name: "全局".to_string(),
-            id: String::new(),
-        };
+        self.config.load().flight_recorder.record(RecordKind::Pause, NO_TASK, 0, 0);
 
-        let mut data = HashMap::new();
-        data.insert("Text".to_string(), serde_json::Value::String("下载已暂停".to_string()));
+        let event = Event::global(EventType::Msg, "暂停");
 
-        let _ = send_message(event, data, &self.config, &self.ws_client, &self.socket_client).await;
+        let data = EventData::Text("下载已暂停".to_string());
+
+        let _ = send_message(event, data, &self.config).await;
+        running
+    }
+
+    /// 修改配置：复制当前快照、应用修改后整体替换（并发修改时 `f` 可能被重复调用）
+    ///
+    /// 正在运行的任务在下一次读取配置时看到新值。
+    pub fn update_config(&self, f: impl Fn(&mut DownloadConfig)) {
+        self.config.rcu(|current| {
+            let mut next = DownloadConfig::clone(current);
+            f(&mut next);
+            next
+        });
     }
 
-    pub async fn resume_download(&self) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
-        self.start_download().await
+    /// 在运行中修改下载参数，不中断正在传输的分块
+    ///
+    /// 线程数、分块大小和 UA 在下一个分块开始时生效；限速立即生效；进度上报间隔在下一次上报时生效。
+    pub fn apply_config_update(&self, update: &ConfigUpdate) -> Result<(), String> {
+        if update.thread_count == Some(0) || update.chunk_size_mb == Some(0) {
+            return Err("线程数与分块大小必须大于 0".to_string());
+        }
+        if let Some(ref user_agent) = update.user_agent {
+            reqwest::header::HeaderValue::from_str(user_agent).map_err(|_| format!("无效的 UA: {:?}", user_agent))?;
+        }
+
+        self.update_config(|cfg| {
+            if let Some(n) = update.thread_count {
+                cfg.thread_count = n;
+            }
+            if let Some(n) = update.chunk_size_mb {
+                cfg.chunk_size_mb = n;
+            }
+            if let Some(ms) = update.progress_interval_ms {
+                cfg.progress_interval_ms = if ms == 0 { DEFAULT_PROGRESS_INTERVAL_MS } else { ms };
+            }
+            if let Some(ref user_agent) = update.user_agent {
+                cfg.user_agent = user_agent.clone();
+            }
+        });
+        if let Some(rate) = update.rate_limit_bps {
+            self.config.load().rate_limiter.set_rate(rate);
+        }
+        Ok(())
     }
 
+    /// 停止下载：取消当前运行并等所有工作任务退出后才记录结局（Cancelled）并返回，
+    /// 调用方随后把下载器移出注册表时不会再有分块在写文件
     pub async fn stop_download(&self) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
-        self.pause_download().await;
+        if self.cancel_run().await {
+            self.wait_run_end().await;
+        }
+        self.config.load().flight_recorder.record(RecordKind::Stop, NO_TASK, 0, 0);
 
         // 关闭网络连接
         if let Some(ref ws_client) = self.ws_client {
@@ -480,25 +727,269 @@ impl HSDownloader {
             client.close();
         }
 
-        let event = Event {
-            event_type: EventType::Msg,
-            name: "停止".to_string(),
-            show_name: "全局".to_string(),
-            id: String::new(),
-        };
+        let event = Event::global(EventType::Msg, "停止");
 
-        let mut data = HashMap::new();
-        data.insert("Text".to_string(), serde_json::Value::String("下载已停止".to_string()));
+        let data = EventData::Text("下载已停止".to_string());
 
-        send_message(event, data, &self.config, &self.ws_client, &self.socket_client).await?;
+        let result = send_message(event, data, &self.config).await;
+        // 被取消的运行不记录结局，停止的结局总是在这里记录（从未启动或暂停中停止也一样）
+        self.completion.finish(Outcome::Cancelled);
+        result?;
 
         Ok(())
     }
 
+    /// 记录一次 start/resume 的结局并唤醒等待者，由运行下载的任务在移出注册表之前调用
+    ///
+    /// 被暂停或停止的运行不在这里记录（暂停没有结局，停止由 `stop_download` 记录），返回 None。
+    pub fn finish(&self, result: &Result<(), Box<dyn std::error::Error + Send + Sync>>) -> Option<Outcome> {
+        if self.completion.is_cancelled() {
+            return None;
+        }
+        let outcome = if result.is_err() { Outcome::Failed } else { Outcome::Completed };
+        self.completion.finish(outcome);
+        Some(outcome)
+    }
+
+    /// 汇总下载器的运行统计（JSON 对象，按模块分组）
+    pub async fn get_stats(&self) -> HashMap<String, serde_json::Value> {
+        let mut stats = HashMap::new();
+        if let Some(ref dispatcher) = self.config.load().event_dispatcher {
+            stats.insert("callback".to_string(), serde_json::to_value(dispatcher.get_stats()).unwrap_or_default());
+        }
+
+        let mut rate_limit = HashMap::new();
+        self.config.load().rate_limiter.write_stats(&mut rate_limit);
+        stats.insert("rate_limit".to_string(), serde_json::to_value(rate_limit).unwrap_or_default());
+
+        if let Some(ref socket_client) = self.socket_client {
+            let client = socket_client.lock().await;
+            stats.insert("socket".to_string(), serde_json::to_value(client.get_stats()).unwrap_or_default());
+        }
+
+        if let Some(ref ws_client) = self.ws_client {
+            let client = ws_client.lock().await;
+            stats.insert("websocket".to_string(), serde_json::to_value(client.get_stats()).unwrap_or_default());
+        }
+        stats
+    }
+
+    /// 将飞行记录器内容转储到指定文件
+    pub async fn dump_flight_recorder(&self, path: &std::path::Path) -> std::io::Result<()> {
+        let recorder = self.config.load().flight_recorder.clone();
+        let path = path.to_path_buf();
+        tokio::task::spawn_blocking(move || recorder.dump_to_file(&path))
+            .await
+            .map_err(std::io::Error::other)?
+    }
+
     pub async fn get_snapshot(&self, _task_id: &str) -> Option<HashMap<String, serde_json::Value>> {
         if let Some(monitor) = get_global_monitor().await {
             return Some(monitor.get_stats().await);
         }
         None
     }
-}
\ No newline at end of file
+}
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::time::Duration;
+    use tokio::io::{AsyncReadExt, AsyncWriteExt};
+    use tokio::net::TcpListener;
+
+    /// 声称有 64MB、分块数据每 20ms 只给 1KB 的源站，下载不会自己结束
+    async fn slow_origin() -> String {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let addr = listener.local_addr().unwrap();
+        tokio::spawn(async move {
+            loop {
+                let Ok((mut stream, _)) = listener.accept().await else { return };
+                tokio::spawn(async move {
+                    let mut request = Vec::new();
+                    let mut buf = [0u8; 1024];
+                    while !request.windows(4).any(|w| w == b"\r\n\r\n") {
+                        match stream.read(&mut buf).await {
+                            Ok(0) | Err(_) => return,
+                            Ok(n) => request.extend_from_slice(&buf[..n]),
+                        }
+                    }
+                    let size = 64 * 1024 * 1024;
+                    if request.starts_with(b"HEAD") {
+                        let head = format!("HTTP/1.1 200 OK\r\nContent-Length: {}\r\nConnection: close\r\n\r\n", size);
+                        let _ = stream.write_all(head.as_bytes()).await;
+                        return;
+                    }
+                    let head = "HTTP/1.1 206 Partial Content\r\nConnection: close\r\n\r\n";
+                    if stream.write_all(head.as_bytes()).await.is_err() {
+                        return;
+                    }
+                    loop {
+                        if stream.write_all(&[0u8; 1024]).await.is_err() {
+                            return;
+                        }
+                        tokio::time::sleep(Duration::from_millis(20)).await;
+                    }
+                });
+            }
+        });
+        format!("http://{}/big.bin", addr)
+    }
+
+    #[tokio::test(flavor = "multi_thread", worker_threads = 2)]
+    async fn stop_returns_after_workers_observe_cancellation() {
+        let save_path = std::env::temp_dir().join(format!("tthsd-stop-test-{}.bin", std::process::id()));
+        let task = DownloadTask {
+            url: Arc::from(slow_origin().await),
+            save_path: Arc::from(save_path.to_string_lossy().as_ref()),
+            show_name: Arc::from("big.bin"),
+            id: Arc::from("1"),
+        };
+        let config = DownloadConfig { tasks: Arc::from([task]), thread_count: 2, ..Default::default() };
+        let downloader = Arc::new(HSDownloader::new(config));
+
+        let run = tokio::spawn({
+            let downloader = downloader.clone();
+            async move {
+                let result = downloader.start_download().await;
+                downloader.finish(&result);
+                result.is_ok()
+            }
+        });
+        tokio::time::sleep(Duration::from_millis(300)).await;
+        assert!(!run.is_finished());
+
+        tokio::time::timeout(Duration::from_secs(5), downloader.stop_download())
+            .await
+            .expect("stop_download 应在工作任务退出后返回")
+            .unwrap();
+        assert_eq!(downloader.completion.outcome(), Some(Outcome::Cancelled));
+        assert!(downloader.cancel_token.lock().await.is_none());
+        assert!(tokio::time::timeout(Duration::from_secs(1), run).await.is_ok());
+        let _ = std::fs::remove_file(&save_path);
+    }
+
+    #[tokio::test(flavor = "multi_thread", worker_threads = 2)]
+    async fn second_start_while_running_leaves_run_untouched() {
+        let save_path = std::env::temp_dir().join(format!("tthsd-restart-test-{}.bin", std::process::id()));
+        let task = DownloadTask {
+            url: Arc::from(slow_origin().await),
+            save_path: Arc::from(save_path.to_string_lossy().as_ref()),
+            show_name: Arc::from("big.bin"),
+            id: Arc::from("1"),
+        };
+        let config = DownloadConfig { tasks: Arc::from([task]), thread_count: 2, ..Default::default() };
+        let downloader = Arc::new(HSDownloader::new(config));
+        let ended = Arc::new(std::sync::atomic::AtomicUsize::new(0));
+
+        let on_end = |ended: &Arc<std::sync::atomic::AtomicUsize>| {
+            let ended = ended.clone();
+            move |_: Outcome| {
+                ended.fetch_add(1, std::sync::atomic::Ordering::SeqCst);
+            }
+        };
+        downloader.spawn_run(false, on_end(&ended)).await.unwrap();
+        tokio::time::sleep(Duration::from_millis(200)).await;
+
+        // 第二次启动被拒绝：不记录结局、不触发结束回调，原来的运行继续
+        assert!(downloader.spawn_run(true, on_end(&ended)).await.is_err());
+        tokio::time::sleep(Duration::from_millis(100)).await;
+        assert_eq!(downloader.completion.outcome(), None);
+        assert_eq!(ended.load(std::sync::atomic::Ordering::SeqCst), 0);
+        assert!(downloader.cancel_token.lock().await.is_some());
+
+        downloader.stop_download().await.unwrap();
+        assert_eq!(downloader.completion.outcome(), Some(Outcome::Cancelled));
+        let _ = std::fs::remove_file(&save_path);
+    }
+
+    #[tokio::test(flavor = "multi_thread", worker_threads = 2)]
+    async fn pause_keeps_downloader_and_resume_starts_new_run() {
+        let save_path = std::env::temp_dir().join(format!("tthsd-pause-test-{}.bin", std::process::id()));
+        let task = DownloadTask {
+            url: Arc::from(slow_origin().await),
+            save_path: Arc::from(save_path.to_string_lossy().as_ref()),
+            show_name: Arc::from("big.bin"),
+            id: Arc::from("1"),
+        };
+        let config = DownloadConfig { tasks: Arc::from([task]), thread_count: 2, ..Default::default() };
+        let downloader = Arc::new(HSDownloader::new(config));
+        let ended = Arc::new(std::sync::atomic::AtomicUsize::new(0));
+        let on_end = |ended: &Arc<std::sync::atomic::AtomicUsize>| {
+            let ended = ended.clone();
+            move |_: Outcome| {
+                ended.fetch_add(1, std::sync::atomic::Ordering::SeqCst);
+            }
+        };
+
+        downloader.spawn_run(true, on_end(&ended)).await.unwrap();
+        tokio::time::sleep(Duration::from_millis(200)).await;
+
+        // 暂停在工作任务退出后返回：不记录结局、不触发结束回调
+        tokio::time::timeout(Duration::from_secs(5), downloader.pause_download()).await.unwrap();
+        assert!(downloader.cancel_token.lock().await.is_none());
+        tokio::time::sleep(Duration::from_millis(100)).await;
+        assert_eq!(downloader.completion.outcome(), None);
+        assert_eq!(ended.load(std::sync::atomic::Ordering::SeqCst), 0);
+
+        // 恢复沿用上次的启动方式，开始新一次运行
+        downloader.resume_download(on_end(&ended)).await.unwrap();
+        assert!(downloader.multiple.load(std::sync::atomic::Ordering::Relaxed));
+        assert!(downloader.cancel_token.lock().await.is_some());
+        assert!(!downloader.completion.is_cancelled());
+        assert!(downloader.resume_download(on_end(&ended)).await.is_err());
+
+        downloader.stop_download().await.unwrap();
+        assert_eq!(downloader.completion.outcome(), Some(Outcome::Cancelled));
+        assert_eq!(ended.load(std::sync::atomic::Ordering::SeqCst), 0);
+        let _ = std::fs::remove_file(&save_path);
+    }
+
+    #[tokio::test(flavor = "multi_thread", worker_threads = 2)]
+    async fn progress_is_tracked_per_downloader() {
+        let url: Arc<str> = Arc::from(slow_origin().await);
+        let downloaders: Vec<_> = (0..2)
+            .map(|i| {
+                let save_path = std::env::temp_dir().join(format!("tthsd-progress-test-{}-{}.bin", std::process::id(), i));
+                let task = DownloadTask {
+                    url: url.clone(),
+                    save_path: Arc::from(save_path.to_string_lossy().as_ref()),
+                    show_name: Arc::from("big.bin"),
+                    id: Arc::from("1"),
+                };
+                let config = DownloadConfig { tasks: Arc::from([task]), thread_count: 2, ..Default::default() };
+                (Arc::new(HSDownloader::new(config)), save_path)
+            })
+            .collect();
+
+        for (downloader, _) in &downloaders {
+            downloader.spawn_run(false, |_| {}).await.unwrap();
+        }
+        tokio::time::sleep(Duration::from_millis(300)).await;
+
+        // 两个下载器同时运行，各自的总大小只包含自己的任务
+        for (downloader, _) in &downloaders {
+            assert_eq!(downloader.config.load().progress_monitor.expected_bytes(), 64 * 1024 * 1024);
+        }
+        for (downloader, save_path) in &downloaders {
+            downloader.stop_download().await.unwrap();
+            let _ = std::fs::remove_file(save_path);
+        }
+    }
+
+    #[test]
+    fn new_run_clears_previous_outcome() {
+        let downloader = HSDownloader::new(DownloadConfig { downloader_id: 2_000_001, ..Default::default() });
+        downloader.completion.finish(Outcome::Cancelled);
+        assert_eq!(crate::core::completion::recent_outcome(2_000_001), Some(Outcome::Cancelled));
+        downloader.completion.reset();
+        assert_eq!(downloader.completion.outcome(), None);
+        assert_eq!(crate::core::completion::recent_outcome(2_000_001), None);
+    }
+
+    #[tokio::test]
+    async fn stop_without_run_records_cancelled() {
+        let downloader = HSDownloader::new(DownloadConfig::default());
+        downloader.stop_download().await.unwrap();
+        assert_eq!(downloader.completion.outcome(), Some(Outcome::Cancelled));
+    }
+}
@@ -1,9 +1,9 @@
 use std::time::Instant;
 use std::sync::Arc;
-use tokio::sync::RwLock;
+use tokio_util::sync::CancellationToken;
 use super::websocket_client::WebSocketClient;
 use super::socket_client::SocketClient;
-use super::downloader::{DownloadChunk, DownloadConfig, DownloadTask};
+use super::downloader::{DownloadChunk, DownloadTask, SharedConfig};
 
 #[async_trait::async_trait]
 pub trait Downloader: Send + Sync {
@@ -21,8 +21,10 @@ pub struct BaseDownloader {
     pub chunks: Vec<DownloadChunk>,
     pub ws_client: Option<Arc<tokio::sync::Mutex<WebSocketClient>>>,
     pub socket_client: Option<Arc<tokio::sync::Mutex<SocketClient>>>,
-    pub config: Option<Arc<RwLock<DownloadConfig>>>,
+    pub config: Option<SharedConfig>,
     pub running: bool,
+    /// 本次运行的取消令牌（暂停/停止时取消），实现应在所有工作任务退出后再从 `download` 返回
+    pub cancel_token: CancellationToken,
 }
 
 impl BaseDownloader {
@@ -37,6 +39,7 @@ impl BaseDownloader {
             socket_client: None,
             config: None,
             running: true,
+            cancel_token: CancellationToken::new(),
         }
     }
 
@@ -0,0 +1,294 @@
+use std::io::Write;
+use std::sync::Arc;
+use super::downloader::{Event, EventType};
+
+/// 进度事件数据（字段名与旧版 Golang 接口保持一致），统计范围为发出事件的下载器的本次运行
+#[derive(Debug, Clone, Default)]
+pub struct ProgressData {
+    pub downloaded: i64,
+    pub total: i64,
+    pub current_speed_bps: f64,
+    pub average_speed_bps: f64,
+    pub peak_speed_bps: f64,
+    pub chunk_downloads: i64,
+    pub failed_chunks: i64,
+    pub retried_chunks: i64,
+    pub elapsed_time: f64,
+}
+
+/// 强类型事件数据
+///
+/// 取代原先的 `HashMap<String, serde_json::Value>`，每种输出格式各编码一次：
+/// 本地回调由投递器通过手写的 JSON writer 写入可复用缓冲区，Socket / WebSocket 由各自的写任务
+/// 按连接协商出的格式（旧版 JSON 帧或 MessagePack）另行编码，见 `remote_protocol`。
+#[derive(Debug, Clone)]
+pub enum EventData {
+    /// 无附带数据（start / end）
+    Empty,
+    /// 进度更新（update）
+    Progress(ProgressData),
+    /// 单个任务开始/结束（startOne / endOne）
+    Task {
+        url: Arc<str>,
+        save_path: Arc<str>,
+        show_name: Arc<str>,
+        index: usize,
+        total: usize,
+    },
+    /// 文本消息（msg）
+    Text(String),
+    /// 错误信息（err），失败时附带自动转储的飞行记录文件路径
+    Error {
+        message: String,
+        flight_recorder: Option<String>,
+    },
+}
+
+impl EventData {
+    /// 不带飞行记录的错误数据
+    pub fn error(message: String) -> Self {
+        EventData::Error { message, flight_recorder: None }
+    }
+
+    /// 以 JSON 对象形式写入 `out`，不做额外的堆分配（`out` 容量足够时）
+    pub fn write_json(&self, out: &mut Vec<u8>) {
+        self.write_fields(&mut JsonSink::new(out));
+    }
+
+    /// 按字段描述写入任意结构化输出（JSON / MessagePack 共用同一份字段表）
+    pub fn write_fields<S: FieldSink>(&self, sink: &mut S) {
+        match self {
+            EventData::Empty => {
+                sink.begin_map(0);
+                sink.end_map();
+            }
+            EventData::Progress(p) => {
+                const MB: f64 = 1024.0 * 1024.0;
+                sink.begin_map(13);
+                sink.key("Downloaded");
+                sink.int(p.downloaded);
+                sink.key("total_bytes");
+                sink.int(p.downloaded);
+                sink.key("Total");
+                sink.int(p.total);
+                sink.key("current_speed_bps");
+                sink.int(p.current_speed_bps as i64);
+                sink.key("current_speed_mbps");
+                sink.float(p.current_speed_bps / MB);
+                sink.key("average_speed_bps");
+                sink.int(p.average_speed_bps as i64);
+                sink.key("average_speed_mbps");
+                sink.float(p.average_speed_bps / MB);
+                sink.key("peak_speed_bps");
+                sink.int(p.peak_speed_bps as i64);
+                sink.key("peak_speed_mbps");
+                sink.float(p.peak_speed_bps / MB);
+                sink.key("chunk_downloads");
+                sink.int(p.chunk_downloads);
+                sink.key("failed_chunks");
+                sink.int(p.failed_chunks);
+                sink.key("retried_chunks");
+                sink.int(p.retried_chunks);
+                sink.key("elapsed_time");
+                sink.float(p.elapsed_time);
+                sink.end_map();
+            }
+            EventData::Task { url, save_path, show_name, index, total } => {
+                sink.begin_map(5);
+                sink.key("URL");
+                sink.str(url);
+                sink.key("SavePath");
+                sink.str(save_path);
+                sink.key("ShowName");
+                sink.str(show_name);
+                sink.key("Index");
+                sink.int(*index as i64 + 1);
+                sink.key("Total");
+                sink.int(*total as i64);
+                sink.end_map();
+            }
+            EventData::Text(text) => {
+                sink.begin_map(1);
+                sink.key("Text");
+                sink.str(text);
+                sink.end_map();
+            }
+            EventData::Error { message, flight_recorder } => {
+                sink.begin_map(if flight_recorder.is_some() { 2 } else { 1 });
+                sink.key("Error");
+                sink.str(message);
+                if let Some(path) = flight_recorder {
+                    sink.key("FlightRecorder");
+                    sink.str(path);
+                }
+                sink.end_map();
+            }
+        }
+    }
+}
+
+/// 结构化输出目标
+///
+/// `begin_map` 需要给出字段数（MessagePack 的 map 头部要求），JSON 实现忽略该值。
+pub trait FieldSink {
+    fn begin_map(&mut self, len: usize);
+    fn key(&mut self, key: &str);
+    fn int(&mut self, v: i64);
+    fn float(&mut self, v: f64);
+    fn str(&mut self, v: &str);
+    fn end_map(&mut self);
+}
+
+/// JSON 输出：非有限浮点数写为 0，字符串按 JSON 规则转义
+pub struct JsonSink<'a> {
+    out: &'a mut Vec<u8>,
+    need_comma: bool,
+}
+
+impl<'a> JsonSink<'a> {
+    pub fn new(out: &'a mut Vec<u8>) -> Self {
+        JsonSink { out, need_comma: false }
+    }
+}
+
+impl FieldSink for JsonSink<'_> {
+    fn begin_map(&mut self, _len: usize) {
+        self.out.push(b'{');
+        self.need_comma = false;
+    }
+
+    fn key(&mut self, key: &str) {
+        write_key(self.out, key, !self.need_comma);
+    }
+
+    fn int(&mut self, v: i64) {
+        write_i64(self.out, v);
+        self.need_comma = true;
+    }
+
+    fn float(&mut self, v: f64) {
+        write_f64(self.out, v);
+        self.need_comma = true;
+    }
+
+    fn str(&mut self, v: &str) {
+        write_str(self.out, v);
+        self.need_comma = true;
+    }
+
+    fn end_map(&mut self) {
+        self.out.push(b'}');
+        self.need_comma = true;
+    }
+}
+
+impl EventType {
+    /// 回调 JSON 中使用的类型名（与 serde rename 一致）
+    pub const fn as_str(&self) -> &'static str {
+        match self {
+            EventType::Start => "start",
+            EventType::StartOne => "startOne",
+            EventType::Update => "update",
+            EventType::End => "end",
+            EventType::EndOne => "endOne",
+            EventType::Msg => "msg",
+            EventType::Err => "err",
+        }
+    }
+
+    /// 远程协议中使用的类型名（沿用旧版 `format!("{:?}")` 的输出）
+    pub const fn remote_name(&self) -> &'static str {
+        match self {
+            EventType::Start => "Start",
+            EventType::StartOne => "StartOne",
+            EventType::Update => "Update",
+            EventType::End => "End",
+            EventType::EndOne => "EndOne",
+            EventType::Msg => "Msg",
+            EventType::Err => "Err",
+        }
+    }
+}
+
+/// 写入事件元数据 JSON：`{"Type":..,"Name":..,"ShowName":..,"ID":..}`
+pub fn write_event_json(event: &Event, out: &mut Vec<u8>) {
+    out.push(b'{');
+    write_key(out, "Type", true);
+    write_str(out, event.event_type.as_str());
+    write_key(out, "Name", false);
+    write_str(out, &event.name);
+    write_key(out, "ShowName", false);
+    write_str(out, &event.show_name);
+    write_key(out, "ID", false);
+    write_str(out, &event.id);
+    out.push(b'}');
+}
+
+/// 写入远程协议帧：`{"Type":"Update","Msg":"<data json>","Downloader":1}`
+///
+/// `data_json` 为已经序列化好的数据，这里只做一次字符串转义，不再重新序列化。
+/// `downloader_id` 为 0 时省略 `Downloader` 字段。
+pub fn write_remote_frame(event_type: &EventType, data_json: &[u8], downloader_id: i32, out: &mut Vec<u8>) {
+    out.extend_from_slice(b"{\"Type\":\"");
+    out.extend_from_slice(event_type.remote_name().as_bytes());
+    out.extend_from_slice(b"\",\"Msg\":");
+    write_escaped(out, data_json);
+    if downloader_id != 0 {
+        write_key(out, "Downloader", false);
+        write_i64(out, downloader_id as i64);
+    }
+    out.push(b'}');
+}
+
+fn write_key(out: &mut Vec<u8>, key: &str, first: bool) {
+    if !first {
+        out.push(b',');
+    }
+    write_str(out, key);
+    out.push(b':');
+}
+
+fn write_i64(out: &mut Vec<u8>, v: i64) {
+    let _ = write!(out, "{}", v);
+}
+
+fn write_f64(out: &mut Vec<u8>, v: f64) {
+    if v.is_finite() {
+        let _ = write!(out, "{}", v);
+    } else {
+        out.push(b'0');
+    }
+}
+
+fn write_str(out: &mut Vec<u8>, s: &str) {
+    write_escaped(out, s.as_bytes());
+}
+
+/// 按 JSON 规则转义并加上引号（输入必须是合法 UTF-8）
+fn write_escaped(out: &mut Vec<u8>, bytes: &[u8]) {
+    const HEX: &[u8; 16] = b"0123456789abcdef";
+
+    out.push(b'"');
+    let mut start = 0;
+    for (i, &b) in bytes.iter().enumerate() {
+        let escape: &[u8] = match b {
+            b'"' => b"\\\"",
+            b'\\' => b"\\\\",
+            b'\n' => b"\\n",
+            b'\r' => b"\\r",
+            b'\t' => b"\\t",
+            0x00..=0x1f => b"",
+            _ => continue,
+        };
+
+        out.extend_from_slice(&bytes[start..i]);
+        if escape.is_empty() {
+            out.extend_from_slice(&[b'\\', b'u', b'0', b'0', HEX[(b >> 4) as usize], HEX[(b & 0xf) as usize]]);
+        } else {
+            out.extend_from_slice(escape);
+        }
+        start = i + 1;
+    }
+    out.extend_from_slice(&bytes[start..]);
+    out.push(b'"');
+}
@@ -0,0 +1,465 @@
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU8, AtomicU64, AtomicUsize, Ordering};
+use std::sync::{mpsc, Arc, Mutex};
+use std::time::{Duration, Instant};
+use super::downloader::{Event, EventType, ProgressCallback};
+use super::event_data::{write_event_json, EventData};
+use super::flight_recorder::{FlightRecorder, RecordKind, NO_TASK};
+use super::socket_client::SocketClient;
+use super::websocket_client::WebSocketClient;
+
+/// 默认回调耗时预算（毫秒），超过后输出警告
+pub const DEFAULT_CALLBACK_BUDGET_MS: u64 = 50;
+/// 队列积压超过该值时丢弃进度事件（控制类事件永不丢弃）
+const CALLBACK_QUEUE_SOFT_LIMIT: usize = 4096;
+/// 慢回调、丢弃进度警告的最小输出间隔，避免刷屏
+const SLOW_CALLBACK_WARN_INTERVAL: Duration = Duration::from_secs(1);
+
+/// 投递方式：尚未决定 / 宿主驱动（poll_events）/ 已启动投递线程。只通过 CAS 转换，
+/// 保证两种方式不会同时消费队列
+const PUMP_IDLE: u8 = 0;
+const PUMP_HOST: u8 = 1;
+const PUMP_THREAD: u8 = 2;
+
+/// 进程内的事件接收端（例如守护进程把事件转发给 RPC 客户端），在投递线程上调用
+pub type EventSink = Arc<dyn Fn(&Event, &EventData) + Send + Sync>;
+
+enum DispatchItem {
+    Event { event: Event, data: EventData },
+    /// 在投递上下文中执行的通知；排在它之前入队的事件总是先投递完
+    Call(Box<dyn FnOnce() + Send>),
+}
+
+/// 回调序列化缓冲区，每个投递上下文持有一份并反复复用
+#[derive(Default)]
+pub struct EventBuffers {
+    event: Vec<u8>,
+    data: Vec<u8>,
+}
+
+impl EventBuffers {
+    /// 序列化一个事件：事件 JSON、数据 JSON 各写一次
+    ///
+    /// 返回后 `event_cstr`/`data_cstr` 为以 NUL 结尾的 C 字符串。
+    /// 远程输出端的帧不复用这里的结果，由各自的写任务按连接协商出的格式再编码一次，见 `remote_protocol`。
+    pub fn encode(&mut self, event: &Event, data: &EventData) {
+        self.event.clear();
+        self.data.clear();
+
+        write_event_json(event, &mut self.event);
+        self.event.push(0);
+
+        data.write_json(&mut self.data);
+        self.data.push(0);
+    }
+
+    pub fn event_cstr(&self) -> *const std::ffi::c_char {
+        self.event.as_ptr() as *const std::ffi::c_char
+    }
+
+    pub fn data_cstr(&self) -> *const std::ffi::c_char {
+        self.data.as_ptr() as *const std::ffi::c_char
+    }
+}
+
+#[derive(Default)]
+struct DispatcherStats {
+    queue_depth: AtomicUsize,
+    max_queue_depth: AtomicUsize,
+    delivered: AtomicU64,
+    /// 队列积压超过 CALLBACK_QUEUE_SOFT_LIMIT 时丢弃的进度事件数
+    dropped_updates: AtomicU64,
+    /// 投递端已退出、无法入队的事件与通知数
+    dropped_messages: AtomicU64,
+    slow_callbacks: AtomicU64,
+    total_callback_ns: AtomicU64,
+    max_callback_ns: AtomicU64,
+}
+
+struct DispatcherShared {
+    callback: Option<ProgressCallback>,
+    /// 进程内接收端：创建时指定，或之后由 `install_sink` 设置一次
+    sink: Mutex<Option<EventSink>>,
+    ws_client: Option<WebSocketClient>,
+    socket_client: Option<SocketClient>,
+    recorder: Arc<FlightRecorder>,
+    receiver: Mutex<mpsc::Receiver<DispatchItem>>,
+    pump_buffers: Mutex<EventBuffers>,
+    stats: DispatcherStats,
+    budget_ns: AtomicU64,
+    pump_state: AtomicU8,
+    last_slow_warn: Mutex<Option<Instant>>,
+    last_drop_warn: Mutex<Option<Instant>>,
+}
+
+/// 事件投递器
+///
+/// 本地输出端（外部回调、进程内接收端）的事件先进入队列，再由专用的投递线程
+/// （或宿主通过 `poll_events` 自行驱动）序列化并调用；慢回调（GIL、跨语言封送、日志等）不会再占用 tokio 工作线程。
+/// 远程输出端（Socket、WebSocket）不经过投递线程，由 `send` 在产生事件的任务中直接放入其发送队列。
+pub struct EventDispatcher {
+    sender: mpsc::Sender<DispatchItem>,
+    shared: Arc<DispatcherShared>,
+}
+
+impl std::fmt::Debug for EventDispatcher {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("EventDispatcher")
+            .field("queue_depth", &self.shared.stats.queue_depth.load(Ordering::Relaxed))
+            .field("host_pump", &self.shared.is_host_pump())
+            .finish()
+    }
+}
+
+impl EventDispatcher {
+    pub fn new(
+        callback: Option<ProgressCallback>,
+        sink: Option<EventSink>,
+        budget_ms: u64,
+        ws_client: Option<WebSocketClient>,
+        socket_client: Option<SocketClient>,
+        recorder: Arc<FlightRecorder>,
+    ) -> Self {
+        Self::build(callback, sink, budget_ms, ws_client, socket_client, recorder)
+    }
+
+    /// 创建只输出到进程内接收端的投递器（不经过 C 回调与远程回调地址）
+    pub fn with_event_sink(sink: EventSink, budget_ms: u64, recorder: Arc<FlightRecorder>) -> Self {
+        Self::build(None, Some(sink), budget_ms, None, None, recorder)
+    }
+
+    fn build(
+        callback: Option<ProgressCallback>,
+        sink: Option<EventSink>,
+        budget_ms: u64,
+        ws_client: Option<WebSocketClient>,
+        socket_client: Option<SocketClient>,
+        recorder: Arc<FlightRecorder>,
+    ) -> Self {
+        let (sender, receiver) = mpsc::channel();
+        EventDispatcher {
+            sender,
+            shared: Arc::new(DispatcherShared {
+                callback,
+                sink: Mutex::new(sink),
+                ws_client,
+                socket_client,
+                recorder,
+                receiver: Mutex::new(receiver),
+                pump_buffers: Mutex::new(EventBuffers::default()),
+                stats: DispatcherStats::default(),
+                budget_ns: AtomicU64::new(budget_ms.saturating_mul(1_000_000)),
+                pump_state: AtomicU8::new(PUMP_IDLE),
+                last_slow_warn: Mutex::new(None),
+                last_drop_warn: Mutex::new(None),
+            }),
+        }
+    }
+
+    /// 把事件交给所有输出端
+    ///
+    /// 本地输出端只入队、不等待；远程输出端的发送队列满时，控制类事件在这里等待空间，
+    /// 背压落在调用方（下载任务）上，而不是同时负责宿主回调的投递线程。
+    pub async fn send(&self, event: Event, data: EventData) {
+        let shared = &self.shared;
+        if shared.ws_client.is_none() && shared.socket_client.is_none() {
+            return self.dispatch(event, data);
+        }
+        if shared.has_local_sinks() {
+            self.dispatch(event.clone(), data.clone());
+        }
+
+        // 每个下载器最多只有一个远程输出端，事件直接移交给它（共享连接）的写任务
+        if let Some(ref ws_client) = shared.ws_client {
+            ws_client.send_event(event, data).await;
+        } else if let Some(ref socket_client) = shared.socket_client {
+            socket_client.send_event(event, data).await;
+        }
+    }
+
+    /// 将事件放入本地输出端的投递队列，不会阻塞调用方；远程输出端由 `send` 负责
+    pub fn dispatch(&self, event: Event, data: EventData) {
+        if !self.shared.has_local_sinks() {
+            let has_remote = self.shared.ws_client.is_some() || self.shared.socket_client.is_some();
+            if !has_remote && event.event_type != EventType::Update {
+                eprintln!("警告: 没有回调函数 (event {:?}, data {:?})", event.name, data);
+            }
+            return;
+        }
+
+        let stats = &self.shared.stats;
+        let depth = stats.queue_depth.load(Ordering::Relaxed);
+        if event.event_type == EventType::Update && depth >= CALLBACK_QUEUE_SOFT_LIMIT {
+            let dropped = stats.dropped_updates.fetch_add(1, Ordering::Relaxed) + 1;
+            self.shared.recorder.record(RecordKind::BackpressureWait, NO_TASK, depth as i64, event.event_type.mask_bit() as i64);
+
+            let mut last_warn = self.shared.last_drop_warn.lock().unwrap();
+            if last_warn.map_or(true, |t| t.elapsed() >= SLOW_CALLBACK_WARN_INTERVAL) {
+                *last_warn = Some(Instant::now());
+                eprintln!("警告: 回调队列积压 {}，已丢弃 {} 个进度事件（控制类事件不受影响）", depth, dropped);
+            }
+            return;
+        }
+
+        self.enqueue(DispatchItem::Event { event, data });
+    }
+
+    /// 把通知排进投递队列：在投递线程（宿主驱动模式下为 `poll_events` 的调用线程）上执行，
+    /// 执行时之前入队的事件都已投递。用于结束通知等需要排在最后一个事件之后的场合
+    pub fn dispatch_call(&self, call: Box<dyn FnOnce() + Send>) {
+        self.enqueue(DispatchItem::Call(call));
+    }
+
+    /// 设置进程内接收端；已有接收端时不替换，返回 false
+    pub fn install_sink(&self, sink: EventSink) -> bool {
+        let mut current = self.shared.sink.lock().unwrap();
+        if current.is_some() {
+            return false;
+        }
+        *current = Some(sink);
+        true
+    }
+
+    fn enqueue(&self, item: DispatchItem) {
+        self.ensure_thread();
+
+        let stats = &self.shared.stats;
+        let depth = stats.queue_depth.fetch_add(1, Ordering::Relaxed) + 1;
+        stats.max_queue_depth.fetch_max(depth, Ordering::Relaxed);
+        if self.sender.send(item).is_err() {
+            stats.queue_depth.fetch_sub(1, Ordering::Relaxed);
+            stats.dropped_messages.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    /// 设置单次回调的耗时预算（毫秒）
+    pub fn set_budget_ms(&self, budget_ms: u64) {
+        self.shared.budget_ns.store(budget_ms.saturating_mul(1_000_000), Ordering::Relaxed);
+    }
+
+    /// 切换为宿主驱动模式：不再启动投递线程，由宿主调用 `poll_events` 在自己的线程上接收回调
+    ///
+    /// 投递线程已经启动后无法切换，返回 false。与首次投递并发调用时，两者只有一方生效。
+    pub fn set_host_pump(&self, enabled: bool) -> bool {
+        let (from, to) = if enabled { (PUMP_IDLE, PUMP_HOST) } else { (PUMP_HOST, PUMP_IDLE) };
+        match self.shared.pump_state.compare_exchange(from, to, Ordering::AcqRel, Ordering::Acquire) {
+            Ok(_) => true,
+            Err(current) => current == to,
+        }
+    }
+
+    /// 宿主驱动模式下，在调用线程上投递最多 `max_events` 个事件，返回实际投递数量
+    pub fn poll_events(&self, max_events: usize) -> usize {
+        if !self.shared.is_host_pump() {
+            return 0;
+        }
+
+        let receiver = match self.shared.receiver.try_lock() {
+            Ok(r) => r,
+            Err(_) => return 0,
+        };
+
+        let mut buffers = self.shared.pump_buffers.lock().unwrap();
+        let mut delivered = 0;
+        while delivered < max_events {
+            match receiver.try_recv() {
+                Ok(item) => {
+                    self.shared.deliver(item, &mut buffers);
+                    delivered += 1;
+                }
+                Err(_) => break,
+            }
+        }
+        delivered
+    }
+
+    pub fn get_stats(&self) -> HashMap<String, serde_json::Value> {
+        let stats = &self.shared.stats;
+        let delivered = stats.delivered.load(Ordering::Relaxed);
+        let total_ns = stats.total_callback_ns.load(Ordering::Relaxed);
+        let avg_us = if delivered > 0 { total_ns / delivered / 1000 } else { 0 };
+
+        let mut map = HashMap::new();
+        map.insert("queue_depth".to_string(), serde_json::Value::from(stats.queue_depth.load(Ordering::Relaxed)));
+        map.insert("max_queue_depth".to_string(), serde_json::Value::from(stats.max_queue_depth.load(Ordering::Relaxed)));
+        map.insert("delivered".to_string(), serde_json::Value::from(delivered));
+        map.insert("dropped_updates".to_string(), serde_json::Value::from(stats.dropped_updates.load(Ordering::Relaxed)));
+        map.insert("dropped_messages".to_string(), serde_json::Value::from(stats.dropped_messages.load(Ordering::Relaxed)));
+        map.insert("slow_callbacks".to_string(), serde_json::Value::from(stats.slow_callbacks.load(Ordering::Relaxed)));
+        map.insert("avg_callback_us".to_string(), serde_json::Value::from(avg_us));
+        map.insert("max_callback_us".to_string(), serde_json::Value::from(stats.max_callback_ns.load(Ordering::Relaxed) / 1000));
+        map.insert("host_pump".to_string(), serde_json::Value::from(self.shared.is_host_pump()));
+        map
+    }
+
+    fn ensure_thread(&self) {
+        // 只有从 IDLE 抢到 THREAD 的一方创建线程；宿主驱动模式或线程已启动时直接返回
+        if self.shared.pump_state
+            .compare_exchange(PUMP_IDLE, PUMP_THREAD, Ordering::AcqRel, Ordering::Acquire)
+            .is_err()
+        {
+            return;
+        }
+
+        let shared = self.shared.clone();
+        let result = std::thread::Builder::new()
+            .name("tthsd-callback".to_string())
+            .spawn(move || {
+                let receiver = shared.receiver.lock().unwrap();
+                let mut buffers = EventBuffers::default();
+                // 所有 sender 被释放（下载器销毁）后，队列中剩余的事件仍会先投递完再退出
+                while let Ok(item) = receiver.recv() {
+                    shared.deliver(item, &mut buffers);
+                }
+            });
+
+        if let Err(e) = result {
+            eprintln!("创建回调投递线程失败: {:?}", e);
+            self.shared.pump_state.store(PUMP_IDLE, Ordering::Release);
+        }
+    }
+}
+
+impl DispatcherShared {
+    fn is_host_pump(&self) -> bool {
+        self.pump_state.load(Ordering::Acquire) == PUMP_HOST
+    }
+
+    fn has_local_sinks(&self) -> bool {
+        self.callback.is_some() || self.sink.lock().unwrap().is_some()
+    }
+
+    fn deliver(&self, item: DispatchItem, buffers: &mut EventBuffers) {
+        self.stats.queue_depth.fetch_sub(1, Ordering::Relaxed);
+
+        let (event, data) = match item {
+            DispatchItem::Event { event, data } => (event, data),
+            DispatchItem::Call(call) => return call(),
+        };
+
+        if let Some(callback) = self.callback {
+            self.invoke_callback(callback, &event, &data, buffers);
+        }
+        // 接收端在锁外调用，它自己可以再访问下载器
+        let sink = self.sink.lock().unwrap().clone();
+        if let Some(sink) = sink {
+            sink(&event, &data);
+        }
+    }
+
+    fn invoke_callback(&self, callback: ProgressCallback, event: &Event, data: &EventData, buffers: &mut EventBuffers) {
+        buffers.encode(event, data);
+
+        let started = Instant::now();
+        callback(buffers.event_cstr(), buffers.data_cstr());
+        let elapsed = started.elapsed();
+        let elapsed_ns = elapsed.as_nanos().min(u64::MAX as u128) as u64;
+
+        self.stats.delivered.fetch_add(1, Ordering::Relaxed);
+        self.stats.total_callback_ns.fetch_add(elapsed_ns, Ordering::Relaxed);
+        self.stats.max_callback_ns.fetch_max(elapsed_ns, Ordering::Relaxed);
+
+        let budget_ns = self.budget_ns.load(Ordering::Relaxed);
+        if budget_ns > 0 && elapsed_ns > budget_ns {
+            self.stats.slow_callbacks.fetch_add(1, Ordering::Relaxed);
+
+            let mut last_warn = self.last_slow_warn.lock().unwrap();
+            if last_warn.map_or(true, |t| t.elapsed() >= SLOW_CALLBACK_WARN_INTERVAL) {
+                *last_warn = Some(Instant::now());
+                eprintln!(
+                    "警告: 回调耗时 {:.1}ms 超过预算 {}ms (event {:?}, 队列积压 {})",
+                    elapsed.as_secs_f64() * 1000.0,
+                    budget_ns / 1_000_000,
+                    event.event_type,
+                    self.stats.queue_depth.load(Ordering::Relaxed)
+                );
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::Barrier;
+
+    fn event(event_type: EventType, id: &str) -> Event {
+        Event { event_type, name: "", show_name: Arc::from(""), id: Arc::from(id) }
+    }
+
+    /// 记录每次接收端调用所在的线程
+    fn recording_sink() -> (EventSink, Arc<Mutex<Vec<std::thread::ThreadId>>>) {
+        let calls = Arc::new(Mutex::new(Vec::new()));
+        let recorded = calls.clone();
+        let sink: EventSink = Arc::new(move |_: &Event, _: &EventData| {
+            recorded.lock().unwrap().push(std::thread::current().id());
+        });
+        (sink, calls)
+    }
+
+    #[test]
+    fn host_pump_and_first_dispatch_never_both_win() {
+        for _ in 0..200 {
+            let (sink, calls) = recording_sink();
+            let dispatcher = Arc::new(EventDispatcher::with_event_sink(sink, 0, Arc::new(FlightRecorder::new())));
+            let barrier = Arc::new(Barrier::new(2));
+
+            let producer = {
+                let (dispatcher, barrier) = (dispatcher.clone(), barrier.clone());
+                std::thread::spawn(move || {
+                    barrier.wait();
+                    for _ in 0..8 {
+                        dispatcher.dispatch(event(EventType::Msg, "0"), EventData::Text(String::new()));
+                    }
+                })
+            };
+            barrier.wait();
+            let host_pump = dispatcher.set_host_pump(true);
+            producer.join().unwrap();
+
+            if host_pump {
+                // 宿主驱动模式生效：投递线程从未启动，事件全部由 poll_events 在本线程投递
+                assert_eq!(dispatcher.poll_events(usize::MAX), 8);
+                let calls = calls.lock().unwrap();
+                assert_eq!(calls.len(), 8);
+                assert!(calls.iter().all(|t| *t == std::thread::current().id()));
+            } else {
+                assert_eq!(dispatcher.poll_events(usize::MAX), 0);
+                let deadline = Instant::now() + Duration::from_secs(5);
+                while calls.lock().unwrap().len() < 8 && Instant::now() < deadline {
+                    std::thread::sleep(Duration::from_millis(1));
+                }
+                let calls = calls.lock().unwrap();
+                assert_eq!(calls.len(), 8);
+                assert!(calls.iter().all(|t| *t != std::thread::current().id()));
+            }
+        }
+    }
+
+    #[test]
+    fn set_host_pump_fails_after_thread_started() {
+        let (sink, _calls) = recording_sink();
+        let dispatcher = EventDispatcher::with_event_sink(sink, 0, Arc::new(FlightRecorder::new()));
+        dispatcher.dispatch(event(EventType::Start, ""), EventData::Empty);
+        assert!(!dispatcher.set_host_pump(true));
+        assert_eq!(dispatcher.get_stats()["host_pump"], false);
+    }
+
+    #[test]
+    fn updates_over_soft_limit_are_counted_and_control_events_kept() {
+        let (sink, calls) = recording_sink();
+        let dispatcher = EventDispatcher::with_event_sink(sink, 0, Arc::new(FlightRecorder::new()));
+        assert!(dispatcher.set_host_pump(true));
+
+        let extra = 10;
+        for _ in 0..CALLBACK_QUEUE_SOFT_LIMIT + extra {
+            dispatcher.dispatch(event(EventType::Update, ""), EventData::Progress(Default::default()));
+        }
+        dispatcher.dispatch(event(EventType::End, ""), EventData::Empty);
+
+        let stats = dispatcher.get_stats();
+        assert_eq!(stats["dropped_updates"], extra as u64);
+        assert_eq!(dispatcher.poll_events(usize::MAX), CALLBACK_QUEUE_SOFT_LIMIT + 1);
+        assert_eq!(calls.lock().unwrap().len(), CALLBACK_QUEUE_SOFT_LIMIT + 1);
+    }
+}
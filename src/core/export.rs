@@ -1,26 +1,132 @@
-use std::collections::HashMap;
-use std::sync::{Arc, Mutex};
-use tokio::sync::RwLock;
-use super::downloader::{HSDownloader, DownloadTask, DownloadConfig, Event, EventType, UA};
-use super::send_message::send_message;
-
-lazy_static::lazy_static! {
-    static ref RUNTIME: tokio::runtime::Runtime = tokio::runtime::Builder::new_multi_thread()
-        .enable_all()
-        .build()
-        .unwrap();
+use std::sync::Arc;
+use std::time::Duration;
+use super::completion::{self, Completion, WaitResult};
+use super::downloader::{HSDownloader, DownloadTask, DownloadConfig, ConfigUpdate, Event, UA, EVENT_MASK_ALL, DEFAULT_PROGRESS_INTERVAL_MS, DEFAULT_PROGRESS_BATCH_BYTES};
+use super::event_data::EventData;
+use super::event_dispatcher::{EventBuffers, EventSink, DEFAULT_CALLBACK_BUDGET_MS};
+use super::power::{self, PowerProfile};
+use super::registry::{self, Registry};
+use super::runtime::{self, RuntimeConfig, DEFAULT_THREAD_NAME_PREFIX};
+
+fn get_downloaders() -> &'static Registry<HSDownloader> {
+    static DOWNLOADERS: once_cell::sync::Lazy<Registry<HSDownloader>> =
+        once_cell::sync::Lazy::new(Registry::new);
+    &DOWNLOADERS
 }
 
-fn get_downloaders() -> &'static Mutex<HashMap<i32, Arc<RwLock<HSDownloader>>>> {
-    static DOWNLOADERS: once_cell::sync::Lazy<Mutex<HashMap<i32, Arc<RwLock<HSDownloader>>>>> =
-        once_cell::sync::Lazy::new(|| Mutex::new(HashMap::new()));
-    &DOWNLOADERS
+/// `tthsd_wait` / `tthsd_wait_any` 超时时的返回值（对应 `TTHSD_WAIT_TIMEOUT`）
+pub const WAIT_TIMEOUT: i32 = -2;
+
+/// 进度上报参数（对应 C 头文件中的 `TTHSD_ProgressOptions`）
+///
+/// 所有字段为 0 时使用默认值：500ms 上报间隔、512KB 批量提交、每个周期都上报。
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct ProgressOptions {
+    /// 进度上报间隔（毫秒），0 = 默认 500ms
+    pub interval_ms: u32,
+    /// 分块内批量提交阈值（字节），0 = 默认 512KB
+    pub batch_bytes: u32,
+    /// 进度变化超过该百分比才上报，0 = 不启用
+    pub min_delta_percent: f64,
+    /// 进度变化超过该字节数才上报，0 = 不启用
+    pub min_delta_bytes: i64,
+}
+
+/// 回调投递参数（对应 C 头文件中的 `TTHSD_CallbackOptions`）
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct CallbackOptions {
+    /// 单次回调耗时预算（毫秒），超过后输出警告，0 = 默认 50ms
+    pub budget_ms: u32,
+    /// 是否由宿主调用 `tthsd_poll_events` 在自己的线程上接收回调（不创建投递线程）
+    pub host_pump: bool,
 }
 
-fn get_downloader_id() -> &'static Mutex<i32> {
-    static DOWNLOADER_ID: once_cell::sync::Lazy<Mutex<i32>> =
-        once_cell::sync::Lazy::new(|| Mutex::new(0));
-    &DOWNLOADER_ID
+/// `ConfigPatch::fields` 中的位：对应字段需要修改
+pub const PATCH_THREAD_COUNT: u32 = 1 << 0;
+pub const PATCH_CHUNK_SIZE: u32 = 1 << 1;
+pub const PATCH_RATE_LIMIT: u32 = 1 << 2;
+pub const PATCH_PROGRESS_INTERVAL: u32 = 1 << 3;
+pub const PATCH_USER_AGENT: u32 = 1 << 4;
+
+/// 运行中修改的下载参数（对应 C 头文件中的 `TTHSD_ConfigPatch`），只应用 `fields` 中标记的字段
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct ConfigPatch {
+    /// PATCH_* 按位或
+    pub fields: u32,
+    pub thread_count: u32,
+    pub chunk_size_mb: u32,
+    /// 限速（字节/秒），0 = 不限速
+    pub rate_limit_bps: u64,
+    /// 进度上报间隔（毫秒），0 = 默认 500ms
+    pub progress_interval_ms: u32,
+    pub user_agent: *const std::ffi::c_char,
+}
+
+/// 运行时参数（对应 C 头文件中的 `TTHSD_RuntimeConfig`），字段为 0 / NULL 时使用默认值
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct RuntimeOptions {
+    /// 工作线程数，0 = CPU 核数
+    pub worker_threads: u32,
+    /// 阻塞线程池上限，0 = 默认 512
+    pub max_blocking_threads: u32,
+    /// 线程名前缀，NULL = "tthsd-worker"
+    pub thread_name_prefix: *const std::ffi::c_char,
+    /// 允许运行时线程使用的 CPU 编号（仅 Linux/Android），NULL = 不限制
+    pub cpu_affinity: *const u32,
+    pub cpu_affinity_len: u32,
+    /// 单线程模式
+    pub current_thread: bool,
+}
+
+/// 配置全局运行时，必须在创建第一个下载器之前调用；`options` 为 NULL 时按默认参数立即创建
+///
+/// 返回值: 0=成功，-1=运行时已创建或参数无效
+#[unsafe(no_mangle)]
+pub extern "C" fn tthsd_init(options: *const RuntimeOptions) -> i32 {
+    let config = if options.is_null() {
+        RuntimeConfig::default()
+    } else {
+        let options = unsafe { *options };
+        let thread_name_prefix = if options.thread_name_prefix.is_null() {
+            DEFAULT_THREAD_NAME_PREFIX.to_string()
+        } else {
+            match unsafe { std::ffi::CStr::from_ptr(options.thread_name_prefix) }.to_str() {
+                Ok(s) if !s.is_empty() => s.to_string(),
+                Ok(_) => DEFAULT_THREAD_NAME_PREFIX.to_string(),
+                Err(e) => {
+                    eprintln!("转换线程名前缀失败: {:?}", e);
+                    return -1;
+                }
+            }
+        };
+        let cpu_affinity = if options.cpu_affinity.is_null() || options.cpu_affinity_len == 0 {
+            Vec::new()
+        } else {
+            unsafe { std::slice::from_raw_parts(options.cpu_affinity, options.cpu_affinity_len as usize) }
+                .iter()
+                .map(|&cpu| cpu as usize)
+                .collect()
+        };
+        RuntimeConfig {
+            worker_threads: (options.worker_threads > 0).then_some(options.worker_threads as usize),
+            max_blocking_threads: (options.max_blocking_threads > 0).then_some(options.max_blocking_threads as usize),
+            thread_name_prefix,
+            cpu_affinity,
+            current_thread: options.current_thread,
+        }
+    };
+
+    match runtime::init(config) {
+        Ok(()) => 0,
+        Err(e) => {
+            eprintln!("{}", e);
+            -1
+        }
+    }
 }
 
 #[unsafe(no_mangle)]
@@ -88,61 +194,37 @@ pub extern "C" fn start_download(
         None
     };
 
-    let config = DownloadConfig {
-        tasks,
-        thread_count: thread_count as usize,
-        chunk_size_mb: chunk_size_mb as usize,
-        callback_func,
-        use_callback_url,
-        callback_url,
-        use_socket: use_socket_val,
-        show_name: String::new(),
-        user_agent: UA.to_string(),
-    };
-
-    let downloader = Arc::new(RwLock::new(HSDownloader::new(config)));
-
-    let downloader_id = {
-        let mut id = get_downloader_id().lock().unwrap();
-        *id += 1;
-        *id
+    // ID 在创建前分配，远程回调消息会带上该 ID 以区分共享连接上的下载器
+    let registered = get_downloaders().insert_with(|downloader_id| {
+        let config = DownloadConfig {
+            tasks: tasks.into(),
+            thread_count: thread_count as usize,
+            chunk_size_mb: chunk_size_mb as usize,
+            callback_func,
+            use_callback_url,
+            callback_url,
+            use_socket: use_socket_val,
+            show_name: String::new(),
+            user_agent: UA.to_string(),
+            downloader_id,
+            ..Default::default()
+        };
+        // 在运行时上下文中创建，远程回调客户端会在运行时上启动写任务
+        let _guard = runtime::get().enter();
+        HSDownloader::new(config)
+    });
+    let Some((downloader_id, downloader)) = registered else {
+        eprintln!("下载器数量已达上限 ({})", registry::CAPACITY);
+        return -1;
     };
 
-    {
-        let mut downloaders = get_downloaders().lock().unwrap();
-        downloaders.insert(downloader_id, downloader.clone());
+    let started = runtime::get().block_on(downloader.spawn_run(is_multiple_val, move |_| {
+        get_downloaders().remove(downloader_id);
+    }));
+    if let Err(e) = started {
+        eprintln!("启动下载失败: {}", e);
     }
 
-    let downloader_clone = downloader.clone();
-    RUNTIME.spawn(async move {
-        let result = if is_multiple_val {
-            downloader_clone.read().await.start_multiple_downloads().await
-        } else {
-            downloader_clone.read().await.start_download().await
-        };
-
-        if let Err(e) = result {
-            let event = Event {
-                event_type: EventType::Err,
-                name: "错误".to_string(),
-                show_name: String::new(),
-                id: String::new(),
-            };
-
-            let mut data = HashMap::new();
-            data.insert("Error".to_string(), serde_json::Value::String(e.to_string()));
-
-            let config = downloader_clone.read().await.config.clone();
-            let ws_client = downloader_clone.read().await.ws_client.clone();
-            let socket_client = downloader_clone.read().await.socket_client.clone();
-
-            let _ = send_message(event, data, &config, &ws_client, &socket_client).await;
-        }
-
-        let mut downloaders = get_downloaders().lock().unwrap();
-        downloaders.remove(&downloader_id);
-    });
-
     downloader_id
 }
 
@@ -197,68 +279,50 @@ pub extern "C" fn get_downloader(
         None
     };
 
-    let config = DownloadConfig {
-        tasks,
-        thread_count: thread_count as usize,
-        chunk_size_mb: chunk_size_mb as usize,
-        callback_func,
-        use_callback_url,
-        callback_url,
-        use_socket: use_socket_val,
-        show_name: String::new(),
-        user_agent: UA.to_string(),
-    };
-
-    let downloader = Arc::new(RwLock::new(HSDownloader::new(config)));
-
-    let downloader_id = {
-        let mut id = get_downloader_id().lock().unwrap();
-        *id += 1;
-        *id
+    // ID 在创建前分配，远程回调消息会带上该 ID 以区分共享连接上的下载器
+    let registered = get_downloaders().insert_with(|downloader_id| {
+        let config = DownloadConfig {
+            tasks: tasks.into(),
+            thread_count: thread_count as usize,
+            chunk_size_mb: chunk_size_mb as usize,
+            callback_func,
+            use_callback_url,
+            callback_url,
+            use_socket: use_socket_val,
+            show_name: String::new(),
+            user_agent: UA.to_string(),
+            downloader_id,
+            ..Default::default()
+        };
+        // 在运行时上下文中创建，远程回调客户端会在运行时上启动写任务
+        let _guard = runtime::get().enter();
+        HSDownloader::new(config)
+    });
+    let Some((downloader_id, _)) = registered else {
+        eprintln!("下载器数量已达上限 ({})", registry::CAPACITY);
+        return -1;
     };
 
-    {
-        let mut downloaders = get_downloaders().lock().unwrap();
-        downloaders.insert(downloader_id, downloader);
-    }
-
     downloader_id
 }
 
 #[unsafe(no_mangle)]
 pub extern "C" fn start_download_id(id: i32) -> i32 {
-    let downloaders = get_downloaders().lock().unwrap();
-    let downloader = downloaders.get(&id).cloned();
-    drop(downloaders);
+    let downloader = get_downloaders().get(id);
 
     match downloader {
         Some(d) => {
-            let d_clone = d.clone();
-            RUNTIME.spawn(async move {
-                let result = d_clone.read().await.start_download().await;
-
-                if let Err(e) = result {
-                    let event = Event {
-                        event_type: EventType::Err,
-                        name: "错误".to_string(),
-                        show_name: String::new(),
-                        id: String::new(),
-                    };
-
-                    let mut data = HashMap::new();
-                    data.insert("Error".to_string(), serde_json::Value::String(e.to_string()));
-
-                    let config = d_clone.read().await.config.clone();
-                    let ws_client = d_clone.read().await.ws_client.clone();
-                    let socket_client = d_clone.read().await.socket_client.clone();
-
-                    let _ = send_message(event, data, &config, &ws_client, &socket_client).await;
+            // 同步登记运行：已在运行时返回 -1，不记录结局、也不移出注册表，正在进行的运行不受影响
+            let started = runtime::get().block_on(d.spawn_run(false, move |_| {
+                get_downloaders().remove(id);
+            }));
+            match started {
+                Ok(()) => 0,
+                Err(e) => {
+                    eprintln!("启动下载失败: {}", e);
+                    -1
                 }
-
-                let mut downloaders = get_downloaders().lock().unwrap();
-                downloaders.remove(&id);
-            });
-            0
+            }
         }
         None => -1,
     }
@@ -266,38 +330,21 @@ pub extern "C" fn start_download_id(id: i32) -> i32 {
 
 #[unsafe(no_mangle)]
 pub extern "C" fn start_multiple_downloads_id(id: i32) -> i32 {
-    let downloaders = get_downloaders().lock().unwrap();
-    let downloader = downloaders.get(&id).cloned();
-    drop(downloaders);
+    let downloader = get_downloaders().get(id);
 
     match downloader {
         Some(d) => {
-            let d_clone = d.clone();
-            RUNTIME.spawn(async move {
-                let result = d_clone.read().await.start_multiple_downloads().await;
-
-                if let Err(e) = result {
-                    let event = Event {
-                        event_type: EventType::Err,
-                        name: "错误".to_string(),
-                        show_name: String::new(),
-                        id: String::new(),
-                    };
-
-                    let mut data = HashMap::new();
-                    data.insert("Error".to_string(), serde_json::Value::String(e.to_string()));
-
-                    let config = d_clone.read().await.config.clone();
-                    let ws_client = d_clone.read().await.ws_client.clone();
-                    let socket_client = d_clone.read().await.socket_client.clone();
-
-                    let _ = send_message(event, data, &config, &ws_client, &socket_client).await;
+            // 同步登记运行：已在运行时返回 -1，不记录结局、也不移出注册表，正在进行的运行不受影响
+            let started = runtime::get().block_on(d.spawn_run(true, move |_| {
+                get_downloaders().remove(id);
+            }));
+            match started {
+                Ok(()) => 0,
+                Err(e) => {
+                    eprintln!("启动下载失败: {}", e);
+                    -1
                 }
-
-                let mut downloaders = get_downloaders().lock().unwrap();
-                downloaders.remove(&id);
-            });
-            0
+            }
         }
         None => -1,
     }
@@ -305,14 +352,12 @@ pub extern "C" fn start_multiple_downloads_id(id: i32) -> i32 {
 
 #[unsafe(no_mangle)]
 pub extern "C" fn pause_download(id: i32) -> i32 {
-    let downloaders = get_downloaders().lock().unwrap();
-    let downloader = downloaders.get(&id).cloned();
-    drop(downloaders);
+    let downloader = get_downloaders().get(id);
 
     match downloader {
         Some(d) => {
-            RUNTIME.block_on(async {
-                d.read().await.pause_download().await;
+            runtime::get().block_on(async {
+                d.pause_download().await;
             });
             0
         }
@@ -322,18 +367,20 @@ pub extern "C" fn pause_download(id: i32) -> i32 {
 
 #[unsafe(no_mangle)]
 pub extern "C" fn resume_download(id: i32) -> i32 {
-    let downloaders = get_downloaders().lock().unwrap();
-    let downloader = downloaders.get(&id).cloned();
-    drop(downloaders);
+    let downloader = get_downloaders().get(id);
 
     match downloader {
         Some(d) => {
-            let result = RUNTIME.block_on(async {
-                d.read().await.resume_download().await
-            });
-            match result {
-                Ok(_) => 0,
-                Err(_) => -1,
+            // 与启动相同：登记失败（仍在运行）时返回 -1，不影响正在进行的运行
+            let resumed = runtime::get().block_on(d.resume_download(move |_| {
+                get_downloaders().remove(id);
+            }));
+            match resumed {
+                Ok(()) => 0,
+                Err(e) => {
+                    eprintln!("恢复下载失败: {}", e);
+                    -1
+                }
             }
         }
         None => -1,
@@ -342,15 +389,15 @@ pub extern "C" fn resume_download(id: i32) -> i32 {
 
 #[unsafe(no_mangle)]
 pub extern "C" fn stop_download(id: i32) -> i32 {
-    let mut downloaders = get_downloaders().lock().unwrap();
-    let downloader = downloaders.remove(&id);
-    drop(downloaders);
+    // 停止（记录结局）之后才移出注册表，等待者不会看到"已移除但没有结局"的中间状态
+    let downloader = get_downloaders().get(id);
 
     match downloader {
         Some(d) => {
-            let result = RUNTIME.block_on(async {
-                d.read().await.stop_download().await
+            let result = runtime::get().block_on(async {
+                d.stop_download().await
             });
+            get_downloaders().remove(id);
             match result {
                 Ok(_) => 0,
                 Err(_) => -1,
@@ -358,4 +405,353 @@ pub extern "C" fn stop_download(id: i32) -> i32 {
         }
         None => -1,
     }
-}
\ No newline at end of file
+}
+
+/// 设置下载器的进度上报节奏，运行中也可调用：上报间隔与"显著变化"阈值在下一次上报时生效，
+/// 批量提交阈值从下一个分块开始生效
+///
+/// 返回值: 0=成功，-1=下载器不存在或参数无效（负数或 NaN）
+#[unsafe(no_mangle)]
+pub extern "C" fn tthsd_set_progress_options(id: i32, options: *const ProgressOptions) -> i32 {
+    if options.is_null() {
+        return -1;
+    }
+    let options = unsafe { *options };
+    // 写成 !(x >= 0.0) 使 NaN 也被拒绝
+    if !(options.min_delta_percent >= 0.0) || options.min_delta_bytes < 0 {
+        return -1;
+    }
+
+    let downloader = get_downloaders().get(id);
+
+    match downloader {
+        Some(d) => {
+            d.update_config(|cfg| {
+                cfg.progress_interval_ms = if options.interval_ms == 0 {
+                    DEFAULT_PROGRESS_INTERVAL_MS
+                } else {
+                    options.interval_ms as u64
+                };
+                cfg.progress_batch_bytes = if options.batch_bytes == 0 {
+                    DEFAULT_PROGRESS_BATCH_BYTES
+                } else {
+                    options.batch_bytes as i64
+                };
+                cfg.progress_min_delta_percent = options.min_delta_percent;
+                cfg.progress_min_delta_bytes = options.min_delta_bytes;
+            });
+            0
+        }
+        None => -1,
+    }
+}
+
+/// 设置回调投递方式，需在下载器启动前调用（宿主驱动模式无法在投递线程启动后切换）
+///
+/// 返回值: 0=成功，-1=下载器不存在、未设置回调或无法切换
+#[unsafe(no_mangle)]
+pub extern "C" fn tthsd_set_callback_options(id: i32, options: *const CallbackOptions) -> i32 {
+    if options.is_null() {
+        return -1;
+    }
+    let options = unsafe { *options };
+
+    let downloader = get_downloaders().get(id);
+
+    let Some(d) = downloader else {
+        return -1;
+    };
+
+    let budget_ms = if options.budget_ms == 0 {
+        DEFAULT_CALLBACK_BUDGET_MS
+    } else {
+        options.budget_ms as u64
+    };
+    d.update_config(|cfg| cfg.callback_budget_ms = budget_ms);
+
+    match d.config.load().event_dispatcher {
+        Some(ref dispatcher) => {
+            dispatcher.set_budget_ms(budget_ms);
+            if dispatcher.set_host_pump(options.host_pump) { 0 } else { -1 }
+        }
+        None => -1,
+    }
+}
+
+/// 修改运行中（或尚未启动）的下载器参数，不中断正在传输的分块
+///
+/// 线程数、分块大小、UA 在下一个分块开始时生效；限速立即生效；进度上报间隔在下一次上报时生效。
+/// 返回值: 0=成功，-1=下载器不存在或参数无效
+#[unsafe(no_mangle)]
+pub extern "C" fn tthsd_update_config(id: i32, patch: *const ConfigPatch) -> i32 {
+    if patch.is_null() {
+        return -1;
+    }
+    let patch = unsafe { *patch };
+    let has = |bit: u32| patch.fields & bit != 0;
+
+    let user_agent = if has(PATCH_USER_AGENT) {
+        if patch.user_agent.is_null() {
+            return -1;
+        }
+        match unsafe { std::ffi::CStr::from_ptr(patch.user_agent) }.to_str() {
+            Ok(s) if !s.is_empty() => Some(s.to_string()),
+            _ => return -1,
+        }
+    } else {
+        None
+    };
+    let update = ConfigUpdate {
+        thread_count: has(PATCH_THREAD_COUNT).then_some(patch.thread_count as usize),
+        chunk_size_mb: has(PATCH_CHUNK_SIZE).then_some(patch.chunk_size_mb as usize),
+        rate_limit_bps: has(PATCH_RATE_LIMIT).then_some(patch.rate_limit_bps),
+        progress_interval_ms: has(PATCH_PROGRESS_INTERVAL).then_some(patch.progress_interval_ms as u64),
+        user_agent,
+    };
+
+    let downloader = get_downloaders().get(id);
+
+    let Some(d) = downloader else {
+        return -1;
+    };
+
+    match d.apply_config_update(&update) {
+        Ok(()) => 0,
+        Err(e) => {
+            eprintln!("修改下载器 {} 配置失败: {}", id, e);
+            -1
+        }
+    }
+}
+
+/// 设置事件订阅掩码（TTHSD_EVENT_* 按位或），立即生效
+///
+/// 未订阅的事件在构建数据和序列化之前就被丢弃，对回调和远程回调地址同时生效。
+/// 返回值: 0=成功，-1=下载器不存在
+#[unsafe(no_mangle)]
+pub extern "C" fn tthsd_set_event_mask(id: i32, mask: u32) -> i32 {
+    let downloader = get_downloaders().get(id);
+
+    match downloader {
+        Some(d) => {
+            d.update_config(|cfg| cfg.event_mask = mask & EVENT_MASK_ALL);
+            0
+        }
+        None => -1,
+    }
+}
+
+/// 宿主驱动模式下，在调用线程上投递最多 max_events 个回调
+///
+/// 返回值: 实际投递的事件数，-1=下载器不存在
+#[unsafe(no_mangle)]
+pub extern "C" fn tthsd_poll_events(id: i32, max_events: i32) -> i32 {
+    let downloader = get_downloaders().get(id);
+
+    let Some(d) = downloader else {
+        return -1;
+    };
+
+    // 回调执行期间不持有配置快照
+    let dispatcher = d.config.load().event_dispatcher.clone();
+
+    match dispatcher {
+        Some(dispatcher) => dispatcher.poll_events(max_events.max(0) as usize) as i32,
+        None => 0,
+    }
+}
+
+/// 获取下载器运行统计（JSON），写入调用方提供的缓冲区
+///
+/// 返回值: JSON 字节长度（不含结尾 NUL）；缓冲区不足时不写入并返回所需长度；-1=下载器不存在
+#[unsafe(no_mangle)]
+pub extern "C" fn tthsd_get_stats(id: i32, buf: *mut i8, buf_len: i32) -> i32 {
+    let downloader = get_downloaders().get(id);
+
+    let Some(d) = downloader else {
+        return -1;
+    };
+
+    let stats = runtime::get().block_on(async {
+        d.get_stats().await
+    });
+    let json = serde_json::to_string(&stats).unwrap_or_else(|_| "{}".to_string());
+
+    if !buf.is_null() && (json.len() as i64) < buf_len as i64 {
+        unsafe {
+            std::ptr::copy_nonoverlapping(json.as_ptr(), buf as *mut u8, json.len());
+            *buf.add(json.len()) = 0;
+        }
+    }
+    json.len() as i32
+}
+
+/// 将下载器的飞行记录（最近的内部事件）转储到指定文件
+///
+/// 返回值: 0=成功，-1=下载器不存在、路径无效或写入失败
+#[unsafe(no_mangle)]
+pub extern "C" fn tthsd_dump_flight_recorder(id: i32, path: *const i8) -> i32 {
+    if path.is_null() {
+        return -1;
+    }
+
+    let path_str = unsafe { std::ffi::CStr::from_ptr(path as *const std::ffi::c_char) };
+    let path = match path_str.to_str() {
+        Ok(s) => std::path::PathBuf::from(s),
+        Err(_) => return -1,
+    };
+
+    let downloader = get_downloaders().get(id);
+
+    let Some(d) = downloader else {
+        return -1;
+    };
+
+    let result = runtime::get().block_on(async {
+        d.dump_flight_recorder(&path).await
+    });
+
+    match result {
+        Ok(()) => 0,
+        Err(e) => {
+            eprintln!("写入飞行记录失败: {:?}", e);
+            -1
+        }
+    }
+}
+
+fn wait_target(id: i32) -> (i32, Option<Arc<Completion>>) {
+    (id, get_downloaders().get(id).map(|d| d.completion.clone()))
+}
+
+fn wait_timeout(timeout_ms: i32) -> Option<Duration> {
+    (timeout_ms >= 0).then(|| Duration::from_millis(timeout_ms as u64))
+}
+
+/// 阻塞等待下载器结束，timeout_ms < 0 无限等待
+///
+/// 返回值: 结局（0=完成，1=失败，2=停止；暂停不是结局，会继续等待），WAIT_TIMEOUT=超时，-1=ID 无效
+#[unsafe(no_mangle)]
+pub extern "C" fn tthsd_wait(id: i32, timeout_ms: i32) -> i32 {
+    match completion::wait_any(&[wait_target(id)], wait_timeout(timeout_ms)) {
+        WaitResult::Done { outcome, .. } => outcome as i32,
+        WaitResult::TimedOut => WAIT_TIMEOUT,
+        WaitResult::Unknown { .. } => -1,
+    }
+}
+
+/// 阻塞等待任意一个下载器结束，timeout_ms < 0 无限等待
+///
+/// 返回值: 已结束下载器在 ids 中的下标，WAIT_TIMEOUT=超时，-1=参数无效或包含无效 ID
+#[unsafe(no_mangle)]
+pub extern "C" fn tthsd_wait_any(ids: *const i32, count: i32, timeout_ms: i32) -> i32 {
+    if ids.is_null() || count <= 0 {
+        return -1;
+    }
+    let ids = unsafe { std::slice::from_raw_parts(ids, count as usize) };
+    let targets: Vec<_> = ids.iter().map(|&id| wait_target(id)).collect();
+
+    match completion::wait_any(&targets, wait_timeout(timeout_ms)) {
+        WaitResult::Done { index, .. } => index as i32,
+        WaitResult::TimedOut => WAIT_TIMEOUT,
+        WaitResult::Unknown { .. } => -1,
+    }
+}
+
+/// 单个下载器的事件回调：(ID, 事件 JSON, 数据 JSON, user_data)
+pub type EventCallbackEx = extern "C" fn(i32, *const std::ffi::c_char, *const std::ffi::c_char, *mut std::ffi::c_void);
+/// 结束通知：(ID, 结局, user_data)
+pub type FinishCallback = extern "C" fn(i32, i32, *mut std::ffi::c_void);
+
+/// 调用方的上下文指针，由调用方保证在结束通知之前有效且可跨线程使用
+#[derive(Clone, Copy)]
+struct UserData(*mut std::ffi::c_void);
+unsafe impl Send for UserData {}
+unsafe impl Sync for UserData {}
+
+impl UserData {
+    // 通过方法取值：闭包只捕获 `.0` 字段时会绕过上面的 Send/Sync 实现
+    fn ptr(self) -> *mut std::ffi::c_void {
+        self.0
+    }
+}
+
+/// 为下载器设置带上下文指针的事件回调与结束通知，应在启动之前调用，每个下载器只能设置一次
+///
+/// 两者都在投递线程上按顺序调用；结束通知排在结束前产生的所有事件之后，且只调用一次，
+/// 之后不再调用 on_event，调用方可以在结束通知里释放 user_data。
+/// 返回值: 0=成功，-1=下载器不存在、两个回调都为空或已经设置过
+#[unsafe(no_mangle)]
+pub extern "C" fn tthsd_set_callbacks(
+    id: i32,
+    on_event: Option<EventCallbackEx>,
+    on_finish: Option<FinishCallback>,
+    user_data: *mut std::ffi::c_void,
+) -> i32 {
+    if on_event.is_none() && on_finish.is_none() {
+        return -1;
+    }
+    let Some(d) = get_downloaders().get(id) else {
+        return -1;
+    };
+    let Some(dispatcher) = d.config.load().event_dispatcher.clone() else {
+        return -1;
+    };
+
+    let user_data = UserData(user_data);
+    let finished = Arc::new(std::sync::atomic::AtomicBool::new(false));
+
+    if let Some(on_event) = on_event {
+        let finished = finished.clone();
+        let buffers = std::sync::Mutex::new(EventBuffers::default());
+        let sink: EventSink = Arc::new(move |event: &Event, data: &EventData| {
+            if finished.load(std::sync::atomic::Ordering::Acquire) {
+                return;
+            }
+            let mut buffers = buffers.lock().unwrap();
+            buffers.encode(event, data);
+            on_event(id, buffers.event_cstr(), buffers.data_cstr(), user_data.ptr());
+        });
+        if !dispatcher.install_sink(sink) {
+            return -1;
+        }
+    }
+
+    let completion = d.completion.clone();
+    runtime::get().spawn(async move {
+        let outcome = completion.wait().await;
+        dispatcher.dispatch_call(Box::new(move || {
+            finished.store(true, std::sync::atomic::Ordering::Release);
+            if let Some(on_finish) = on_finish {
+                on_finish(id, outcome as i32, user_data.ptr());
+            }
+        }));
+    });
+    0
+}
+
+/// 设置进程级功耗档位（0=普通，1=省电），对所有下载器立即生效
+///
+/// 省电模式：周期性定时器对齐到整秒合并唤醒、进度上报间隔不小于 2 秒、分块写入攒满 1MB 再写；
+/// 在创建第一个下载器之前设置时，默认运行时只创建两个工作线程。
+///
+/// 返回值: 0=成功，-1=档位无效
+#[unsafe(no_mangle)]
+pub extern "C" fn tthsd_set_power_profile(profile: i32) -> i32 {
+    match PowerProfile::from_code(profile) {
+        Some(profile) => {
+            power::set_profile(profile);
+            0
+        }
+        None => -1,
+    }
+}
+
+/// 通知宿主应用进入/离开后台：后台时暂停进度上报，切回前台时立即补报一次
+///
+/// 返回值: 0=成功
+#[unsafe(no_mangle)]
+pub extern "C" fn tthsd_set_background(background: bool) -> i32 {
+    power::set_background(background);
+    0
+}
@@ -0,0 +1,367 @@
+use std::io::Write;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{fence, AtomicI64, AtomicU32, AtomicU64, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant, SystemTime};
+
+/// 每个下载器保留的最近事件条数（必须是 2 的幂）
+pub const FLIGHT_RECORDER_CAPACITY: usize = 1024;
+/// 失败自动转储目录（系统临时目录下）中最多保留的文件数，超出时删除最旧的
+const MAX_FAILURE_DUMPS: usize = 32;
+/// 失败自动转储文件的最长保留时间
+const FAILURE_DUMP_MAX_AGE: Duration = Duration::from_secs(7 * 24 * 3600);
+const FAILURE_DUMP_DIR: &str = "tthsd-flight";
+
+/// 错误记录中的错误码：HTTP 状态码（>= 100），或以下负值
+pub const ERR_OTHER: i64 = -1;
+pub const ERR_NETWORK: i64 = -2;
+pub const ERR_TIMEOUT: i64 = -3;
+pub const ERR_IO: i64 = -4;
+pub const ERR_STALLED: i64 = -5;
+pub const ERR_INCOMPLETE: i64 = -6;
+
+/// 带错误码与分块偏移的下载错误
+///
+/// `Debug`/`Display` 只输出消息文本，与原先的字符串错误一致（err 事件的消息格式不变）。
+pub struct DownloadError {
+    pub code: i64,
+    /// 出错分块的起始偏移，与任务整体有关时为 -1
+    pub chunk_offset: i64,
+    message: String,
+}
+
+impl DownloadError {
+    pub fn new(code: i64, chunk_offset: i64, message: impl Into<String>) -> Self {
+        DownloadError { code, chunk_offset, message: message.into() }
+    }
+}
+
+impl std::fmt::Debug for DownloadError {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(f, "{:?}", self.message)
+    }
+}
+
+impl std::fmt::Display for DownloadError {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.write_str(&self.message)
+    }
+}
+
+impl std::error::Error for DownloadError {}
+
+/// 按错误类型归类出飞行记录用的错误码
+pub fn error_code(err: &(dyn std::error::Error + 'static)) -> i64 {
+    if let Some(e) = err.downcast_ref::<DownloadError>() {
+        return e.code;
+    }
+    if let Some(e) = err.downcast_ref::<reqwest::Error>() {
+        return match e.status() {
+            Some(status) => status.as_u16() as i64,
+            None if e.is_timeout() => ERR_TIMEOUT,
+            None => ERR_NETWORK,
+        };
+    }
+    if err.downcast_ref::<std::io::Error>().is_some() {
+        return ERR_IO;
+    }
+    ERR_OTHER
+}
+
+/// 出错分块的起始偏移，未知时为 -1
+pub fn error_chunk_offset(err: &(dyn std::error::Error + 'static)) -> i64 {
+    err.downcast_ref::<DownloadError>().map_or(-1, |e| e.chunk_offset)
+}
+
+/// 飞行记录器中的事件类型
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u32)]
+pub enum RecordKind {
+    TaskStart = 1,
+    TaskEnd = 2,
+    /// a = 文件大小
+    FileSize = 3,
+    /// a = 起始偏移, b = 结束偏移
+    ChunkStart = 4,
+    /// a = 起始偏移, b = 实际写入字节数
+    ChunkEnd = 5,
+    /// a = 起始偏移, b = 错误码
+    ChunkError = 6,
+    /// a = 起始偏移, b = 重试次数
+    Retry = 7,
+    /// a = 起始偏移, b = 停滞毫秒数
+    Stall = 8,
+    /// a = HTTP 状态码, b = 起始偏移（HEAD 请求为 -1）
+    Status = 9,
+    /// a = 队列深度, b = 被丢弃的事件类型位
+    BackpressureWait = 10,
+    /// 任务失败：a = 错误码（见 ERR_*，或 HTTP 状态码）, b = 出错分块的起始偏移（-1 = 与分块无关）
+    Error = 11,
+    Pause = 12,
+    Stop = 13,
+}
+
+impl RecordKind {
+    fn from_u32(v: u32) -> Option<Self> {
+        Some(match v {
+            1 => RecordKind::TaskStart,
+            2 => RecordKind::TaskEnd,
+            3 => RecordKind::FileSize,
+            4 => RecordKind::ChunkStart,
+            5 => RecordKind::ChunkEnd,
+            6 => RecordKind::ChunkError,
+            7 => RecordKind::Retry,
+            8 => RecordKind::Stall,
+            9 => RecordKind::Status,
+            10 => RecordKind::BackpressureWait,
+            11 => RecordKind::Error,
+            12 => RecordKind::Pause,
+            13 => RecordKind::Stop,
+            _ => return None,
+        })
+    }
+
+    fn as_str(&self) -> &'static str {
+        match self {
+            RecordKind::TaskStart => "task_start",
+            RecordKind::TaskEnd => "task_end",
+            RecordKind::FileSize => "file_size",
+            RecordKind::ChunkStart => "chunk_start",
+            RecordKind::ChunkEnd => "chunk_end",
+            RecordKind::ChunkError => "chunk_error",
+            RecordKind::Retry => "retry",
+            RecordKind::Stall => "stall",
+            RecordKind::Status => "status",
+            RecordKind::BackpressureWait => "backpressure",
+            RecordKind::Error => "error",
+            RecordKind::Pause => "pause",
+            RecordKind::Stop => "stop",
+        }
+    }
+}
+
+/// 任务序号未知时使用的占位值
+pub const NO_TASK: u32 = u32::MAX;
+
+#[derive(Default)]
+struct Slot {
+    /// 序列号：奇数表示正在写入，偶数 2*(n+1) 表示第 n 条记录已写完
+    seq: AtomicU64,
+    timestamp_us: AtomicU64,
+    kind: AtomicU32,
+    task: AtomicU32,
+    a: AtomicI64,
+    b: AtomicI64,
+}
+
+/// 飞行记录器：固定大小的无锁环形缓冲区，保存下载器最近的内部事件
+///
+/// 写入只有一次 `fetch_add` 和几次原子存储，不分配内存、不加锁；
+/// 下载失败时自动转储，也可以通过 `tthsd_dump_flight_recorder` 随时导出。
+pub struct FlightRecorder {
+    head: AtomicU64,
+    slots: Box<[Slot]>,
+    started: Instant,
+}
+
+impl std::fmt::Debug for FlightRecorder {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("FlightRecorder")
+            .field("records", &self.head.load(Ordering::Relaxed))
+            .finish()
+    }
+}
+
+impl FlightRecorder {
+    pub fn new() -> Self {
+        FlightRecorder {
+            head: AtomicU64::new(0),
+            slots: (0..FLIGHT_RECORDER_CAPACITY).map(|_| Slot::default()).collect(),
+            started: Instant::now(),
+        }
+    }
+
+    pub fn record(&self, kind: RecordKind, task: u32, a: i64, b: i64) {
+        let n = self.head.fetch_add(1, Ordering::Relaxed);
+        let slot = &self.slots[n as usize & (FLIGHT_RECORDER_CAPACITY - 1)];
+
+        slot.seq.store(2 * n + 1, Ordering::Relaxed);
+        fence(Ordering::Release);
+        slot.timestamp_us.store(self.started.elapsed().as_micros() as u64, Ordering::Relaxed);
+        slot.kind.store(kind as u32, Ordering::Relaxed);
+        slot.task.store(task, Ordering::Relaxed);
+        slot.a.store(a, Ordering::Relaxed);
+        slot.b.store(b, Ordering::Relaxed);
+        slot.seq.store(2 * (n + 1), Ordering::Release);
+    }
+
+    /// 按时间顺序写出当前缓冲区中的全部有效记录
+    pub fn dump_to<W: Write>(&self, out: &mut W) -> std::io::Result<()> {
+        let head = self.head.load(Ordering::Acquire);
+        let first = head.saturating_sub(FLIGHT_RECORDER_CAPACITY as u64);
+
+        writeln!(out, "# TTHSD flight recorder: {} records total, showing last {}", head, head - first)?;
+        writeln!(out, "# seq\ttime_ms\tkind\ttask\ta\tb")?;
+
+        for n in first..head {
+            let slot = &self.slots[n as usize & (FLIGHT_RECORDER_CAPACITY - 1)];
+
+            let seq_before = slot.seq.load(Ordering::Acquire);
+            let timestamp_us = slot.timestamp_us.load(Ordering::Relaxed);
+            let kind = slot.kind.load(Ordering::Relaxed);
+            let task = slot.task.load(Ordering::Relaxed);
+            let a = slot.a.load(Ordering::Relaxed);
+            let b = slot.b.load(Ordering::Relaxed);
+            fence(Ordering::Acquire);
+            let seq_after = slot.seq.load(Ordering::Relaxed);
+
+            // 读取期间被覆盖或尚未写完的记录直接跳过
+            if seq_before != seq_after || seq_before != 2 * (n + 1) {
+                continue;
+            }
+            let Some(kind) = RecordKind::from_u32(kind) else {
+                continue;
+            };
+
+            let task = if task == NO_TASK { "-".to_string() } else { task.to_string() };
+            writeln!(
+                out,
+                "{}\t{:.3}\t{}\t{}\t{}\t{}",
+                n,
+                timestamp_us as f64 / 1000.0,
+                kind.as_str(),
+                task,
+                a,
+                b
+            )?;
+        }
+        Ok(())
+    }
+
+    pub fn dump_to_file(&self, path: &Path) -> std::io::Result<()> {
+        let mut file = std::io::BufWriter::new(std::fs::File::create(path)?);
+        self.dump_to(&mut file)?;
+        file.flush()
+    }
+
+    /// 失败时自动转储到系统临时目录下的 tthsd-flight/，返回写入的文件路径
+    ///
+    /// 文件写入在阻塞线程池中进行；同时清理该目录中过期或超出数量上限的旧转储。
+    pub async fn dump_on_failure(self: &Arc<Self>) -> Option<PathBuf> {
+        static DUMP_SEQ: AtomicU64 = AtomicU64::new(0);
+
+        let timestamp = SystemTime::now()
+            .duration_since(std::time::UNIX_EPOCH)
+            .map(|d| d.as_millis())
+            .unwrap_or(0);
+        let dir = std::env::temp_dir().join(FAILURE_DUMP_DIR);
+        let path = dir.join(format!(
+            "tthsd-flight-{}-{}-{}.log",
+            std::process::id(),
+            timestamp,
+            DUMP_SEQ.fetch_add(1, Ordering::Relaxed)
+        ));
+
+        let recorder = self.clone();
+        let result = tokio::task::spawn_blocking(move || {
+            std::fs::create_dir_all(&dir)?;
+            recorder.dump_to_file(&path)?;
+            prune_dumps(&dir, MAX_FAILURE_DUMPS, FAILURE_DUMP_MAX_AGE);
+            Ok::<_, std::io::Error>(path)
+        })
+        .await;
+
+        match result {
+            Ok(Ok(path)) => Some(path),
+            Ok(Err(e)) => {
+                eprintln!("写入飞行记录失败: {:?}", e);
+                None
+            }
+            Err(e) => {
+                eprintln!("写入飞行记录失败: {:?}", e);
+                None
+            }
+        }
+    }
+}
+
+/// 删除目录中超过 `max_age` 的转储，并只保留最新的 `keep` 个
+fn prune_dumps(dir: &Path, keep: usize, max_age: Duration) {
+    let Ok(entries) = std::fs::read_dir(dir) else {
+        return;
+    };
+
+    let mut dumps: Vec<(SystemTime, PathBuf)> = entries
+        .filter_map(|entry| entry.ok())
+        .filter(|entry| entry.file_name().to_string_lossy().starts_with("tthsd-flight-"))
+        .filter_map(|entry| Some((entry.metadata().ok()?.modified().ok()?, entry.path())))
+        .collect();
+    dumps.sort_by(|a, b| b.0.cmp(&a.0));
+
+    let now = SystemTime::now();
+    for (index, (modified, path)) in dumps.iter().enumerate() {
+        let expired = now.duration_since(*modified).map_or(false, |age| age > max_age);
+        if index >= keep || expired {
+            let _ = std::fs::remove_file(path);
+        }
+    }
+}
+
+impl Default for FlightRecorder {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn error_record_carries_code_and_chunk() {
+        let recorder = FlightRecorder::new();
+        let err: Box<dyn std::error::Error + Send + Sync> = Box::new(DownloadError::new(503, 4096, "Bad status: 503"));
+        recorder.record(RecordKind::Error, 2, error_code(err.as_ref()), error_chunk_offset(err.as_ref()));
+
+        let mut out = Vec::new();
+        recorder.dump_to(&mut out).unwrap();
+        let text = String::from_utf8(out).unwrap();
+        assert!(text.lines().any(|line| line.ends_with("\terror\t2\t503\t4096")), "{}", text);
+        // 消息格式与原先的字符串错误相同
+        assert_eq!(format!("{:?}", err), format!("{:?}", "Bad status: 503"));
+    }
+
+    #[test]
+    fn error_code_classifies_common_errors() {
+        let io = std::io::Error::new(std::io::ErrorKind::PermissionDenied, "denied");
+        assert_eq!(error_code(&io), ERR_IO);
+        let other: Box<dyn std::error::Error + Send + Sync> = "whatever".into();
+        assert_eq!(error_code(other.as_ref()), ERR_OTHER);
+        assert_eq!(error_chunk_offset(other.as_ref()), -1);
+    }
+
+    #[test]
+    fn prune_keeps_newest_dumps() {
+        let dir = std::env::temp_dir().join(format!("tthsd-prune-test-{}", std::process::id()));
+        let _ = std::fs::remove_dir_all(&dir);
+        std::fs::create_dir_all(&dir).unwrap();
+        for i in 0..5 {
+            let file = std::fs::File::create(dir.join(format!("tthsd-flight-{}.log", i))).unwrap();
+            let modified = SystemTime::now() - Duration::from_secs(100 - i * 10);
+            file.set_modified(modified).unwrap();
+        }
+        std::fs::write(dir.join("unrelated.txt"), b"").unwrap();
+
+        prune_dumps(&dir, 2, Duration::from_secs(3600));
+        let mut left: Vec<String> = std::fs::read_dir(&dir).unwrap()
+            .map(|e| e.unwrap().file_name().to_string_lossy().into_owned())
+            .collect();
+        left.sort();
+        assert_eq!(left, ["tthsd-flight-3.log", "tthsd-flight-4.log", "unrelated.txt"]);
+
+        prune_dumps(&dir, 10, Duration::from_secs(65));
+        assert!(!dir.join("tthsd-flight-3.log").exists());
+        assert!(dir.join("tthsd-flight-4.log").exists());
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+}
@@ -1,15 +1,19 @@
 use std::sync::Arc;
 use std::time::{Duration, Instant};
 use tokio::fs::OpenOptions;
-use tokio::io::{AsyncSeekExt, AsyncWriteExt};
-use tokio::sync::{mpsc, RwLock};
+use tokio::io::{AsyncSeekExt, AsyncWriteExt, BufWriter};
+use tokio::sync::RwLock;
+use tokio_util::sync::CancellationToken;
 use futures::StreamExt;
 use reqwest::{Client, header::{HeaderMap, HeaderValue, RANGE, USER_AGENT, ACCEPT, ACCEPT_LANGUAGE, ACCEPT_ENCODING, CACHE_CONTROL}};
 use serde::{Deserialize, Serialize};
 use super::downloader_interface::{Downloader, BaseDownloader};
-use super::downloader::{DownloadTask, DownloadChunk, DownloadConfig, Event, EventType};
+use super::downloader::{DownloadTask, DownloadChunk, Event, EventType, SharedConfig, DEFAULT_PROGRESS_BATCH_BYTES, UA};
 use super::performance_monitor::PerformanceMonitor;
 use super::send_message::send_message;
+use super::event_data::EventData;
+use super::flight_recorder::{error_code, DownloadError, FlightRecorder, RecordKind, ERR_INCOMPLETE, ERR_STALLED, NO_TASK};
+use super::power;
 
 const STALL_TIMEOUT: Duration = Duration::from_secs(30);
 
@@ -99,11 +103,16 @@ pub struct HTTPDownloader {
     base: BaseDownloader,
     client: Client,
     monitor: Option<Arc<PerformanceMonitor>>,
+    /// 所属下载器本次运行的进度统计
+    run_monitor: Arc<PerformanceMonitor>,
     status: Option<DownloadStatus>,
+    recorder: Option<Arc<FlightRecorder>>,
+    /// 当前任务在配置中的序号，用于飞行记录
+    task_tag: u32,
 }
 
 impl HTTPDownloader {
-    pub async fn new(config: Arc<RwLock<DownloadConfig>>) -> Self {
+    pub async fn new(config: SharedConfig, cancel_token: CancellationToken) -> Self {
         let mut headers = HeaderMap::new();
         headers.insert(USER_AGENT, HeaderValue::from_static("Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/131.0.0.0 Safari/537.36"));
 
@@ -115,27 +124,36 @@ impl HTTPDownloader {
             .expect("Failed to create HTTP client");
 
         let monitor = super::performance_monitor::get_global_monitor().await;
+        let recorder = config.load().flight_recorder.clone();
+        let run_monitor = config.load().progress_monitor.clone();
 
         HTTPDownloader {
             base: BaseDownloader {
                 config: Some(config),
                 running: true,
+                cancel_token,
                 ..Default::default()
             },
             client,
             monitor,
+            run_monitor,
             status: None,
+            recorder: Some(recorder),
+            task_tag: NO_TASK,
         }
     }
 
     async fn get_file_size(&self, url: &str) -> Result<i64, Box<dyn std::error::Error + Send + Sync>> {
         let response = self.client
             .head(url)
+            .header(USER_AGENT, self.user_agent())
             .send()
             .await?;
 
+        let status = response.status().as_u16() as i64;
+        self.record(RecordKind::Status, status, -1);
         if !response.status().is_success() {
-            return Err(format!("HEAD failed: {}", response.status()).into());
+            return Err(DownloadError::new(status, -1, format!("HEAD failed: {}", response.status())).into());
         }
 
         let content_length = response
@@ -152,31 +170,27 @@ impl HTTPDownloader {
         Ok(content_length)
     }
 
-    fn create_chunks(file_size: i64, chunk_size: i64, thread_count: usize) -> Vec<DownloadChunk> {
-        let min_chunks = thread_count * 2;
-        let mut chunk_size = chunk_size;
+    /// 分块大小：至少切成 thread_count * 2 块，切分后的分块不小于 1MB
+    fn effective_chunk_size(file_size: i64, chunk_size: i64, thread_count: usize) -> i64 {
+        let min_chunks = (thread_count * 2).max(1) as i64;
+        let mut chunk_size = chunk_size.max(1);
 
-        if file_size / min_chunks as i64 > chunk_size {
-            chunk_size = file_size / min_chunks as i64;
+        if file_size / min_chunks > chunk_size {
+            chunk_size = file_size / min_chunks;
             if chunk_size < 1024 * 1024 {
                 chunk_size = 1024 * 1024;
             }
         }
+        chunk_size
+    }
 
-        let mut chunks = Vec::new();
-        let mut offset = 0;
-
-        while offset < file_size {
-            let end = std::cmp::min(offset + chunk_size - 1, file_size - 1);
-            chunks.push(DownloadChunk {
-                start_offset: offset,
-                end_offset: end,
-                done: false,
-            });
-            offset = end + 1;
-        }
-
-        chunks
+    /// 当前配置中的 UA（运行中可修改，每个请求发出前读取）
+    fn user_agent(&self) -> HeaderValue {
+        self.base
+            .config
+            .as_ref()
+            .and_then(|config| HeaderValue::from_str(&config.load().user_agent).ok())
+            .unwrap_or_else(|| HeaderValue::from_static(UA))
     }
 
     async fn download_chunk(
@@ -185,9 +199,10 @@ impl HTTPDownloader {
         chunk: &DownloadChunk,
         downloaded_size: Arc<RwLock<i64>>,
         _total_size: i64,
+        batch_update_threshold: i64,
     ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
         let mut headers = HeaderMap::new();
-        headers.insert(USER_AGENT, HeaderValue::from_static("Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/131.0.0.0 Safari/537.36"));
+        headers.insert(USER_AGENT, self.user_agent());
         headers.insert(RANGE, HeaderValue::from_str(&format!("bytes={}-{}", chunk.start_offset, chunk.end_offset))?);
         headers.insert(ACCEPT, HeaderValue::from_static("*/*"));
         headers.insert(ACCEPT_LANGUAGE, HeaderValue::from_static("en-US,en;q=0.9"));
@@ -195,59 +210,61 @@ impl HTTPDownloader {
         headers.insert(CACHE_CONTROL, HeaderValue::from_static("no-cache"));
 
         let response = self.client
-            .get(&task.url)
+            .get(&*task.url)
             .headers(headers)
             .send()
             .await?;
 
+        let status = response.status().as_u16() as i64;
+        self.record(RecordKind::Status, status, chunk.start_offset);
         if !response.status().is_success() {
-            return Err(format!("Bad status: {}", response.status()).into());
+            return Err(DownloadError::new(status, chunk.start_offset, format!("Bad status: {}", response.status())).into());
         }
 
-        let last_read = Arc::new(RwLock::new(Instant::now()));
-        let stalled_tx = Arc::new(mpsc::channel::<()>(1).0);
-
-        let last_read_clone = last_read.clone();
-        let stalled_tx_clone = stalled_tx.clone();
-        tokio::spawn(async move {
-            let mut interval = tokio::time::interval(Duration::from_secs(5));
-            loop {
-                interval.tick().await;
-                let elapsed = {
-                    let lr = last_read_clone.read().await;
-                    lr.elapsed()
-                };
-                if elapsed > STALL_TIMEOUT {
-                    let _ = stalled_tx_clone.send(()).await;
-                    break;
-                }
-            }
-        });
-
-        let mut writer = OpenOptions::new()
+        let mut file = OpenOptions::new()
             .write(true)
-            .open(&task.save_path).await?;
+            .open(&*task.save_path).await?;
 
-        writer.seek(std::io::SeekFrom::Start(chunk.start_offset as u64)).await?;
+        file.seek(std::io::SeekFrom::Start(chunk.start_offset as u64)).await?;
+        // 省电模式下攒够一批再写，减少阻塞线程池的唤醒；容量为 0 时直接写入
+        let mut writer = BufWriter::with_capacity(power::write_buffer_bytes(), file);
 
-        const BATCH_UPDATE_THRESHOLD: i64 = 512 * 1024;
         let mut local_downloaded = 0i64;
+        let mut chunk_downloaded = 0i64;
 
+        let (rate_limiter, shared_rate_limiter) = match self.base.config {
+            Some(ref config) => {
+                let config = config.load();
+                (Some(config.rate_limiter.clone()), config.shared_rate_limiter.clone())
+            }
+            None => (None, None),
+        };
         let mut stream = response.bytes_stream();
 
-        while let Some(bytes_result) = stream.next().await {
-            let bytes = bytes_result?;
+        loop {
+            // 停滞检测只计读取等待的时间，限速等待不算停滞；不另起定时任务，分块结束后不留下定时器
+            let bytes = match tokio::time::timeout(STALL_TIMEOUT, stream.next()).await {
+                Ok(Some(bytes_result)) => bytes_result?,
+                Ok(None) => break,
+                Err(_) => {
+                    self.record(RecordKind::Stall, chunk.start_offset, STALL_TIMEOUT.as_millis() as i64);
+                    return Err(DownloadError::new(ERR_STALLED, chunk.start_offset, "connection stalled").into());
+                }
+            };
 
-            {
-                let mut lr = last_read.write().await;
-                *lr = Instant::now();
+            if let Some(ref limiter) = rate_limiter {
+                limiter.acquire(bytes.len()).await;
+            }
+            if let Some(ref limiter) = shared_rate_limiter {
+                limiter.acquire(bytes.len()).await;
             }
 
             writer.write_all(&bytes).await?;
 
             local_downloaded += bytes.len() as i64;
+            chunk_downloaded += bytes.len() as i64;
 
-            if local_downloaded >= BATCH_UPDATE_THRESHOLD {
+            if local_downloaded >= batch_update_threshold {
                 let mut ds = downloaded_size.write().await;
                 *ds += local_downloaded;
                 drop(ds);
@@ -255,15 +272,12 @@ impl HTTPDownloader {
                 if let Some(ref monitor) = self.monitor {
                     monitor.add_bytes(local_downloaded).await;
                 }
+                self.run_monitor.add_bytes(local_downloaded).await;
 
                 local_downloaded = 0;
             }
-
-            // 检查是否停滞
-            if stalled_tx.try_reserve().is_ok() {
-                return Err("connection stalled".into());
-            }
         }
+        writer.flush().await?;
 
         if local_downloaded > 0 {
             let mut ds = downloaded_size.write().await;
@@ -273,24 +287,24 @@ impl HTTPDownloader {
             if let Some(ref monitor) = self.monitor {
                 monitor.add_bytes(local_downloaded).await;
             }
+            self.run_monitor.add_bytes(local_downloaded).await;
         }
 
+        self.record(RecordKind::ChunkEnd, chunk.start_offset, chunk_downloaded);
         Ok(())
     }
 
+    fn record(&self, kind: RecordKind, a: i64, b: i64) {
+        if let Some(ref recorder) = self.recorder {
+            recorder.record(kind, self.task_tag, a, b);
+        }
+    }
+
     async fn send_error_message(&self, msg: String) {
         if let Some(ref config) = self.base.config {
-            let event = Event {
-                event_type: EventType::Err,
-                name: "Error".to_string(),
-                show_name: String::new(),
-                id: String::new(),
-            };
-
-            let mut data = serde_json::Map::new();
-            data.insert("Error".to_string(), serde_json::Value::String(msg));
+            let event = Event::bare(EventType::Err, "Error");
 
-            let _ = send_message(event, data.into_iter().map(|(k, v)| (k, v)).collect(), config, &self.base.ws_client, &self.base.socket_client).await;
+            let _ = send_message(event, EventData::error(msg), config).await;
         }
     }
 }
@@ -307,6 +321,7 @@ impl Default for BaseDownloader {
             socket_client: None,
             config: None,
             running: true,
+            cancel_token: CancellationToken::new(),
         }
     }
 }
@@ -314,19 +329,31 @@ impl Default for BaseDownloader {
 #[async_trait::async_trait]
 impl Downloader for HTTPDownloader {
     async fn download(&mut self, task: &DownloadTask) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
-        let file_size = self.get_file_size(&task.url).await?;
+        // 整个任务使用同一份配置快照
+        let cfg = self.base.config.as_ref().map(|config| config.load_full());
+        if let Some(ref cfg) = cfg {
+            self.task_tag = cfg.tasks.iter().position(|t| t.id == task.id).map_or(NO_TASK, |i| i as u32);
+        }
+
+        let token = self.base.cancel_token.clone();
+        let file_size = tokio::select! {
+            size = self.get_file_size(&task.url) => size?,
+            _ = token.cancelled() => return Err("download cancelled".into()),
+        };
+        self.record(RecordKind::FileSize, file_size, 0);
 
         self.status = Some(DownloadStatus::new(file_size));
         
-        // 更新全局监控的总大小
+        // 更新全局监控的总大小；下载器自己的总大小按任务累加
         if let Some(ref monitor) = self.monitor {
             monitor.set_total_bytes(file_size);
         }
+        self.run_monitor.add_expected_bytes(file_size);
 
         let file = OpenOptions::new()
             .write(true)
             .create(true)
-            .open(&task.save_path).await?;
+            .open(&*task.save_path).await?;
 
         // FAT32 文件系统单文件上限为 4GB，超过时给出明确提示
         const FAT32_MAX_FILE_SIZE: i64 = 4_294_967_295; // 4GB - 1 byte
@@ -343,47 +370,91 @@ impl Downloader for HTTPDownloader {
             eprintln!("警告: 无法预分配文件空间 ({}), 将继续下载", e);
         }
 
-        let thread_count = if let Some(ref config) = self.base.config {
-            let cfg = config.read().await;
-            cfg.thread_count
-        } else {
-            num_cpus::get() * 2
-        };
-
-        let chunk_size = if let Some(ref config) = self.base.config {
-            let cfg = config.read().await;
-            cfg.chunk_size_mb * 1024 * 1024
-        } else {
-            10 * 1024 * 1024
-        };
+        let connection_budget = cfg.as_ref().and_then(|cfg| cfg.connection_budget.clone());
+        drop(cfg);
 
-        let chunks = Self::create_chunks(file_size, chunk_size as i64, thread_count);
         let downloaded_size = Arc::new(RwLock::new(0i64));
-
         let mut join_set = tokio::task::JoinSet::new();
+        let mut next_offset = 0i64;
+        let mut first_failure: Option<(i64, i64)> = None;
+
+        loop {
+            // 每到分块边界重新读取配置：运行中修改的线程数、分块大小与批量提交阈值从下一个分块开始生效，
+            // 已在传输的分块不受影响
+            let (thread_count, chunk_size, batch_update_threshold) = match self.base.config {
+                Some(ref config) => {
+                    let cfg = config.load();
+                    (cfg.thread_count.max(1), (cfg.chunk_size_mb * 1024 * 1024) as i64, cfg.progress_batch_bytes.max(1))
+                }
+                None => (num_cpus::get() * 2, 10 * 1024 * 1024, DEFAULT_PROGRESS_BATCH_BYTES),
+            };
 
-        for chunk in chunks {
-            let task_clone = task.clone();
-            let downloaded_size_clone = downloaded_size.clone();
-            let self_clone = self.clone_downloader();
-
-            join_set.spawn(async move {
-                self_clone.download_chunk(&task_clone, &chunk, downloaded_size_clone, file_size).await
-            });
-        }
+            // 取消后不再派发新分块，等已派发的分块观察到取消后退出
+            while join_set.len() < thread_count && next_offset < file_size && !token.is_cancelled() {
+                let size = Self::effective_chunk_size(file_size, chunk_size, thread_count);
+                let chunk = DownloadChunk {
+                    start_offset: next_offset,
+                    end_offset: std::cmp::min(next_offset + size - 1, file_size - 1),
+                    done: false,
+                };
+                next_offset = chunk.end_offset + 1;
+
+                let task_clone = task.clone();
+                let downloaded_size_clone = downloaded_size.clone();
+                let self_clone = self.clone_downloader();
+                let budget = connection_budget.clone();
+                let token = token.clone();
+
+                join_set.spawn(async move {
+                    let work = async {
+                        // 共享连接预算：拿到许可后才发起请求，分块结束时归还
+                        let _permit = match budget {
+                            Some(budget) => Some(budget.acquire_owned().await?),
+                            None => None,
+                        };
+                        self_clone.record(RecordKind::ChunkStart, chunk.start_offset, chunk.end_offset);
+                        self_clone.download_chunk(&task_clone, &chunk, downloaded_size_clone, file_size, batch_update_threshold).await
+                    };
+                    // 取消时丢弃进行中的请求与写入（归还连接许可），不算分块失败
+                    let result = tokio::select! {
+                        result = work => result,
+                        _ = token.cancelled() => return Ok(()),
+                    };
+                    // 失败时返回 (错误码, 分块起始偏移)，供任务失败记录使用
+                    result.map_err(|e| {
+                        let code = error_code(e.as_ref());
+                        self_clone.record(RecordKind::ChunkError, chunk.start_offset, code);
+                        (code, chunk.start_offset)
+                    })
+                });
+            }
 
-        while let Some(result) = join_set.join_next().await {
-            if let Err(e) = result {
-                self.send_error_message(format!("worker error: {:?}", e)).await;
-                if let Some(ref status) = self.status {
-                    status.set_error(format!("worker error: {:?}", e)).await;
+            let Some(result) = join_set.join_next().await else {
+                break;
+            };
+            match result {
+                Ok(Ok(())) => {}
+                Ok(Err(failure)) => {
+                    first_failure.get_or_insert(failure);
+                }
+                Err(e) => {
+                    self.send_error_message(format!("worker error: {:?}", e)).await;
+                    if let Some(ref status) = self.status {
+                        status.set_error(format!("worker error: {:?}", e)).await;
+                    }
                 }
             }
         }
 
+        if token.is_cancelled() {
+            return Err("download cancelled".into());
+        }
+
         let current_size = *downloaded_size.read().await;
         if current_size != file_size {
-            return Err(format!("download incomplete: {}/{} bytes", current_size, file_size).into());
+            // 错误码与偏移取第一个失败的分块；没有分块报错时记为 ERR_INCOMPLETE
+            let (code, offset) = first_failure.unwrap_or((ERR_INCOMPLETE, -1));
+            return Err(DownloadError::new(code, offset, format!("download incomplete: {}/{} bytes", current_size, file_size)).into());
         }
 
         Ok(())
@@ -427,11 +498,15 @@ impl HTTPDownloader {
             base: BaseDownloader {
                 config: self.base.config.clone(),
                 running: self.base.running,
+                cancel_token: self.base.cancel_token.clone(),
                 ..Default::default()
             },
             client: self.client.clone(),
             monitor: self.monitor.clone(),
+            run_monitor: self.run_monitor.clone(),
             status: None,
+            recorder: self.recorder.clone(),
+            task_tag: self.task_tag,
         }
     }
 }
\ No newline at end of file
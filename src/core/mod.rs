@@ -4,9 +4,22 @@ pub mod http_downloader;
 pub mod socket_client;
 pub mod websocket_client;
 pub mod send_message;
+pub mod event_dispatcher;
+pub mod event_data;
+pub mod flight_recorder;
 pub mod performance_monitor;
+pub mod remote_protocol;
+pub mod remote_queue;
+pub mod rate_limiter;
+pub mod power;
+pub mod completion;
+pub mod registry;
+pub mod runtime;
+pub mod proxy;
 pub mod get_downloader;
 pub mod export;
+#[cfg(unix)]
+pub mod daemon;
 
 #[cfg(feature = "android")]
 pub mod android_export;
\ No newline at end of file
@@ -3,6 +3,7 @@ use std::sync::Arc;
 use std::time::Instant;
 use tokio::sync::RwLock;
 use std::sync::atomic::{AtomicI64, Ordering};
+use super::event_data::ProgressData;
 
 pub struct PerformanceMonitor {
     start_time: Instant,
@@ -18,6 +19,15 @@ pub struct PerformanceMonitor {
     retried_chunks: Arc<AtomicI64>,
 }
 
+impl std::fmt::Debug for PerformanceMonitor {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("PerformanceMonitor")
+            .field("total_bytes", &self.total_bytes())
+            .field("expected_bytes", &self.expected_bytes())
+            .finish()
+    }
+}
+
 impl PerformanceMonitor {
     pub fn new() -> Self {
         PerformanceMonitor {
@@ -40,10 +50,25 @@ impl PerformanceMonitor {
         self.update_speed().await;
     }
 
+    /// 当前已下载的总字节数（无锁读取）
+    pub fn total_bytes(&self) -> i64 {
+        self.total_bytes.load(Ordering::Relaxed)
+    }
+
+    /// 预期总字节数（无锁读取）
+    pub fn expected_bytes(&self) -> i64 {
+        self.total_expected_bytes.load(Ordering::Relaxed)
+    }
+
     pub fn set_total_bytes(&self, bytes: i64) {
         self.total_expected_bytes.store(bytes, Ordering::Relaxed);
     }
 
+    /// 累加预期总字节数（下载器内每个任务得知文件大小时各加一次）
+    pub fn add_expected_bytes(&self, bytes: i64) {
+        self.total_expected_bytes.fetch_add(bytes, Ordering::Relaxed);
+    }
+
     pub fn add_chunk_download(&self) {
         self.chunk_downloads.fetch_add(1, Ordering::Relaxed);
     }
@@ -103,6 +128,21 @@ impl PerformanceMonitor {
         }
     }
 
+    /// 读取当前进度数据，供进度事件直接使用（不构建 JSON Map）
+    pub async fn progress_data(&self) -> ProgressData {
+        ProgressData {
+            downloaded: self.total_bytes.load(Ordering::Relaxed),
+            total: self.total_expected_bytes.load(Ordering::Relaxed),
+            current_speed_bps: *self.current_speed.read().await,
+            average_speed_bps: *self.average_speed.read().await,
+            peak_speed_bps: *self.peak_speed.read().await,
+            chunk_downloads: self.chunk_downloads.load(Ordering::Relaxed),
+            failed_chunks: self.failed_chunks.load(Ordering::Relaxed),
+            retried_chunks: self.retried_chunks.load(Ordering::Relaxed),
+            elapsed_time: self.start_time.elapsed().as_secs_f64(),
+        }
+    }
+
     pub async fn get_stats(&self) -> HashMap<String, serde_json::Value> {
         let total_bytes = self.total_bytes.load(Ordering::Relaxed);
         let current_speed = *self.current_speed.read().await;
@@ -0,0 +1,97 @@
+use std::time::Duration;
+use once_cell::sync::Lazy;
+use tokio::sync::watch;
+use tokio::time::Instant;
+
+/// 省电模式下所有周期性定时器对齐到该粒度的整数倍，同一时刻到期的定时器由一次唤醒统一处理
+pub const SAVER_TIMER_ALIGN: Duration = Duration::from_secs(1);
+/// 省电模式下进度上报间隔的下限（毫秒）
+pub const SAVER_MIN_PROGRESS_INTERVAL_MS: u64 = 2000;
+/// 省电模式下默认运行时的工作线程数
+pub const SAVER_WORKER_THREADS: usize = 2;
+/// 省电模式下每个分块的写缓冲（攒够后一次写入，减少阻塞线程池的唤醒次数）
+pub const SAVER_WRITE_BUFFER_BYTES: usize = 1024 * 1024;
+
+/// 功耗档位（数值与 C 头文件中的 `TTHSD_POWER_*` 一致）
+#[repr(i32)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub enum PowerProfile {
+    #[default]
+    Normal = 0,
+    /// 低唤醒：定时器对齐合并、进度上报放缓、分块写入攒批、默认运行时只用两个工作线程
+    Saver = 1,
+}
+
+impl PowerProfile {
+    pub fn from_code(code: i32) -> Option<Self> {
+        match code {
+            0 => Some(PowerProfile::Normal),
+            1 => Some(PowerProfile::Saver),
+            _ => None,
+        }
+    }
+}
+
+/// 进程级功耗状态（运行时与所有下载器共用）
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub struct PowerState {
+    pub profile: PowerProfile,
+    /// 宿主应用处于后台：暂停进度上报（开始/结束/错误等事件照常发送）
+    pub background: bool,
+}
+
+impl PowerState {
+    pub fn saver(&self) -> bool {
+        self.profile == PowerProfile::Saver
+    }
+}
+
+static STATE: Lazy<watch::Sender<PowerState>> = Lazy::new(|| watch::channel(PowerState::default()).0);
+/// 定时器对齐的基准点
+static EPOCH: Lazy<Instant> = Lazy::new(Instant::now);
+
+pub fn current() -> PowerState {
+    *STATE.borrow()
+}
+
+/// 订阅状态变化（进度上报任务据此在切回前台时立即补报一次）
+pub fn subscribe() -> watch::Receiver<PowerState> {
+    STATE.subscribe()
+}
+
+pub fn set_profile(profile: PowerProfile) {
+    STATE.send_if_modified(|state| std::mem::replace(&mut state.profile, profile) != profile);
+}
+
+pub fn set_background(background: bool) {
+    STATE.send_if_modified(|state| std::mem::replace(&mut state.background, background) != background);
+}
+
+/// 省电模式下把到期时间移到最近的对齐点（最多提前或推迟半个对齐粒度）；普通模式原样返回
+///
+/// 取最近而不是向上取整：定时器总是在对齐点触发，下一次到期时间 = 触发时刻 + 间隔，
+/// 向上取整会因为触发时刻略晚于对齐点而多等一整个粒度。
+pub fn align(deadline: Instant) -> Instant {
+    if !current().saver() {
+        return deadline;
+    }
+    let epoch = *EPOCH;
+    let slot = SAVER_TIMER_ALIGN.as_nanos();
+    let since = deadline.saturating_duration_since(epoch).as_nanos();
+    epoch + Duration::from_nanos(((since + slot / 2) / slot * slot) as u64)
+}
+
+/// 实际使用的进度上报间隔；后台时返回 None（不上报）
+pub fn progress_interval(configured_ms: u64) -> Option<Duration> {
+    let state = current();
+    if state.background {
+        return None;
+    }
+    let ms = if state.saver() { configured_ms.max(SAVER_MIN_PROGRESS_INTERVAL_MS) } else { configured_ms };
+    Some(Duration::from_millis(ms))
+}
+
+/// 分块写缓冲大小，0 = 不缓冲（每次读到的数据直接写入）
+pub fn write_buffer_bytes() -> usize {
+    if current().saver() { SAVER_WRITE_BUFFER_BYTES } else { 0 }
+}
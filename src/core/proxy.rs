@@ -0,0 +1,1160 @@
+use std::collections::HashMap;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::Duration;
+use futures::StreamExt;
+use reqwest::header::{
+    HeaderMap, HeaderName, HeaderValue, CONTENT_DISPOSITION, CONTENT_ENCODING, CONTENT_RANGE, CONTENT_TYPE, ETAG,
+    LAST_MODIFIED, RANGE,
+};
+use reqwest::{Client, Method, StatusCode};
+use serde::{Deserialize, Serialize};
+use tokio::io::{AsyncBufReadExt, AsyncReadExt, AsyncWriteExt, BufReader};
+use tokio::net::tcp::OwnedWriteHalf;
+use tokio::net::{TcpListener, TcpStream};
+use tokio::sync::{mpsc, watch, Semaphore};
+use tokio_util::bytes::Bytes;
+use super::rate_limiter::RateLimiter;
+
+/// 默认每个请求的并行分块数
+pub const DEFAULT_PROXY_PARALLEL: usize = 8;
+/// 默认分块大小
+pub const DEFAULT_PROXY_CHUNK_SIZE: u64 = 4 * 1024 * 1024;
+/// 请求头最大长度
+const MAX_HEADER_BYTES: usize = 64 * 1024;
+/// 单个分块的最大重试次数
+const CHUNK_RETRIES: usize = 3;
+const CONNECT_TIMEOUT: Duration = Duration::from_secs(15);
+
+/// 逐跳头部，不向上游或客户端转发
+const HOP_BY_HOP: &[&str] = &[
+    "connection",
+    "proxy-connection",
+    "keep-alive",
+    "proxy-authorization",
+    "proxy-authenticate",
+    "te",
+    "trailer",
+    "transfer-encoding",
+    "upgrade",
+    "host",
+    "content-length",
+];
+
+/// 代理参数
+#[derive(Debug, Clone)]
+pub struct ProxyOptions {
+    /// 监听地址，例如 `127.0.0.1:3128`
+    pub listen: String,
+    /// 内容缓存目录，None = 不缓存
+    pub cache_dir: Option<PathBuf>,
+    /// 缓存容量上限（字节），超出时按最近使用顺序淘汰，0 = 不限制
+    pub cache_max_bytes: u64,
+    /// 每个请求的并行分块数
+    pub parallel: usize,
+    pub chunk_size: u64,
+    /// 与下载器共用的并发连接预算（守护进程模式），None = 不限制
+    pub connection_budget: Option<Arc<Semaphore>>,
+    /// 与下载器共用的总限速（守护进程模式），只作用于加速的分块下载，None = 不限速
+    pub rate_limiter: Option<Arc<RateLimiter>>,
+}
+
+impl Default for ProxyOptions {
+    fn default() -> Self {
+        ProxyOptions {
+            listen: "127.0.0.1:3128".to_string(),
+            cache_dir: None,
+            cache_max_bytes: 0,
+            parallel: DEFAULT_PROXY_PARALLEL,
+            chunk_size: DEFAULT_PROXY_CHUNK_SIZE,
+            connection_budget: None,
+            rate_limiter: None,
+        }
+    }
+}
+
+#[derive(Default)]
+struct ProxyStats {
+    requests: AtomicU64,
+    accelerated: AtomicU64,
+    cache_hits: AtomicU64,
+    passthrough: AtomicU64,
+    tunnels: AtomicU64,
+    deduplicated: AtomicU64,
+    bytes_served: AtomicU64,
+    upstream_errors: AtomicU64,
+}
+
+/// 随内容一起转发（并写入缓存）的实体头部
+#[derive(Debug, Clone, Default, PartialEq, Serialize, Deserialize)]
+struct ContentHeaders {
+    etag: Option<String>,
+    last_modified: Option<String>,
+    content_type: Option<String>,
+    #[serde(default)]
+    content_encoding: Option<String>,
+    #[serde(default)]
+    content_disposition: Option<String>,
+}
+
+impl ContentHeaders {
+    fn from_headers(headers: &HeaderMap) -> Self {
+        let text = |name| headers.get(name).and_then(|v: &HeaderValue| v.to_str().ok()).map(str::to_string);
+        ContentHeaders {
+            etag: text(ETAG),
+            last_modified: text(LAST_MODIFIED),
+            content_type: text(CONTENT_TYPE),
+            content_encoding: text(CONTENT_ENCODING),
+            content_disposition: text(CONTENT_DISPOSITION),
+        }
+    }
+
+    fn push_to(&self, head: &mut Vec<(String, String)>) {
+        let fields = [
+            ("ETag", &self.etag),
+            ("Last-Modified", &self.last_modified),
+            ("Content-Type", &self.content_type),
+            ("Content-Encoding", &self.content_encoding),
+            ("Content-Disposition", &self.content_disposition),
+        ];
+        for (name, value) in fields {
+            if let Some(value) = value {
+                head.push((name.to_string(), value.clone()));
+            }
+        }
+    }
+}
+
+/// 缓存条目的元数据，与内容文件放在一起（`<key>.json` / `<key>.bin`）
+#[derive(Debug, Clone, Serialize, Deserialize)]
+struct CacheMeta {
+    url: String,
+    size: u64,
+    #[serde(flatten)]
+    headers: ContentHeaders,
+}
+
+/// 源站探测结果（`Range: bytes=0-0` 返回 206 时得到）
+struct Probe {
+    size: u64,
+    headers: ContentHeaders,
+}
+
+impl Probe {
+    /// 缓存条目与源站当前内容一致：大小相同且至少有一个验证器（ETag / Last-Modified）相同
+    fn matches(&self, meta: &CacheMeta) -> bool {
+        if meta.size != self.size {
+            return false;
+        }
+        match (&self.headers.etag, &meta.headers.etag) {
+            (Some(a), Some(b)) => return a == b,
+            (Some(_), None) | (None, Some(_)) => return false,
+            (None, None) => {}
+        }
+        matches!((&self.headers.last_modified, &meta.headers.last_modified), (Some(a), Some(b)) if a == b)
+    }
+}
+
+/// 缓存容量记账：key -> (大小, 最近使用序号)。启动时按内容文件的修改时间恢复使用顺序
+#[derive(Default)]
+struct CacheIndex {
+    entries: HashMap<String, (u64, u64)>,
+    total: u64,
+    clock: u64,
+}
+
+impl CacheIndex {
+    fn touch(&mut self, key: &str) {
+        self.clock += 1;
+        if let Some(entry) = self.entries.get_mut(key) {
+            entry.1 = self.clock;
+        }
+    }
+
+    /// 登记（或替换）条目，返回为满足容量上限需要删除的 key，最久未使用的优先；刚登记的条目不会被淘汰
+    fn insert(&mut self, key: &str, size: u64, max_bytes: u64) -> Vec<String> {
+        self.clock += 1;
+        if let Some((old, _)) = self.entries.insert(key.to_string(), (size, self.clock)) {
+            self.total -= old;
+        }
+        self.total += size;
+        self.evict(max_bytes, Some(key))
+    }
+
+    /// 移出最久未使用的条目直到总量不超过 `max_bytes`（0 = 不限制），返回被移出的 key
+    fn evict(&mut self, max_bytes: u64, keep: Option<&str>) -> Vec<String> {
+        let mut evicted = Vec::new();
+        while max_bytes > 0 && self.total > max_bytes {
+            let victim = self
+                .entries
+                .iter()
+                .filter(|(k, _)| Some(k.as_str()) != keep)
+                .min_by_key(|(_, (_, used))| *used)
+                .map(|(k, _)| k.clone());
+            let Some(victim) = victim else { break };
+            if let Some((size, _)) = self.entries.remove(&victim) {
+                self.total -= size;
+            }
+            evicted.push(victim);
+        }
+        evicted
+    }
+}
+
+/// 一个分块的数据通道：数据片按到达顺序送入，重试用尽时送入错误
+type ChunkSender = mpsc::UnboundedSender<Result<Bytes, String>>;
+
+/// 临时文件序号，保证同一进程内并发下载同一 URL 时临时文件名不冲突
+static TEMP_SEQ: AtomicU64 = AtomicU64::new(0);
+
+struct ProxyRequest {
+    method: String,
+    target: String,
+    version: String,
+    headers: Vec<(String, String)>,
+}
+
+impl ProxyRequest {
+    fn header(&self, name: &str) -> Option<&str> {
+        self.headers
+            .iter()
+            .find(|(k, _)| k.eq_ignore_ascii_case(name))
+            .map(|(_, v)| v.as_str())
+    }
+
+    fn keep_alive(&self) -> bool {
+        let connection = self
+            .header("proxy-connection")
+            .or_else(|| self.header("connection"))
+            .map(|v| v.to_ascii_lowercase());
+        match connection.as_deref() {
+            Some(v) if v.contains("close") => false,
+            Some(v) if v.contains("keep-alive") => true,
+            _ => self.version == "HTTP/1.1",
+        }
+    }
+
+    /// 转发给上游的请求头（去掉逐跳头部）
+    fn upstream_headers(&self) -> HeaderMap {
+        let mut headers = HeaderMap::new();
+        for (name, value) in &self.headers {
+            if HOP_BY_HOP.iter().any(|h| name.eq_ignore_ascii_case(h)) {
+                continue;
+            }
+            if let (Ok(name), Ok(value)) = (HeaderName::from_bytes(name.as_bytes()), HeaderValue::from_str(value)) {
+                headers.append(name, value);
+            }
+        }
+        headers
+    }
+}
+
+/// 本机 HTTP 正向代理
+///
+/// 其他工具（curl、包管理器等）把它设为 `http_proxy` 后，普通 GET 请求会经过并行分块引擎加速：
+/// 先用 `Range: bytes=0-0` 探测大小与验证器，足够大且支持 Range 时按分块并行拉取，
+/// 队首分块边下载边写给客户端，领先的分块在内存中缓冲（最多 `parallel` 个分块）；同时写入内容缓存，
+/// 相同 URL（验证器未变化）的后续请求直接从缓存返回，同一 URL 的并发请求只下载一次。
+/// 设置了 `cache_max_bytes` 时按最近使用顺序淘汰缓存条目。
+///
+/// 其他方法、带 Range 的请求、不支持 Range 的源站按原样转发；`CONNECT`（HTTPS）只做隧道，无法加速。
+pub struct ProxyServer {
+    options: ProxyOptions,
+    client: Client,
+    stats: ProxyStats,
+    /// 正在下载的 URL -> 完成通知（用于合并同一 URL 的并发请求）
+    inflight: Mutex<HashMap<String, watch::Receiver<bool>>>,
+    cache_index: Mutex<CacheIndex>,
+}
+
+impl ProxyServer {
+    pub fn new(mut options: ProxyOptions) -> Result<Arc<Self>, Box<dyn std::error::Error + Send + Sync>> {
+        options.parallel = options.parallel.max(1);
+        options.chunk_size = options.chunk_size.max(64 * 1024);
+        let mut cache_index = CacheIndex::default();
+        if let Some(ref dir) = options.cache_dir {
+            std::fs::create_dir_all(dir)?;
+            cache_index = scan_cache_dir(dir, options.cache_max_bytes)?;
+        }
+
+        let client = Client::builder()
+            .connect_timeout(CONNECT_TIMEOUT)
+            .pool_idle_timeout(Duration::from_secs(90))
+            .pool_max_idle_per_host(options.parallel)
+            .tcp_keepalive(Duration::from_secs(30))
+            // 重定向交给客户端处理，跳转后的地址再经过代理时同样可以加速
+            .redirect(reqwest::redirect::Policy::none())
+            .build()?;
+
+        Ok(Arc::new(ProxyServer {
+            options,
+            client,
+            stats: ProxyStats::default(),
+            inflight: Mutex::new(HashMap::new()),
+            cache_index: Mutex::new(cache_index),
+        }))
+    }
+
+    /// 监听并处理连接，直到监听失败
+    pub async fn run(self: Arc<Self>) -> std::io::Result<()> {
+        let listener = TcpListener::bind(&self.options.listen).await?;
+        eprintln!(
+            "TTHSD 代理已启动: http://{}（缓存 {}）",
+            self.options.listen,
+            self.options.cache_dir.as_ref().map_or("未启用".to_string(), |d| d.display().to_string())
+        );
+        self.serve(listener).await
+    }
+
+    async fn serve(self: Arc<Self>, listener: TcpListener) -> std::io::Result<()> {
+        loop {
+            let (stream, _) = listener.accept().await?;
+            let server = self.clone();
+            tokio::spawn(async move {
+                if let Err(e) = server.serve_connection(stream).await {
+                    if e.kind() != std::io::ErrorKind::BrokenPipe && e.kind() != std::io::ErrorKind::ConnectionReset {
+                        eprintln!("代理连接异常结束: {:?}", e);
+                    }
+                }
+            });
+        }
+    }
+
+    pub fn get_stats(&self) -> HashMap<String, serde_json::Value> {
+        let stats = &self.stats;
+        let mut map = HashMap::new();
+        map.insert("listen".to_string(), serde_json::Value::from(self.options.listen.clone()));
+        map.insert("requests".to_string(), serde_json::Value::from(stats.requests.load(Ordering::Relaxed)));
+        map.insert("accelerated".to_string(), serde_json::Value::from(stats.accelerated.load(Ordering::Relaxed)));
+        map.insert("cache_hits".to_string(), serde_json::Value::from(stats.cache_hits.load(Ordering::Relaxed)));
+        map.insert("deduplicated".to_string(), serde_json::Value::from(stats.deduplicated.load(Ordering::Relaxed)));
+        map.insert("passthrough".to_string(), serde_json::Value::from(stats.passthrough.load(Ordering::Relaxed)));
+        map.insert("tunnels".to_string(), serde_json::Value::from(stats.tunnels.load(Ordering::Relaxed)));
+        map.insert("bytes_served".to_string(), serde_json::Value::from(stats.bytes_served.load(Ordering::Relaxed)));
+        map.insert("upstream_errors".to_string(), serde_json::Value::from(stats.upstream_errors.load(Ordering::Relaxed)));
+        if self.options.cache_dir.is_some() {
+            let index = self.cache_index.lock().unwrap();
+            map.insert("cache_entries".to_string(), serde_json::Value::from(index.entries.len()));
+            map.insert("cache_bytes".to_string(), serde_json::Value::from(index.total));
+        }
+        map
+    }
+
+    async fn serve_connection(&self, stream: TcpStream) -> std::io::Result<()> {
+        let _ = stream.set_nodelay(true);
+        let (read_half, mut writer) = stream.into_split();
+        let mut reader = BufReader::new(read_half);
+
+        loop {
+            let Some(request) = read_request(&mut reader).await? else {
+                return Ok(());
+            };
+            self.stats.requests.fetch_add(1, Ordering::Relaxed);
+
+            if request.method.eq_ignore_ascii_case("CONNECT") {
+                self.stats.tunnels.fetch_add(1, Ordering::Relaxed);
+                return tunnel(&request.target, reader, writer).await;
+            }
+
+            if !request.target.starts_with("http://") && !request.target.starts_with("https://") {
+                write_simple(&mut writer, 400, "Bad Request", "仅支持代理形式的请求（absolute-form URL）").await?;
+                return Ok(());
+            }
+
+            // 请求体只支持 Content-Length
+            let mut body = Vec::new();
+            if let Some(len) = request.header("content-length").and_then(|v| v.trim().parse::<usize>().ok()) {
+                body.resize(len, 0);
+                reader.read_exact(&mut body).await?;
+            } else if request.header("transfer-encoding").is_some() {
+                write_simple(&mut writer, 501, "Not Implemented", "不支持分块编码的请求体").await?;
+                return Ok(());
+            }
+
+            let accelerate = request.method == "GET" && request.header("range").is_none();
+            let keep_alive = if accelerate {
+                self.serve_get(&request, &mut writer).await?
+            } else {
+                self.passthrough(&request, body, &mut writer).await?
+            };
+            if !keep_alive || !request.keep_alive() {
+                let _ = writer.shutdown().await;
+                return Ok(());
+            }
+        }
+    }
+
+    /// 处理普通 GET：缓存命中直接返回，否则探测后并行加速或原样转发。返回连接是否可以复用
+    async fn serve_get(&self, request: &ProxyRequest, writer: &mut OwnedWriteHalf) -> std::io::Result<bool> {
+        let url = request.target.as_str();
+        let headers = request.upstream_headers();
+
+        loop {
+            let probe = match self.client.get(url).headers(headers.clone()).header(RANGE, "bytes=0-0").send().await {
+                Ok(response) => response,
+                Err(e) => {
+                    self.stats.upstream_errors.fetch_add(1, Ordering::Relaxed);
+                    write_simple(writer, 502, "Bad Gateway", &format!("上游请求失败: {}", e)).await?;
+                    return Ok(true);
+                }
+            };
+
+            // 不支持 Range（200）或出错（4xx/5xx/3xx）：探测响应本身就是完整响应，直接转发
+            if probe.status() != StatusCode::PARTIAL_CONTENT {
+                self.stats.passthrough.fetch_add(1, Ordering::Relaxed);
+                return self.forward_response(probe, writer).await;
+            }
+            let Some(info) = parse_probe(probe.headers()) else {
+                drop(probe);
+                return self.passthrough_get(request, writer).await;
+            };
+            drop(probe);
+
+            if let Some(meta) = self.cache_lookup(url).await {
+                if info.matches(&meta) {
+                    // 条目可能刚被淘汰，打不开时按未命中处理
+                    if let (Some(key), Some((_, data_path))) = (self.cache_key(url), self.cache_paths(url)) {
+                        if let Ok(file) = tokio::fs::File::open(&data_path).await {
+                            self.stats.cache_hits.fetch_add(1, Ordering::Relaxed);
+                            self.cache_index.lock().unwrap().touch(&key);
+                            return self.serve_cached(file, &meta, writer).await;
+                        }
+                    }
+                }
+            }
+
+            if info.size < self.options.chunk_size * 2 {
+                return self.passthrough_get(request, writer).await;
+            }
+
+            // 同一 URL 正在下载时等待其完成，再按缓存重新判断（缓存未启用时直接各自下载）；
+            // 检查与登记在同一把锁内完成，两个并发请求不会同时成为下载者
+            let registration = match self.options.cache_dir {
+                Some(_) => {
+                    let mut inflight = self.inflight.lock().unwrap();
+                    match inflight.get(url).cloned() {
+                        Some(done) => Err(done),
+                        None => {
+                            let (done_tx, done_rx) = watch::channel(false);
+                            inflight.insert(url.to_string(), done_rx);
+                            Ok(Some(InflightGuard { server: self, url: url.to_string(), done: done_tx }))
+                        }
+                    }
+                }
+                None => Ok(None),
+            };
+            let registration = match registration {
+                Ok(registration) => registration,
+                Err(mut done) => {
+                    self.stats.deduplicated.fetch_add(1, Ordering::Relaxed);
+                    let _ = done.wait_for(|finished| *finished).await;
+                    continue;
+                }
+            };
+
+            self.stats.accelerated.fetch_add(1, Ordering::Relaxed);
+            return self.accelerate(url, &headers, info, registration, writer).await;
+        }
+    }
+
+    /// 按分块并行下载，按顺序写给客户端并同时写入缓存
+    ///
+    /// 每个分块有自己的数据通道：队首分块收到多少就写出多少，领先的分块留在通道里，
+    /// 只有序号落在 `[队首, 队首 + parallel)` 内的分块才开始下载，缓冲的数据不超过 `parallel` 个分块。
+    async fn accelerate(
+        &self,
+        url: &str,
+        headers: &HeaderMap,
+        info: Probe,
+        registration: Option<InflightGuard<'_>>,
+        writer: &mut OwnedWriteHalf,
+    ) -> std::io::Result<bool> {
+        let mut head = vec![
+            ("Content-Length".to_string(), info.size.to_string()),
+            ("Accept-Ranges".to_string(), "bytes".to_string()),
+            ("X-TTHSD-Cache".to_string(), "MISS".to_string()),
+        ];
+        info.headers.push_to(&mut head);
+        write_head(writer, 200, "OK", &head).await?;
+
+        // 超过缓存容量上限的文件不写缓存
+        let max_bytes = self.options.cache_max_bytes;
+        let mut cache_file = match (&registration, self.cache_paths(url)) {
+            (Some(_), Some((_, data_path))) if max_bytes == 0 || info.size <= max_bytes => {
+                let seq = TEMP_SEQ.fetch_add(1, Ordering::Relaxed);
+                let temp = data_path.with_extension(format!("part-{}-{}", std::process::id(), seq));
+                tokio::fs::File::create(&temp).await.ok().map(|f| (f, temp))
+            }
+            _ => None,
+        };
+
+        let ranges = split_ranges(info.size, self.options.chunk_size);
+        let (senders, receivers): (Vec<_>, Vec<_>) = ranges.iter().map(|_| mpsc::unbounded_channel()).unzip();
+        let parallel = self.options.parallel;
+        let (head_tx, head_rx) = watch::channel(0usize);
+
+        let producer = futures::stream::iter(ranges.iter().copied().zip(senders).enumerate()).for_each_concurrent(
+            parallel,
+            |(index, ((start, end), tx))| {
+                let mut head_rx = head_rx.clone();
+                async move {
+                    // 队首已走远之前等待；发送端释放（客户端处理结束）时直接放弃
+                    if head_rx.wait_for(|head| index < head + parallel).await.is_ok() {
+                        self.fetch_range(url, headers, start, end, tx).await;
+                    }
+                }
+            },
+        );
+
+        let consumer = async {
+            let mut client_alive = true;
+            for (index, (mut chunk, (start, end))) in receivers.into_iter().zip(ranges.iter().copied()).enumerate() {
+                let _ = head_tx.send(index);
+                let mut received = 0u64;
+                let mut failure = None;
+                while let Some(piece) = chunk.recv().await {
+                    let piece = match piece {
+                        Ok(piece) => piece,
+                        Err(e) => {
+                            failure = Some(e);
+                            break;
+                        }
+                    };
+                    received += piece.len() as u64;
+
+                    if client_alive {
+                        if writer.write_all(&piece).await.is_ok() {
+                            self.stats.bytes_served.fetch_add(piece.len() as u64, Ordering::Relaxed);
+                        } else {
+                            client_alive = false;
+                        }
+                    }
+                    if let Some((ref mut file, _)) = cache_file {
+                        if file.write_all(&piece).await.is_err() {
+                            let (_, temp) = cache_file.take().unwrap();
+                            let _ = tokio::fs::remove_file(temp).await;
+                        }
+                    }
+
+                    // 客户端已断开且不需要写缓存时不再继续下载
+                    if !client_alive && cache_file.is_none() {
+                        return false;
+                    }
+                }
+
+                if failure.is_none() && received != end - start + 1 {
+                    failure = Some(format!("分块 {}-{} 只收到 {} 字节", start, end, received));
+                }
+                if let Some(e) = failure {
+                    // 响应头已经发出，只能断开连接让客户端感知失败
+                    self.stats.upstream_errors.fetch_add(1, Ordering::Relaxed);
+                    eprintln!("代理分块下载失败 ({}): {}", url, e);
+                    if let Some((_, temp)) = cache_file.take() {
+                        let _ = tokio::fs::remove_file(temp).await;
+                    }
+                    return false;
+                }
+            }
+
+            if let Some((mut file, temp)) = cache_file.take() {
+                let _ = file.flush().await;
+                drop(file);
+                let meta = CacheMeta { url: url.to_string(), size: info.size, headers: info.headers.clone() };
+                self.cache_store(&meta, &temp).await;
+            }
+            client_alive
+        };
+
+        // 客户端处理先结束时丢弃下载任务（取消未完成的分块请求）
+        tokio::pin!(producer, consumer);
+        let client_alive = tokio::select! {
+            alive = &mut consumer => alive,
+            _ = &mut producer => consumer.await,
+        };
+        drop(registration);
+        Ok(client_alive)
+    }
+
+    /// 下载 `start..=end`，数据片按到达顺序送入 `tx`；中途断开时从已收到的位置续传，重试用尽后送入错误
+    async fn fetch_range(&self, url: &str, headers: &HeaderMap, start: u64, end: u64, tx: ChunkSender) {
+        let _permit = match self.options.connection_budget {
+            Some(ref budget) => match budget.clone().acquire_owned().await {
+                Ok(permit) => Some(permit),
+                Err(e) => {
+                    let _ = tx.send(Err(e.to_string()));
+                    return;
+                }
+            },
+            None => None,
+        };
+
+        let mut offset = start;
+        let mut last_error = String::new();
+        for attempt in 0..CHUNK_RETRIES {
+            if attempt > 0 {
+                tokio::time::sleep(Duration::from_millis(200 * attempt as u64)).await;
+            }
+            let response = match self
+                .client
+                .get(url)
+                .headers(headers.clone())
+                .header(RANGE, format!("bytes={}-{}", offset, end))
+                .send()
+                .await
+            {
+                Ok(r) => r,
+                Err(e) => {
+                    last_error = e.to_string();
+                    continue;
+                }
+            };
+            if response.status() != StatusCode::PARTIAL_CONTENT {
+                last_error = format!("分块 {}-{} 返回 {}", offset, end, response.status());
+                continue;
+            }
+
+            let mut stream = response.bytes_stream();
+            loop {
+                match stream.next().await {
+                    Some(Ok(mut bytes)) => {
+                        // 源站多返回的部分丢弃
+                        bytes.truncate((end + 1 - offset) as usize);
+                        if let Some(ref limiter) = self.options.rate_limiter {
+                            limiter.acquire(bytes.len()).await;
+                        }
+                        offset += bytes.len() as u64;
+                        if tx.send(Ok(bytes)).is_err() {
+                            return;
+                        }
+                        if offset > end {
+                            return;
+                        }
+                    }
+                    Some(Err(e)) => {
+                        last_error = e.to_string();
+                        break;
+                    }
+                    None => {
+                        last_error = format!("分块 {}-{} 在 {} 处提前结束", start, end, offset);
+                        break;
+                    }
+                }
+            }
+        }
+        let _ = tx.send(Err(last_error));
+    }
+
+    /// 不加速的 GET：单连接转发
+    async fn passthrough_get(&self, request: &ProxyRequest, writer: &mut OwnedWriteHalf) -> std::io::Result<bool> {
+        self.passthrough(request, Vec::new(), writer).await
+    }
+
+    /// 原样转发请求并流式返回响应
+    async fn passthrough(&self, request: &ProxyRequest, body: Vec<u8>, writer: &mut OwnedWriteHalf) -> std::io::Result<bool> {
+        self.stats.passthrough.fetch_add(1, Ordering::Relaxed);
+        let method = match Method::from_bytes(request.method.as_bytes()) {
+            Ok(m) => m,
+            Err(_) => {
+                write_simple(writer, 405, "Method Not Allowed", "无效的请求方法").await?;
+                return Ok(false);
+            }
+        };
+
+        let mut builder = self.client.request(method, &request.target).headers(request.upstream_headers());
+        if !body.is_empty() {
+            builder = builder.body(body);
+        }
+        match builder.send().await {
+            Ok(response) => self.forward_response(response, writer).await,
+            Err(e) => {
+                self.stats.upstream_errors.fetch_add(1, Ordering::Relaxed);
+                write_simple(writer, 502, "Bad Gateway", &format!("上游请求失败: {}", e)).await?;
+                Ok(true)
+            }
+        }
+    }
+
+    /// 写出上游响应；长度未知时以关闭连接结束响应体
+    async fn forward_response(&self, response: reqwest::Response, writer: &mut OwnedWriteHalf) -> std::io::Result<bool> {
+        let status = response.status();
+        let length = response.content_length();
+        let mut head: Vec<(String, String)> = response
+            .headers()
+            .iter()
+            .filter(|(name, _)| !HOP_BY_HOP.iter().any(|h| name.as_str().eq_ignore_ascii_case(h)))
+            .filter_map(|(name, value)| Some((name.as_str().to_string(), value.to_str().ok()?.to_string())))
+            .collect();
+        let keep_alive = match length {
+            Some(len) => {
+                head.push(("Content-Length".to_string(), len.to_string()));
+                true
+            }
+            None => {
+                head.push(("Connection".to_string(), "close".to_string()));
+                false
+            }
+        };
+        write_head(writer, status.as_u16(), status.canonical_reason().unwrap_or(""), &head).await?;
+
+        let mut stream = response.bytes_stream();
+        while let Some(item) = stream.next().await {
+            match item {
+                Ok(bytes) => {
+                    writer.write_all(&bytes).await?;
+                    self.stats.bytes_served.fetch_add(bytes.len() as u64, Ordering::Relaxed);
+                }
+                Err(e) => {
+                    self.stats.upstream_errors.fetch_add(1, Ordering::Relaxed);
+                    eprintln!("代理转发中断: {}", e);
+                    return Ok(false);
+                }
+            }
+        }
+        Ok(keep_alive)
+    }
+
+    async fn serve_cached(&self, mut file: tokio::fs::File, meta: &CacheMeta, writer: &mut OwnedWriteHalf) -> std::io::Result<bool> {
+        let mut head = vec![
+            ("Content-Length".to_string(), meta.size.to_string()),
+            ("Accept-Ranges".to_string(), "bytes".to_string()),
+            ("X-TTHSD-Cache".to_string(), "HIT".to_string()),
+        ];
+        meta.headers.push_to(&mut head);
+        write_head(writer, 200, "OK", &head).await?;
+
+        let copied = tokio::io::copy(&mut file, writer).await?;
+        self.stats.bytes_served.fetch_add(copied, Ordering::Relaxed);
+        Ok(copied == meta.size)
+    }
+
+    /// 缓存键：URL 的 FNV-1a 64 位哈希（十六进制）
+    fn cache_key(&self, url: &str) -> Option<String> {
+        self.options.cache_dir.as_ref()?;
+        Some(format!("{:016x}", fnv1a64(url.as_bytes())))
+    }
+
+    /// 缓存文件路径：(`<key>.json`, `<key>.bin`)
+    fn cache_paths(&self, url: &str) -> Option<(PathBuf, PathBuf)> {
+        let dir = self.options.cache_dir.as_ref()?;
+        let key = self.cache_key(url)?;
+        Some((dir.join(format!("{}.json", key)), dir.join(format!("{}.bin", key))))
+    }
+
+    async fn cache_lookup(&self, url: &str) -> Option<CacheMeta> {
+        let (meta_path, data_path) = self.cache_paths(url)?;
+        let meta: CacheMeta = serde_json::from_slice(&tokio::fs::read(meta_path).await.ok()?).ok()?;
+        let size = tokio::fs::metadata(data_path).await.ok()?.len();
+        (meta.url == url && meta.size == size).then_some(meta)
+    }
+
+    /// 下载完成后把临时文件提交为缓存条目（先写内容再写元数据，元数据存在即表示条目完整）
+    async fn cache_store(&self, meta: &CacheMeta, temp: &std::path::Path) {
+        let Some((meta_path, data_path)) = self.cache_paths(&meta.url) else {
+            return;
+        };
+        let _ = tokio::fs::remove_file(&meta_path).await;
+        if let Err(e) = tokio::fs::rename(temp, &data_path).await {
+            eprintln!("写入代理缓存失败: {:?}", e);
+            let _ = tokio::fs::remove_file(temp).await;
+            return;
+        }
+        match serde_json::to_vec(meta) {
+            Ok(json) => {
+                if let Err(e) = tokio::fs::write(&meta_path, json).await {
+                    eprintln!("写入代理缓存元数据失败: {:?}", e);
+                    return;
+                }
+            }
+            Err(e) => {
+                eprintln!("序列化代理缓存元数据失败: {:?}", e);
+                return;
+            }
+        }
+
+        let (Some(key), Some(dir)) = (self.cache_key(&meta.url), self.options.cache_dir.as_ref()) else {
+            return;
+        };
+        let evicted = self.cache_index.lock().unwrap().insert(&key, meta.size, self.options.cache_max_bytes);
+        // 先删元数据：元数据不存在的条目不会再被命中
+        for victim in evicted {
+            let _ = tokio::fs::remove_file(dir.join(format!("{}.json", victim))).await;
+            let _ = tokio::fs::remove_file(dir.join(format!("{}.bin", victim))).await;
+        }
+    }
+}
+
+/// 进行中的下载登记，释放时移除并唤醒等待同一 URL 的请求
+struct InflightGuard<'a> {
+    server: &'a ProxyServer,
+    url: String,
+    done: watch::Sender<bool>,
+}
+
+impl Drop for InflightGuard<'_> {
+    fn drop(&mut self) {
+        self.server.inflight.lock().unwrap().remove(&self.url);
+        let _ = self.done.send(true);
+    }
+}
+
+/// 读取一个请求的请求行与头部；连接在请求之间正常关闭时返回 None
+async fn read_request<R>(reader: &mut BufReader<R>) -> std::io::Result<Option<ProxyRequest>>
+where
+    R: tokio::io::AsyncRead + Unpin,
+{
+    let mut line = String::new();
+    let mut total = 0usize;
+
+    // 跳过请求之间多余的空行
+    loop {
+        line.clear();
+        if reader.read_line(&mut line).await? == 0 {
+            return Ok(None);
+        }
+        if !line.trim().is_empty() {
+            break;
+        }
+    }
+    total += line.len();
+
+    let mut parts = line.split_whitespace();
+    let (Some(method), Some(target), Some(version)) = (parts.next(), parts.next(), parts.next()) else {
+        return Err(std::io::Error::new(std::io::ErrorKind::InvalidData, "无效的请求行"));
+    };
+    let mut request = ProxyRequest {
+        method: method.to_string(),
+        target: target.to_string(),
+        version: version.to_string(),
+        headers: Vec::new(),
+    };
+
+    loop {
+        line.clear();
+        let n = reader.read_line(&mut line).await?;
+        total += n;
+        if n == 0 || total > MAX_HEADER_BYTES {
+            return Err(std::io::Error::new(std::io::ErrorKind::InvalidData, "请求头不完整或过长"));
+        }
+        let trimmed = line.trim_end_matches(['\r', '\n']);
+        if trimmed.is_empty() {
+            break;
+        }
+        if let Some((name, value)) = trimmed.split_once(':') {
+            request.headers.push((name.trim().to_string(), value.trim().to_string()));
+        }
+    }
+    Ok(Some(request))
+}
+
+/// CONNECT 隧道：与目标建立 TCP 连接后双向转发
+async fn tunnel<R>(target: &str, mut reader: BufReader<R>, mut writer: OwnedWriteHalf) -> std::io::Result<()>
+where
+    R: tokio::io::AsyncRead + Unpin,
+{
+    let upstream = match tokio::time::timeout(CONNECT_TIMEOUT, TcpStream::connect(target)).await {
+        Ok(Ok(stream)) => stream,
+        _ => {
+            write_simple(&mut writer, 502, "Bad Gateway", "无法连接目标地址").await?;
+            return Ok(());
+        }
+    };
+    writer.write_all(b"HTTP/1.1 200 Connection Established\r\n\r\n").await?;
+
+    let (mut up_read, mut up_write) = upstream.into_split();
+    let client_to_upstream = async {
+        tokio::io::copy(&mut reader, &mut up_write).await?;
+        up_write.shutdown().await
+    };
+    let upstream_to_client = async {
+        tokio::io::copy(&mut up_read, &mut writer).await?;
+        writer.shutdown().await
+    };
+    let _ = tokio::try_join!(client_to_upstream, upstream_to_client);
+    Ok(())
+}
+
+fn parse_probe(headers: &HeaderMap) -> Option<Probe> {
+    // Content-Range: bytes 0-0/12345
+    let size = headers.get(CONTENT_RANGE)?.to_str().ok()?.rsplit('/').next()?.trim().parse::<u64>().ok()?;
+    Some(Probe { size, headers: ContentHeaders::from_headers(headers) })
+}
+
+/// 把 `0..size` 按 `chunk_size` 切成闭区间
+fn split_ranges(size: u64, chunk_size: u64) -> Vec<(u64, u64)> {
+    (0..size)
+        .step_by(chunk_size as usize)
+        .map(|start| (start, (start + chunk_size).min(size) - 1))
+        .collect()
+}
+
+/// 启动时登记已有的缓存条目（按内容文件的修改时间恢复使用顺序），淘汰超出容量上限的部分，
+/// 并清理上次异常退出留下的临时文件
+fn scan_cache_dir(dir: &Path, max_bytes: u64) -> std::io::Result<CacheIndex> {
+    let mut found = Vec::new();
+    for entry in std::fs::read_dir(dir)? {
+        let path = entry?.path();
+        let (Some(stem), Some(ext)) = (path.file_stem().and_then(|s| s.to_str()), path.extension().and_then(|s| s.to_str())) else {
+            continue;
+        };
+        if ext.starts_with("part-") {
+            let _ = std::fs::remove_file(&path);
+        } else if ext == "bin" && path.with_extension("json").exists() {
+            if let Ok(meta) = std::fs::metadata(&path) {
+                let modified = meta.modified().unwrap_or(std::time::UNIX_EPOCH);
+                found.push((modified, stem.to_string(), meta.len()));
+            }
+        }
+    }
+
+    found.sort();
+    let mut index = CacheIndex::default();
+    for (_, key, size) in found {
+        index.insert(&key, size, 0);
+    }
+    for victim in index.evict(max_bytes, None) {
+        let _ = std::fs::remove_file(dir.join(format!("{}.json", victim)));
+        let _ = std::fs::remove_file(dir.join(format!("{}.bin", victim)));
+    }
+    Ok(index)
+}
+
+async fn write_head(writer: &mut OwnedWriteHalf, status: u16, reason: &str, headers: &[(String, String)]) -> std::io::Result<()> {
+    let mut head = format!("HTTP/1.1 {} {}\r\n", status, reason);
+    for (name, value) in headers {
+        head.push_str(name);
+        head.push_str(": ");
+        head.push_str(value);
+        head.push_str("\r\n");
+    }
+    head.push_str("\r\n");
+    writer.write_all(head.as_bytes()).await
+}
+
+async fn write_simple(writer: &mut OwnedWriteHalf, status: u16, reason: &str, message: &str) -> std::io::Result<()> {
+    let head = [
+        ("Content-Type".to_string(), "text/plain; charset=utf-8".to_string()),
+        ("Content-Length".to_string(), message.len().to_string()),
+    ];
+    write_head(writer, status, reason, &head).await?;
+    writer.write_all(message.as_bytes()).await
+}
+
+/// FNV-1a 64 位哈希（缓存文件名需要跨版本稳定，不能用 `DefaultHasher`）
+fn fnv1a64(data: &[u8]) -> u64 {
+    let mut hash: u64 = 0xcbf29ce484222325;
+    for &b in data {
+        hash ^= b as u64;
+        hash = hash.wrapping_mul(0x100000001b3);
+    }
+    hash
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::atomic::AtomicUsize;
+
+    fn temp_cache_dir(name: &str) -> PathBuf {
+        let dir = std::env::temp_dir().join(format!("tthsd-proxy-{}-{}", name, std::process::id()));
+        let _ = std::fs::remove_dir_all(&dir);
+        dir
+    }
+
+    fn cached_server(dir: &Path, cache_max_bytes: u64) -> Arc<ProxyServer> {
+        let options = ProxyOptions {
+            cache_dir: Some(dir.to_path_buf()),
+            cache_max_bytes,
+            chunk_size: 64 * 1024,
+            ..Default::default()
+        };
+        ProxyServer::new(options).unwrap()
+    }
+
+    fn probe(size: u64, etag: Option<&str>, last_modified: Option<&str>) -> Probe {
+        Probe {
+            size,
+            headers: ContentHeaders {
+                etag: etag.map(str::to_string),
+                last_modified: last_modified.map(str::to_string),
+                ..Default::default()
+            },
+        }
+    }
+
+    async fn store(server: &ProxyServer, url: &str, body: &[u8], etag: &str) {
+        let (_, data_path) = server.cache_paths(url).unwrap();
+        let temp = data_path.with_extension("part-test");
+        tokio::fs::write(&temp, body).await.unwrap();
+        let meta = CacheMeta {
+            url: url.to_string(),
+            size: body.len() as u64,
+            headers: ContentHeaders {
+                etag: Some(etag.to_string()),
+                content_encoding: Some("gzip".to_string()),
+                ..Default::default()
+            },
+        };
+        server.cache_store(&meta, &temp).await;
+    }
+
+    #[test]
+    fn split_ranges_covers_size_exactly() {
+        assert_eq!(split_ranges(10, 4), vec![(0, 3), (4, 7), (8, 9)]);
+        assert_eq!(split_ranges(8, 4), vec![(0, 3), (4, 7)]);
+        assert_eq!(split_ranges(3, 4), vec![(0, 2)]);
+        assert!(split_ranges(0, 4).is_empty());
+    }
+
+    #[test]
+    fn probe_matches_requires_size_and_validator() {
+        let meta = CacheMeta {
+            url: "http://a/".to_string(),
+            size: 100,
+            headers: ContentHeaders {
+                etag: Some("\"v1\"".to_string()),
+                last_modified: Some("Mon".to_string()),
+                ..Default::default()
+            },
+        };
+        assert!(probe(100, Some("\"v1\""), None).matches(&meta));
+        assert!(!probe(100, Some("\"v2\""), Some("Mon")).matches(&meta));
+        assert!(!probe(99, Some("\"v1\""), None).matches(&meta));
+        // 只有一方有 ETag 时不信任 Last-Modified
+        assert!(!probe(100, None, Some("Mon")).matches(&meta));
+
+        let no_etag = CacheMeta { headers: ContentHeaders { etag: None, ..meta.headers.clone() }, ..meta };
+        assert!(probe(100, None, Some("Mon")).matches(&no_etag));
+        assert!(!probe(100, None, None).matches(&CacheMeta { headers: ContentHeaders::default(), ..no_etag }));
+    }
+
+    #[tokio::test]
+    async fn cache_hit_miss_and_validator_mismatch() {
+        let dir = temp_cache_dir("lookup");
+        let server = cached_server(&dir, 0);
+        let url = "http://example.com/a.bin";
+
+        assert!(server.cache_lookup(url).await.is_none());
+        store(&server, url, b"hello", "\"v1\"").await;
+
+        let meta = server.cache_lookup(url).await.expect("cache hit");
+        assert_eq!(meta.size, 5);
+        assert_eq!(meta.headers.content_encoding.as_deref(), Some("gzip"));
+        assert!(probe(5, Some("\"v1\""), None).matches(&meta));
+        assert!(!probe(5, Some("\"v2\""), None).matches(&meta));
+        assert!(server.cache_lookup("http://example.com/other.bin").await.is_none());
+
+        // 内容文件被截断时元数据不再可信
+        let (_, data_path) = server.cache_paths(url).unwrap();
+        std::fs::write(&data_path, b"hel").unwrap();
+        assert!(server.cache_lookup(url).await.is_none());
+        let _ = std::fs::remove_dir_all(&dir);
+    }
+
+    #[tokio::test]
+    async fn cache_evicts_least_recently_used() {
+        let dir = temp_cache_dir("lru");
+        let server = cached_server(&dir, 250);
+        let body = [7u8; 100];
+
+        store(&server, "http://h/a", &body, "a").await;
+        store(&server, "http://h/b", &body, "b").await;
+        server.cache_index.lock().unwrap().touch(&server.cache_key("http://h/a").unwrap());
+        store(&server, "http://h/c", &body, "c").await;
+
+        assert!(server.cache_lookup("http://h/a").await.is_some());
+        assert!(server.cache_lookup("http://h/b").await.is_none());
+        assert!(server.cache_lookup("http://h/c").await.is_some());
+        assert!(!server.cache_paths("http://h/b").unwrap().1.exists());
+        assert_eq!(server.cache_index.lock().unwrap().total, 200);
+
+        // 重启后按已有条目恢复容量记账，并清理残留的临时文件
+        std::fs::write(dir.join("0000000000000000.part-1-1"), b"x").unwrap();
+        let restarted = cached_server(&dir, 250);
+        assert_eq!(restarted.cache_index.lock().unwrap().total, 200);
+        assert!(!dir.join("0000000000000000.part-1-1").exists());
+        let _ = std::fs::remove_dir_all(&dir);
+    }
+
+    /// 支持 Range 的最小源站：记录非探测的分块请求数，分块响应延迟发出
+    async fn origin(body: Arc<Vec<u8>>, chunk_requests: Arc<AtomicUsize>) -> String {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let addr = listener.local_addr().unwrap();
+        tokio::spawn(async move {
+            loop {
+                let Ok((stream, _)) = listener.accept().await else { return };
+                let body = body.clone();
+                let chunk_requests = chunk_requests.clone();
+                tokio::spawn(async move {
+                    let (read_half, mut writer) = stream.into_split();
+                    let mut reader = BufReader::new(read_half);
+                    while let Ok(Some(request)) = read_request(&mut reader).await {
+                        let range = request.header("range").and_then(|r| r.strip_prefix("bytes=")).and_then(|r| {
+                            let (a, b) = r.split_once('-')?;
+                            Some((a.parse::<usize>().ok()?, b.parse::<usize>().ok()?))
+                        });
+                        let Some((start, end)) = range else { return };
+                        if end > 0 {
+                            chunk_requests.fetch_add(1, Ordering::SeqCst);
+                            tokio::time::sleep(Duration::from_millis(150)).await;
+                        }
+                        let end = end.min(body.len() - 1);
+                        let head = format!(
+                            "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes {}-{}/{}\r\nContent-Length: {}\r\n\
+                             ETag: \"v1\"\r\nContent-Disposition: attachment; filename=f.bin\r\n\r\n",
+                            start,
+                            end,
+                            body.len(),
+                            end - start + 1
+                        );
+                        if writer.write_all(head.as_bytes()).await.is_err() || writer.write_all(&body[start..=end]).await.is_err() {
+                            return;
+                        }
+                    }
+                });
+            }
+        });
+        format!("http://{}/f.bin", addr)
+    }
+
+    async fn proxy_get(proxy: std::net::SocketAddr, url: &str) -> (String, Vec<u8>) {
+        let mut stream = TcpStream::connect(proxy).await.unwrap();
+        let request = format!("GET {} HTTP/1.1\r\nHost: origin\r\nConnection: close\r\n\r\n", url);
+        stream.write_all(request.as_bytes()).await.unwrap();
+        let mut response = Vec::new();
+        stream.read_to_end(&mut response).await.unwrap();
+        let split = response.windows(4).position(|w| w == b"\r\n\r\n").unwrap();
+        (String::from_utf8_lossy(&response[..split]).to_string(), response[split + 4..].to_vec())
+    }
+
+    #[tokio::test]
+    async fn concurrent_requests_for_one_url_download_once() {
+        let body: Arc<Vec<u8>> = Arc::new((0..3 * 64 * 1024).map(|i| (i % 251) as u8).collect());
+        let chunk_requests = Arc::new(AtomicUsize::new(0));
+        let url = origin(body.clone(), chunk_requests.clone()).await;
+
+        let dir = temp_cache_dir("dedup");
+        let server = cached_server(&dir, 0);
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let proxy = listener.local_addr().unwrap();
+        tokio::spawn(server.clone().serve(listener));
+
+        let first = tokio::spawn({
+            let url = url.clone();
+            async move { proxy_get(proxy, &url).await }
+        });
+        tokio::time::sleep(Duration::from_millis(50)).await;
+        let (second_head, second_body) = proxy_get(proxy, &url).await;
+        let (first_head, first_body) = first.await.unwrap();
+
+        assert_eq!(first_body, *body);
+        assert_eq!(second_body, *body);
+        assert!(first_head.contains("X-TTHSD-Cache: MISS"), "{}", first_head);
+        assert!(second_head.contains("X-TTHSD-Cache: HIT"), "{}", second_head);
+        assert!(second_head.contains("Content-Disposition: attachment; filename=f.bin"), "{}", second_head);
+        assert_eq!(chunk_requests.load(Ordering::SeqCst), 3);
+        assert_eq!(server.stats.deduplicated.load(Ordering::Relaxed), 1);
+        assert_eq!(server.stats.cache_hits.load(Ordering::Relaxed), 1);
+        let _ = std::fs::remove_dir_all(&dir);
+    }
+}
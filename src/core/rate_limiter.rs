@@ -0,0 +1,84 @@
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Mutex;
+use std::time::{Duration, Instant};
+
+struct Bucket {
+    /// 可用字节数，允许为负（欠额），欠额越多后续读取等待越久
+    tokens: f64,
+    last_refill: Instant,
+}
+
+/// 令牌桶限速器（同一下载器的所有分块共用一个）
+///
+/// 速率可以随时通过 [`RateLimiter::set_rate`] 修改并立即生效；速率为 0 时不限速，
+/// `acquire` 只做一次原子读取，不加锁。桶容量为一秒的流量。
+pub struct RateLimiter {
+    /// 字节/秒，0 = 不限速
+    rate: AtomicU64,
+    bucket: Mutex<Bucket>,
+    throttle_waits: AtomicU64,
+    throttled_us: AtomicU64,
+}
+
+impl std::fmt::Debug for RateLimiter {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("RateLimiter").field("rate", &self.rate()).finish()
+    }
+}
+
+impl RateLimiter {
+    pub fn new(rate_bps: u64) -> Self {
+        RateLimiter {
+            rate: AtomicU64::new(rate_bps),
+            bucket: Mutex::new(Bucket {
+                tokens: rate_bps as f64,
+                last_refill: Instant::now(),
+            }),
+            throttle_waits: AtomicU64::new(0),
+            throttled_us: AtomicU64::new(0),
+        }
+    }
+
+    pub fn rate(&self) -> u64 {
+        self.rate.load(Ordering::Relaxed)
+    }
+
+    /// 修改速率（字节/秒，0 = 不限速），清空欠额，避免旧速率下积累的等待拖累新速率
+    pub fn set_rate(&self, rate_bps: u64) {
+        let mut bucket = self.bucket.lock().unwrap();
+        bucket.tokens = bucket.tokens.max(0.0).min(rate_bps as f64);
+        bucket.last_refill = Instant::now();
+        self.rate.store(rate_bps, Ordering::Relaxed);
+    }
+
+    /// 消耗 `bytes` 个令牌，不足时等待到欠额还清
+    pub async fn acquire(&self, bytes: usize) {
+        let rate = self.rate();
+        if rate == 0 {
+            return;
+        }
+
+        let delay = {
+            let mut bucket = self.bucket.lock().unwrap();
+            let now = Instant::now();
+            let refill = now.duration_since(bucket.last_refill).as_secs_f64() * rate as f64;
+            bucket.tokens = (bucket.tokens + refill).min(rate as f64) - bytes as f64;
+            bucket.last_refill = now;
+            (bucket.tokens < 0.0).then(|| Duration::from_secs_f64(-bucket.tokens / rate as f64))
+        };
+
+        if let Some(delay) = delay {
+            self.throttle_waits.fetch_add(1, Ordering::Relaxed);
+            self.throttled_us.fetch_add(delay.as_micros() as u64, Ordering::Relaxed);
+            tokio::time::sleep(delay).await;
+        }
+    }
+
+    /// 写入限速统计：rate_bps / throttle_waits / throttled_ms
+    pub fn write_stats(&self, map: &mut HashMap<String, serde_json::Value>) {
+        map.insert("rate_bps".to_string(), serde_json::Value::from(self.rate()));
+        map.insert("throttle_waits".to_string(), serde_json::Value::from(self.throttle_waits.load(Ordering::Relaxed)));
+        map.insert("throttled_ms".to_string(), serde_json::Value::from(self.throttled_us.load(Ordering::Relaxed) / 1000));
+    }
+}
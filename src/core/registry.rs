@@ -0,0 +1,165 @@
+use std::sync::atomic::{AtomicU32, AtomicU64, AtomicUsize, Ordering};
+use std::sync::Arc;
+use arc_swap::ArcSwapOption;
+use once_cell::sync::OnceCell;
+
+/// 每页槽位数，页按需分配，分配后不再移动或释放
+const PAGE_SIZE: usize = 1024;
+const PAGE_COUNT: usize = 64;
+/// 最多同时存在的对象数
+pub const CAPACITY: usize = PAGE_SIZE * PAGE_COUNT;
+
+const INDEX_BITS: u32 = 16;
+const INDEX_MASK: u32 = (1 << INDEX_BITS) - 1;
+/// 代数占 15 位（1..=32767），保证 ID 为正数，且 0 / 负数永远不是有效 ID
+const MAX_GENERATION: u32 = (1 << (31 - INDEX_BITS)) - 1;
+
+struct Slot<T> {
+    /// 槽位当前代数；对象移除时加一，旧 ID 随即失效
+    generation: AtomicU32,
+    value: ArcSwapOption<T>,
+    /// 空闲链表中下一个槽位的 下标+1，0 = 链表结束
+    next_free: AtomicU32,
+}
+
+/// 无锁对象表：以带代数的 ID 索引（`ID = 代数 << 16 | 槽位下标`）
+///
+/// - 查找只做两次原子读取和一次 `ArcSwapOption` 加载，不加锁，不同 ID 之间互不影响；
+/// - ID 分配优先复用空闲链表（带版本号的 Treiber 栈），否则从未使用的槽位中顺序取；
+/// - 移除时槽位代数加一，已移除对象的旧 ID 不会误命中复用该槽位的新对象
+///   （同一槽位被复用 32767 次后代数回绕，此前持有的旧 ID 才可能重新有效）。
+pub struct Registry<T> {
+    pages: [OnceCell<Box<[Slot<T>]>>; PAGE_COUNT],
+    /// 从未使用过的第一个槽位下标
+    next_unused: AtomicU32,
+    /// 空闲链表头：高 32 位为版本号（防 ABA），低 32 位为 下标+1
+    free_head: AtomicU64,
+    len: AtomicUsize,
+}
+
+impl<T> Registry<T> {
+    pub fn new() -> Self {
+        Registry {
+            pages: std::array::from_fn(|_| OnceCell::new()),
+            next_unused: AtomicU32::new(0),
+            free_head: AtomicU64::new(0),
+            len: AtomicUsize::new(0),
+        }
+    }
+
+    /// 分配 ID 并用 `make(id)` 创建对象后登记；表满时返回 None
+    pub fn insert_with(&self, make: impl FnOnce(i32) -> T) -> Option<(i32, Arc<T>)> {
+        let index = self.pop_free().or_else(|| self.take_unused())?;
+        let slot = self.slot(index)?;
+        let id = make_id(slot.generation.load(Ordering::Acquire), index);
+
+        let value = Arc::new(make(id));
+        slot.value.store(Some(value.clone()));
+        self.len.fetch_add(1, Ordering::Relaxed);
+        Some((id, value))
+    }
+
+    pub fn get(&self, id: i32) -> Option<Arc<T>> {
+        let (generation, index) = split_id(id)?;
+        let slot = self.slot(index)?;
+        if slot.generation.load(Ordering::Acquire) != generation {
+            return None;
+        }
+        let value = slot.value.load_full()?;
+        // 读取期间槽位可能已被移除并复用，代数不变才说明取到的是该 ID 对应的对象
+        (slot.generation.load(Ordering::Acquire) == generation).then_some(value)
+    }
+
+    /// 移除并返回对象；ID 已失效（重复移除、从未分配）时返回 None
+    pub fn remove(&self, id: i32) -> Option<Arc<T>> {
+        let (generation, index) = split_id(id)?;
+        let slot = self.slot(index)?;
+        // 只有把代数推进成功的一方负责清空槽位并归还，并发重复移除只有一个生效
+        slot.generation
+            .compare_exchange(generation, next_generation(generation), Ordering::AcqRel, Ordering::Acquire)
+            .ok()?;
+        let value = slot.value.swap(None);
+        self.len.fetch_sub(1, Ordering::Relaxed);
+        self.push_free(index, slot);
+        value
+    }
+
+    pub fn len(&self) -> usize {
+        self.len.load(Ordering::Relaxed)
+    }
+
+    fn slot(&self, index: u32) -> Option<&Slot<T>> {
+        let index = index as usize;
+        let page = self.pages.get(index / PAGE_SIZE)?.get()?;
+        page.get(index % PAGE_SIZE)
+    }
+
+    fn take_unused(&self) -> Option<u32> {
+        let index = self
+            .next_unused
+            .fetch_update(Ordering::AcqRel, Ordering::Acquire, |n| ((n as usize) < CAPACITY).then_some(n + 1))
+            .ok()?;
+        // 页内第一个槽位被取走时才分配该页；同页的其他分配者在 get_or_init 上短暂等待
+        self.pages[index as usize / PAGE_SIZE].get_or_init(|| {
+            (0..PAGE_SIZE)
+                .map(|_| Slot {
+                    generation: AtomicU32::new(1),
+                    value: ArcSwapOption::empty(),
+                    next_free: AtomicU32::new(0),
+                })
+                .collect()
+        });
+        Some(index)
+    }
+
+    fn pop_free(&self) -> Option<u32> {
+        let mut head = self.free_head.load(Ordering::Acquire);
+        loop {
+            let top = head as u32;
+            if top == 0 {
+                return None;
+            }
+            let next = self.slot(top - 1)?.next_free.load(Ordering::Acquire);
+            let new_head = (((head >> 32) + 1) << 32) | next as u64;
+            match self.free_head.compare_exchange_weak(head, new_head, Ordering::AcqRel, Ordering::Acquire) {
+                Ok(_) => return Some(top - 1),
+                Err(current) => head = current,
+            }
+        }
+    }
+
+    fn push_free(&self, index: u32, slot: &Slot<T>) {
+        let mut head = self.free_head.load(Ordering::Acquire);
+        loop {
+            slot.next_free.store(head as u32, Ordering::Release);
+            let new_head = (((head >> 32) + 1) << 32) | (index + 1) as u64;
+            match self.free_head.compare_exchange_weak(head, new_head, Ordering::AcqRel, Ordering::Acquire) {
+                Ok(_) => return,
+                Err(current) => head = current,
+            }
+        }
+    }
+}
+
+impl<T> Default for Registry<T> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+fn make_id(generation: u32, index: u32) -> i32 {
+    ((generation << INDEX_BITS) | index) as i32
+}
+
+fn split_id(id: i32) -> Option<(u32, u32)> {
+    if id <= 0 {
+        return None;
+    }
+    let id = id as u32;
+    let generation = id >> INDEX_BITS;
+    (generation != 0).then_some((generation, id & INDEX_MASK))
+}
+
+fn next_generation(generation: u32) -> u32 {
+    if generation >= MAX_GENERATION { 1 } else { generation + 1 }
+}
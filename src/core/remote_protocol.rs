@@ -0,0 +1,340 @@
+use std::collections::HashMap;
+use std::sync::{Arc, Mutex, Weak};
+use std::time::Duration;
+use tokio_util::sync::CancellationToken;
+use super::downloader::{Event, EventType};
+use super::event_data::{write_remote_frame, EventData, FieldSink};
+use super::remote_queue::RemoteQueue;
+
+/// WebSocket 子协议名：二进制 MessagePack 记录
+pub const WS_SUBPROTOCOL_MSGPACK: &str = "tthsd.msgpack";
+/// WebSocket 子协议名：旧版 JSON 帧
+pub const WS_SUBPROTOCOL_JSON: &str = "tthsd.json";
+/// Unix 域套接字回调地址前缀（`unix:///path` 或 `unix://@abstract`），总是由 `SocketClient` 处理
+pub const UNIX_SCHEME: &str = "unix:";
+/// 默认攒批间隔（毫秒）
+pub const DEFAULT_REMOTE_FLUSH_MS: u64 = 50;
+/// 默认单批最大字节数，达到后立即发送
+pub const DEFAULT_REMOTE_BATCH_BYTES: usize = 64 * 1024;
+
+/// 远程回调的编码格式
+///
+/// - `Json`：旧版 `{"Type":"Update","Msg":"<data json>"}`，Socket 以换行分隔，WebSocket 每帧一条；
+/// - `MsgPack`：每个事件一条带 4 字节大端长度前缀的 MessagePack 记录，
+///   记录为 map：`Type` / `Name` / `ShowName` / `ID` / `Data`，`Data` 中的数值保持原始类型。
+///
+/// 两种格式的 `Type` 都使用首字母大写的旧版拼写（`Update` / `Err` ...，见 `EventType::remote_name`），
+/// 与本地回调事件 JSON 中的小写拼写（`update` / `err`）不同。
+///
+/// 两种格式都带有 `Downloader` 字段（下载器 ID），同一回调地址的所有下载器共享一条连接。
+///
+/// 通过回调地址的 `format=msgpack` 查询参数启用；WebSocket 会在握手时协商子协议，
+/// 服务端不支持时回退为 JSON。参考解码器见 `scripts/tthsd_remote_decoder.py`。
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum RemoteFormat {
+    Json,
+    MsgPack,
+}
+
+/// 远程回调的传输参数，从回调地址的查询参数中解析
+///
+/// - `format=json|msgpack`：编码格式；
+/// - `flush_ms=N`：攒批间隔，0 = 有事件就立即发送（仍会合并队列中已就绪的事件）；
+/// - `batch_bytes=N`：单批达到该字节数时不等间隔立即发送。
+///
+/// `err` / `end` 事件总是立即触发发送，批内事件保持原有顺序。
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct RemoteOptions {
+    pub format: RemoteFormat,
+    pub flush_interval: Duration,
+    /// 是否显式指定了 `flush_ms`（WebSocket JSON 模式只有显式指定时才把多条事件放进同一帧）
+    pub flush_explicit: bool,
+    pub max_batch_bytes: usize,
+}
+
+impl Default for RemoteOptions {
+    fn default() -> Self {
+        RemoteOptions {
+            format: RemoteFormat::Json,
+            flush_interval: Duration::from_millis(DEFAULT_REMOTE_FLUSH_MS),
+            flush_explicit: false,
+            max_batch_bytes: DEFAULT_REMOTE_BATCH_BYTES,
+        }
+    }
+}
+
+impl RemoteOptions {
+    /// 取出回调地址中 TTHSD 自己的查询参数，返回去掉这些参数后的地址与解析出的选项
+    pub fn parse_url(raw: &str) -> (String, RemoteOptions) {
+        let raw = raw.trim();
+        let mut options = RemoteOptions::default();
+        let Some((base, query)) = raw.split_once('?') else {
+            return (raw.to_string(), options);
+        };
+
+        let mut rest = Vec::new();
+        for param in query.split('&').filter(|p| !p.is_empty()) {
+            match param.split_once('=') {
+                Some(("format", value)) => {
+                    options.format = match value.to_ascii_lowercase().as_str() {
+                        "msgpack" | "binary" => RemoteFormat::MsgPack,
+                        "json" => RemoteFormat::Json,
+                        other => {
+                            eprintln!("未知的远程回调格式 {:?}，使用 JSON", other);
+                            RemoteFormat::Json
+                        }
+                    };
+                }
+                Some(("flush_ms", value)) => match value.parse::<u64>() {
+                    Ok(ms) => {
+                        options.flush_interval = Duration::from_millis(ms);
+                        options.flush_explicit = true;
+                    }
+                    Err(_) => eprintln!("无效的 flush_ms 参数 {:?}，使用默认值", value),
+                },
+                Some(("batch_bytes", value)) => match value.parse::<usize>() {
+                    Ok(bytes) => options.max_batch_bytes = bytes.max(1),
+                    Err(_) => eprintln!("无效的 batch_bytes 参数 {:?}，使用默认值", value),
+                },
+                _ => rest.push(param),
+            }
+        }
+
+        if rest.is_empty() {
+            (base.to_string(), options)
+        } else {
+            (format!("{}?{}", base, rest.join("&")), options)
+        }
+    }
+}
+
+/// 回调地址是否指向 Unix 域套接字
+pub fn is_unix_socket_url(raw: &str) -> bool {
+    raw.trim_start().starts_with(UNIX_SCHEME)
+}
+
+impl RemoteFormat {
+    pub fn from_subprotocol(name: &str) -> Option<RemoteFormat> {
+        match name.trim() {
+            WS_SUBPROTOCOL_MSGPACK => Some(RemoteFormat::MsgPack),
+            WS_SUBPROTOCOL_JSON => Some(RemoteFormat::Json),
+            _ => None,
+        }
+    }
+}
+
+/// 投递给远程输出端的事件，由各自的写任务按连接协商出的格式编码
+#[derive(Debug)]
+pub struct RemoteEvent {
+    pub event: Event,
+    pub data: EventData,
+    /// 事件来源的下载器 ID（0 = 未分配，编码时省略）
+    pub downloader_id: i32,
+}
+
+impl RemoteEvent {
+    /// 需要立即发送、不等待攒批间隔的事件
+    pub fn is_urgent(&self) -> bool {
+        matches!(self.event.event_type, EventType::Err | EventType::End)
+    }
+}
+
+/// 以 `first` 开头收集一批事件，直到攒批间隔到期、批大小达到上限、遇到紧急事件或队列关闭
+///
+/// `push` 追加一个事件并返回当前批的字节数。队列中已经就绪的事件总是先于计时器被取出。
+pub async fn collect_batch<F>(
+    first: RemoteEvent,
+    queue: &RemoteQueue,
+    options: &RemoteOptions,
+    shutdown: &CancellationToken,
+    mut push: F,
+) where
+    F: FnMut(RemoteEvent) -> usize,
+{
+    let deadline = tokio::time::Instant::now() + options.flush_interval;
+    let mut urgent = first.is_urgent();
+    let mut bytes = push(first);
+
+    while !urgent && bytes < options.max_batch_bytes {
+        tokio::select! {
+            biased;
+            item = queue.recv() => match item {
+                Some(item) => {
+                    urgent = item.is_urgent();
+                    bytes = push(item);
+                }
+                None => break,
+            },
+            _ = tokio::time::sleep_until(deadline) => break,
+            _ = shutdown.cancelled() => break,
+        }
+    }
+}
+
+/// 按回调地址共享的远程连接表
+///
+/// 只保存弱引用：每个下载器的客户端持有连接的强引用，最后一个下载器释放后连接被销毁
+/// （连接的 `Drop` 负责通知写任务退出），下次查找时清理失效的条目。
+pub struct ConnectionRegistry<T> {
+    connections: Mutex<HashMap<String, Weak<T>>>,
+}
+
+impl<T> ConnectionRegistry<T> {
+    pub fn new() -> Self {
+        ConnectionRegistry {
+            connections: Mutex::new(HashMap::new()),
+        }
+    }
+
+    /// 取得 `key` 对应的连接，不存在时调用 `create` 创建并登记
+    pub fn acquire<F>(&self, key: &str, create: F) -> Arc<T>
+    where
+        F: FnOnce() -> T,
+    {
+        let mut connections = self.connections.lock().unwrap();
+        if let Some(connection) = connections.get(key).and_then(Weak::upgrade) {
+            return connection;
+        }
+
+        connections.retain(|_, weak| weak.strong_count() > 0);
+        let connection = Arc::new(create());
+        connections.insert(key.to_string(), Arc::downgrade(&connection));
+        connection
+    }
+}
+
+impl<T> Default for ConnectionRegistry<T> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// 远程帧编码器，写任务持有一份并复用其中的缓冲区
+#[derive(Default)]
+pub struct RemoteEncoder {
+    scratch: Vec<u8>,
+}
+
+impl RemoteEncoder {
+    /// 追加一条旧版 JSON 帧（不含分隔符）
+    pub fn write_json_frame(&mut self, item: &RemoteEvent, out: &mut Vec<u8>) {
+        self.scratch.clear();
+        item.data.write_json(&mut self.scratch);
+        write_remote_frame(&item.event.event_type, &self.scratch, item.downloader_id, out);
+    }
+
+    /// 追加一条带长度前缀的 MessagePack 记录
+    pub fn write_msgpack_record(&mut self, item: &RemoteEvent, out: &mut Vec<u8>) {
+        let start = out.len();
+        out.extend_from_slice(&[0; 4]);
+
+        let mut sink = MsgPackSink { out: &mut *out };
+        sink.begin_map(if item.downloader_id != 0 { 6 } else { 5 });
+        sink.key("Type");
+        // 与 JSON 帧使用同一拼写，收集端切换 format= 时看到的类型名不变
+        sink.str(item.event.event_type.remote_name());
+        sink.key("Name");
+        sink.str(&item.event.name);
+        sink.key("ShowName");
+        sink.str(&item.event.show_name);
+        sink.key("ID");
+        sink.str(&item.event.id);
+        if item.downloader_id != 0 {
+            sink.key("Downloader");
+            sink.int(item.downloader_id as i64);
+        }
+        sink.key("Data");
+        item.data.write_fields(&mut sink);
+
+        let len = (out.len() - start - 4) as u32;
+        out[start..start + 4].copy_from_slice(&len.to_be_bytes());
+    }
+}
+
+/// MessagePack 输出（整数选择最短编码，浮点数统一为 float64）
+pub struct MsgPackSink<'a> {
+    out: &'a mut Vec<u8>,
+}
+
+impl<'a> MsgPackSink<'a> {
+    pub fn new(out: &'a mut Vec<u8>) -> Self {
+        MsgPackSink { out }
+    }
+}
+
+impl FieldSink for MsgPackSink<'_> {
+    fn begin_map(&mut self, len: usize) {
+        if len < 16 {
+            self.out.push(0x80 | len as u8);
+        } else if len <= u16::MAX as usize {
+            self.out.push(0xde);
+            self.out.extend_from_slice(&(len as u16).to_be_bytes());
+        } else {
+            self.out.push(0xdf);
+            self.out.extend_from_slice(&(len as u32).to_be_bytes());
+        }
+    }
+
+    fn key(&mut self, key: &str) {
+        self.str(key);
+    }
+
+    fn int(&mut self, v: i64) {
+        let out = &mut *self.out;
+        if (0..128).contains(&v) {
+            out.push(v as u8);
+        } else if (-32..0).contains(&v) {
+            out.push(v as i8 as u8);
+        } else if v >= 0 {
+            if v <= u8::MAX as i64 {
+                out.push(0xcc);
+                out.push(v as u8);
+            } else if v <= u16::MAX as i64 {
+                out.push(0xcd);
+                out.extend_from_slice(&(v as u16).to_be_bytes());
+            } else if v <= u32::MAX as i64 {
+                out.push(0xce);
+                out.extend_from_slice(&(v as u32).to_be_bytes());
+            } else {
+                out.push(0xcf);
+                out.extend_from_slice(&(v as u64).to_be_bytes());
+            }
+        } else if v >= i8::MIN as i64 {
+            out.push(0xd0);
+            out.push(v as i8 as u8);
+        } else if v >= i16::MIN as i64 {
+            out.push(0xd1);
+            out.extend_from_slice(&(v as i16).to_be_bytes());
+        } else if v >= i32::MIN as i64 {
+            out.push(0xd2);
+            out.extend_from_slice(&(v as i32).to_be_bytes());
+        } else {
+            out.push(0xd3);
+            out.extend_from_slice(&v.to_be_bytes());
+        }
+    }
+
+    fn float(&mut self, v: f64) {
+        self.out.push(0xcb);
+        self.out.extend_from_slice(&v.to_be_bytes());
+    }
+
+    fn str(&mut self, v: &str) {
+        let len = v.len();
+        if len < 32 {
+            self.out.push(0xa0 | len as u8);
+        } else if len <= u8::MAX as usize {
+            self.out.push(0xd9);
+            self.out.push(len as u8);
+        } else if len <= u16::MAX as usize {
+            self.out.push(0xda);
+            self.out.extend_from_slice(&(len as u16).to_be_bytes());
+        } else {
+            self.out.push(0xdb);
+            self.out.extend_from_slice(&(len as u32).to_be_bytes());
+        }
+        self.out.extend_from_slice(v.as_bytes());
+    }
+
+    fn end_map(&mut self) {}
+}
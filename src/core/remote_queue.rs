@@ -0,0 +1,341 @@
+use std::collections::{HashMap, VecDeque};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+use tokio::sync::Notify;
+use super::downloader::EventType;
+use super::remote_protocol::RemoteEvent;
+
+#[derive(Default)]
+struct RemoteQueueStats {
+    /// 被同一任务更新的进度覆盖的旧进度消息数
+    coalesced_updates: AtomicU64,
+    /// 队列满且无法合并时丢弃的进度消息数
+    dropped_updates: AtomicU64,
+    /// 队列已关闭后无法投递的控制类消息数
+    dropped_messages: AtomicU64,
+    /// 控制类消息因队列满而等待空间的次数
+    backpressure_waits: AtomicU64,
+    max_depth: AtomicU64,
+}
+
+struct QueueState {
+    /// 已被更新的进度取代的条目置为 None，出队时跳过
+    items: VecDeque<Option<RemoteEvent>>,
+    /// 有效（非 None）条目数
+    live: usize,
+    /// `items` 队首元素的序号，元素序号 - head_seq 即其下标
+    head_seq: u64,
+    /// 尚未被取走的进度消息：(下载器 ID, 事件 ID) -> 序号
+    pending_updates: HashMap<(i32, Arc<str>), u64>,
+    /// 每个下载器最后一条尚未取走的控制类消息的序号；进度消息不能越过它
+    last_control: HashMap<i32, u64>,
+    closed: bool,
+}
+
+impl QueueState {
+    fn next_seq(&self) -> u64 {
+        self.head_seq + self.items.len() as u64
+    }
+}
+
+/// 远程输出端的发送队列（多生产者、单个写任务消费）
+///
+/// 与普通有界通道不同，这里区分两类消息：
+/// - `update`：同一下载器同一任务的进度只保留最新一条。旧进度之后没有同一下载器的控制类消息时
+///   原地覆盖（保持其位置）；否则作废旧进度、把新进度追加到队尾，保证进度不会越过先入队的控制类消息。
+///   只有队列满且无可覆盖的条目时才丢弃；
+/// - 其他控制类事件（start / end / err / msg ...）：从不丢弃，队列满时 `push` 等待写任务腾出空间，
+///   背压落在产生事件的下载任务上（投递方是 `send_message`，不经过回调投递线程）。
+///   只有队列关闭后才无法入队。
+pub struct RemoteQueue {
+    state: Mutex<QueueState>,
+    capacity: usize,
+    not_empty: Notify,
+    not_full: Notify,
+    stats: RemoteQueueStats,
+}
+
+impl RemoteQueue {
+    pub fn new(capacity: usize) -> Self {
+        RemoteQueue {
+            state: Mutex::new(QueueState {
+                items: VecDeque::with_capacity(capacity.min(1024)),
+                live: 0,
+                head_seq: 0,
+                pending_updates: HashMap::new(),
+                last_control: HashMap::new(),
+                closed: false,
+            }),
+            capacity: capacity.max(1),
+            not_empty: Notify::new(),
+            not_full: Notify::new(),
+            stats: RemoteQueueStats::default(),
+        }
+    }
+
+    /// 放入一条消息；队列满时控制类消息等待空间，进度消息合并或丢弃而不等待
+    ///
+    /// 返回 false 表示消息未入队（队列已关闭，或进度消息被丢弃）
+    pub async fn push(&self, item: RemoteEvent) -> bool {
+        let mut item = item;
+        let mut waited = false;
+        loop {
+            // 先登记唤醒再检查，避免检查之后、等待之前腾出的空间被错过
+            let notified = self.not_full.notified();
+            tokio::pin!(notified);
+            notified.as_mut().enable();
+
+            match self.try_push(item) {
+                Ok(pushed) => return pushed,
+                Err(full) => item = full,
+            }
+            if !waited {
+                waited = true;
+                self.stats.backpressure_waits.fetch_add(1, Ordering::Relaxed);
+            }
+            notified.await;
+        }
+    }
+
+    /// 尝试放入一条消息；控制类消息遇到队列满时原样返回 Err
+    fn try_push(&self, item: RemoteEvent) -> Result<bool, RemoteEvent> {
+        let mut state = self.state.lock().unwrap();
+        if state.closed {
+            self.count_rejected(&item);
+            return Ok(false);
+        }
+
+        let seq = state.next_seq();
+        if item.event.event_type == EventType::Update {
+            let key = (item.downloader_id, item.event.id.clone());
+            if let Some(&pending) = state.pending_updates.get(&key) {
+                let index = (pending - state.head_seq) as usize;
+                self.stats.coalesced_updates.fetch_add(1, Ordering::Relaxed);
+                let barrier = state.last_control.get(&item.downloader_id).copied();
+                if barrier.map_or(true, |control| control < pending) {
+                    state.items[index] = Some(item);
+                    return Ok(true);
+                }
+                // 旧进度之后已有控制类消息：作废旧进度，新进度排到队尾（不占用额外容量）
+                state.items[index] = None;
+                state.live -= 1;
+            } else if state.live >= self.capacity {
+                self.stats.dropped_updates.fetch_add(1, Ordering::Relaxed);
+                return Ok(false);
+            }
+            state.pending_updates.insert(key, seq);
+        } else {
+            if state.live >= self.capacity {
+                return Err(item);
+            }
+            state.last_control.insert(item.downloader_id, seq);
+        }
+
+        state.items.push_back(Some(item));
+        state.live += 1;
+        self.stats.max_depth.fetch_max(state.live as u64, Ordering::Relaxed);
+        drop(state);
+        self.not_empty.notify_one();
+        Ok(true)
+    }
+
+    /// 取出队首消息（不等待）
+    pub fn try_recv(&self) -> Option<RemoteEvent> {
+        let item = self.pop();
+        if item.is_some() {
+            self.not_full.notify_waiters();
+        }
+        item
+    }
+
+    fn pop(&self) -> Option<RemoteEvent> {
+        let mut state = self.state.lock().unwrap();
+        loop {
+            let slot = state.items.pop_front()?;
+            let seq = state.head_seq;
+            state.head_seq += 1;
+            let Some(item) = slot else {
+                continue;
+            };
+            state.live -= 1;
+
+            if item.event.event_type == EventType::Update {
+                let key = (item.downloader_id, item.event.id.clone());
+                if state.pending_updates.get(&key) == Some(&seq) {
+                    state.pending_updates.remove(&key);
+                }
+            } else if state.last_control.get(&item.downloader_id) == Some(&seq) {
+                state.last_control.remove(&item.downloader_id);
+            }
+            return Some(item);
+        }
+    }
+
+    /// 等待下一条消息；队列关闭且已取空时返回 None
+    pub async fn recv(&self) -> Option<RemoteEvent> {
+        loop {
+            if let Some(item) = self.try_recv() {
+                return Some(item);
+            }
+            if self.state.lock().unwrap().closed {
+                return None;
+            }
+            // 单消费者：notify_one 在没有等待者时会保留一个许可，不会丢失唤醒
+            self.not_empty.notified().await;
+        }
+    }
+
+    /// 关闭队列：之后的消息不再入队，等待空间的投递方立即返回；已入队的消息仍可取出
+    pub fn close(&self) {
+        self.state.lock().unwrap().closed = true;
+        self.not_empty.notify_one();
+        self.not_full.notify_waiters();
+    }
+
+    pub fn len(&self) -> usize {
+        self.state.lock().unwrap().live
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// 写入队列统计：queue_depth / max_queue_depth / coalesced_updates / dropped_updates /
+    /// dropped_messages / backpressure_waits
+    pub fn write_stats(&self, map: &mut HashMap<String, serde_json::Value>) {
+        let stats = &self.stats;
+        map.insert("queue_depth".to_string(), serde_json::Value::from(self.len()));
+        map.insert("max_queue_depth".to_string(), serde_json::Value::from(stats.max_depth.load(Ordering::Relaxed)));
+        map.insert("coalesced_updates".to_string(), serde_json::Value::from(stats.coalesced_updates.load(Ordering::Relaxed)));
+        map.insert("dropped_updates".to_string(), serde_json::Value::from(stats.dropped_updates.load(Ordering::Relaxed)));
+        map.insert("dropped_messages".to_string(), serde_json::Value::from(stats.dropped_messages.load(Ordering::Relaxed)));
+        map.insert("backpressure_waits".to_string(), serde_json::Value::from(stats.backpressure_waits.load(Ordering::Relaxed)));
+    }
+
+    fn count_rejected(&self, item: &RemoteEvent) {
+        if item.event.event_type == EventType::Update {
+            self.stats.dropped_updates.fetch_add(1, Ordering::Relaxed);
+        } else {
+            self.stats.dropped_messages.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::core::downloader::Event;
+    use crate::core::event_data::{EventData, ProgressData};
+    use std::time::Duration;
+
+    fn update(downloader_id: i32, downloaded: i64) -> RemoteEvent {
+        RemoteEvent {
+            event: Event::global(EventType::Update, "进度更新"),
+            data: EventData::Progress(ProgressData { downloaded, ..Default::default() }),
+            downloader_id,
+        }
+    }
+
+    fn control(downloader_id: i32, event_type: EventType) -> RemoteEvent {
+        RemoteEvent { event: Event::bare(event_type, "错误"), data: EventData::Empty, downloader_id }
+    }
+
+    /// 取空队列，返回 (事件类型, 进度字节数)
+    fn drain(queue: &RemoteQueue) -> Vec<(EventType, i64)> {
+        std::iter::from_fn(|| queue.try_recv())
+            .map(|item| {
+                let downloaded = match item.data {
+                    EventData::Progress(ref p) => p.downloaded,
+                    _ => -1,
+                };
+                (item.event.event_type, downloaded)
+            })
+            .collect()
+    }
+
+    fn stat(queue: &RemoteQueue, name: &str) -> u64 {
+        let mut map = HashMap::new();
+        queue.write_stats(&mut map);
+        map[name].as_u64().unwrap()
+    }
+
+    #[tokio::test]
+    async fn update_coalesces_in_place_without_control_in_between() {
+        let queue = RemoteQueue::new(16);
+        queue.push(control(1, EventType::Start)).await;
+        queue.push(update(1, 50)).await;
+        queue.push(update(1, 70)).await;
+        assert_eq!(drain(&queue), [(EventType::Start, -1), (EventType::Update, 70)]);
+        assert_eq!(stat(&queue, "coalesced_updates"), 1);
+    }
+
+    #[tokio::test]
+    async fn update_never_overtakes_later_control_event() {
+        let queue = RemoteQueue::new(16);
+        queue.push(update(1, 50)).await;
+        queue.push(control(1, EventType::Err)).await;
+        queue.push(update(1, 70)).await;
+        queue.push(update(1, 90)).await;
+        assert_eq!(queue.len(), 2);
+        assert_eq!(drain(&queue), [(EventType::Err, -1), (EventType::Update, 90)]);
+        assert!(queue.is_empty());
+
+        // 其他下载器的控制类消息不影响原地覆盖
+        queue.push(update(1, 10)).await;
+        queue.push(control(2, EventType::End)).await;
+        queue.push(update(1, 20)).await;
+        assert_eq!(drain(&queue), [(EventType::Update, 20), (EventType::End, -1)]);
+    }
+
+    #[tokio::test(flavor = "multi_thread", worker_threads = 2)]
+    async fn blocked_collector_applies_backpressure_without_dropping() {
+        let capacity = 4;
+        let total = 64;
+        let queue = Arc::new(RemoteQueue::new(capacity));
+
+        // 没有消费者：占满容量后控制类消息等待，进度消息直接丢弃
+        let producer = tokio::spawn({
+            let queue = queue.clone();
+            async move {
+                for i in 0..total {
+                    assert!(queue.push(control(1, EventType::Msg)).await, "第 {} 条控制类消息未入队", i);
+                }
+            }
+        });
+        tokio::time::sleep(Duration::from_millis(100)).await;
+        assert!(!producer.is_finished());
+        assert_eq!(queue.len(), capacity);
+        assert!(!queue.push(update(1, 1)).await);
+
+        // 慢速消费：每条控制类消息都送达，且顺序不变
+        let mut received = 0;
+        while received < total {
+            match tokio::time::timeout(Duration::from_secs(5), queue.recv()).await {
+                Ok(Some(item)) => {
+                    assert_eq!(item.event.event_type, EventType::Msg);
+                    received += 1;
+                }
+                other => panic!("队列提前结束: {:?}", other.map(|i| i.map(|i| i.event.event_type))),
+            }
+        }
+        producer.await.unwrap();
+        assert!(queue.is_empty());
+        assert_eq!(stat(&queue, "dropped_messages"), 0);
+        assert_eq!(stat(&queue, "dropped_updates"), 1);
+        assert!(stat(&queue, "backpressure_waits") > 0);
+    }
+
+    #[tokio::test]
+    async fn close_releases_waiting_producer() {
+        let queue = Arc::new(RemoteQueue::new(1));
+        queue.push(control(1, EventType::Start)).await;
+        let waiting = tokio::spawn({
+            let queue = queue.clone();
+            async move { queue.push(control(1, EventType::End)).await }
+        });
+        tokio::time::sleep(Duration::from_millis(50)).await;
+        queue.close();
+        assert!(!tokio::time::timeout(Duration::from_secs(1), waiting).await.unwrap().unwrap());
+        assert_eq!(stat(&queue, "dropped_messages"), 1);
+    }
+}
@@ -0,0 +1,134 @@
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+use once_cell::sync::OnceCell;
+use tokio::runtime::Runtime;
+
+/// 默认线程名前缀，线程名为 `<前缀>-<序号>`
+pub const DEFAULT_THREAD_NAME_PREFIX: &str = "tthsd-worker";
+
+static RUNTIME: OnceCell<Runtime> = OnceCell::new();
+
+/// 运行时参数（C ABI 的 `TTHSD_RuntimeConfig`、JNI 的 `init` 与守护进程共用）
+#[derive(Debug, Clone)]
+pub struct RuntimeConfig {
+    /// 工作线程数，None = CPU 核数（创建时已处于省电模式则为 2）
+    pub worker_threads: Option<usize>,
+    /// 阻塞线程池上限（文件 IO 等），None = tokio 默认的 512
+    pub max_blocking_threads: Option<usize>,
+    pub thread_name_prefix: String,
+    /// 把运行时的所有线程限制在这些 CPU 上（仅 Linux/Android），空 = 不限制
+    pub cpu_affinity: Vec<usize>,
+    /// 单线程模式：所有任务在一个专用线程上运行，忽略 `worker_threads`
+    pub current_thread: bool,
+}
+
+impl Default for RuntimeConfig {
+    fn default() -> Self {
+        RuntimeConfig {
+            worker_threads: None,
+            max_blocking_threads: None,
+            thread_name_prefix: DEFAULT_THREAD_NAME_PREFIX.to_string(),
+            cpu_affinity: Vec::new(),
+            current_thread: false,
+        }
+    }
+}
+
+/// 用指定参数创建全局运行时；必须在第一次使用运行时（创建下载器等）之前调用，否则返回错误
+pub fn init(config: RuntimeConfig) -> Result<(), String> {
+    if let Some(&cpu) = config.cpu_affinity.iter().find(|&&cpu| cpu >= MAX_CPUS) {
+        return Err(format!("CPU 编号超出范围: {}", cpu));
+    }
+
+    let mut created = false;
+    RUNTIME.get_or_try_init(|| {
+        created = true;
+        build(&config)
+    })?;
+    if !created {
+        return Err("运行时已初始化，tthsd_init 必须在第一次使用前调用".to_string());
+    }
+    if config.current_thread {
+        spawn_driver(&config)?;
+    }
+    Ok(())
+}
+
+/// 全局运行时；未调用 [`init`] 时按默认参数（多线程，每核一个工作线程）创建
+pub fn get() -> &'static Runtime {
+    RUNTIME.get_or_init(|| build(&RuntimeConfig::default()).expect("创建 tokio 运行时失败"))
+}
+
+fn build(config: &RuntimeConfig) -> Result<Runtime, String> {
+    let mut builder = if config.current_thread {
+        tokio::runtime::Builder::new_current_thread()
+    } else {
+        tokio::runtime::Builder::new_multi_thread()
+    };
+    builder.enable_all();
+
+    if !config.current_thread {
+        if let Some(n) = config.worker_threads {
+            builder.worker_threads(n.max(1));
+        } else if super::power::current().saver() {
+            // 省电模式只在运行时创建之前设置才影响线程数
+            builder.worker_threads(super::power::SAVER_WORKER_THREADS);
+        }
+    }
+    if let Some(n) = config.max_blocking_threads {
+        builder.max_blocking_threads(n.max(1));
+    }
+
+    let prefix = config.thread_name_prefix.clone();
+    let counter = Arc::new(AtomicUsize::new(0));
+    builder.thread_name_fn(move || format!("{}-{}", prefix, counter.fetch_add(1, Ordering::Relaxed)));
+
+    if !config.cpu_affinity.is_empty() {
+        let cpus = config.cpu_affinity.clone();
+        builder.on_thread_start(move || {
+            if !pin_current_thread(&cpus) {
+                eprintln!("设置线程 CPU 亲和性失败: {:?}", cpus);
+            }
+        });
+    }
+
+    builder.build().map_err(|e| format!("创建 tokio 运行时失败: {:?}", e))
+}
+
+/// 单线程模式下，任务只有在某个线程驱动运行时时才会执行。
+/// 这里起一个专用线程一直驱动它；C ABI 调用方在自己的线程上 `block_on` 时只等待结果，不抢占驱动。
+fn spawn_driver(config: &RuntimeConfig) -> Result<(), String> {
+    let cpus = config.cpu_affinity.clone();
+    std::thread::Builder::new()
+        .name(config.thread_name_prefix.clone())
+        .spawn(move || {
+            if !cpus.is_empty() && !pin_current_thread(&cpus) {
+                eprintln!("设置线程 CPU 亲和性失败: {:?}", cpus);
+            }
+            get().block_on(std::future::pending::<()>());
+        })
+        .map(|_| ())
+        .map_err(|e| format!("创建运行时线程失败: {:?}", e))
+}
+
+#[cfg(any(target_os = "linux", target_os = "android"))]
+const MAX_CPUS: usize = libc::CPU_SETSIZE as usize;
+#[cfg(not(any(target_os = "linux", target_os = "android")))]
+const MAX_CPUS: usize = 1024;
+
+#[cfg(any(target_os = "linux", target_os = "android"))]
+fn pin_current_thread(cpus: &[usize]) -> bool {
+    unsafe {
+        let mut set: libc::cpu_set_t = std::mem::zeroed();
+        for &cpu in cpus {
+            libc::CPU_SET(cpu, &mut set);
+        }
+        libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &set) == 0
+    }
+}
+
+/// 其他平台没有可用的线程亲和性接口，忽略该参数
+#[cfg(not(any(target_os = "linux", target_os = "android")))]
+fn pin_current_thread(_cpus: &[usize]) -> bool {
+    true
+}
@@ -1,64 +1,34 @@
-use std::collections::HashMap;
-use std::sync::Arc;
-use tokio::sync::RwLock;
-use super::downloader::{DownloadConfig, Event};
-use super::websocket_client::WebSocketClient;
-use super::socket_client::SocketClient;
+use super::downloader::{Event, SharedConfig};
+use super::event_data::EventData;
 
+/// 发送事件
+///
+/// 事件在当前任务中按顺序交给下载器的事件投递器：回调函数由投递线程调用，调用方不会被慢回调阻塞；
+/// WebSocket / Socket 的发送队列满时，控制类事件在这里等待空间（进度事件合并或丢弃，不等待）。
 pub async fn send_message(
     event: Event,
-    data: HashMap<String, serde_json::Value>,
-    config: &Arc<RwLock<DownloadConfig>>,
-    ws_client: &Option<Arc<tokio::sync::Mutex<WebSocketClient>>>,
-    socket_client: &Option<Arc<tokio::sync::Mutex<SocketClient>>>,
+    data: EventData,
+    config: &SharedConfig,
 ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
-    let mut is_called = false;
+    // 配置快照不跨 await 持有，只取出投递器
+    let dispatcher = {
+        let config = config.load();
 
-    let config_clone = config.clone();
-    let ws_client_clone = ws_client.clone();
-    let socket_client_clone = socket_client.clone();
-    let event_clone = event.clone();
-
-    tokio::spawn(async move {
-        let config = config_clone.read().await;
-
-        // 调用回调函数
-        if let Some(callback_func) = config.callback_func {
-            if let Ok(event_json) = serde_json::to_string(&event_clone) {
-                if let Ok(data_json) = serde_json::to_string(&data) {
-                    if let (Ok(c_event), Ok(c_data)) = (
-                        std::ffi::CString::new(event_json),
-                        std::ffi::CString::new(data_json),
-                    ) {
-                        callback_func(c_event.as_ptr(), c_data.as_ptr());
-                        is_called = true;
-                    }
-                }
-            }
+        // 未订阅的事件直接丢弃，不做任何序列化和跨 FFI 调用
+        if !config.is_subscribed(&event.event_type) {
+            return Ok(());
         }
-
-        // 发送WebSocket消息
-        if let Some(ref ws_client) = ws_client_clone {
-            if config.callback_url.is_some() {
-                let client = ws_client.lock().await;
-                client.send_message(event_clone.clone(), data.clone()).await;
-                is_called = true;
+        config.event_dispatcher.clone()
+    };
+
+    match dispatcher {
+        Some(dispatcher) => dispatcher.send(event, data).await,
+        None => {
+            if event.event_type != super::downloader::EventType::Update {
+                eprintln!("警告: 没有回调函数 (event {:?}, data {:?})", event.name, data);
             }
         }
-
-        // 发送Socket消息
-        if let Some(ref socket_client) = socket_client_clone {
-            if config.callback_url.is_some() {
-                let client = socket_client.lock().await;
-                client.send_message(event_clone.clone(), data.clone()).await;
-                is_called = true;
-            }
-        }
-
-        if !is_called && event_clone.event_type != super::downloader::EventType::Update {
-            eprintln!("警告: 没有回调函数 (event {:?}, data {:?})", event_clone.name, data);
-        }
-    });
+    }
 
     Ok(())
-}
\ No newline at end of file
+}
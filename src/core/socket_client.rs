@@ -1,213 +1,376 @@
 use std::collections::HashMap;
-use std::io::Write;
-use std::net::TcpStream;
-use std::sync::Arc;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::{Arc, RwLock};
 use std::time::Duration;
-use tokio::sync::Mutex;
-use serde::{Deserialize, Serialize};
-use super::downloader::{Event, EventType};
+use once_cell::sync::Lazy;
+use tokio::io::AsyncWriteExt;
+use tokio::net::TcpStream;
+use tokio_util::sync::CancellationToken;
+use super::downloader::Event;
+use super::event_data::EventData;
+use super::remote_queue::RemoteQueue;
+use super::remote_protocol::{
+    collect_batch, ConnectionRegistry, RemoteEncoder, RemoteEvent, RemoteFormat, RemoteOptions, UNIX_SCHEME,
+};
 
+/// 发送队列容量（按消息条数计）
 const SOCKET_SEND_QUEUE_SIZE: usize = 1024;
+const SOCKET_CONNECT_TIMEOUT: Duration = Duration::from_secs(10);
+const SOCKET_WRITE_TIMEOUT: Duration = Duration::from_secs(3);
+/// 重连退避：从 100ms 开始翻倍，最长 10s
+const SOCKET_RECONNECT_MIN: Duration = Duration::from_millis(100);
+const SOCKET_RECONNECT_MAX: Duration = Duration::from_secs(10);
+/// 关闭时把队列中剩余消息写出的最长时间
+const SOCKET_DRAIN_TIMEOUT: Duration = Duration::from_secs(1);
 
-#[derive(Debug, Clone, Serialize, Deserialize)]
-pub struct ProgressMessageS {
-    #[serde(rename = "Type")]
-    pub msg_type: String,
-    #[serde(rename = "Msg")]
-    pub msg: String,
+#[derive(Default)]
+struct SocketStats {
+    sent_messages: AtomicU64,
+    sent_bytes: AtomicU64,
+    write_calls: AtomicU64,
+    connects: AtomicU64,
+    connect_failures: AtomicU64,
+    write_failures: AtomicU64,
 }
 
-pub struct SocketClient {
-    address: String,
-    connection: Arc<tokio::sync::Mutex<Option<TcpStream>>>,
-    connected: Arc<tokio::sync::Mutex<bool>>,
-    send_queue: tokio::sync::broadcast::Sender<Vec<u8>>,
-    done: Arc<tokio::sync::Mutex<bool>>,
-    close_once: Arc<tokio::sync::Mutex<bool>>,
+/// 连接目标，由回调地址解析：`host:port`、`unix:///path/to.sock`，Linux/Android 上另支持
+/// 抽象命名空间套接字 `unix://@name`
+#[derive(Debug, Clone, PartialEq, Eq)]
+enum SocketTarget {
+    Tcp(String),
+    Unix(std::path::PathBuf),
+    Abstract(Vec<u8>),
 }
 
-impl SocketClient {
-    pub fn new(address: String) -> Self {
-        if address.is_empty() {
-            return SocketClient {
-                address,
-                connection: Arc::new(Mutex::new(None)),
-                connected: Arc::new(Mutex::new(false)),
-                send_queue: tokio::sync::broadcast::channel(SOCKET_SEND_QUEUE_SIZE).0,
-                done: Arc::new(Mutex::new(false)),
-                close_once: Arc::new(Mutex::new(false)),
-            };
-        }
-
-        let client = SocketClient {
-            address: address.clone(),
-            connection: Arc::new(Mutex::new(None)),
-            connected: Arc::new(Mutex::new(false)),
-            send_queue: tokio::sync::broadcast::channel(SOCKET_SEND_QUEUE_SIZE).0,
-            done: Arc::new(Mutex::new(false)),
-            close_once: Arc::new(Mutex::new(false)),
+impl SocketTarget {
+    fn parse(address: &str) -> SocketTarget {
+        let Some(rest) = address.strip_prefix(UNIX_SCHEME) else {
+            return SocketTarget::Tcp(address.to_string());
         };
+        let rest = rest.strip_prefix("//").unwrap_or(rest);
+        match rest.strip_prefix('@') {
+            Some(name) => SocketTarget::Abstract(name.as_bytes().to_vec()),
+            None => SocketTarget::Unix(std::path::PathBuf::from(rest)),
+        }
+    }
+}
 
-        client.connect();
-        client.start_write_loop();
+/// 已建立的连接：TCP 或 Unix 域套接字，两者使用相同的帧格式
+enum SocketStream {
+    Tcp(TcpStream),
+    #[cfg(unix)]
+    Unix(tokio::net::UnixStream),
+}
 
-        client
+impl SocketStream {
+    async fn write_all(&mut self, buf: &[u8]) -> std::io::Result<()> {
+        match self {
+            SocketStream::Tcp(s) => s.write_all(buf).await,
+            #[cfg(unix)]
+            SocketStream::Unix(s) => s.write_all(buf).await,
+        }
     }
 
-    fn connect(&self) {
-        if self.address.is_empty() {
-            return;
+    async fn shutdown(&mut self) -> std::io::Result<()> {
+        match self {
+            SocketStream::Tcp(s) => s.shutdown().await,
+            #[cfg(unix)]
+            SocketStream::Unix(s) => s.shutdown().await,
         }
+    }
+}
 
-        match TcpStream::connect_timeout(&self.address.parse().unwrap(), Duration::from_secs(10)) {
-            Ok(conn) => {
-                let mut connection = self.connection.blocking_lock();
-                *connection = Some(conn);
+struct SocketShared {
+    address: String,
+    target: SocketTarget,
+    options: RemoteOptions,
+    connected: AtomicBool,
+    stats: SocketStats,
+}
 
-                let mut connected = self.connected.blocking_lock();
-                *connected = true;
-            }
-            Err(e) => {
-                eprintln!("Socket连接失败: {:?}", e);
-            }
-        }
-    }
+/// 同一回调地址上所有下载器共享的连接（队列 + 写任务），最后一个使用者释放时关闭
+struct SocketConnection {
+    shared: Arc<SocketShared>,
+    /// 写任务未启动（地址为空或不在运行时中）时为 None
+    queue: Option<Arc<RemoteQueue>>,
+    shutdown: CancellationToken,
+}
 
-    fn start_write_loop(&self) {
-        let send_queue = self.send_queue.clone();
-        let connection = self.connection.clone();
-        let connected = self.connected.clone();
-        let done = self.done.clone();
-
-        tokio::spawn(async move {
-            let mut receiver = send_queue.subscribe();
-
-            loop {
-                tokio::select! {
-                    _ = async {
-                        let d = done.lock().await;
-                        *d
-                    } => {
-                        break;
-                    }
-                    result = receiver.recv() => {
-                        match result {
-                            Ok(payload) => {
-                                if let Err(e) = Self::write_raw(&connection, &connected, payload).await {
-                                    eprintln!("Write failed: {:?}", e);
-                                    break;
-                                }
-                            }
-                            Err(_) => break,
-                        }
-                    }
-                }
-            }
-        });
+impl Drop for SocketConnection {
+    fn drop(&mut self) {
+        // 写任务收到取消信号后会把队列中剩余的消息写出再退出
+        self.shutdown.cancel();
     }
+}
 
-    async fn write_raw(
-        connection: &Arc<Mutex<Option<TcpStream>>>,
-        connected: &Arc<Mutex<bool>>,
-        payload: Vec<u8>,
-    ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
-        let conn_guard = connection.lock().await;
-                let mut conn = conn_guard.as_ref().ok_or("socket not connected")?.try_clone()?;
-                drop(conn_guard);
-        
-                let conn_connected = connected.lock().await;
-                if !*conn_connected {
-                    return Err("socket not connected".into());
-                }
-                drop(conn_connected);
-        
-                conn.set_write_timeout(Some(Duration::from_secs(3)))?;
-        conn.write_all(&payload)?;
+/// 按原始回调地址（含查询参数）共享的连接表
+static SOCKET_CONNECTIONS: Lazy<ConnectionRegistry<SocketConnection>> = Lazy::new(ConnectionRegistry::new);
 
-        Ok(())
-    }
+/// TCP 远程回调客户端
+///
+/// 所有网络操作都在 tokio 运行时上的写任务中完成：`send_event` 只把事件放入有界队列，
+/// 写任务负责连接、断线后按指数退避重连，并按攒批间隔（默认 50ms）把多条消息编码后合并成一次写入。
+/// 连接建立之前产生的消息会留在队列中，连接成功后再发出。
+///
+/// 回调地址相同的下载器共享同一条连接，每条消息带有 `Downloader` 字段标明来源；
+/// 连接按引用计数管理，最后一个下载器 `close()` 或销毁后才断开。
+///
+/// 地址形如 `host:port`；同机的控制进程可以改用 Unix 域套接字 `unix:///path/to.sock`
+/// （Linux/Android 上 `unix://@name` 表示抽象命名空间套接字），省去回环 TCP 与端口管理。
+/// 可附加查询参数（见 `RemoteOptions`）：`?format=msgpack` 改用带长度前缀的
+/// MessagePack 记录，否则沿用以换行分隔的 JSON 帧。
+#[derive(Clone)]
+pub struct SocketClient {
+    downloader_id: i32,
+    /// 同一下载器的所有副本共用一份租约，`close()` 后置空
+    lease: Arc<RwLock<Option<Arc<SocketConnection>>>>,
+}
 
-    pub async fn send_message(&self, event: Event, data: HashMap<String, serde_json::Value>) {
-        let done = self.done.lock().await;
-        if *done {
-            return;
+impl SocketClient {
+    /// 取得（必要时创建）回调地址对应的共享连接
+    ///
+    /// 新连接的写任务在当前 tokio 运行时上启动（不会阻塞调用方），因此必须在运行时上下文中调用
+    /// （例如 `Runtime::enter()` 之后），否则客户端不会发送任何消息。
+    pub fn new(address: String, downloader_id: i32) -> Self {
+        let key = address.trim().to_string();
+        let connection = SOCKET_CONNECTIONS.acquire(&key, || SocketConnection::open(&key));
+        SocketClient {
+            downloader_id,
+            lease: Arc::new(RwLock::new(Some(connection))),
         }
-        drop(done);
+    }
+}
+
+impl SocketConnection {
+    fn open(address: &str) -> Self {
+        let (address, options) = RemoteOptions::parse_url(address);
+        let shared = Arc::new(SocketShared {
+            target: SocketTarget::parse(&address),
+            address,
+            options,
+            connected: AtomicBool::new(false),
+            stats: SocketStats::default(),
+        });
+        let shutdown = CancellationToken::new();
 
-        let connected = self.connected.lock().await;
-        if !*connected {
-            return;
+        if shared.address.is_empty() {
+            return SocketConnection { shared, queue: None, shutdown };
         }
-        drop(connected);
 
-        let data_bytes = match serde_json::to_string(&data) {
-            Ok(bytes) => bytes,
-            Err(e) => {
-                eprintln!("序列化额外数据失败: {:?}", e);
-                return;
+        let handle = match tokio::runtime::Handle::try_current() {
+            Ok(handle) => handle,
+            Err(_) => {
+                eprintln!("Socket客户端必须在 tokio 运行时中创建: {}", shared.address);
+                return SocketConnection { shared, queue: None, shutdown };
             }
         };
 
-        let message = ProgressMessageS {
-            msg_type: format!("{:?}", event.event_type),
-            msg: data_bytes,
-        };
+        let queue = Arc::new(RemoteQueue::new(SOCKET_SEND_QUEUE_SIZE));
+        handle.spawn(Self::write_loop(shared.clone(), queue.clone(), shutdown.clone()));
 
-        let json_data = match serde_json::to_string(&message) {
-            Ok(data) => data,
-            Err(e) => {
-                eprintln!("序列化消息失败: {:?}", e);
-                return;
+        SocketConnection {
+            shared,
+            queue: Some(queue),
+            shutdown,
+        }
+    }
+
+    async fn connect(target: &SocketTarget) -> std::io::Result<SocketStream> {
+        tokio::time::timeout(SOCKET_CONNECT_TIMEOUT, Self::connect_target(target))
+            .await
+            .map_err(|_| std::io::Error::new(std::io::ErrorKind::TimedOut, "connect timeout"))?
+    }
+
+    async fn connect_target(target: &SocketTarget) -> std::io::Result<SocketStream> {
+        match target {
+            SocketTarget::Tcp(address) => {
+                let stream = TcpStream::connect(address.as_str()).await?;
+                stream.set_nodelay(true)?;
+                Ok(SocketStream::Tcp(stream))
             }
-        };
+            #[cfg(unix)]
+            SocketTarget::Unix(path) => Ok(SocketStream::Unix(tokio::net::UnixStream::connect(path).await?)),
+            #[cfg(any(target_os = "linux", target_os = "android"))]
+            SocketTarget::Abstract(name) => {
+                // tokio 不直接支持抽象地址：用标准库连接（本机连接几乎立即完成）后转为非阻塞
+                let name = name.clone();
+                let stream = tokio::task::spawn_blocking(move || Self::connect_abstract(&name))
+                    .await
+                    .map_err(std::io::Error::other)??;
+                stream.set_nonblocking(true)?;
+                Ok(SocketStream::Unix(tokio::net::UnixStream::from_std(stream)?))
+            }
+            #[allow(unreachable_patterns)]
+            _ => Err(std::io::Error::new(
+                std::io::ErrorKind::Unsupported,
+                "当前平台不支持该类型的 Unix 域套接字",
+            )),
+        }
+    }
+
+    #[cfg(any(target_os = "linux", target_os = "android"))]
+    fn connect_abstract(name: &[u8]) -> std::io::Result<std::os::unix::net::UnixStream> {
+        #[cfg(target_os = "android")]
+        use std::os::android::net::SocketAddrExt;
+        #[cfg(target_os = "linux")]
+        use std::os::linux::net::SocketAddrExt;
+
+        let addr = std::os::unix::net::SocketAddr::from_abstract_name(name)?;
+        std::os::unix::net::UnixStream::connect_addr(&addr)
+    }
 
-        let json_data = format!("{}\n", json_data).into_bytes();
+    /// 写任务：取出一条消息后在攒批间隔内继续收集，编码到同一个缓冲区后一次性写出
+    async fn write_loop(shared: Arc<SocketShared>, queue: Arc<RemoteQueue>, shutdown: CancellationToken) {
+        let stats = &shared.stats;
+        let mut stream: Option<SocketStream> = None;
+        let mut encoder = RemoteEncoder::default();
+        let format = shared.options.format;
+        let mut batch: Vec<u8> = Vec::with_capacity(shared.options.max_batch_bytes);
+        let mut batch_messages = 0u64;
+        let mut backoff = SOCKET_RECONNECT_MIN;
 
-        if event.event_type == EventType::Update {
-            let _ = self.send_queue.send(json_data);
-            return;
+        loop {
+            // 上一批写入失败时保留原数据，重连成功后重新发送
+            if batch.is_empty() {
+                let first = tokio::select! {
+                    _ = shutdown.cancelled() => break,
+                    item = queue.recv() => match item {
+                        Some(item) => item,
+                        None => break,
+                    },
+                };
+                collect_batch(first, &queue, &shared.options, &shutdown, |item| {
+                    Self::encode(&mut encoder, format, &item, &mut batch);
+                    batch_messages += 1;
+                    batch.len()
+                })
+                .await;
+            }
+
+            if stream.is_none() {
+                match Self::connect(&shared.target).await {
+                    Ok(conn) => {
+                        stream = Some(conn);
+                        shared.connected.store(true, Ordering::Release);
+                        stats.connects.fetch_add(1, Ordering::Relaxed);
+                        backoff = SOCKET_RECONNECT_MIN;
+                    }
+                    Err(e) => {
+                        let failures = stats.connect_failures.fetch_add(1, Ordering::Relaxed);
+                        if failures == 0 || backoff == SOCKET_RECONNECT_MAX {
+                            eprintln!("Socket连接失败 ({}): {:?}，{}ms 后重试", shared.address, e, backoff.as_millis());
+                        }
+                        tokio::select! {
+                            _ = shutdown.cancelled() => break,
+                            _ = tokio::time::sleep(backoff) => {}
+                        }
+                        backoff = (backoff * 2).min(SOCKET_RECONNECT_MAX);
+                        continue;
+                    }
+                }
+            }
+
+            let Some(conn) = stream.as_mut() else {
+                continue;
+            };
+            match tokio::time::timeout(SOCKET_WRITE_TIMEOUT, conn.write_all(&batch)).await {
+                Ok(Ok(())) => {
+                    stats.write_calls.fetch_add(1, Ordering::Relaxed);
+                    stats.sent_messages.fetch_add(batch_messages, Ordering::Relaxed);
+                    stats.sent_bytes.fetch_add(batch.len() as u64, Ordering::Relaxed);
+                    batch.clear();
+                    batch_messages = 0;
+                }
+                Ok(Err(e)) => {
+                    stats.write_failures.fetch_add(1, Ordering::Relaxed);
+                    eprintln!("Socket写入失败，准备重连: {:?}", e);
+                    stream = None;
+                    shared.connected.store(false, Ordering::Release);
+                }
+                Err(_) => {
+                    stats.write_failures.fetch_add(1, Ordering::Relaxed);
+                    eprintln!("Socket写入超时，准备重连");
+                    stream = None;
+                    shared.connected.store(false, Ordering::Release);
+                }
+            }
         }
 
-        match self.send_queue.send(json_data) {
-            Ok(_) => {}
-            Err(_) => {
-                eprintln!("Socket发送队列阻塞，丢弃非进度消息");
+        // 关闭前尽量把已经排队的消息写出去
+        // 先关闭队列，等待空间的投递方立即返回，之后不再有新消息入队
+        queue.close();
+        if let Some(mut conn) = stream.take() {
+            while let Some(item) = queue.try_recv() {
+                Self::encode(&mut encoder, format, &item, &mut batch);
             }
+            if !batch.is_empty() {
+                let _ = tokio::time::timeout(SOCKET_DRAIN_TIMEOUT, conn.write_all(&batch)).await;
+            }
+            let _ = conn.shutdown().await;
         }
+        shared.connected.store(false, Ordering::Release);
     }
 
-    pub fn close(&self) {
-        let mut close_once = self.close_once.blocking_lock();
-        if *close_once {
-            return;
+    fn encode(encoder: &mut RemoteEncoder, format: RemoteFormat, item: &RemoteEvent, out: &mut Vec<u8>) {
+        match format {
+            RemoteFormat::Json => {
+                encoder.write_json_frame(item, out);
+                out.push(b'\n');
+            }
+            RemoteFormat::MsgPack => encoder.write_msgpack_record(item, out),
         }
-        *close_once = true;
-        drop(close_once);
+    }
 
-        let mut done = self.done.blocking_lock();
-        *done = true;
-        drop(done);
+    fn write_stats(&self, map: &mut HashMap<String, serde_json::Value>) {
+        let stats = &self.shared.stats;
 
-        let mut connection = self.connection.blocking_lock();
-        if let Some(conn) = connection.take() {
-            let _ = conn.shutdown(std::net::Shutdown::Both);
+        map.insert("connected".to_string(), serde_json::Value::from(self.shared.connected.load(Ordering::Relaxed)));
+        map.insert("format".to_string(), serde_json::Value::from(format!("{:?}", self.shared.options.format).to_lowercase()));
+        if let Some(ref queue) = self.queue {
+            queue.write_stats(map);
         }
-        drop(connection);
-
-        let mut connected = self.connected.blocking_lock();
-        *connected = false;
+        map.insert("sent_messages".to_string(), serde_json::Value::from(stats.sent_messages.load(Ordering::Relaxed)));
+        map.insert("sent_bytes".to_string(), serde_json::Value::from(stats.sent_bytes.load(Ordering::Relaxed)));
+        map.insert("write_calls".to_string(), serde_json::Value::from(stats.write_calls.load(Ordering::Relaxed)));
+        map.insert("connects".to_string(), serde_json::Value::from(stats.connects.load(Ordering::Relaxed)));
+        map.insert("connect_failures".to_string(), serde_json::Value::from(stats.connect_failures.load(Ordering::Relaxed)));
+        map.insert("write_failures".to_string(), serde_json::Value::from(stats.write_failures.load(Ordering::Relaxed)));
     }
 }
 
-impl Clone for SocketClient {
-    fn clone(&self) -> Self {
-        SocketClient {
-            address: self.address.clone(),
-            connection: self.connection.clone(),
-            connected: self.connected.clone(),
-            send_queue: self.send_queue.clone(),
-            done: self.done.clone(),
-            close_once: self.close_once.clone(),
+impl SocketClient {
+    /// 将事件放入共享连接的发送队列（由 `send_message` 在产生事件的任务中调用），编码在写任务中完成
+    ///
+    /// 同一任务尚未发出的进度消息会被新进度覆盖（不越过之后入队的控制类消息）；队列满时控制类消息
+    /// 在这里等待写任务腾出空间，从不丢弃，见 `RemoteQueue`。
+    pub async fn send_event(&self, event: Event, data: EventData) {
+        // 只持有队列而不持有连接：等待期间 close() 仍能释放连接、停止写任务，写任务关闭队列后这里立即返回
+        let queue = self.lease.read().unwrap().as_ref().and_then(|connection| connection.queue.clone());
+        if let Some(queue) = queue {
+            queue.push(RemoteEvent { event, data, downloader_id: self.downloader_id }).await;
+        }
+    }
+
+    /// 统计信息为整条共享连接的数据，`shared_by` 为当前共用该连接的下载器数量
+    pub fn get_stats(&self) -> HashMap<String, serde_json::Value> {
+        let mut map = HashMap::new();
+        map.insert("downloader_id".to_string(), serde_json::Value::from(self.downloader_id));
+        let lease = self.lease.read().unwrap();
+        match *lease {
+            Some(ref connection) => {
+                map.insert("shared_by".to_string(), serde_json::Value::from(Arc::strong_count(connection)));
+                connection.write_stats(&mut map);
+            }
+            None => {
+                map.insert("shared_by".to_string(), serde_json::Value::from(0));
+                map.insert("connected".to_string(), serde_json::Value::from(false));
+            }
         }
+        map
+    }
+
+    /// 释放本下载器对共享连接的引用；最后一个引用释放时停止写任务，队列中剩余的消息会在短时间内尽量写出
+    pub fn close(&self) {
+        self.lease.write().unwrap().take();
     }
 }
@@ -1,84 +1,139 @@
 use std::collections::HashMap;
-use std::sync::Arc;
-use tokio::sync::Mutex;
-use tokio_tungstenite::{connect_async, tungstenite::protocol::Message};
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::{Arc, RwLock};
+use std::time::{Duration, Instant};
 use futures::sink::SinkExt;
-use serde::{Deserialize, Serialize};
-use super::downloader::{Event, EventType};
-
+use once_cell::sync::Lazy;
+use futures::StreamExt;
+use tokio_tungstenite::connect_async;
+use tokio_tungstenite::tungstenite::client::IntoClientRequest;
+use tokio_tungstenite::tungstenite::http::header::{HeaderValue, SEC_WEBSOCKET_PROTOCOL};
+use tokio_tungstenite::tungstenite::protocol::Message;
+use tokio_util::sync::CancellationToken;
+use super::downloader::Event;
+use super::event_data::EventData;
+use super::remote_queue::RemoteQueue;
+use super::remote_protocol::{
+    collect_batch, ConnectionRegistry, RemoteEncoder, RemoteEvent, RemoteFormat, RemoteOptions, WS_SUBPROTOCOL_JSON, WS_SUBPROTOCOL_MSGPACK,
+};
+
+/// 发送队列容量（按消息条数计）
 const WS_SEND_QUEUE_SIZE: usize = 1024;
-
-#[derive(Debug, Clone, Serialize, Deserialize)]
-pub struct ProgressMessageWs {
-    #[serde(rename = "Type")]
-    pub msg_type: String,
-    #[serde(rename = "Msg")]
-    pub msg: String,
+const WS_CONNECT_TIMEOUT: Duration = Duration::from_secs(10);
+const WS_WRITE_TIMEOUT: Duration = Duration::from_secs(3);
+/// 重连退避：从 100ms 开始翻倍，最长 10s
+const WS_RECONNECT_MIN: Duration = Duration::from_millis(100);
+const WS_RECONNECT_MAX: Duration = Duration::from_secs(10);
+/// 心跳间隔；超过 3 个间隔没有收到任何数据（含 pong）则认为连接已失效
+const WS_PING_INTERVAL: Duration = Duration::from_secs(15);
+const WS_IDLE_TIMEOUT: Duration = Duration::from_secs(45);
+
+type WsStream = tokio_tungstenite::WebSocketStream<tokio_tungstenite::MaybeTlsStream<tokio::net::TcpStream>>;
+
+#[derive(Default)]
+struct WsStats {
+    sent_messages: AtomicU64,
+    sent_bytes: AtomicU64,
+    flushes: AtomicU64,
+    connects: AtomicU64,
+    connect_failures: AtomicU64,
+    write_failures: AtomicU64,
+    liveness_timeouts: AtomicU64,
 }
 
-pub struct WebSocketClient {
+struct WsShared {
     url: String,
-    connection: Arc<tokio::sync::Mutex<Option<tokio_tungstenite::WebSocketStream<tokio_tungstenite::MaybeTlsStream<tokio::net::TcpStream>>>>>,
-    connected: Arc<tokio::sync::Mutex<bool>>,
-    send_queue: tokio::sync::broadcast::Sender<Vec<u8>>,
-    done: Arc<tokio::sync::Mutex<bool>>,
-    close_once: Arc<tokio::sync::Mutex<bool>>,
+    /// 请求的编码格式与攒批参数（实际格式在每次握手时协商）
+    options: RemoteOptions,
+    connected: AtomicBool,
+    negotiated_msgpack: AtomicBool,
+    stats: WsStats,
 }
 
-impl WebSocketClient {
-    pub fn new(url: String) -> Self {
-        if url.is_empty() {
-            return WebSocketClient {
-                url,
-                connection: Arc::new(Mutex::new(None)),
-                connected: Arc::new(Mutex::new(false)),
-                send_queue: tokio::sync::broadcast::channel(WS_SEND_QUEUE_SIZE).0,
-                done: Arc::new(Mutex::new(false)),
-                close_once: Arc::new(Mutex::new(false)),
-            };
-        }
-
-        let client = WebSocketClient {
-            url: url.clone(),
-            connection: Arc::new(Mutex::new(None)),
-            connected: Arc::new(Mutex::new(false)),
-            send_queue: tokio::sync::broadcast::channel(WS_SEND_QUEUE_SIZE).0,
-            done: Arc::new(Mutex::new(false)),
-            close_once: Arc::new(Mutex::new(false)),
-        };
-
-        client.connect();
-        client.start_write_loop();
+/// 同一回调地址上所有下载器共享的连接（队列 + 写任务），最后一个使用者释放时关闭
+struct WsConnection {
+    shared: Arc<WsShared>,
+    /// 写任务未启动（地址为空或不在运行时中）时为 None
+    queue: Option<Arc<RemoteQueue>>,
+    shutdown: CancellationToken,
+}
 
-        client
+impl Drop for WsConnection {
+    fn drop(&mut self) {
+        // 写任务收到取消信号后会把队列中剩余的消息写出，再发送 Close 帧
+        self.shutdown.cancel();
     }
+}
 
-    fn connect(&self) {
-        if self.url.is_empty() {
-            return;
-        }
+/// 按原始回调地址（含查询参数）共享的连接表
+static WS_CONNECTIONS: Lazy<ConnectionRegistry<WsConnection>> = Lazy::new(ConnectionRegistry::new);
+
+/// WebSocket 远程回调客户端
+///
+/// 与 `SocketClient` 相同，创建时只在共享运行时上启动写任务，不做任何握手：
+/// 连接在后台异步建立，期间的事件留在有界队列中；断线后按指数退避重连，
+/// 并通过 ping/pong 检测半开连接。
+///
+/// 回调地址带 `?format=msgpack` 时，握手中提供 `tthsd.msgpack` 与 `tthsd.json` 两个子协议；
+/// 服务端选择 `tthsd.msgpack` 时，每个攒批间隔内的事件合并为一个二进制帧（多条带长度前缀的
+/// MessagePack 记录）；否则回退为旧版 JSON 文本帧，每帧一条事件。显式指定 `flush_ms` 时，
+/// JSON 模式也把一批事件以换行分隔放进同一个文本帧。
+///
+/// 回调地址相同的下载器共享同一条连接，每条消息带有 `Downloader` 字段标明来源；
+/// 连接按引用计数管理，最后一个下载器 `close()` 或销毁后才断开。
+#[derive(Clone)]
+pub struct WebSocketClient {
+    downloader_id: i32,
+    /// 同一下载器的所有副本共用一份租约，`close()` 后置空
+    lease: Arc<RwLock<Option<Arc<WsConnection>>>>,
+}
 
-        let ws_url = Self::normalize_websocket_url(&self.url);
-        if ws_url.is_empty() {
-            return;
+impl WebSocketClient {
+    /// 取得（必要时创建）回调地址对应的共享连接（立即返回）
+    ///
+    /// 新连接的写任务在当前 tokio 运行时上启动，因此必须在运行时上下文中调用
+    /// （例如 `Runtime::enter()` 之后），否则客户端不会发送任何消息。
+    pub fn new(url: String, downloader_id: i32) -> Self {
+        let key = url.trim().to_string();
+        let connection = WS_CONNECTIONS.acquire(&key, || WsConnection::open(&key));
+        WebSocketClient {
+            downloader_id,
+            lease: Arc::new(RwLock::new(Some(connection))),
         }
+    }
+}
 
-        let rt = tokio::runtime::Runtime::new().unwrap();
-        let result = rt.block_on(async {
-            connect_async(&ws_url).await
+impl WsConnection {
+    fn open(url: &str) -> Self {
+        let (url, options) = RemoteOptions::parse_url(url);
+        let shared = Arc::new(WsShared {
+            url: Self::normalize_websocket_url(&url),
+            options,
+            connected: AtomicBool::new(false),
+            negotiated_msgpack: AtomicBool::new(false),
+            stats: WsStats::default(),
         });
+        let shutdown = CancellationToken::new();
 
-        match result {
-            Ok((ws_stream, _)) => {
-                let mut connection = self.connection.blocking_lock();
-                *connection = Some(ws_stream);
+        if shared.url.is_empty() {
+            return WsConnection { shared, queue: None, shutdown };
+        }
 
-                let mut connected = self.connected.blocking_lock();
-                *connected = true;
-            }
-            Err(e) => {
-                eprintln!("WebSocket连接失败: {:?}", e);
+        let handle = match tokio::runtime::Handle::try_current() {
+            Ok(handle) => handle,
+            Err(_) => {
+                eprintln!("WebSocket客户端必须在 tokio 运行时中创建: {}", shared.url);
+                return WsConnection { shared, queue: None, shutdown };
             }
+        };
+
+        let queue = Arc::new(RemoteQueue::new(WS_SEND_QUEUE_SIZE));
+        handle.spawn(Self::write_loop(shared.clone(), queue.clone(), shutdown.clone()));
+
+        WsConnection {
+            shared,
+            queue: Some(queue),
+            shutdown,
         }
     }
 
@@ -101,142 +156,265 @@ impl WebSocketClient {
         format!("{}websocket", ws_url)
     }
 
-    fn start_write_loop(&self) {
-        let send_queue = self.send_queue.clone();
-        let connection = self.connection.clone();
-        let connected = self.connected.clone();
-        let done = self.done.clone();
-
-        tokio::spawn(async move {
-            let mut receiver = send_queue.subscribe();
-
-            loop {
-                tokio::select! {
-                    _ = async {
-                        let d = done.lock().await;
-                        *d
-                    } => {
-                        break;
-                    }
-                    result = receiver.recv() => {
-                        match result {
-                            Ok(payload) => {
-                                if let Err(e) = Self::write_raw(&connection, &connected, payload).await {
-                                    eprintln!("Write failed: {:?}", e);
-                                    break;
-                                }
-                            }
-                            Err(_) => break,
-                        }
-                    }
-                }
-            }
-        });
-    }
-
-    async fn write_raw(
-        connection: &Arc<Mutex<Option<tokio_tungstenite::WebSocketStream<tokio_tungstenite::MaybeTlsStream<tokio::net::TcpStream>>>>>,
-        connected: &Arc<Mutex<bool>>,
-        payload: Vec<u8>,
-    ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
-        let mut conn_guard = connection.lock().await;
-        let conn = conn_guard.as_mut().ok_or("websocket not connected")?;
-
-        let conn_connected = connected.lock().await;
-        if !*conn_connected {
-            return Err("websocket not connected".into());
+    /// 建立连接；请求 MessagePack 时通过子协议协商，返回实际使用的格式
+    async fn connect(url: &str, format: RemoteFormat) -> Result<(WsStream, RemoteFormat), Box<dyn std::error::Error + Send + Sync>> {
+        let mut request = url.into_client_request()?;
+        if format == RemoteFormat::MsgPack {
+            let offer = format!("{}, {}", WS_SUBPROTOCOL_MSGPACK, WS_SUBPROTOCOL_JSON);
+            request.headers_mut().insert(SEC_WEBSOCKET_PROTOCOL, HeaderValue::from_str(&offer)?);
         }
-        drop(conn_connected);
 
-        let message = Message::Text(String::from_utf8(payload)?);
-        conn.send(message).await?;
-
-        Ok(())
+        let (ws_stream, response) = tokio::time::timeout(WS_CONNECT_TIMEOUT, connect_async(request))
+            .await
+            .map_err(|_| "websocket connect timeout")??;
+
+        let negotiated = response
+            .headers()
+            .get(SEC_WEBSOCKET_PROTOCOL)
+            .and_then(|v| v.to_str().ok())
+            .and_then(RemoteFormat::from_subprotocol)
+            .unwrap_or(RemoteFormat::Json);
+        Ok((ws_stream, negotiated))
     }
 
-    pub async fn send_message(&self, event: Event, data: HashMap<String, serde_json::Value>) {
-        let done = self.done.lock().await;
-        if *done {
-            return;
+    /// 按协商出的格式追加一个事件；JSON 帧之间以换行分隔
+    fn encode(encoder: &mut RemoteEncoder, format: RemoteFormat, item: &RemoteEvent, frame: &mut Vec<u8>) {
+        match format {
+            RemoteFormat::Json => {
+                encoder.write_json_frame(item, frame);
+                frame.push(b'\n');
+            }
+            RemoteFormat::MsgPack => encoder.write_msgpack_record(item, frame),
         }
-        drop(done);
+    }
 
-        let connected = self.connected.lock().await;
-        if !*connected {
-            return;
+    /// 写出一批已编码的事件并刷新一次
+    async fn write_frame(
+        ws: &mut WsStream,
+        format: RemoteFormat,
+        json_single_frame: bool,
+        frame: Vec<u8>,
+    ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+        match format {
+            RemoteFormat::MsgPack => ws.feed(Message::Binary(frame)).await?,
+            RemoteFormat::Json if json_single_frame => {
+                let mut text = String::from_utf8(frame)?;
+                text.pop();
+                ws.feed(Message::Text(text)).await?;
+            }
+            RemoteFormat::Json => {
+                // JSON 帧内部的换行都已转义，可以安全地按换行拆分
+                for line in frame.split(|b| *b == b'\n').filter(|l| !l.is_empty()) {
+                    ws.feed(Message::Text(String::from_utf8(line.to_vec())?)).await?;
+                }
+            }
         }
-        drop(connected);
+        ws.flush().await?;
+        Ok(())
+    }
 
-        let data_bytes = match serde_json::to_string(&data) {
-            Ok(bytes) => bytes,
-            Err(e) => {
-                eprintln!("序列化额外数据失败: {:?}", e);
-                return;
+    /// 写任务：负责连接、重连、心跳，并按攒批间隔把多条事件合并后一次刷新出去
+    async fn write_loop(shared: Arc<WsShared>, queue: Arc<RemoteQueue>, shutdown: CancellationToken) {
+        let stats = &shared.stats;
+        let mut stream: Option<WsStream> = None;
+        let options = shared.options;
+        let json_single_frame = options.flush_explicit && !options.flush_interval.is_zero();
+        let mut format = RemoteFormat::Json;
+        let mut encoder = RemoteEncoder::default();
+        // 上一批写入失败时保留原事件，重连成功后按新连接协商的格式重新编码发送
+        let mut batch: Vec<RemoteEvent> = Vec::new();
+        let mut frame: Vec<u8> = Vec::new();
+        let mut frame_format = format;
+        let mut backoff = WS_RECONNECT_MIN;
+        let mut last_seen = Instant::now();
+        let mut ping = tokio::time::interval(WS_PING_INTERVAL);
+        ping.set_missed_tick_behavior(tokio::time::MissedTickBehavior::Delay);
+
+        'outer: loop {
+            if stream.is_none() {
+                // 服务端不接受子协议时（部分实现会直接拒绝握手），立即以纯 JSON 再试一次
+                let result = match Self::connect(&shared.url, options.format).await {
+                    Err(e) if options.format == RemoteFormat::MsgPack => {
+                        Self::connect(&shared.url, RemoteFormat::Json).await.map_err(|_| e)
+                    }
+                    result => result,
+                };
+                match result {
+                    Ok((ws, negotiated)) => {
+                        stream = Some(ws);
+                        format = negotiated;
+                        shared.negotiated_msgpack.store(format == RemoteFormat::MsgPack, Ordering::Relaxed);
+                        shared.connected.store(true, Ordering::Release);
+                        stats.connects.fetch_add(1, Ordering::Relaxed);
+                        backoff = WS_RECONNECT_MIN;
+                        last_seen = Instant::now();
+                        ping.reset();
+                    }
+                    Err(e) => {
+                        let failures = stats.connect_failures.fetch_add(1, Ordering::Relaxed);
+                        if failures == 0 || backoff == WS_RECONNECT_MAX {
+                            eprintln!("WebSocket连接失败 ({}): {:?}，{}ms 后重试", shared.url, e, backoff.as_millis());
+                        }
+                        tokio::select! {
+                            _ = shutdown.cancelled() => break,
+                            _ = tokio::time::sleep(backoff) => {}
+                        }
+                        backoff = (backoff * 2).min(WS_RECONNECT_MAX);
+                        continue;
+                    }
+                }
             }
-        };
 
-        let message = ProgressMessageWs {
-            msg_type: format!("{:?}", event.event_type),
-            msg: data_bytes,
-        };
+            let Some(ws) = stream.as_mut() else {
+                continue;
+            };
 
-        let json_data = match serde_json::to_string(&message) {
-            Ok(data) => data,
-            Err(e) => {
-                eprintln!("序列化消息失败: {:?}", e);
-                return;
+            if batch.is_empty() {
+                let first = tokio::select! {
+                    _ = shutdown.cancelled() => break,
+                    item = queue.recv() => match item {
+                        Some(item) => item,
+                        None => break,
+                    },
+                    incoming = ws.next() => {
+                        match incoming {
+                            Some(Ok(Message::Close(_))) | None | Some(Err(_)) => {
+                                stream = None;
+                                shared.connected.store(false, Ordering::Release);
+                            }
+                            // ping 由 tungstenite 自动回复 pong，其余消息只用于确认连接存活
+                            Some(Ok(_)) => last_seen = Instant::now(),
+                        }
+                        continue;
+                    }
+                    _ = ping.tick() => {
+                        if last_seen.elapsed() > WS_IDLE_TIMEOUT {
+                            stats.liveness_timeouts.fetch_add(1, Ordering::Relaxed);
+                            eprintln!("WebSocket心跳超时，准备重连: {}", shared.url);
+                            stream = None;
+                            shared.connected.store(false, Ordering::Release);
+                        } else if ws.send(Message::Ping(Vec::new())).await.is_err() {
+                            stream = None;
+                            shared.connected.store(false, Ordering::Release);
+                        }
+                        continue;
+                    }
+                };
+
+                frame.clear();
+                frame_format = format;
+                collect_batch(first, &queue, &options, &shutdown, |item| {
+                    Self::encode(&mut encoder, format, &item, &mut frame);
+                    batch.push(item);
+                    frame.len()
+                })
+                .await;
             }
-        };
 
-        let json_data = json_data.into_bytes();
+            if frame.is_empty() || frame_format != format {
+                frame.clear();
+                frame_format = format;
+                for item in &batch {
+                    Self::encode(&mut encoder, format, item, &mut frame);
+                }
+            }
 
-        if event.event_type == EventType::Update {
-            let _ = self.send_queue.send(json_data);
-            return;
+            let bytes = frame.len() as u64;
+            let payload = std::mem::take(&mut frame);
+            match tokio::time::timeout(WS_WRITE_TIMEOUT, Self::write_frame(ws, format, json_single_frame, payload)).await {
+                Ok(Ok(())) => {
+                    stats.flushes.fetch_add(1, Ordering::Relaxed);
+                    stats.sent_messages.fetch_add(batch.len() as u64, Ordering::Relaxed);
+                    stats.sent_bytes.fetch_add(bytes, Ordering::Relaxed);
+                    batch.clear();
+                }
+                result => {
+                    stats.write_failures.fetch_add(1, Ordering::Relaxed);
+                    match result {
+                        Ok(Err(e)) => eprintln!("WebSocket写入失败，准备重连: {:?}", e),
+                        _ => eprintln!("WebSocket写入超时，准备重连"),
+                    }
+                    stream = None;
+                    shared.connected.store(false, Ordering::Release);
+                    if shutdown.is_cancelled() {
+                        break 'outer;
+                    }
+                }
+            }
         }
 
-        match self.send_queue.send(json_data) {
-            Ok(_) => {}
-            Err(_) => {
-                eprintln!("WebSocket发送队列阻塞，丢弃非进度消息");
+        // 关闭前尽量把已经排队的消息写出去
+        // 先关闭队列，等待空间的投递方立即返回，之后不再有新消息入队
+        queue.close();
+        if let Some(mut ws) = stream.take() {
+            while let Some(item) = queue.try_recv() {
+                batch.push(item);
+            }
+            if !batch.is_empty() {
+                frame.clear();
+                for item in &batch {
+                    Self::encode(&mut encoder, format, item, &mut frame);
+                }
+                let _ = tokio::time::timeout(WS_WRITE_TIMEOUT, Self::write_frame(&mut ws, format, json_single_frame, frame)).await;
             }
+            let _ = tokio::time::timeout(WS_WRITE_TIMEOUT, ws.close(None)).await;
         }
+        shared.connected.store(false, Ordering::Release);
     }
 
-    pub fn close(&self) {
-        let mut close_once = self.close_once.blocking_lock();
-        if *close_once {
-            return;
-        }
-        *close_once = true;
-        drop(close_once);
-
-        let mut done = self.done.blocking_lock();
-        *done = true;
-        drop(done);
-
-        let mut connection = self.connection.blocking_lock();
-        if let Some(mut conn) = connection.take() {
-            let _ = tokio::task::block_in_place(|| {
-                tokio::runtime::Handle::current().block_on(conn.close(None))
-            });
-        }
-        drop(connection);
+    fn write_stats(&self, map: &mut HashMap<String, serde_json::Value>) {
+        let stats = &self.shared.stats;
 
-        let mut connected = self.connected.blocking_lock();
-        *connected = false;
+        map.insert("connected".to_string(), serde_json::Value::from(self.shared.connected.load(Ordering::Relaxed)));
+        let format = if self.shared.negotiated_msgpack.load(Ordering::Relaxed) { "msgpack" } else { "json" };
+        map.insert("format".to_string(), serde_json::Value::from(format));
+        if let Some(ref queue) = self.queue {
+            queue.write_stats(map);
+        }
+        map.insert("sent_messages".to_string(), serde_json::Value::from(stats.sent_messages.load(Ordering::Relaxed)));
+        map.insert("sent_bytes".to_string(), serde_json::Value::from(stats.sent_bytes.load(Ordering::Relaxed)));
+        map.insert("flushes".to_string(), serde_json::Value::from(stats.flushes.load(Ordering::Relaxed)));
+        map.insert("connects".to_string(), serde_json::Value::from(stats.connects.load(Ordering::Relaxed)));
+        map.insert("connect_failures".to_string(), serde_json::Value::from(stats.connect_failures.load(Ordering::Relaxed)));
+        map.insert("write_failures".to_string(), serde_json::Value::from(stats.write_failures.load(Ordering::Relaxed)));
+        map.insert("liveness_timeouts".to_string(), serde_json::Value::from(stats.liveness_timeouts.load(Ordering::Relaxed)));
     }
 }
 
-impl Clone for WebSocketClient {
-    fn clone(&self) -> Self {
-        WebSocketClient {
-            url: self.url.clone(),
-            connection: self.connection.clone(),
-            connected: self.connected.clone(),
-            send_queue: self.send_queue.clone(),
-            done: self.done.clone(),
-            close_once: self.close_once.clone(),
+impl WebSocketClient {
+    /// 将事件放入共享连接的发送队列（由 `send_message` 在产生事件的任务中调用），编码在写任务中完成
+    ///
+    /// 同一任务尚未发出的进度消息会被新进度覆盖（不越过之后入队的控制类消息）；队列满时控制类消息
+    /// 在这里等待写任务腾出空间，从不丢弃，见 `RemoteQueue`。
+    pub async fn send_event(&self, event: Event, data: EventData) {
+        // 只持有队列而不持有连接：等待期间 close() 仍能释放连接、停止写任务，写任务关闭队列后这里立即返回
+        let queue = self.lease.read().unwrap().as_ref().and_then(|connection| connection.queue.clone());
+        if let Some(queue) = queue {
+            queue.push(RemoteEvent { event, data, downloader_id: self.downloader_id }).await;
+        }
+    }
+
+    /// 统计信息为整条共享连接的数据，`shared_by` 为当前共用该连接的下载器数量
+    pub fn get_stats(&self) -> HashMap<String, serde_json::Value> {
+        let mut map = HashMap::new();
+        map.insert("downloader_id".to_string(), serde_json::Value::from(self.downloader_id));
+        let lease = self.lease.read().unwrap();
+        match *lease {
+            Some(ref connection) => {
+                map.insert("shared_by".to_string(), serde_json::Value::from(Arc::strong_count(connection)));
+                connection.write_stats(&mut map);
+            }
+            None => {
+                map.insert("shared_by".to_string(), serde_json::Value::from(0));
+                map.insert("connected".to_string(), serde_json::Value::from(false));
+            }
         }
+        map
     }
-}
\ No newline at end of file
+
+    /// 释放本下载器对共享连接的引用；最后一个引用释放时停止写任务，
+    /// 队列中剩余的消息会在短时间内尽量写出，然后发送 Close 帧
+    pub fn close(&self) {
+        self.lease.write().unwrap().take();
+    }
+}